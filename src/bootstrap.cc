@@ -13,6 +13,10 @@
 #include "socket.h"
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 // [RCCL]
 #include "clique/CliqueManager.h"
 #include "clique/CliqueShmNames.h"
@@ -85,10 +89,37 @@ static ncclResult_t bootstrapNetRecv(int fd, union socketAddress *addr, void* da
   return ncclSuccess;
 }
 
+// Number of steps of the Bruck AllGather; at step k, rank r sends to r-2^k
+static int bootstrapBruckSteps(int nranks) {
+  int nSteps = 0;
+  while ((1<<nSteps) < nranks) nSteps++;
+  return nSteps;
+}
+
+NCCL_PARAM(BootstrapRingMaxRanks, "BOOTSTRAP_RING_MAX_RANKS", 32);
+NCCL_PARAM(BootstrapHierMaxBytes, "BOOTSTRAP_HIER_MAX_BYTES", 1<<20);
+NCCL_PARAM(BootstrapStaggerUsec, "BOOTSTRAP_STAGGER_USEC", 100);
+// Peer connections a rank keeps open for sending; the least recently used one
+// is closed to make room for a new one. 0 means no limit.
+NCCL_PARAM(BootstrapMaxConns, "BOOTSTRAP_MAX_CONNS", 128);
+
+#define BOOTSTRAP_ALLGATHER_RING 0
+#define BOOTSTRAP_ALLGATHER_BRUCK 1
+#define BOOTSTRAP_ALLGATHER_HIER 2
+
+// Tags reserved for the bootstrap itself
+#define BOOTSTRAP_TAG_RING INT_MIN
+#define BOOTSTRAP_TAG_HIER_GATHER (INT_MIN+1)
+#define BOOTSTRAP_TAG_HIER_BCAST (INT_MIN+2)
+#define BOOTSTRAP_TAG_ALLGATHER (INT_MIN+3) // + step
+
+// Messages exchanged in both directions at once are sent in pieces of at most
+// this size, each with its own header
+#define BOOTSTRAP_MAX_PIECE (128*1024)
+
 struct extInfo {
   int rank;
   int nranks;
-  union socketAddress extAddressListenRoot;
   union socketAddress extAddressListen;
 };
 
@@ -102,6 +133,51 @@ static ncclResult_t setFilesLimit() {
   return ncclSuccess;
 }
 
+// Connection from a rank to the root. The rank sends its extInfo, then waits
+// on the same connection for the addresses of its peers.
+struct bootstrapRootConn {
+  int fd;
+  union socketAddress addr;
+  int offset;
+  char hello[sizeof(int)+sizeof(struct extInfo)];
+  int replySize;
+  char* reply;
+  struct bootstrapRootConn* next;
+};
+
+static double bootstrapRootTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e3 + ts.tv_nsec*1e-6;
+}
+
+static ncclResult_t bootstrapRootWatch(int epollFd, int op, int fd, uint32_t events, void* ptr) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.ptr = ptr;
+  SYSCHECK(epoll_ctl(epollFd, op, fd, &ev), "epoll_ctl");
+  return ncclSuccess;
+}
+
+static ncclResult_t bootstrapRootWait(int epollFd, struct epoll_event* events, int maxEvents, int* nEvents) {
+  do {
+    *nEvents = epoll_wait(epollFd, events, maxEvents, -1);
+  } while (*nEvents == -1 && errno == EINTR);
+  if (*nEvents == -1) {
+    WARN("Bootstrap Root : epoll_wait failed : %s", strerror(errno));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
+
+// Append a message as bootstrapNetSend would have sent it
+static void bootstrapRootPack(char** ptr, void* data, int size) {
+  memcpy(*ptr, &size, sizeof(int));
+  memcpy(*ptr+sizeof(int), data, size);
+  *ptr += sizeof(int)+size;
+}
+
 static void *bootstrapRoot(void* bootstrapRootStruct) { // [RCCL] Modified to include hash argument)
 
   // [RCCL] Unpack bootstrapRootStruct
@@ -113,71 +189,153 @@ static void *bootstrapRoot(void* bootstrapRootStruct) { // [RCCL] Modified to in
   // [/RCCL]
 
   ncclResult_t res = ncclSuccess;
-  int nranks = 0, c = 0;
-  struct extInfo info;
+  int nranks = 0, c = 0, nSending = 0;
+  int epollFd = -1;
+  struct epoll_event events[64];
+  struct bootstrapRootConn* conns = NULL; // all connections, for cleanup
+  struct bootstrapRootConn** rankConns = NULL;
   union socketAddress *rankAddresses = NULL;
-  union socketAddress *rankAddressesRoot = NULL; // for initial rank <-> root information exchange
-  union socketAddress *zero = NULL;
-  NCCLCHECKGOTO(ncclCalloc(&zero, 1), res, out);
+  union socketAddress *bruckAddresses = NULL;
+  double tStart = bootstrapRootTime(), tFirst = 0, tCollected = 0, tInit = 0;
   setFilesLimit();
 
   TRACE(NCCL_INIT, "BEGIN");
-  /* Receive addresses from all ranks */
-  do {
-    int tmpFd;
-    union socketAddress addr;
-    NCCLCHECKGOTO(bootstrapNetAccept(listenFd, &tmpFd, &addr), res, out);
-    NCCLCHECKGOTO(bootstrapNetRecv(tmpFd, &addr, &info, sizeof(info)), res, out);
-    close(tmpFd);
-
-    if (c == 0) {
-      nranks = info.nranks;
-      NCCLCHECKGOTO(ncclCalloc(&rankAddresses, nranks), res, out);
-      NCCLCHECKGOTO(ncclCalloc(&rankAddressesRoot, nranks), res, out);
-    }
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd == -1 || fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK) == -1) {
+    WARN("Bootstrap Root : setup failed : %s", strerror(errno));
+    goto out;
+  }
+  NCCLCHECKGOTO(bootstrapRootWatch(epollFd, EPOLL_CTL_ADD, listenFd, EPOLLIN, NULL), res, out);
+
+  /* Receive addresses from all ranks, servicing all connections at once */
+  while (c < nranks || nranks == 0) {
+    int nEvents;
+    NCCLCHECKGOTO(bootstrapRootWait(epollFd, events, 64, &nEvents), res, out);
+    for (int e=0; e<nEvents; e++) {
+      struct bootstrapRootConn* conn = (struct bootstrapRootConn*)events[e].data.ptr;
+      if (conn == NULL) {
+        // Accept everything which is waiting
+        while (1) {
+          union socketAddress addr;
+          socklen_t socklen = sizeof(union socketAddress);
+          int fd = accept(listenFd, &addr.sa, &socklen);
+          if (fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) break;
+            WARN("Bootstrap Root : accept failed : %s", strerror(errno));
+            goto out;
+          }
+          NCCLCHECKGOTO(ncclCalloc(&conn, 1), res, out);
+          conn->fd = fd;
+          conn->addr = addr;
+          conn->next = conns;
+          conns = conn;
+          NCCLCHECKGOTO(bootstrapRootWatch(epollFd, EPOLL_CTL_ADD, fd, EPOLLIN, conn), res, out);
+        }
+        continue;
+      }
+      NCCLCHECKGOTO(socketProgress(NCCL_SOCKET_RECV, conn->fd, &conn->addr, conn->hello, sizeof(conn->hello), &conn->offset), res, out);
+      if (conn->offset < (int)sizeof(conn->hello)) continue;
+      NCCLCHECKGOTO(bootstrapRootWatch(epollFd, EPOLL_CTL_DEL, conn->fd, 0, NULL), res, out);
+
+      int size;
+      struct extInfo info;
+      memcpy(&size, conn->hello, sizeof(int));
+      memcpy(&info, conn->hello+sizeof(int), sizeof(info));
+      if (size != sizeof(info)) {
+        WARN("Bootstrap Root : received %d bytes instead of %ld", size, sizeof(info));
+        goto out;
+      }
 
-    if (nranks != info.nranks) {
-      WARN("Bootstrap Root : mismatch in rank count from procs %d : %d", nranks, info.nranks);
-      goto out;
-    }
+      if (c == 0) {
+        nranks = info.nranks;
+        tFirst = bootstrapRootTime();
+        NCCLCHECKGOTO(ncclCalloc(&rankAddresses, nranks), res, out);
+        NCCLCHECKGOTO(ncclCalloc(&rankConns, nranks), res, out);
+      }
 
-    if (memcmp(zero, &rankAddressesRoot[info.rank], sizeof(union socketAddress)) != 0) {
-      WARN("Bootstrap Root : rank %d of %d ranks has already checked in", info.rank, nranks);
-      goto out;
-    }
+      if (nranks != info.nranks) {
+        WARN("Bootstrap Root : mismatch in rank count from procs %d : %d", nranks, info.nranks);
+        goto out;
+      }
+
+      if (info.rank < 0 || info.rank >= nranks || rankConns[info.rank] != NULL) {
+        WARN("Bootstrap Root : rank %d of %d ranks has already checked in", info.rank, nranks);
+        goto out;
+      }
 
-    // Save the connection handle for that rank
-    memcpy(rankAddressesRoot+info.rank, &info.extAddressListenRoot, sizeof(union socketAddress));
-    memcpy(rankAddresses+info.rank, &info.extAddressListen, sizeof(union socketAddress));
+      // Save the connection handle for that rank
+      rankConns[info.rank] = conn;
+      memcpy(rankAddresses+info.rank, &info.extAddressListen, sizeof(union socketAddress));
 
-    ++c;
-    TRACE(NCCL_INIT, "Received connect from rank %d total %d/%d",  info.rank, c, nranks);
-  } while (c < nranks);
+      ++c;
+      TRACE(NCCL_INIT, "Received connect from rank %d total %d/%d",  info.rank, c, nranks);
+    }
+  }
+  tCollected = bootstrapRootTime();
   TRACE(NCCL_INIT, "COLLECTED ALL %d HANDLES", nranks);
 
   { // [RCCL] Initialize message queues / shared memory files
     NCCLCHECKGOTO(CliqueManager::BootstrapRootInit(pid, hash), res, out);
   } // [/RCCL]
-
-  // Send the connect handle for the next rank in the AllGather ring
-  for (int r=0; r<nranks; ++r) {
-    int next = (r+1) % nranks;
-
-    int tmpSendFd;
-    NCCLCHECKGOTO(connectAddress(&tmpSendFd, rankAddressesRoot+r), res, out);
-    NCCLCHECKGOTO(bootstrapNetSend(tmpSendFd, rankAddressesRoot+r, rankAddresses+next, sizeof(union socketAddress)), res, out);
-    { // [RCCL] Send the root pid for shared file naming
-      NCCLCHECKGOTO(bootstrapNetSend(tmpSendFd, rankAddressesRoot+r, &pid, sizeof(int)), res, out);
-    } // [/RCCL]
-    close(tmpSendFd);
+  tInit = bootstrapRootTime();
+
+  // Answer each rank with the connect handle for the next rank in the
+  // AllGather ring, and those of the ranks r-2^k the Bruck AllGather sends
+  // to. Most answers fit in the socket buffers and go out right away; the
+  // others are finished as the sockets drain.
+  {
+    int nSteps = bootstrapBruckSteps(nranks);
+    NCCLCHECKGOTO(ncclCalloc(&bruckAddresses, nSteps+1), res, out);
+    for (int r=0; r<nranks; ++r) {
+      struct bootstrapRootConn* conn = rankConns[r];
+      int next = (r+1) % nranks;
+      for (int k=0; k<nSteps; k++) bruckAddresses[k] = rankAddresses[(r - (1<<k) + nranks) % nranks];
+
+      conn->replySize = 3*sizeof(int) + (nSteps+1)*sizeof(union socketAddress) + sizeof(int);
+      NCCLCHECKGOTO(ncclCalloc(&conn->reply, conn->replySize), res, out);
+      char* ptr = conn->reply;
+      bootstrapRootPack(&ptr, rankAddresses+next, sizeof(union socketAddress));
+      bootstrapRootPack(&ptr, bruckAddresses, nSteps*sizeof(union socketAddress));
+      { // [RCCL] Send the root pid for shared file naming
+        bootstrapRootPack(&ptr, &pid, sizeof(int));
+      } // [/RCCL]
+      conn->offset = 0;
+      NCCLCHECKGOTO(socketProgress(NCCL_SOCKET_SEND, conn->fd, &conn->addr, conn->reply, conn->replySize, &conn->offset), res, out);
+      if (conn->offset < conn->replySize) {
+        NCCLCHECKGOTO(bootstrapRootWatch(epollFd, EPOLL_CTL_ADD, conn->fd, EPOLLOUT, conn), res, out);
+        nSending++;
+      }
+    }
+  }
+  while (nSending) {
+    int nEvents;
+    NCCLCHECKGOTO(bootstrapRootWait(epollFd, events, 64, &nEvents), res, out);
+    for (int e=0; e<nEvents; e++) {
+      struct bootstrapRootConn* conn = (struct bootstrapRootConn*)events[e].data.ptr;
+      if (conn == NULL) continue;
+      NCCLCHECKGOTO(socketProgress(NCCL_SOCKET_SEND, conn->fd, &conn->addr, conn->reply, conn->replySize, &conn->offset), res, out);
+      if (conn->offset < conn->replySize) continue;
+      NCCLCHECKGOTO(bootstrapRootWatch(epollFd, EPOLL_CTL_DEL, conn->fd, 0, NULL), res, out);
+      nSending--;
+    }
   }
   TRACE(NCCL_INIT, "SENT OUT ALL %d HANDLES", nranks);
+  INFO(NCCL_INIT, "Bootstrap Root : %d ranks, first rank after %.2f ms, all ranks in %.2f ms, root init %.2f ms, answers sent in %.2f ms",
+      nranks, tFirst-tStart, tCollected-tFirst, tInit-tCollected, bootstrapRootTime()-tInit);
 
 out:
   close(listenFd);
+  if (epollFd != -1) close(epollFd);
+  while (conns) {
+    struct bootstrapRootConn* next = conns->next;
+    close(conns->fd);
+    free(conns->reply);
+    free(conns);
+    conns = next;
+  }
+  if (rankConns) free(rankConns);
   if (rankAddresses) free(rankAddresses);
-  if (rankAddressesRoot) free(rankAddressesRoot);
-  if (zero) free(zero);
+  if (bruckAddresses) free(bruckAddresses);
 
   TRACE(NCCL_INIT, "DONE");
   return NULL;
@@ -220,12 +378,37 @@ ncclResult_t bootstrapGetUniqueId(ncclUniqueId* id) {
   return ncclSuccess;
 }
 
-struct unexConn {
-  int peer;
-  int tag;
+// Peers keep one connection open in each direction and reuse it for all
+// their messages. A message is a {tag, size} header followed by the data.
+// The sender may close its connection between two messages to stay within
+// NCCL_BOOTSTRAP_MAX_CONNS, and opens a new one for its next message.
+struct bootstrapConn {
   int fd;
   union socketAddress addr;
-  struct unexConn* next;
+  uint64_t lastUsed;
+};
+
+struct bootstrapMsgHeader {
+  int tag;
+  int size;
+};
+
+// Message read from a peer connection before anyone asked for it
+struct unexMsg {
+  int peer;
+  int tag;
+  int size;
+  char* data;
+  struct unexMsg* next;
+};
+
+// Unexpected messages hashed on (peer, tag). Each bucket is kept in arrival
+// order so that messages with the same peer and tag are received in order.
+#define BOOTSTRAP_UNEX_BUCKETS 256
+struct unexTable {
+  struct unexMsg* head[BOOTSTRAP_UNEX_BUCKETS];
+  struct unexMsg* tail[BOOTSTRAP_UNEX_BUCKETS];
+  int count;
 };
 
 // Remote allocator state
@@ -235,14 +418,37 @@ struct remAllocState {
   volatile int stop;
 };
 
+// Ranks grouped by host, for the hierarchical AllGather. Nodes are ordered
+// by their lowest rank, which is the leader of the node.
+struct bootstrapNodes {
+  int nNodes;
+  int myNode;
+  int* ranks;   // ranks of each node, node after node
+  int* offsets; // where the ranks of each node start, nNodes+1 entries
+  int* nodeOf;  // node of each rank
+};
+
+static void bootstrapFreeNodes(struct bootstrapNodes* nodes) {
+  if (nodes == NULL) return;
+  free(nodes->ranks);
+  free(nodes->offsets);
+  free(nodes->nodeOf);
+  free(nodes);
+}
+
 struct extState {
   int extListenFd;
-  int extRingRecvFd;
-  int extRingSendFd;
-  union socketAddress extRingRecvAddr, extRingSendAddr;
+  union socketAddress extRingSendAddr;
+  struct bootstrapConn* sendConns; // to each peer, fd is -1 until the first send
+  struct bootstrapConn* recvConns; // from each peer, fd is -1 until accepted
+  int nSendConns, nRecvConns;
+  uint64_t connClock;
   union socketAddress* peerCommAddresses;
   union socketAddress* peerAllocAddresses;
-  struct unexConn* unexpectedConnections;
+  union socketAddress* bruckAddresses; // of ranks rank-2^k
+  uint64_t* peerHostHashes;
+  struct bootstrapNodes* nodes;
+  struct unexTable unexpected;
   int cudaDev;
   int rank;
   int nranks;
@@ -252,6 +458,11 @@ struct extState {
   pthread_t allocThread;
 };
 
+struct bootstrapPeerInfo {
+  union socketAddress addr;
+  uint64_t hostHash;
+};
+
 #define MAX_SEGMENTS 128
 
 static ncclResult_t remoteAlloc(void** ptr, int fd, union socketAddress *addr) {
@@ -272,8 +483,6 @@ static ncclResult_t remoteAlloc(void** ptr, int fd, union socketAddress *addr) {
   return ncclSuccess;
 }
 
-#include <poll.h>
-
 // Service thread to allocate memory for other GPUs, used as intermediate step.
 void* ncclRemoteMemAllocationService(void* args) {
   struct remAllocState* state = (struct remAllocState *) args;
@@ -355,6 +564,196 @@ ncclResult_t bootstrapRemFree(int id, int rank, void* commState) {
   return ncclSuccess;
 }
 
+static int unexpectedBucket(int peer, int tag) {
+  uint32_t h = (uint32_t)peer*0x9e3779b1u ^ (uint32_t)tag*0x85ebca77u;
+  h ^= h >> 16;
+  return h % BOOTSTRAP_UNEX_BUCKETS;
+}
+
+static void unexpectedEnqueue(struct extState* state, struct unexMsg* msg) {
+  int b = unexpectedBucket(msg->peer, msg->tag);
+  if (state->unexpected.tail[b]) state->unexpected.tail[b]->next = msg;
+  else state->unexpected.head[b] = msg;
+  state->unexpected.tail[b] = msg;
+  state->unexpected.count++;
+}
+
+static struct unexMsg* unexpectedDequeue(struct extState* state, int peer, int tag) {
+  int b = unexpectedBucket(peer, tag);
+  struct unexMsg* prev = NULL;
+  for (struct unexMsg* msg = state->unexpected.head[b]; msg; prev = msg, msg = msg->next) {
+    if (msg->peer != peer || msg->tag != tag) continue;
+    if (prev) prev->next = msg->next;
+    else state->unexpected.head[b] = msg->next;
+    if (state->unexpected.tail[b] == msg) state->unexpected.tail[b] = prev;
+    state->unexpected.count--;
+    return msg;
+  }
+  return NULL;
+}
+
+static void unexpectedFree(struct extState* state) {
+  for (int b=0; b<BOOTSTRAP_UNEX_BUCKETS; b++) {
+    struct unexMsg* msg = state->unexpected.head[b];
+    while (msg) {
+      struct unexMsg* next = msg->next;
+      free(msg->data);
+      free(msg);
+      msg = next;
+    }
+    state->unexpected.head[b] = state->unexpected.tail[b] = NULL;
+  }
+  state->unexpected.count = 0;
+}
+
+// Hand a queued message over to the receiver
+static ncclResult_t bootstrapRecvQueued(struct unexMsg* msg, void* data, int size) {
+  int msgSize = msg->size;
+  if (msgSize <= size) memcpy(data, msg->data, msgSize);
+  free(msg->data);
+  free(msg);
+  if (msgSize > size) {
+    WARN("Message truncated : received %d bytes instead of %d", msgSize, size);
+    return ncclInternalError;
+  }
+  return ncclSuccess;
+}
+
+// Read the data of a message nobody asked for yet from peer and queue it
+static ncclResult_t bootstrapRecvUnexpected(struct extState* state, int peer, struct bootstrapMsgHeader* header) {
+  struct bootstrapConn* conn = state->recvConns+peer;
+  struct unexMsg* msg;
+  NCCLCHECK(ncclCalloc(&msg, 1));
+  msg->peer = peer;
+  msg->tag = header->tag;
+  msg->size = header->size;
+  if (header->size > 0) {
+    ncclResult_t ret = ncclCalloc(&msg->data, header->size);
+    if (ret == ncclSuccess) ret = socketRecv(conn->fd, &conn->addr, msg->data, header->size);
+    if (ret != ncclSuccess) {
+      free(msg->data);
+      free(msg);
+      return ret;
+    }
+  }
+  unexpectedEnqueue(state, msg);
+  return ncclSuccess;
+}
+
+// Whether the peer closed the connection, i.e. there is nothing left to read
+static ncclResult_t bootstrapRecvClosed(struct bootstrapConn* conn, int block, int* closed) {
+  char c;
+  ssize_t bytes;
+  do {
+    bytes = recv(conn->fd, &c, 1, MSG_PEEK | (block ? 0 : MSG_DONTWAIT));
+  } while (bytes == -1 && errno == EINTR);
+  if (bytes == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    char line[SOCKET_NAME_MAXLEN+1];
+    WARN("Net : Call to recv from %s failed : %s", socketToString(&conn->addr, line), strerror(errno));
+    return ncclSystemError;
+  }
+  *closed = bytes == 0;
+  return ncclSuccess;
+}
+
+// The peer closed its connection after its last message: queue the messages
+// still in the socket and close our end.
+static ncclResult_t bootstrapDrainRecvConn(struct extState* state, int peer) {
+  struct bootstrapConn* conn = state->recvConns+peer;
+  while (1) {
+    int closed;
+    NCCLCHECK(bootstrapRecvClosed(conn, 1, &closed));
+    if (closed) break;
+    struct bootstrapMsgHeader header;
+    NCCLCHECK(socketRecv(conn->fd, &conn->addr, &header, sizeof(header)));
+    NCCLCHECK(bootstrapRecvUnexpected(state, peer, &header));
+  }
+  close(conn->fd);
+  conn->fd = -1;
+  state->nRecvConns--;
+  return ncclSuccess;
+}
+
+// Close the connections peers have closed on their side once we hold more than
+// NCCL_BOOTSTRAP_MAX_CONNS of them. Only the ones we read everything from are
+// closed, so that no message moves to the unexpected queue behind the back of
+// a receiver.
+static ncclResult_t bootstrapTrimRecvConns(struct extState* state) {
+  for (int r=0; r<state->nranks && state->nRecvConns > ncclParamBootstrapMaxConns(); r++) {
+    if (state->recvConns[r].fd == -1) continue;
+    int closed;
+    NCCLCHECK(bootstrapRecvClosed(state->recvConns+r, 0, &closed));
+    if (closed) NCCLCHECK(bootstrapDrainRecvConn(state, r));
+  }
+  return ncclSuccess;
+}
+
+// Accept connections until the one from peer shows up. Each connection starts
+// with the rank of the peer which opened it. A peer only opens a new connection
+// after closing its previous one, whose messages we queue; this never happens
+// to peer itself, which has no connection yet.
+static ncclResult_t bootstrapAccept(struct extState* state, int peer) {
+  while (state->recvConns[peer].fd == -1) {
+    int fd, newPeer;
+    union socketAddress addr;
+    NCCLCHECK(bootstrapNetAccept(state->extListenFd, &fd, &addr));
+    NCCLCHECK(socketRecv(fd, &addr, &newPeer, sizeof(int)));
+    if (newPeer < 0 || newPeer >= state->nranks) {
+      WARN("Bootstrap : unexpected connection from rank %d", newPeer);
+      close(fd);
+      return ncclInternalError;
+    }
+    if (state->recvConns[newPeer].fd != -1) NCCLCHECK(bootstrapDrainRecvConn(state, newPeer));
+    state->recvConns[newPeer].fd = fd;
+    state->recvConns[newPeer].addr = addr;
+    state->nRecvConns++;
+    if (ncclParamBootstrapMaxConns() > 0) NCCLCHECK(bootstrapTrimRecvConns(state));
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t bootstrapConnect(struct extState* state, int peer, union socketAddress* addr) {
+  struct bootstrapConn* conn = state->sendConns+peer;
+  if (conn->fd == -1) {
+    int maxConns = ncclParamBootstrapMaxConns();
+    if (maxConns > 0 && state->nSendConns >= maxConns) {
+      // Close the least recently used connection. We are between two messages
+      // on all of them, and the peer still reads what was sent before the close.
+      int lru = -1;
+      for (int r=0; r<state->nranks; r++) {
+        if (state->sendConns[r].fd == -1) continue;
+        if (lru == -1 || state->sendConns[r].lastUsed < state->sendConns[lru].lastUsed) lru = r;
+      }
+      close(state->sendConns[lru].fd);
+      state->sendConns[lru].fd = -1;
+      state->nSendConns--;
+    }
+    int fd;
+    NCCLCHECK(connectAddress(&fd, addr));
+    conn->fd = fd;
+    conn->addr = *addr;
+    state->nSendConns++;
+    NCCLCHECK(socketSend(conn->fd, &conn->addr, &state->rank, sizeof(int)));
+  }
+  conn->lastUsed = ++state->connClock;
+  return ncclSuccess;
+}
+
+// Read the header of the next message from peer, following the peer to its
+// new connection if it closed the previous one
+static ncclResult_t bootstrapRecvHeader(struct extState* state, int peer, struct bootstrapMsgHeader* header) {
+  while (1) {
+    NCCLCHECK(bootstrapAccept(state, peer));
+    int closed;
+    NCCLCHECK(bootstrapRecvClosed(state->recvConns+peer, 1, &closed));
+    if (!closed) break;
+    NCCLCHECK(bootstrapDrainRecvConn(state, peer));
+  }
+  struct bootstrapConn* conn = state->recvConns+peer;
+  NCCLCHECK(socketRecv(conn->fd, &conn->addr, header, sizeof(struct bootstrapMsgHeader)));
+  return ncclSuccess;
+}
+
 ncclResult_t bootstrapInit(ncclUniqueId * id, int rank, int nranks, void** commState, int* rootPid) { // [RCCL] Adding rootPid
   struct extState* state;
   NCCLCHECK(ncclCalloc(&state, 1));
@@ -367,48 +766,58 @@ ncclResult_t bootstrapInit(ncclUniqueId * id, int rank, int nranks, void** commS
   struct extInfo info = { 0 };
   info.rank = rank;
   info.nranks = nranks;
-  int tmpSendFd, tmpRecvFd;
+  int tmpFd;
 
-  int extListenFdRoot;
   memcpy(&info.extAddressListen,     &bootstrapNetIfAddr, sizeof(union socketAddress));
-  memcpy(&info.extAddressListenRoot, &bootstrapNetIfAddr, sizeof(union socketAddress));
   NCCLCHECK(createListenSocket(&state->extListenFd, &info.extAddressListen));
-  NCCLCHECK(createListenSocket(&extListenFdRoot, &info.extAddressListenRoot));
 
-  // stagger connection times to avoid an overload of the root
+  // stagger connection times to avoid overflowing the listen backlog of the root
   if (nranks > 128) {
-    long msec = rank;
+    long usec = rank*ncclParamBootstrapStaggerUsec();
     struct timespec tv;
-    tv.tv_sec = msec / 1000;
-    tv.tv_nsec = 1000000 * (msec % 1000);
-    TRACE(NCCL_INIT, "rank %d delaying connection to root by %ld msec", rank, msec);
+    tv.tv_sec = usec / 1000000;
+    tv.tv_nsec = 1000 * (usec % 1000000);
+    TRACE(NCCL_INIT, "rank %d delaying connection to root by %ld usec", rank, usec);
     (void) nanosleep(&tv, NULL);
   }
 
   // send info on my listening socket to root
   union socketAddress* rootAddr = (union socketAddress*)id;
-  NCCLCHECK(connectAddress(&tmpSendFd, rootAddr));
-  NCCLCHECK(bootstrapNetSend(tmpSendFd, rootAddr,  &info, sizeof(info)));
-  close(tmpSendFd);
-
-  // get info on my "next" rank in the bootstrap ring from root
-  union socketAddress addr;
-  NCCLCHECK(bootstrapNetAccept(extListenFdRoot, &tmpRecvFd, &addr));
-  NCCLCHECK(bootstrapNetRecv(tmpRecvFd, &addr, &state->extRingSendAddr, sizeof(state->extRingSendAddr)));
+  NCCLCHECK(connectAddress(&tmpFd, rootAddr));
+  NCCLCHECK(bootstrapNetSend(tmpFd, rootAddr,  &info, sizeof(info)));
+
+  // get info on my "next" rank in the bootstrap ring from root, on the same
+  // connection, once all ranks have checked in
+  NCCLCHECK(bootstrapNetRecv(tmpFd, rootAddr, &state->extRingSendAddr, sizeof(state->extRingSendAddr)));
+  NCCLCHECK(ncclCalloc(&state->bruckAddresses, bootstrapBruckSteps(nranks)+1));
+  NCCLCHECK(bootstrapNetRecv(tmpFd, rootAddr, state->bruckAddresses, bootstrapBruckSteps(nranks)*sizeof(union socketAddress)));
   { // [RCCL] Receive PID from root
-    NCCLCHECK(bootstrapNetRecv(tmpRecvFd, &addr, rootPid, sizeof(int)));
+    NCCLCHECK(bootstrapNetRecv(tmpFd, rootAddr, rootPid, sizeof(int)));
   } // [/RCCL]
-  close(tmpRecvFd);
-  close(extListenFdRoot);
-
-  NCCLCHECK(connectAddress(&state->extRingSendFd, &state->extRingSendAddr));
-  // Accept the connect request from the previous rank in the AllGather ring
-  NCCLCHECK(bootstrapNetAccept(state->extListenFd, &state->extRingRecvFd, &state->extRingRecvAddr));
+  close(tmpFd);
 
-  // AllGather all listen handlers
+  // Each rank may keep a connection to and from many peers
+  setFilesLimit();
+  NCCLCHECK(ncclCalloc(&state->sendConns, nranks));
+  NCCLCHECK(ncclCalloc(&state->recvConns, nranks));
+  for (int r=0; r<nranks; r++) state->sendConns[r].fd = state->recvConns[r].fd = -1;
+  // Connect to the next rank in the AllGather ring now, so that connection
+  // errors show up during the init
+  NCCLCHECK(bootstrapConnect(state, (rank+1)%nranks, &state->extRingSendAddr));
+
+  // AllGather all listen handlers, along with the host of each rank
+  struct bootstrapPeerInfo* peerInfo;
+  NCCLCHECK(ncclCalloc(&peerInfo, nranks));
+  peerInfo[rank].addr = info.extAddressListen;
+  peerInfo[rank].hostHash = getHostHash();
+  NCCLCHECK(bootstrapAllGather(state, peerInfo, sizeof(struct bootstrapPeerInfo)));
   NCCLCHECK(ncclCalloc(&state->peerCommAddresses, nranks));
-  memcpy(state->peerCommAddresses+rank, &info.extAddressListen, sizeof(union socketAddress));
-  NCCLCHECK(bootstrapAllGather(state, state->peerCommAddresses, sizeof(union socketAddress)));
+  NCCLCHECK(ncclCalloc(&state->peerHostHashes, nranks));
+  for (int r=0; r<nranks; r++) {
+    state->peerCommAddresses[r] = peerInfo[r].addr;
+    state->peerHostHashes[r] = peerInfo[r].hostHash;
+  }
+  free(peerInfo);
 
   // Create the memory allocation service
   NCCLCHECK(ncclCalloc(&state->peerAllocAddresses, nranks));
@@ -424,26 +833,317 @@ ncclResult_t bootstrapInit(ncclUniqueId * id, int rank, int nranks, void** commS
   return ncclSuccess;
 }
 
-ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
-  struct extState* state = (struct extState*)commState;
-  char* data = (char*)allData;
+// Send to peer, connecting to addr if we don't have a connection to it yet
+static ncclResult_t bootstrapSendTo(struct extState* state, int peer, union socketAddress* addr, int tag, void* data, int size) {
+  NCCLCHECK(bootstrapConnect(state, peer, addr));
+  struct bootstrapConn* conn = state->sendConns+peer;
+  struct bootstrapMsgHeader header = { tag, size };
+  NCCLCHECK(socketSend(conn->fd, &conn->addr, &header, sizeof(header)));
+  NCCLCHECK(socketSend(conn->fd, &conn->addr, data, size));
+  return ncclSuccess;
+}
+
+// Simple ring based AllGather
+// At each step i receive data from (rank-i-1) from left
+// and send previous step's data from (rank-i) to right
+static ncclResult_t bootstrapRingAllGather(struct extState* state, char* data, int size) {
   int rank = state->rank;
   int nranks = state->nranks;
-
-  TRACE(NCCL_INIT, "rank %d nranks %d size %d", rank, nranks, size);
-
-  /* Simple ring based AllGather
-   * At each step i receive data from (rank-i-1) from left
-   * and send previous step's data from (rank-i) to right
-   */
+  int next = (rank+1) % nranks;
+  int prev = (rank-1+nranks) % nranks;
   for (int i=0; i<nranks-1; i++) {
     size_t rslice = (rank - i - 1 + nranks) % nranks;
     size_t sslice = (rank - i + nranks) % nranks;
 
     // Send slice to the right
-    NCCLCHECK(bootstrapNetSend(state->extRingSendFd, &state->extRingSendAddr, data+sslice*size, size));
+    NCCLCHECK(bootstrapSendTo(state, next, &state->extRingSendAddr, BOOTSTRAP_TAG_RING, data+sslice*size, size));
     // Recv slice from the left
-    NCCLCHECK(bootstrapNetRecv(state->extRingRecvFd, &state->extRingRecvAddr, data+rslice*size, size));
+    NCCLCHECK(bootstrapRecv(state, prev, BOOTSTRAP_TAG_RING, data+rslice*size, size));
+  }
+  return ncclSuccess;
+}
+
+// Send to dst while receiving from src. Both directions progress at once: if
+// every rank of a step sent its piece before receiving, pieces larger than
+// what the socket buffers hold would leave them all blocked in send.
+static ncclResult_t bootstrapSendRecv(struct extState* state, int dst, union socketAddress* dstAddr, char* sendData, size_t sendBytes,
+    int src, char* recvData, size_t recvBytes, int tag) {
+  struct bootstrapConn* sendConn = NULL, *recvConn = NULL;
+  // Connect before accepting: the peer we accept from may be waiting for us
+  if (sendBytes > 0) {
+    NCCLCHECK(bootstrapConnect(state, dst, dstAddr));
+    sendConn = state->sendConns+dst;
+  }
+  if (recvBytes > 0) {
+    NCCLCHECK(bootstrapAccept(state, src));
+    recvConn = state->recvConns+src;
+  }
+  const int hdrSize = sizeof(struct bootstrapMsgHeader);
+  struct bootstrapMsgHeader sendHeader, recvHeader;
+  size_t sent = 0, received = 0;
+  int sendOffset = 0, recvOffset = 0; // Within the current piece, header included
+  while (sent < sendBytes || received < recvBytes) {
+    int progress = 0;
+    if (sent < sendBytes) {
+      int piece = std::min(sendBytes-sent, (size_t)BOOTSTRAP_MAX_PIECE);
+      int start = sendOffset;
+      sendHeader.tag = tag;
+      sendHeader.size = piece;
+      if (sendOffset < hdrSize) NCCLCHECK(socketProgress(NCCL_SOCKET_SEND, sendConn->fd, &sendConn->addr, &sendHeader, hdrSize, &sendOffset));
+      if (sendOffset >= hdrSize) {
+        int offset = sendOffset-hdrSize;
+        NCCLCHECK(socketProgress(NCCL_SOCKET_SEND, sendConn->fd, &sendConn->addr, sendData+sent, piece, &offset));
+        sendOffset = hdrSize+offset;
+      }
+      if (sendOffset != start) progress = 1;
+      if (sendOffset == hdrSize+piece) {
+        sent += piece;
+        sendOffset = 0;
+      }
+    }
+    if (received < recvBytes) {
+      int piece = std::min(recvBytes-received, (size_t)BOOTSTRAP_MAX_PIECE);
+      struct unexMsg* msg = recvOffset == 0 ? unexpectedDequeue(state, src, tag) : NULL;
+      if (msg) {
+        NCCLCHECK(bootstrapRecvQueued(msg, recvData+received, piece));
+        received += piece;
+        progress = 1;
+      } else {
+        if (recvOffset == 0) {
+          // The peer may have closed this connection and opened a new one
+          int closed;
+          NCCLCHECK(bootstrapRecvClosed(recvConn, 0, &closed));
+          if (closed) {
+            NCCLCHECK(bootstrapDrainRecvConn(state, src));
+            NCCLCHECK(bootstrapAccept(state, src));
+            recvConn = state->recvConns+src;
+            continue;
+          }
+        }
+        int start = recvOffset;
+        if (recvOffset < hdrSize) NCCLCHECK(socketProgress(NCCL_SOCKET_RECV, recvConn->fd, &recvConn->addr, &recvHeader, hdrSize, &recvOffset));
+        if (recvOffset != start) progress = 1;
+        if (recvOffset == hdrSize && recvHeader.tag != tag) {
+          // Sent before this exchange started, so it is already on its way
+          NCCLCHECK(bootstrapRecvUnexpected(state, src, &recvHeader));
+          recvOffset = 0;
+        } else if (recvOffset >= hdrSize) {
+          if (recvHeader.size > piece) {
+            WARN("Message truncated : received %d bytes instead of %d", recvHeader.size, piece);
+            return ncclInternalError;
+          }
+          int offset = recvOffset-hdrSize;
+          if (offset < recvHeader.size) {
+            NCCLCHECK(socketProgress(NCCL_SOCKET_RECV, recvConn->fd, &recvConn->addr, recvData+received, recvHeader.size, &offset));
+            if (hdrSize+offset != recvOffset) progress = 1;
+          }
+          recvOffset = hdrSize+offset;
+          if (offset == recvHeader.size) {
+            received += piece;
+            recvOffset = 0;
+          }
+        }
+      }
+    }
+    if (progress) continue;
+    struct pollfd pfds[2];
+    int nfds = 0;
+    if (sent < sendBytes) {
+      pfds[nfds].fd = sendConn->fd;
+      pfds[nfds++].events = POLLOUT;
+    }
+    if (received < recvBytes) {
+      pfds[nfds].fd = recvConn->fd;
+      pfds[nfds++].events = POLLIN;
+    }
+    SYSCHECK(poll(pfds, nfds, -1), "poll");
+  }
+  return ncclSuccess;
+}
+
+// Bruck AllGather over the n members of a group, in ceil(log2(n)) steps.
+// Member i contributes sizes[i] bytes. On return, tmp holds the blocks of
+// members me, me+1, ... (mod n) back to back. At step k, we send what we have
+// to member me-2^k, whose address is dstAddrs[k].
+static ncclResult_t bootstrapBruck(struct extState* state, int* group, int n, int me, size_t* sizes,
+    union socketAddress* dstAddrs, char* tmp) {
+  size_t have = sizes[me];
+  for (int k=0, d=1; d<n; k++, d<<=1) {
+    int count = std::min(d, n-d);
+    int src = (me + d) % n;
+    int dst = (me - d + n) % n;
+    size_t sendBytes = 0, recvBytes = 0;
+    for (int i=0; i<count; i++) {
+      sendBytes += sizes[(me+i) % n];
+      recvBytes += sizes[(src+i) % n];
+    }
+    NCCLCHECK(bootstrapSendRecv(state, group[dst], dstAddrs+k, tmp, sendBytes, group[src], tmp+have, recvBytes, BOOTSTRAP_TAG_ALLGATHER+k));
+    have += recvBytes;
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t bootstrapBruckAllGather(struct extState* state, char* data, int size) {
+  int rank = state->rank;
+  int nranks = state->nranks;
+  int* group = NULL;
+  size_t* sizes = NULL;
+  char* tmp = NULL;
+  ncclResult_t res = ncclSuccess;
+  NCCLCHECKGOTO(ncclCalloc(&group, nranks), res, out);
+  NCCLCHECKGOTO(ncclCalloc(&sizes, nranks), res, out);
+  NCCLCHECKGOTO(ncclCalloc(&tmp, (size_t)nranks*size), res, out);
+  for (int r=0; r<nranks; r++) {
+    group[r] = r;
+    sizes[r] = size;
+  }
+  memcpy(tmp, data+(size_t)rank*size, size);
+  NCCLCHECKGOTO(bootstrapBruck(state, group, nranks, rank, sizes, state->bruckAddresses, tmp), res, out);
+  // tmp starts with our own block, rotate it back into rank order
+  memcpy(data+(size_t)rank*size, tmp, (size_t)(nranks-rank)*size);
+  memcpy(data, tmp+(size_t)(nranks-rank)*size, (size_t)rank*size);
+out:
+  free(group);
+  free(sizes);
+  free(tmp);
+  return res;
+}
+
+// Group ranks by host. Nodes are numbered in the order of their lowest rank.
+static ncclResult_t bootstrapGetNodes(struct extState* state, struct bootstrapNodes** nodesOut) {
+  if (state->nodes == NULL) {
+    int nranks = state->nranks;
+    struct bootstrapNodes* nodes;
+    int* leaders, *count;
+    NCCLCHECK(ncclCalloc(&nodes, 1));
+    NCCLCHECK(ncclCalloc(&nodes->ranks, nranks));
+    NCCLCHECK(ncclCalloc(&nodes->offsets, nranks+1));
+    NCCLCHECK(ncclCalloc(&nodes->nodeOf, nranks));
+    NCCLCHECK(ncclCalloc(&leaders, nranks));
+    NCCLCHECK(ncclCalloc(&count, nranks));
+    for (int r=0; r<nranks; r++) {
+      int n;
+      for (n=0; n<nodes->nNodes; n++) {
+        if (state->peerHostHashes[leaders[n]] == state->peerHostHashes[r]) break;
+      }
+      if (n == nodes->nNodes) leaders[nodes->nNodes++] = r;
+      nodes->nodeOf[r] = n;
+      count[n]++;
+    }
+    for (int n=0; n<nodes->nNodes; n++) {
+      nodes->offsets[n+1] = nodes->offsets[n] + count[n];
+      count[n] = 0;
+    }
+    for (int r=0; r<nranks; r++) {
+      int n = nodes->nodeOf[r];
+      nodes->ranks[nodes->offsets[n] + count[n]++] = r;
+    }
+    free(leaders);
+    free(count);
+    nodes->myNode = nodes->nodeOf[state->rank];
+    state->nodes = nodes;
+  }
+  *nodesOut = state->nodes;
+  return ncclSuccess;
+}
+
+// Hierarchical AllGather: node leaders collect the data of their node, run a
+// Bruck AllGather between them, then hand the result back to their node.
+static ncclResult_t bootstrapHierAllGather(struct extState* state, char* data, int size) {
+  int rank = state->rank;
+  int nranks = state->nranks;
+  struct bootstrapNodes* nodes;
+  NCCLCHECK(bootstrapGetNodes(state, &nodes));
+  int nNodes = nodes->nNodes;
+  int me = nodes->myNode;
+  int* localRanks = nodes->ranks+nodes->offsets[me];
+  int nLocal = nodes->offsets[me+1]-nodes->offsets[me];
+  int leader = localRanks[0];
+
+  if (rank != leader) {
+    NCCLCHECK(bootstrapSend(state, leader, BOOTSTRAP_TAG_HIER_GATHER, data+(size_t)rank*size, size));
+    NCCLCHECK(bootstrapSendRecv(state, -1, NULL, NULL, 0, leader, data, (size_t)nranks*size, BOOTSTRAP_TAG_HIER_BCAST));
+    return ncclSuccess;
+  }
+
+  ncclResult_t res = ncclSuccess;
+  int* leaders = NULL;
+  size_t* sizes = NULL;
+  union socketAddress* dstAddrs = NULL;
+  char* tmp = NULL;
+  for (int l=1; l<nLocal; l++) {
+    NCCLCHECK(bootstrapRecv(state, localRanks[l], BOOTSTRAP_TAG_HIER_GATHER, data+(size_t)localRanks[l]*size, size));
+  }
+  if (nNodes > 1) {
+    // Nodes contribute the blocks of their ranks, in node order
+    NCCLCHECKGOTO(ncclCalloc(&leaders, nNodes), res, out);
+    NCCLCHECKGOTO(ncclCalloc(&sizes, nNodes), res, out);
+    NCCLCHECKGOTO(ncclCalloc(&dstAddrs, bootstrapBruckSteps(nNodes)+1), res, out);
+    NCCLCHECKGOTO(ncclCalloc(&tmp, (size_t)nranks*size), res, out);
+    for (int n=0; n<nNodes; n++) {
+      leaders[n] = nodes->ranks[nodes->offsets[n]];
+      sizes[n] = (size_t)(nodes->offsets[n+1]-nodes->offsets[n])*size;
+    }
+    for (int k=0; (1<<k)<nNodes; k++) dstAddrs[k] = state->peerCommAddresses[leaders[(me - (1<<k) + nNodes) % nNodes]];
+    for (int l=0; l<nLocal; l++) memcpy(tmp+(size_t)l*size, data+(size_t)localRanks[l]*size, size);
+    NCCLCHECKGOTO(bootstrapBruck(state, leaders, nNodes, me, sizes, dstAddrs, tmp), res, out);
+    char* block = tmp;
+    for (int i=0; i<nNodes; i++) {
+      int n = (me+i) % nNodes;
+      for (int j=nodes->offsets[n]; j<nodes->offsets[n+1]; j++, block+=size) memcpy(data+(size_t)nodes->ranks[j]*size, block, size);
+    }
+  }
+  for (int l=1; l<nLocal; l++) {
+    NCCLCHECKGOTO(bootstrapSendRecv(state, localRanks[l], state->peerCommAddresses+localRanks[l], data, (size_t)nranks*size, -1, NULL, 0, BOOTSTRAP_TAG_HIER_BCAST), res, out);
+  }
+out:
+  free(leaders);
+  free(sizes);
+  free(dstAddrs);
+  free(tmp);
+  return res;
+}
+
+// Pick the AllGather algorithm. All ranks must make the same choice, so it
+// only depends on what they all know.
+static int bootstrapAllGatherAlgo(struct extState* state, int size) {
+  int algo = -1;
+  const char* str = getenv("NCCL_BOOTSTRAP_ALLGATHER");
+  if (str) {
+    if (strcasecmp(str, "ring") == 0) algo = BOOTSTRAP_ALLGATHER_RING;
+    else if (strcasecmp(str, "bruck") == 0) algo = BOOTSTRAP_ALLGATHER_BRUCK;
+    else if (strcasecmp(str, "hier") == 0) algo = BOOTSTRAP_ALLGATHER_HIER;
+    else if (state->rank == 0) WARN("Bootstrap : ignoring unknown NCCL_BOOTSTRAP_ALLGATHER value %s", str);
+  }
+  // Until the first AllGather is done, we don't know where ranks live
+  if (algo == BOOTSTRAP_ALLGATHER_HIER && state->peerHostHashes == NULL) algo = BOOTSTRAP_ALLGATHER_BRUCK;
+  if (algo != -1) return algo;
+  if (state->nranks <= ncclParamBootstrapRingMaxRanks()) return BOOTSTRAP_ALLGATHER_RING;
+  // Leaders send the whole result to each of their ranks: only worth it when
+  // it is small and there are several ranks per node to save on.
+  if (state->peerHostHashes && (int64_t)state->nranks*size <= ncclParamBootstrapHierMaxBytes()) {
+    struct bootstrapNodes* nodes;
+    if (bootstrapGetNodes(state, &nodes) == ncclSuccess && nodes->nNodes > 1 && nodes->nNodes < state->nranks) return BOOTSTRAP_ALLGATHER_HIER;
+  }
+  return BOOTSTRAP_ALLGATHER_BRUCK;
+}
+
+ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
+  struct extState* state = (struct extState*)commState;
+  char* data = (char*)allData;
+  int rank = state->rank;
+  int nranks = state->nranks;
+  if (nranks == 1) return ncclSuccess;
+  int algo = bootstrapAllGatherAlgo(state, size);
+
+  TRACE(NCCL_INIT, "rank %d nranks %d size %d algo %d", rank, nranks, size, algo);
+
+  if (algo == BOOTSTRAP_ALLGATHER_RING) {
+    NCCLCHECK(bootstrapRingAllGather(state, data, size));
+  } else if (algo == BOOTSTRAP_ALLGATHER_BRUCK) {
+    NCCLCHECK(bootstrapBruckAllGather(state, data, size));
+  } else {
+    NCCLCHECK(bootstrapHierAllGather(state, data, size));
   }
 
   TRACE(NCCL_INIT, "rank %d nranks %d size %d - DONE", rank, nranks, size);
@@ -452,14 +1152,7 @@ ncclResult_t bootstrapAllGather(void* commState, void* allData, int size) {
 
 ncclResult_t bootstrapSend(void* commState, int peer, int tag, void* data, int size) {
   struct extState* state = (struct extState*)commState;
-  int tmpSendFd;
-  union socketAddress *addr = state->peerCommAddresses+peer;
-  NCCLCHECK(connectAddress(&tmpSendFd, addr));
-  NCCLCHECK(bootstrapNetSend(tmpSendFd, addr, &state->rank, sizeof(int)));
-  NCCLCHECK(bootstrapNetSend(tmpSendFd, addr, &tag, sizeof(int)));
-  NCCLCHECK(bootstrapNetSend(tmpSendFd, addr, data, size));
-  close(tmpSendFd);
-  return ncclSuccess;
+  return bootstrapSendTo(state, peer, state->peerCommAddresses+peer, tag, data, size);
 }
 
 ncclResult_t bootstrapBarrier(void* commState, int *ranks, int rank, int nranks, int tag) {
@@ -499,87 +1192,47 @@ ncclResult_t bootstrapIntraNodeAllGather(void* commState, int *ranks, int rank,
   return ncclSuccess;
 }
 
-ncclResult_t unexpectedEnqueue(struct extState* state, int peer, int tag, int fd, union socketAddress *addr) {
-  // New unex
-  struct unexConn* unex;
-  NCCLCHECK(ncclCalloc(&unex, 1));
-  unex->peer = peer;
-  unex->tag = tag;
-  unex->fd = fd;
-  unex->addr = *addr;
-
-  // Enqueue
-  struct unexConn* list = state->unexpectedConnections;
-  if (list == NULL) {
-    state->unexpectedConnections = unex;
-    return ncclSuccess;
-  }
-  while (list->next) list = list->next;
-  list->next = unex;
-  return ncclSuccess;
-}
-
-int unexpectedDequeue(struct extState* state, int peer, int tag, union socketAddress *addr) {
-  struct unexConn* elem = state->unexpectedConnections;
-  struct unexConn* prev = NULL;
-  while (elem) {
-    if (elem->peer == peer && elem->tag == tag) {
-      if (prev == NULL) {
-        state->unexpectedConnections = elem->next;
-      } else {
-        prev->next = elem->next;
-      }
-      int fd = elem->fd;
-      *addr = elem->addr;
-      free(elem);
-      return fd;
-    }
-    prev = elem;
-    elem = elem->next;
-  }
-  return -1;
-}
-
-// We can't know who we'll receive from, so we need to receive everything at once
+// Messages from a peer arrive in order on its connection. Those with another
+// tag are read ahead and kept until someone asks for them.
 ncclResult_t bootstrapRecv(void* commState, int peer, int tag, void* data, int size) {
   struct extState* state = (struct extState*)commState;
+  struct unexMsg* msg = unexpectedDequeue(state, peer, tag);
+  if (msg) return bootstrapRecvQueued(msg, data, size);
 
-  int tmpRecvFd;
-  union socketAddress addr;
-
-  // Search unexpected connections first
-  if ((tmpRecvFd = unexpectedDequeue(state, peer, tag, &addr)) != -1) {
-    NCCLCHECK(bootstrapNetRecv(tmpRecvFd, &addr, ((char*)data), size));
-    close(tmpRecvFd);
-    return ncclSuccess;
-  }
-
-  // Then look for new connections
   while (1) {
-    union socketAddress addr;
-    NCCLCHECK(bootstrapNetAccept(state->extListenFd, &tmpRecvFd, &addr));
-    int newPeer, newTag;
-    NCCLCHECK(bootstrapNetRecv(tmpRecvFd, &addr, &newPeer, sizeof(int)));
-    NCCLCHECK(bootstrapNetRecv(tmpRecvFd, &addr, &newTag, sizeof(int)));
-    if (newPeer == peer && newTag == tag) {
-      NCCLCHECK(bootstrapNetRecv(tmpRecvFd, &addr, ((char*)data), size));
-      close(tmpRecvFd);
+    struct bootstrapMsgHeader header;
+    NCCLCHECK(bootstrapRecvHeader(state, peer, &header));
+    struct bootstrapConn* conn = state->recvConns+peer;
+    if (header.tag == tag) {
+      if (header.size > size) {
+        WARN("Message truncated : received %d bytes instead of %d", header.size, size);
+        return ncclInternalError;
+      }
+      NCCLCHECK(socketRecv(conn->fd, &conn->addr, data, header.size));
       return ncclSuccess;
     }
-    // Unexpected connection. Save for later.
-    NCCLCHECK(unexpectedEnqueue(state, newPeer, newTag, tmpRecvFd, &addr));
+    NCCLCHECK(bootstrapRecvUnexpected(state, peer, &header));
+  }
+}
+
+static void bootstrapCloseConns(struct extState* state) {
+  for (int r=0; r<state->nranks; r++) {
+    if (state->sendConns && state->sendConns[r].fd != -1) close(state->sendConns[r].fd);
+    if (state->recvConns && state->recvConns[r].fd != -1) close(state->recvConns[r].fd);
   }
+  free(state->sendConns);
+  free(state->recvConns);
+  state->sendConns = state->recvConns = NULL;
 }
 
 ncclResult_t bootstrapClose(void* commState) {
   struct extState* state = (struct extState*)commState;
-  if (state->unexpectedConnections != NULL) {
-    WARN("Unexpected connections are not empty");
+  if (state->unexpected.count != 0) {
+    WARN("Unexpected messages are not empty");
     return ncclInternalError;
   }
   close(state->extListenFd);
-  close(state->extRingSendFd);
-  close(state->extRingRecvFd);
+  bootstrapCloseConns(state);
 
   state->allocState->stop = 1;
 
@@ -590,6 +1243,9 @@ ncclResult_t bootstrapClose(void* commState) {
 
   free(state->peerCommAddresses);
   free(state->peerAllocAddresses);
+  free(state->bruckAddresses);
+  free(state->peerHostHashes);
+  bootstrapFreeNodes(state->nodes);
   free(state);
 
   return ncclSuccess;
@@ -599,11 +1255,14 @@ ncclResult_t bootstrapAbort(void* commState) {
   struct extState* state = (struct extState*)commState;
   if (commState == NULL) return ncclSuccess;
   if (state->extListenFd) close(state->extListenFd);
-  if (state->extRingSendFd) close(state->extRingSendFd);
-  if (state->extRingRecvFd) close(state->extRingRecvFd);
+  bootstrapCloseConns(state);
+  unexpectedFree(state);
   if (state->allocState) state->allocState->stop = 2;
   free(state->peerCommAddresses);
   free(state->peerAllocAddresses);
+  free(state->bruckAddresses);
+  free(state->peerHostHashes);
+  bootstrapFreeNodes(state->nodes);
   free(state);
   return ncclSuccess;
 }
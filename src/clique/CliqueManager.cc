@@ -22,7 +22,8 @@ THE SOFTWARE.
 
 #include "CliqueManager.h"
 #include "CliqueShmNames.h"
-#include "MsgQueue.h"
+#include "CpuBarrier.h"
+#include "ShmRendezvous.h"
 
 #include "nccl.h"
 #include "core.h"
@@ -50,6 +51,7 @@ int*               CliqueManager::m_staticGpuBarrierMem                = NULL;
 RCCL_PARAM(EnableClique, "ENABLE_CLIQUE", 0);                           // Opt-in environment variable for clique-based kernels
 RCCL_PARAM(AllReduceCliqueByteLimit, "CLIQUE_ALLREDUCE_BYTE_LIMIT", 0); // Max number of bytes to use clique-based kernels for all reduce (0 for auto-select)
 RCCL_PARAM(AllReduceNumChannels,     "CLIQUE_ALLREDUCE_NCHANNELS", 0);  // Number of channels to use for all-reduce. (0 for auto-select)
+RCCL_PARAM(CliqueBarrierSpin,        "CLIQUE_BARRIER_SPIN", 20000);     // Polls of the CPU barrier before sleeping (-1 to never sleep)
 
 CliqueManager::CliqueManager(int          const  rank,
                              int          const  numRanks,
@@ -172,10 +174,7 @@ ncclResult_t CliqueManager::Init(ncclUniqueId const* commId, int suffix)
 
     // Initialize IPC caches
     m_ipcHandleSendCache = new NcclIpcHandleSendCache(m_numRanks * NUM_HANDLES_PER_RANK * NCCL_MAX_OPS);
-    m_ipcHandleRecvCache = new NcclIpcHandleRecvCache(m_numRanks * NUM_HANDLES_PER_RANK * NCCL_MAX_OPS,
-                                                      100,
-                                                      hipIpcMemHandleHash,
-                                                      hipIpcMemHandleEqual);
+    m_ipcHandleRecvCache = new NcclIpcHandleRecvCache(m_numRanks * NUM_HANDLES_PER_RANK * NCCL_MAX_OPS);
 
     // Initialize shared object for GPU barrier IPC handle
     m_sharedIpcHandle = ShmObject<hipIpcMemHandle_t>(std::max(4096LU, sizeof(hipIpcMemHandle_t)),
@@ -339,17 +338,8 @@ ncclResult_t CliqueManager::DeclarePointers(void const* inputPtr, void* outputPt
   }
 
   // Increment entry barrier counter - must not block
-  volatile int* entryCounter = &m_cpuBarrierCount[2 * opIndex];
-  int entryVal = LOAD(entryCounter);
-  // Loop until successful atomic update to counter
-  bool done = false;
-  while (done == false) {
-    // Last rank resets exit barrier counter prior to incrementing entry count to numRanks
-    if (entryVal+1 == m_numRanks)
-      m_cpuBarrierCount[2 * opIndex + 1] = 0;
-    done = __sync_bool_compare_and_swap(entryCounter, entryVal, entryVal+1);
-    entryVal++;
-  }
+  // Last rank resets exit barrier counter prior to incrementing entry count to numRanks
+  cpuBarrierArrive(&m_cpuBarrierCount[2 * opIndex], m_numRanks, &m_cpuBarrierCount[2 * opIndex + 1]);
   return ncclSuccess;
 }
 
@@ -427,24 +417,12 @@ ncclResult_t CliqueManager::WaitForPointers(ncclWorkElem* args)
   args->clique.ptrs = &m_pinnedCliquePtrs[opIndex];
 
   // Wait for all ranks to declare pointers for this opIndex
-  volatile int* entryCounter = (volatile int*)(&m_cpuBarrierCount[2 * opIndex]);
-  int entryVal = LOAD(entryCounter);
-  while (entryVal != m_numRanks) entryVal = LOAD(entryCounter);
+  cpuBarrierWait(&m_cpuBarrierCount[2 * opIndex], m_numRanks, rcclParamCliqueBarrierSpin());
 
   // Last rank to past barrier resets entry barrier
   // NOTE: There is another GPU-barrier performed during the kernels therefore it should
   //       not be possible for any rank to modify entry count prior to being reset
-  volatile int* exitCounter = &m_cpuBarrierCount[2 * opIndex + 1];
-  int exitVal = LOAD(exitCounter);
-  // Loop until successful atomic update to counter
-  bool done = false;
-  while (done == false) {
-    // Last rank resets entry counter
-    if (exitVal+1 == m_numRanks)
-      m_cpuBarrierCount[2 * opIndex] = 0;
-    done = __sync_bool_compare_and_swap(exitCounter, exitVal, exitVal+1);
-    exitVal++;
-  }
+  cpuBarrierArrive(&m_cpuBarrierCount[2 * opIndex + 1], m_numRanks, &m_cpuBarrierCount[2 * opIndex]);
   INFO(NCCL_COLL, "Rank %d past opIndex barrier %d", m_rank, opIndex);
 
   // Collect pointers
@@ -551,14 +529,6 @@ ncclResult_t CliqueManager::BootstrapRootInit(int pid, unsigned long hash)
 {
   if (rcclParamEnableClique())
   {
-      for (auto it = CliqueShmNames.begin(); it != CliqueShmNames.end(); it++)
-      {
-        mqd_t mq_desc;
-        std::string msgQueueName = it->second + std::to_string(hash) + "_" + std::to_string(pid);
-        NCCLCHECK(MsgQueueGetId(msgQueueName, true, mq_desc));
-        NCCLCHECK(MsgQueueClose(msgQueueName, mq_desc, true));
-      }
-
       std::string shmDir = "/dev/shm/";
 
       for (auto it = CliqueShmNames.begin(); it != CliqueShmNames.end(); it++)
@@ -572,6 +542,9 @@ ncclResult_t CliqueManager::BootstrapRootInit(int pid, unsigned long hash)
         {
           NCCLCHECK(shmUnlink(shmFileName.c_str()));
         }
+
+        // Remove rendezvous objects left over by a previous run
+        NCCLCHECK(ShmRendezvousUnlink(shmFileName));
       }
   }
   else
@@ -0,0 +1,108 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "CpuBarrier.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// The counters may live in shared memory mapped by several processes, so FUTEX_PRIVATE_FLAG can not be used
+static inline long futexWait(int32_t* addr, int32_t val, struct timespec const* timeout)
+{
+  return syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static inline long futexWakeAll(int32_t* addr)
+{
+  return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline int64_t timeUs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#elif defined(__powerpc__)
+  asm volatile("or 27,27,27" ::: "memory");
+#endif
+}
+
+void cpuBarrierArrive(int32_t* counter, int numRanks, int32_t* resetCounter)
+{
+  int32_t val = __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+  // Loop until successful atomic update to counter
+  while (true)
+  {
+    bool last = (CPU_BARRIER_COUNT(val) + 1 == numRanks);
+    // Last rank resets the other counter prior to releasing the waiting ranks
+    if (last && resetCounter) __atomic_store_n(resetCounter, 0, __ATOMIC_SEQ_CST);
+    if (__atomic_compare_exchange_n(counter, &val, val + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+      if (last && (val & CPU_BARRIER_WAITERS)) futexWakeAll(counter);
+      return;
+    }
+    // val has been updated with the current value of counter
+  }
+}
+
+bool cpuBarrierWait(int32_t* counter, int numRanks, int64_t spinCount, int64_t timeoutUs)
+{
+  int64_t deadline = timeoutUs < 0 ? -1 : timeUs() + timeoutUs;
+  int32_t val = __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+  for (int64_t spin = 0; CPU_BARRIER_COUNT(val) != numRanks; spin++)
+  {
+    if (spinCount < 0 || spin < spinCount)
+    {
+      cpuRelax();
+      val = __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+      continue;
+    }
+    struct timespec timeout;
+    if (deadline >= 0)
+    {
+      int64_t remaining = deadline - timeUs();
+      if (remaining <= 0) return false;
+      timeout.tv_sec = remaining / 1000000;
+      timeout.tv_nsec = (remaining % 1000000) * 1000;
+    }
+    // Flag that a rank is about to sleep. Fails and retries if another rank arrived meanwhile.
+    if (!(val & CPU_BARRIER_WAITERS) &&
+        !__atomic_compare_exchange_n(counter, &val, val | CPU_BARRIER_WAITERS, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      continue;
+    // Only sleeps if counter still holds the flagged value, i.e. the last rank has not arrived yet
+    futexWait(counter, val | CPU_BARRIER_WAITERS, deadline >= 0 ? &timeout : NULL);
+    val = __atomic_load_n(counter, __ATOMIC_SEQ_CST);
+  }
+  return true;
+}
@@ -0,0 +1,44 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef NCCL_CPU_BARRIER_H_
+#define NCCL_CPU_BARRIER_H_
+
+#include <stdint.h>
+
+// Counter based CPU barrier between ranks sharing (possibly inter-process) memory.
+// Ranks waiting for the others spin for a limited number of polls, then sleep on a
+// futex until the last rank arrives. Sleeping ranks set CPU_BARRIER_WAITERS in the
+// counter so that the last rank only enters the kernel when someone is asleep.
+#define CPU_BARRIER_WAITERS 0x40000000
+#define CPU_BARRIER_COUNT(val) ((val) & ~CPU_BARRIER_WAITERS)
+
+// Increments counter. The last of numRanks ranks first resets resetCounter (if not NULL)
+// then wakes up the ranks waiting on counter.
+void cpuBarrierArrive(int32_t* counter, int numRanks, int32_t* resetCounter);
+
+// Waits until numRanks ranks have arrived on counter. Polls spinCount times before
+// sleeping, or forever if spinCount is negative. Returns false if timeoutUs (when not
+// negative) elapsed first.
+bool cpuBarrierWait(int32_t* counter, int numRanks, int64_t spinCount, int64_t timeoutUs = -1);
+
+#endif
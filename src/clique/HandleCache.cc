@@ -22,10 +22,13 @@ THE SOFTWARE.
 
 #include "HandleCache.h"
 
-#include "Hash.h"
-
 // djb2 hash function for hashing char array in hipIpcMemHandle_t
+// The handle is not null-terminated, so hash all of its bytes rather than using djb2Hash
 unsigned long hipIpcMemHandleHash(const hipIpcMemHandle_t& handle)
 {
-    return djb2Hash(handle.reserved);
+    unsigned long hash = 5381;
+    for (size_t i = 0; i < sizeof(handle.reserved); i++)
+        hash = ((hash << 5) + hash) + handle.reserved[i]; /* hash * 33 + c */
+
+    return hash;
 }
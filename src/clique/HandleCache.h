@@ -26,6 +26,8 @@ THE SOFTWARE.
 #include <list>
 #include <unordered_map>
 #include <functional>
+#include <algorithm>
+#include <string.h>
 
 #include "core.h"
 
@@ -124,11 +126,252 @@ private:
     LRUCache m_cache;
 };
 
+// Fixed capacity LRU cache with the interface of NcclIpcHandleCache, which does not allocate
+// after the first insertion. Entries live in a slab and are chained in LRU order by index.
+// An open addressing table (linear probing, at most half full) maps keys to entries; each
+// slot keeps part of the hash so that most other keys are rejected without comparing them.
+template <
+    class Key,
+    class Value,
+    class Hash,
+    class KeyEqual
+>
+class NcclIpcHandleFlatCache
+{
+public:
+    struct Entry
+    {
+        Key                        first;   // Key
+        std::pair<Value, uint64_t> second;  // Value and mixed hash of the key
+        int32_t                    prev;    // Less recently used entry (-1 if none)
+        int32_t                    next;    // More recently used entry (-1 if none), or next free entry
+    };
+    typedef Entry* iterator;
+
+    NcclIpcHandleFlatCache(size_t size,
+                           size_t bucket_count = 0,
+                           const Hash& hash = Hash(),
+                           const KeyEqual& eql = KeyEqual()) :
+        m_hash(hash),
+        m_equal(eql),
+        m_capacity(std::max(size, (size_t)1)),
+        m_size(0),
+        m_tableBits(1),
+        m_slab(NULL),
+        m_table(NULL),
+        m_free(-1),
+        m_lru(-1),
+        m_mru(-1)
+    {
+        while ((1UL << m_tableBits) < 2 * m_capacity) m_tableBits++;
+    }
+
+    NcclIpcHandleFlatCache(const NcclIpcHandleFlatCache&) = delete;
+    NcclIpcHandleFlatCache& operator=(const NcclIpcHandleFlatCache&) = delete;
+
+    ~NcclIpcHandleFlatCache()
+    {
+        delete[] m_slab;
+        delete[] m_table;
+    }
+
+    iterator end()
+    {
+        return NULL;
+    }
+
+    size_t size() const
+    {
+        return m_size;
+    }
+
+    iterator find(const Key& key)
+    {
+        if (m_table == NULL) return end();
+        uint64_t hash = mix(key);
+        int32_t index = lookup(key, hash, NULL);
+        if (index < 0) return end();
+        updateHistory(index);
+        return &m_slab[index];
+    }
+
+    std::pair<iterator, bool> insert(const Key& key, const Value& value)
+    {
+        if (m_table == NULL) allocate();
+        uint64_t hash = mix(key);
+        size_t pos = 0;
+        int32_t index = lookup(key, hash, &pos);
+        if (index >= 0) return std::pair<iterator, bool>(&m_slab[index], false);
+
+        if (m_size == m_capacity)
+        {
+            // Remove least recently used entry, which may move the free slot found above
+            pop();
+            lookup(key, hash, &pos);
+        }
+        index = m_free;
+        Entry& e = m_slab[index];
+        m_free = e.next;
+        e.first = key;
+        e.second = std::make_pair(value, hash);
+        link(index);
+        m_table[pos].tag = (uint32_t)hash;
+        m_table[pos].entry = index + 1;
+        m_size++;
+        return std::pair<iterator, bool>(&e, true);
+    }
+
+    size_t erase(const Key& key)
+    {
+        if (m_table == NULL) return 0;
+        int32_t index = lookup(key, mix(key), NULL);
+        if (index < 0) return 0;
+        remove(index);
+        return 1;
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t tag;    // Low bits of the mixed hash
+        int32_t  entry;  // Index in the slab plus one, 0 if empty
+    };
+
+    uint64_t mix(const Key& key) const
+    {
+        // Fibonacci hashing: the table position comes from the high bits, so that hashes
+        // which only differ in their high bits (e.g. aligned addresses) still spread out
+        return (uint64_t)m_hash(key) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    size_t home(uint64_t hash) const
+    {
+        return hash >> (64 - m_tableBits);
+    }
+
+    // Returns the index of the entry for key, or -1 and the first empty slot in *pos
+    int32_t lookup(const Key& key, uint64_t hash, size_t* pos) const
+    {
+        size_t const mask = (1UL << m_tableBits) - 1;
+        for (size_t p = home(hash); ; p = (p + 1) & mask)
+        {
+            Slot const& slot = m_table[p];
+            if (slot.entry == 0)
+            {
+                if (pos) *pos = p;
+                return -1;
+            }
+            if (slot.tag == (uint32_t)hash && m_equal(m_slab[slot.entry - 1].first, key)) return slot.entry - 1;
+        }
+    }
+
+    void allocate()
+    {
+        m_slab = new Entry[m_capacity];
+        m_table = new Slot[1UL << m_tableBits]();
+        for (size_t i = 0; i < m_capacity; i++) m_slab[i].next = (i + 1 < m_capacity ? (int32_t)(i + 1) : -1);
+        m_free = 0;
+    }
+
+    void link(int32_t index)
+    {
+        Entry& e = m_slab[index];
+        e.prev = m_mru;
+        e.next = -1;
+        if (m_mru >= 0) m_slab[m_mru].next = index; else m_lru = index;
+        m_mru = index;
+    }
+
+    void unlink(int32_t index)
+    {
+        Entry& e = m_slab[index];
+        if (e.prev >= 0) m_slab[e.prev].next = e.next; else m_lru = e.next;
+        if (e.next >= 0) m_slab[e.next].prev = e.prev; else m_mru = e.prev;
+    }
+
+    void updateHistory(int32_t index)
+    {
+        if (index == m_mru) return;
+        unlink(index);
+        link(index);
+    }
+
+    void pop()
+    {
+        remove(m_lru);
+    }
+
+    void remove(int32_t index)
+    {
+        size_t const mask = (1UL << m_tableBits) - 1;
+        size_t hole = home(m_slab[index].second.second);
+        while (m_table[hole].entry != index + 1) hole = (hole + 1) & mask;
+        // Backward shift deletion: move up the following entries which may go to the hole
+        for (size_t p = (hole + 1) & mask; m_table[p].entry != 0; p = (p + 1) & mask)
+        {
+            size_t h = home(m_slab[m_table[p].entry - 1].second.second);
+            if (((p - h) & mask) >= ((p - hole) & mask))
+            {
+                m_table[hole] = m_table[p];
+                hole = p;
+            }
+        }
+        m_table[hole].entry = 0;
+
+        unlink(index);
+        m_slab[index].next = m_free;
+        m_free = index;
+        m_size--;
+    }
+
+    Hash     m_hash;
+    KeyEqual m_equal;
+    size_t   m_capacity;
+    size_t   m_size;
+    int      m_tableBits;
+    Entry*   m_slab;
+    Slot*    m_table;
+    int32_t  m_free;   // Head of the free entries
+    int32_t  m_lru;    // Least recently used entry
+    int32_t  m_mru;    // Most recently used entry
+};
+
 // djb2 hash function for hashing char array in hipIpcMemHandle_t
 unsigned long hipIpcMemHandleHash(const hipIpcMemHandle_t& handle);
 
+// Hashes / compares the handles 8 bytes at a time, which compilers vectorize
+#define IPC_HANDLE_WORDS (sizeof(hipIpcMemHandle_t) / sizeof(uint64_t))
+struct hipIpcMemHandleHasher
+{
+    size_t operator()(const hipIpcMemHandle_t& handle) const
+    {
+        uint64_t words[IPC_HANDLE_WORDS];
+        memcpy(words, handle.reserved, sizeof(words));
+        uint64_t hash = 0;
+        for (size_t i = 0; i < IPC_HANDLE_WORDS; i++)
+        {
+            hash = (hash ^ words[i]) * 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 32;
+        }
+        return hash;
+    }
+};
+
+struct hipIpcMemHandleEqualTo
+{
+    bool operator()(const hipIpcMemHandle_t& l, const hipIpcMemHandle_t& r) const
+    {
+        uint64_t lw[IPC_HANDLE_WORDS], rw[IPC_HANDLE_WORDS];
+        memcpy(lw, l.reserved, sizeof(lw));
+        memcpy(rw, r.reserved, sizeof(rw));
+        uint64_t diff = 0;
+        for (size_t i = 0; i < IPC_HANDLE_WORDS; i++) diff |= lw[i] ^ rw[i];
+        return diff == 0;
+    }
+};
+
 // equality function required for unordered_map
-auto hipIpcMemHandleEqual = [](const hipIpcMemHandle_t& l, const hipIpcMemHandle_t& r)
+static auto hipIpcMemHandleEqual = [](const hipIpcMemHandle_t& l, const hipIpcMemHandle_t& r)
 {
     return memcmp(l.reserved, r.reserved, sizeof(l.reserved)) == 0;
 };
@@ -136,7 +379,7 @@ auto hipIpcMemHandleEqual = [](const hipIpcMemHandle_t& l, const hipIpcMemHandle
 //typedef llvm::DenseMap<uint64_t, hipIpcMemHandle_t> SendCache;
 //typedef llvm::DenseMap<hipIpcMemHandle_t, void*, decltype(&HandleHash), decltype(HandleEqual)> RecvCache;
 
-typedef NcclIpcHandleCache<uint64_t, hipIpcMemHandle_t, std::hash<uint64_t>, std::equal_to<uint64_t>, std::allocator< std::pair<const uint64_t, std::pair<hipIpcMemHandle_t, std::list<uint64_t>::iterator>>>> NcclIpcHandleSendCache;
-typedef NcclIpcHandleCache<hipIpcMemHandle_t, void*, decltype(&hipIpcMemHandleHash), decltype(hipIpcMemHandleEqual), std::allocator< std::pair<const hipIpcMemHandle_t, std::pair<void*, std::list<hipIpcMemHandle_t>::iterator>>>> NcclIpcHandleRecvCache;
+typedef NcclIpcHandleFlatCache<uint64_t, hipIpcMemHandle_t, std::hash<uint64_t>, std::equal_to<uint64_t>> NcclIpcHandleSendCache;
+typedef NcclIpcHandleFlatCache<hipIpcMemHandle_t, void*, hipIpcMemHandleHasher, hipIpcMemHandleEqualTo> NcclIpcHandleRecvCache;
 
 #endif
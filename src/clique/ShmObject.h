@@ -30,7 +30,7 @@ THE SOFTWARE.
 #include <type_traits>
 #include <semaphore.h>
 
-#include "MsgQueue.h"
+#include "ShmRendezvous.h"
 #include "nccl.h"
 #include "core.h"
 #include "shm.h"
@@ -89,32 +89,6 @@ public:
     return m_shmPtr;
   }
 protected:
-  ncclResult_t BroadcastMessage(mqd_t& mq_desc, bool pass) const
-  {
-    char msg_text[1];
-    msg_text[0] = (pass == 0 ? 'F': 'P');
-    for (int rank = 0; rank < m_numRanks; rank++)
-    {
-      if (rank == m_rank) continue;
-      NCCLCHECK(MsgQueueSend(mq_desc, &msg_text[0], sizeof(msg_text)));
-    }
-    return ncclSuccess;
-  }
-
-  ncclResult_t BroadcastAndCloseMessageQueue(mqd_t& mq_desc, bool pass)
-  {
-    ncclResult_t res;
-    NCCLCHECKGOTO(BroadcastMessage(mq_desc, pass), res, dropback);
-    NCCLCHECKGOTO(MsgQueueWaitUntilEmpty(mq_desc), res, dropback);
-    NCCLCHECK(MsgQueueClose(m_shmName, mq_desc, true));
-    return ncclSuccess;
-
-dropback:
-    WARN("Root rank unable to broadcast across message queue.  Closing message queue.");
-    NCCLCHECK(MsgQueueClose(m_shmName, mq_desc, true));
-    return ncclSystemError;
-  }
-
   // tag for dispatch
       template<class U>
         struct OpenTag{};
@@ -137,76 +111,72 @@ dropback:
 template <typename T>
 ncclResult_t ShmObject<T>::Open()
 {
-  mqd_t mq_desc;
-  if (m_alloc == false)
+  if (m_alloc == true)
   {
-    int shmFd;
-    INFO(NCCL_INIT, "Rank %d Initializing message queue for %s\n", m_rank, m_shmName.c_str());
+    WARN("Cannot allocate ShmObject twice.\n");
+    return ncclInvalidUsage;
+  }
 
-    NCCLCHECK(MsgQueueGetId(m_shmName, false, mq_desc));
-    if (m_rank == 0)
+  struct shmRendezvous* rdv;
+  int shmFd;
+  INFO(NCCL_INIT, "Rank %d opening shared memory rendezvous for %s", m_rank, m_shmName.c_str());
+  NCCLCHECK(ShmRendezvousOpen(m_shmName, &rdv));
+  if (m_rank == 0)
+  {
+    ncclResult_t resultSetup = shmSetupExclusive(m_shmName.c_str(), m_shmSize, &shmFd, (void**)&m_shmPtr, 1);
+    ncclResult_t resultSemInit = (resultSetup == ncclSuccess ? InitIfSemaphore(OpenTag<T>{}) : ncclSuccess);
+    ncclResult_t status = (resultSetup == ncclSuccess && resultSemInit == ncclSuccess) ? ncclSuccess : ncclSystemError;
+    if (status != ncclSuccess)
     {
-      ncclResult_t resultSetup = shmSetupExclusive(m_shmName.c_str(), m_shmSize, &shmFd, (void**)&m_shmPtr, 1);
-      ncclResult_t resultSemInit = InitIfSemaphore(OpenTag<T>{});
-      if ((resultSetup != ncclSuccess && errno != EEXIST) || (resultSemInit != ncclSuccess))
-      {
-        NCCLCHECK(BroadcastAndCloseMessageQueue(mq_desc, false));
-        WARN("Call to ShmObject::Open in root rank failed : %s", strerror(errno));
-        if (resultSetup == ncclSuccess)
-        {
-            Close();
-        }
-        return ncclSystemError;
-      }
-      ncclResult_t result;
+      WARN("Call to ShmObject::Open in root rank failed : %s", strerror(errno));
+    }
 
-      // Broadcast two sets of messages: one set is consumed by the other ranks to acknowledge root rank
-      // has successfully opened shared memory; second set is consumed by the other ranks to indicate
-      // that they have successfully opened shared memory and root rank can now unlink shared memory
-      NCCLCHECK(BroadcastMessage(mq_desc, true));
-      NCCLCHECK(BroadcastAndCloseMessageQueue(mq_desc, true));
+    // Publish the outcome, then wait until all other ranks have attached (or given up)
+    // before unlinking the shared memory, so that they can all still open it
+    ncclResult_t res = ShmRendezvousPublish(rdv, status);
+    if (res == ncclSuccess) res = ShmRendezvousWaitAcks(rdv, m_numRanks - 1);
+    NCCLCHECK(ShmRendezvousClose(m_shmName, rdv, true));
 
+    if (resultSetup == ncclSuccess)
+    {
       int retVal = shm_unlink(m_shmName.c_str());
       if (retVal == -1 && errno != ENOENT)
       {
         WARN("Call to shm_unlink in ShmObject failed : %s", strerror(errno));
-        return ncclSystemError;
+        if (status == ncclSuccess) status = ncclSystemError;
       }
+      // Also unmap if the other ranks could not be waited for, the object is not usable
+      if (status != ncclSuccess || res != ncclSuccess) SYSCHECK(munmap(m_shmPtr, m_shmSize), "munmap");
     }
-    else
-    {
-      char msg_text[1];
-      ncclResult_t res;
-      NCCLCHECKGOTO(MsgQueueRecv(mq_desc, &msg_text[0], sizeof(msg_text)), res, dropback);
-
-      if (msg_text[0] == 'P')
-      {
-        NCCLCHECK(shmSetup(m_shmName.c_str(), m_shmSize, &shmFd, (void**)&m_shmPtr, 0));
-        NCCLCHECKGOTO(MsgQueueRecv(mq_desc, &msg_text[0], sizeof(msg_text)), res, dropback);
-        NCCLCHECK(MsgQueueClose(m_shmName, mq_desc, false));
-      }
-      else
-      {
-        NCCLCHECK(MsgQueueClose(m_shmName, mq_desc, false));
-        WARN("Call to shm_open from non-root rank in ShmObject failed : %s", strerror(errno));
-        return ncclSystemError;
-      }
-    }
-    m_alloc = true;
+    if (status != ncclSuccess) return status;
+    if (res != ncclSuccess) return res;
   }
   else
   {
-    WARN("Cannot allocate ShmObject twice.\n");
-    return ncclInvalidUsage;
+    ncclResult_t status;
+    ncclResult_t res = ShmRendezvousWaitPublished(rdv, &status);
+    if (res != ncclSuccess)
+    {
+      WARN("Rank %d failed ShmObject::Open().  Closing rendezvous.", m_rank);
+      NCCLCHECK(ShmRendezvousClose(m_shmName, rdv, true));
+      return res;
+    }
+    if (status == ncclSuccess)
+    {
+      res = shmSetup(m_shmName.c_str(), m_shmSize, &shmFd, (void**)&m_shmPtr, 0);
+    }
+    else
+    {
+      WARN("Root rank failed to create shared memory in ShmObject");
+      res = ncclSystemError;
+    }
+    // Acknowledge even on failure so that the root does not wait for this rank
+    NCCLCHECK(ShmRendezvousAck(rdv, m_numRanks - 1));
+    NCCLCHECK(ShmRendezvousClose(m_shmName, rdv, false));
+    if (res != ncclSuccess) return res;
   }
+  m_alloc = true;
   return ncclSuccess;
-
-dropback:
-  WARN("Rank %d failed ShmObject::Open().  Closing message queue.", m_rank);
-  NCCLCHECK(MsgQueueClose(m_shmName, mq_desc, false));
-  SYSCHECK(shm_unlink(m_shmName.c_str()), "shm_unlink");
-  NCCLCHECK(Close());
-  return ncclSystemError;
 }
 
 template<typename T>
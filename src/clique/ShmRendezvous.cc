@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "ShmRendezvous.h"
+#include "CpuBarrier.h"
+#include "shm.h"
+
+#define SHM_RENDEZVOUS_SPIN 1000
+#define SHM_RENDEZVOUS_TIMEOUT 60
+
+// Both counters follow the CpuBarrier protocol
+struct shmRendezvous
+{
+  int32_t published;  // Generation, set to 1 once the root has created the object (or failed to)
+  int32_t status;     // Outcome of the root
+  int32_t acked;      // Number of non-root ranks done with the object
+};
+
+static std::string ShmRendezvousName(std::string const& name)
+{
+  return name + "Rdv";
+}
+
+ncclResult_t ShmRendezvousOpen(std::string const& name, struct shmRendezvous** rdv)
+{
+  // Any rank may be first to create the control object. New memory reads as zero and
+  // posix_fallocate does not touch existing data, so no rank has to initialize it.
+  std::string rdvName = ShmRendezvousName(name);
+  int fd;
+  void* ptr;
+  SYSCHECKVAL(shm_open(rdvName.c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR), "shm_open", fd);
+  if (shm_allocate(fd, sizeof(struct shmRendezvous)) == -1 || shm_map(fd, sizeof(struct shmRendezvous), &ptr) == -1)
+  {
+    WARN("Unable to map rendezvous object %s : %s", rdvName.c_str(), strerror(errno));
+    close(fd);
+    return ncclSystemError;
+  }
+  close(fd);
+  *rdv = (struct shmRendezvous*)ptr;
+  return ncclSuccess;
+}
+
+ncclResult_t ShmRendezvousPublish(struct shmRendezvous* rdv, ncclResult_t status)
+{
+  __atomic_store_n(&rdv->status, (int32_t)status, __ATOMIC_SEQ_CST);
+  cpuBarrierArrive(&rdv->published, 1, NULL);
+  return ncclSuccess;
+}
+
+ncclResult_t ShmRendezvousWaitPublished(struct shmRendezvous* rdv, ncclResult_t* status)
+{
+  if (!cpuBarrierWait(&rdv->published, 1, SHM_RENDEZVOUS_SPIN, SHM_RENDEZVOUS_TIMEOUT * 1000000LL))
+  {
+    WARN("Shared memory rendezvous timed out waiting for the root rank");
+    return ncclSystemError;
+  }
+  *status = (ncclResult_t)__atomic_load_n(&rdv->status, __ATOMIC_SEQ_CST);
+  return ncclSuccess;
+}
+
+ncclResult_t ShmRendezvousAck(struct shmRendezvous* rdv, int numAcks)
+{
+  cpuBarrierArrive(&rdv->acked, numAcks, NULL);
+  return ncclSuccess;
+}
+
+ncclResult_t ShmRendezvousWaitAcks(struct shmRendezvous* rdv, int numAcks)
+{
+  if (!cpuBarrierWait(&rdv->acked, numAcks, SHM_RENDEZVOUS_SPIN, SHM_RENDEZVOUS_TIMEOUT * 1000000LL))
+  {
+    WARN("Shared memory rendezvous timed out waiting for other ranks (%d out of %d done)",
+         CPU_BARRIER_COUNT(__atomic_load_n(&rdv->acked, __ATOMIC_SEQ_CST)), numAcks);
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
+
+ncclResult_t ShmRendezvousClose(std::string const& name, struct shmRendezvous* rdv, bool unlink)
+{
+  if (unlink)
+  {
+    NCCLCHECK(ShmRendezvousUnlink(name));
+  }
+  SYSCHECK(munmap(rdv, sizeof(struct shmRendezvous)), "munmap");
+  return ncclSuccess;
+}
+
+ncclResult_t ShmRendezvousUnlink(std::string const& name)
+{
+  std::string rdvName = ShmRendezvousName(name);
+  if (shm_unlink(rdvName.c_str()) == -1 && errno != ENOENT)
+  {
+    WARN("Call to shm_unlink for %s failed : %s", rdvName.c_str(), strerror(errno));
+    return ncclSystemError;
+  }
+  return ncclSuccess;
+}
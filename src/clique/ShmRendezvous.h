@@ -1,5 +1,5 @@
 /*
-Copyright (c) 2020 Advanced Micro Devices, Inc. All rights reserved.
+Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
 
 Permission is hereby granted, free of charge, to any person obtaining a copy
 of this software and associated documentation files (the "Software"), to deal
@@ -20,20 +20,26 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 THE SOFTWARE.
 */
 
-#ifndef RCCL_MSG_QUEUE_HPP_
-#define RCCL_MSG_QUEUE_HPP_
+#ifndef RCCL_SHM_RENDEZVOUS_H_
+#define RCCL_SHM_RENDEZVOUS_H_
 
 #include <string>
-#include <mqueue.h>
 
 #include "nccl.h"
 #include "core.h"
 
-ncclResult_t MsgQueueGetId(std::string const& name, bool exclusive, mqd_t& mq_desc);
-ncclResult_t MsgQueueSend(mqd_t const& mq_desc, const char* msgp, size_t msgsz);
-ncclResult_t MsgQueueRecv(mqd_t const& mq_desc, char* msgp, size_t msgsz);
-ncclResult_t MsgQueueWaitUntilEmpty(mqd_t const& mq_desc);
-ncclResult_t MsgQueueClose(std::string const& name, mqd_t& mq_desc, bool unlink);
-ncclResult_t MsgQueueUnlink(std::string const& name);
+// Rendezvous of the ranks opening a shared memory object, through a small control object
+// next to it. The root creates the object and publishes the outcome; the other ranks wait
+// for it, attach and acknowledge; the root waits for all acknowledgements before unlinking.
+// Every rank takes a constant number of steps, waiting with a futex rather than polling.
+struct shmRendezvous;
+
+ncclResult_t ShmRendezvousOpen(std::string const& name, struct shmRendezvous** rdv);
+ncclResult_t ShmRendezvousPublish(struct shmRendezvous* rdv, ncclResult_t status);
+ncclResult_t ShmRendezvousWaitPublished(struct shmRendezvous* rdv, ncclResult_t* status);
+ncclResult_t ShmRendezvousAck(struct shmRendezvous* rdv, int numAcks);
+ncclResult_t ShmRendezvousWaitAcks(struct shmRendezvous* rdv, int numAcks);
+ncclResult_t ShmRendezvousClose(std::string const& name, struct shmRendezvous* rdv, bool unlink);
+ncclResult_t ShmRendezvousUnlink(std::string const& name);
 
 #endif
@@ -9,6 +9,7 @@
 #include "nccl_net.h"
 #include <stdlib.h>
 #include <stdarg.h>
+#include <linux/futex.h>
 
 int ncclDebugLevel = -1;
 thread_local int ncclDebugNoWarn = 0;
@@ -16,6 +17,217 @@ uint64_t ncclDebugMask = NCCL_INIT; // Default debug sub-system mask is INIT
 FILE *ncclDebugFile = stdout;
 pthread_mutex_t ncclDebugLock = PTHREAD_MUTEX_INITIALIZER;
 
+/* Asynchronous logging (NCCL_DEBUG_ASYNC=1)
+ * Each logging thread formats its messages into binary records in its own ring,
+ * without taking any lock. A writer thread adds the hostname/pid/tid prefix and
+ * writes the records of all rings, flushing once per pass. Messages logged while
+ * the ring of the thread is full are dropped and counted. The writer wakes up every
+ * NCCL_DEBUG_ASYNC_INTERVAL us, or as soon as a ring is half full. WARN messages
+ * wait for the ring of the thread to be written.
+ */
+#define NCCL_DEBUG_MSG_SIZE 1024
+#define NCCL_DEBUG_WHERE_SIZE 128
+struct ncclDebugRecord {
+  int level;
+  int cudaDev;
+  double timestamp;                  // TRACE only
+  char where[NCCL_DEBUG_WHERE_SIZE]; // "file:line" for WARN/TRACE
+  char msg[NCCL_DEBUG_MSG_SIZE];
+};
+
+struct ncclDebugRing {
+  uint64_t head;       // Records written by the thread
+  uint64_t tail;       // Records written out by the writer
+  uint64_t dropped;    // Records dropped since the last time the writer looked
+  int tid;
+  int orphaned;        // Set when the thread exits, freed by the writer once empty
+  struct ncclDebugRing* next;
+  struct ncclDebugRecord records[1]; // Actually ncclDebugAsyncRecords
+};
+
+static int ncclDebugAsync = 0;
+static int ncclDebugAsyncRecords = 256;     // NCCL_DEBUG_ASYNC_RECORDS, per thread, power of 2
+static int ncclDebugAsyncIntervalUs = 1000; // NCCL_DEBUG_ASYNC_INTERVAL, writer sleep when idle
+static int ncclDebugAsyncStop = 0;
+static int ncclDebugAsyncWake = 0;          // Futex bumped when a ring gets half full
+static struct ncclDebugRing* ncclDebugRings = NULL; // Protected by ncclDebugLock
+static char ncclDebugHostname[1024];
+static int ncclDebugPid;
+
+struct ncclDebugRingHolder {
+  struct ncclDebugRing* ring;
+  int exited;
+  ~ncclDebugRingHolder() {
+    if (ring) __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+    ring = NULL;
+    exited = 1;
+  }
+};
+static thread_local struct ncclDebugRingHolder ncclDebugThreadRing;
+
+static int ncclDebugFormatPrefix(char* buffer, size_t size, int level, int tid, int cudaDev, const char* where, double timestamp) {
+  int len = 0;
+  if (level == NCCL_LOG_WARN)
+    len = snprintf(buffer, size,
+        "\n%s:%d:%d [%d] %s NCCL WARN ", ncclDebugHostname, ncclDebugPid, tid, cudaDev, where);
+  else if (level == NCCL_LOG_INFO)
+    len = snprintf(buffer, size,
+        "%s:%d:%d [%d] NCCL INFO ", ncclDebugHostname, ncclDebugPid, tid, cudaDev);
+  else if (level == NCCL_LOG_TRACE)
+    len = snprintf(buffer, size,
+        "%s:%d:%d [%d] %f %s NCCL TRACE ", ncclDebugHostname, ncclDebugPid, tid, cudaDev, timestamp, where);
+  return len;
+}
+
+// Write out all records, called with ncclDebugLock held. Returns the number of records written.
+static int ncclDebugAsyncDrain() {
+  int count = 0;
+  char prefix[NCCL_DEBUG_WHERE_SIZE+1024+64];
+  struct ncclDebugRing** prev = &ncclDebugRings;
+  while (*prev) {
+    struct ncclDebugRing* ring = *prev;
+    // Read orphaned first, so that no record can follow once it is set
+    int orphaned = __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    for (uint64_t t = ring->tail; t < head; t++) {
+      struct ncclDebugRecord* rec = ring->records + (t & (ncclDebugAsyncRecords-1));
+      ncclDebugFormatPrefix(prefix, sizeof(prefix), rec->level, ring->tid, rec->cudaDev, rec->where, rec->timestamp);
+      fprintf(ncclDebugFile, "%s%s\n", prefix, rec->msg);
+      count++;
+    }
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+    uint64_t dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped) {
+      ncclDebugFormatPrefix(prefix, sizeof(prefix), NCCL_LOG_INFO, ring->tid, -1, "", 0);
+      fprintf(ncclDebugFile, "%sDropped %lu log messages, increase NCCL_DEBUG_ASYNC_RECORDS\n", prefix, dropped);
+      count++;
+    }
+    if (orphaned) {
+      *prev = ring->next;
+      free(ring);
+    } else {
+      prev = &ring->next;
+    }
+  }
+  if (count) fflush(ncclDebugFile);
+  return count;
+}
+
+static void* ncclDebugAsyncWriter(void*) {
+  while (__atomic_load_n(&ncclDebugAsyncStop, __ATOMIC_RELAXED) == 0) {
+    pthread_mutex_lock(&ncclDebugLock);
+    int count = ncclDebugAsyncDrain();
+    pthread_mutex_unlock(&ncclDebugLock);
+    if (count == 0) {
+      int wake = __atomic_load_n(&ncclDebugAsyncWake, __ATOMIC_ACQUIRE);
+      struct timespec timeout = { ncclDebugAsyncIntervalUs / 1000000, (ncclDebugAsyncIntervalUs % 1000000) * 1000 };
+      syscall(SYS_futex, &ncclDebugAsyncWake, FUTEX_WAIT_PRIVATE, wake, &timeout, NULL, 0);
+    }
+  }
+  return NULL;
+}
+
+static void ncclDebugAsyncExit() {
+  // Messages logged from now on are written synchronously
+  __atomic_store_n(&ncclDebugAsync, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&ncclDebugAsyncStop, 1, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&ncclDebugLock);
+  ncclDebugAsyncDrain();
+  pthread_mutex_unlock(&ncclDebugLock);
+}
+
+// Keep ncclDebugLock consistent across fork, the child does not have the writer thread
+static void ncclDebugAtForkPrepare() { pthread_mutex_lock(&ncclDebugLock); }
+static void ncclDebugAtForkParent() { pthread_mutex_unlock(&ncclDebugLock); }
+static void ncclDebugAtForkChild() {
+  ncclDebugAsync = 0;
+  ncclDebugPid = getpid();
+  pthread_mutex_unlock(&ncclDebugLock);
+}
+
+// Called with ncclDebugLock held
+static void ncclDebugAsyncInit() {
+  const char* str = getenv("NCCL_DEBUG_ASYNC_RECORDS");
+  if (str) {
+    int records = atoi(str);
+    if (records > 0) {
+      ncclDebugAsyncRecords = 1;
+      while (ncclDebugAsyncRecords < records) ncclDebugAsyncRecords <<= 1;
+    }
+  }
+  str = getenv("NCCL_DEBUG_ASYNC_INTERVAL");
+  if (str && atoi(str) > 0) ncclDebugAsyncIntervalUs = atoi(str);
+  getHostName(ncclDebugHostname, sizeof(ncclDebugHostname), '.');
+  ncclDebugPid = getpid();
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, ncclDebugAsyncWriter, NULL) != 0) return;
+  pthread_detach(thread);
+  atexit(ncclDebugAsyncExit);
+  pthread_atfork(ncclDebugAtForkPrepare, ncclDebugAtForkParent, ncclDebugAtForkChild);
+  __atomic_store_n(&ncclDebugAsync, 1, __ATOMIC_RELEASE);
+}
+
+static struct ncclDebugRing* ncclDebugGetRing() {
+  struct ncclDebugRingHolder* holder = &ncclDebugThreadRing;
+  if (holder->ring || holder->exited) return holder->ring;
+  struct ncclDebugRing* ring = (struct ncclDebugRing*)calloc(1, sizeof(struct ncclDebugRing) + (ncclDebugAsyncRecords-1)*sizeof(struct ncclDebugRecord));
+  if (ring == NULL) return NULL;
+  ring->tid = syscall(SYS_gettid);
+  pthread_mutex_lock(&ncclDebugLock);
+  ring->next = ncclDebugRings;
+  ncclDebugRings = ring;
+  pthread_mutex_unlock(&ncclDebugLock);
+  holder->ring = ring;
+  return ring;
+}
+
+// Returns false if the message needs to be logged synchronously
+static bool ncclDebugAsyncLog(ncclDebugLogLevel level, const char *filefunc, int line, const char *fmt, va_list vargs) {
+  if (level != NCCL_LOG_WARN && level != NCCL_LOG_INFO && level != NCCL_LOG_TRACE) return false;
+  struct ncclDebugRing* ring = ncclDebugGetRing();
+  if (ring == NULL) return false;
+  uint64_t head = ring->head;
+  if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == (uint64_t)ncclDebugAsyncRecords) {
+    if (level == NCCL_LOG_WARN) {
+      // Never drop warnings. Write out the older records first to keep the order.
+      pthread_mutex_lock(&ncclDebugLock);
+      ncclDebugAsyncDrain();
+      pthread_mutex_unlock(&ncclDebugLock);
+      return false;
+    }
+    __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return true;
+  }
+  struct ncclDebugRecord* rec = ring->records + (head & (ncclDebugAsyncRecords-1));
+  rec->level = level;
+  hipGetDevice(&rec->cudaDev);
+  rec->where[0] = '\0';
+  if (level != NCCL_LOG_INFO) snprintf(rec->where, sizeof(rec->where), "%s:%d", filefunc, line);
+#ifdef ENABLE_TRACE
+  if (level == NCCL_LOG_TRACE) {
+    auto delta = std::chrono::high_resolution_clock::now() - ncclEpoch;
+    rec->timestamp = std::chrono::duration_cast<std::chrono::duration<double>>(delta).count()*1000;
+  }
+#endif
+  (void) vsnprintf(rec->msg, sizeof(rec->msg), fmt, vargs);
+  __atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+  if (head+1 - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == (uint64_t)ncclDebugAsyncRecords/2) {
+    __atomic_fetch_add(&ncclDebugAsyncWake, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &ncclDebugAsyncWake, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+
+  // Make sure warnings are out before going on, e.g. to abort
+  if (level == NCCL_LOG_WARN) {
+    while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) <= head) {
+      pthread_mutex_lock(&ncclDebugLock);
+      ncclDebugAsyncDrain();
+      pthread_mutex_unlock(&ncclDebugLock);
+    }
+  }
+  return true;
+}
+
 void ncclDebugInit() {
   pthread_mutex_lock(&ncclDebugLock);
   if (ncclDebugLevel != -1) { pthread_mutex_unlock(&ncclDebugLock); return; }
@@ -120,6 +332,8 @@ void ncclDebugInit() {
 #ifdef ENABLE_TRACE
   ncclEpoch = std::chrono::high_resolution_clock::now();
 #endif
+  const char* ncclDebugAsyncEnv = getenv("NCCL_DEBUG_ASYNC");
+  if (ncclDebugLevel >= NCCL_LOG_INFO && ncclDebugAsyncEnv != NULL && atoi(ncclDebugAsyncEnv) == 1) ncclDebugAsyncInit();
   pthread_mutex_unlock(&ncclDebugLock);
 }
 
@@ -132,6 +346,14 @@ void ncclDebugLog(ncclDebugLogLevel level, unsigned long flags, const char *file
   if (ncclDebugNoWarn != 0 && level == NCCL_LOG_WARN) { level = NCCL_LOG_INFO; flags = ncclDebugNoWarn; }
   if (ncclDebugLevel < level || ((flags & ncclDebugMask) == 0)) return;
 
+  if (__atomic_load_n(&ncclDebugAsync, __ATOMIC_ACQUIRE)) {
+    va_list vargs;
+    va_start(vargs, fmt);
+    bool done = ncclDebugAsyncLog(level, filefunc, line, fmt, vargs);
+    va_end(vargs);
+    if (done) return;
+  }
+
   // Gather the rank information. This can take > 1us so we want to make sure
   // we only do it when needed.
   char hostname[1024];
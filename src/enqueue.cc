@@ -361,40 +361,49 @@ static inline ncclResult_t getCollNetSupport(struct ncclInfo* info, int* collNet
 
 static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps) {
   struct ncclComm* comm = info->comm;
+  int tuned = 0;
+  // Precomputed decision for operations which are not aggregated and cannot use CollNet
+  struct ncclAlgoSegment* segment = NULL;
   if (comm->nRanks == 1 || info->coll == ncclFuncAllToAllPivot) {
     info->algorithm = NCCL_ALGO_RING;
     info->protocol = NCCL_PROTO_SIMPLE;
   }
   else {
-    float minTime = 3600000000.0; // Hopefully no operation will take an hour to complete.
-    // Find algorithm / protocol.
-    info->algorithm = -1;
-    info->protocol = -1;
-    int nAlgos = NCCL_NUM_ALGORITHMS;
-    for (int a=0; a<nAlgos; a++) {
-      if (a == NCCL_ALGO_COLLNET && collNetTypeSupport != 1) continue;
-      for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
-        float time;
-        NCCLCHECK(ncclTopoGetAlgoTime(info, a, p, numPipeOps, &time));
-        if (time >= 0 && time < minTime) {
-          info->algorithm = a;
-          info->protocol = p;
-          minTime = time;
-        }
+    if (comm->algoTable && numPipeOps == 1 && info->nChannels == 0 && collNetTypeSupport != 1) {
+      segment = ncclTopoLookupAlgo(comm->algoTable, info->coll, info->nBytes);
+    }
+    if (segment) {
+      info->algorithm = segment->algorithm;
+      info->protocol = segment->protocol;
+    } else {
+      float minTime;
+      // Find algorithm / protocol.
+      NCCLCHECK(ncclTopoGetBestAlgo(info, collNetTypeSupport, numPipeOps, &info->algorithm, &info->protocol, &minTime));
+      if (info->algorithm == -1 || info->protocol == -1) {
+        WARN("Error : no algorithm/protocol available");
+        return ncclInternalError;
       }
+      //if (comm->rank == 0) INFO(NCCL_TUNING, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
+      TRACE(NCCL_COLL, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
     }
-    if (info->algorithm == -1 || info->protocol == -1) {
-      WARN("Error : no algorithm/protocol available");
-      return ncclInternalError;
+    // Operations which are not aggregated can be tuned online
+    if (comm->autoTuner && numPipeOps == 1 && info->nChannels == 0) {
+      NCCLCHECK(ncclAutoTuneGetAlgo(comm->autoTuner, info, collNetTypeSupport, &tuned));
+      if (tuned) {
+        TRACE(NCCL_COLL, "%ld Bytes -> Autotuned algo %d proto %d", info->nBytes, info->algorithm, info->protocol);
+        segment = NULL;
+      }
     }
-    //if (comm->rank == 0) INFO(NCCL_TUNING, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
-    TRACE(NCCL_COLL, "%ld Bytes -> Algo %d proto %d time %f", info->nBytes, info->algorithm, info->protocol, minTime);
   }
 
   int nc = (info->nChannels > 0) ? info->nChannels : comm->nChannels;
   int nt = comm->maxThreads[info->algorithm][info->protocol];
   int threadThreshold = comm->threadThresholds[info->algorithm][info->protocol];
-  if (info->algorithm == NCCL_ALGO_COLLNET) {
+  if (segment) {
+    // Same number of channels as the loop below
+    nt = segment->nThreads;
+    if ((ssize_t)info->nBytes < nc*segment->channelBytes) nc = std::max<ssize_t>(1, info->nBytes/segment->channelBytes);
+  } else if (info->algorithm == NCCL_ALGO_COLLNET) {
     int ncSwitch = 16;
     bool flag = true;
     while (ncSwitch >= 1 && flag) {
@@ -426,7 +435,7 @@ static ncclResult_t getAlgoInfo(struct ncclInfo* info, int collNetTypeSupport, i
   if (info->coll == ncclFuncAllToAllPivot) {
     int pivotA2ANumUniRings = comm->topo->pivotA2ANumBiRings * 2;
     info->nChannels = comm->nChannels / pivotA2ANumUniRings * pivotA2ANumUniRings;
-  } else if (comm->topo->nodes[GPU].nodes[0].gpu.gcn == 910 && comm->nChannels == 32 && comm->nRanks/comm->nNodes == 16 && info->nBytes >= 268435456
+  } else if (!tuned && comm->topo->nodes[GPU].nodes[0].gpu.gcn == 910 && comm->nChannels == 32 && comm->nRanks/comm->nNodes == 16 && info->nBytes >= 268435456
     && ((comm->nNodes > 2 && info->nBytes <= 2147483648) || (comm->nNodes == 2 && info->nBytes <= 1073741824))) {
     static int userTuneInput = -2;
     if (userTuneInput == -2) {
@@ -1328,8 +1337,14 @@ ncclResult_t ncclEnqueueCheck(struct ncclInfo* info) {
     ncclComm_t comm = info->comm;
     NCCLCHECKGOTO(ncclGetCudaGraph(comm, &graph), ret, end);
 
+    // Blocking launches are issued in the same order on all ranks, they can be timed
+    // to tune the algorithm online. Timing captured launches would be meaningless.
+    if (comm->autoTuner) comm->autoTuner->explore = !comm->usingCudaGraph;
+
     // Common part between graph mode and non-graph mode
-    NCCLCHECKGOTO(ncclSetupCollKernel(info), ret, end);
+    ret = ncclSetupCollKernel(info);
+    if (comm->autoTuner) comm->autoTuner->explore = 0;
+    NCCLCHECKGOTO(ret, ret, end);
 
     // Host setup
     if (comm->usingCudaGraph) {
@@ -1339,10 +1354,14 @@ ncclResult_t ncclEnqueueCheck(struct ncclInfo* info) {
       NCCLCHECKGOTO(comm->enqueueInfo->ret, ret, end);
     }
 
+    // The kernel stream waits for the user stream, time the launch on the user stream
+    if (comm->autoTuner) NCCLCHECKGOTO(ncclAutoTuneStart(comm->autoTuner, comm->userStream), ret, end);
+
     // Common part between graph mode and non-graph mode
     NCCLCHECKGOTO(ncclLaunchBarrier(comm), ret, end);
     NCCLCHECKGOTO(ncclLaunchKernel(comm), ret, end);
     NCCLCHECKGOTO(ncclRecordEvents(comm), ret, end);
+    if (comm->autoTuner) NCCLCHECKGOTO(ncclAutoTuneStop(comm->autoTuner, comm->userStream), ret, end);
     NCCLCHECKGOTO(ncclLaunchReset(comm), ret, end);
   }
 end:
@@ -0,0 +1,230 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#include "core.h"
+#include "devcomm.h"
+#include "comm.h"
+#include "graph.h"
+#include <float.h>
+
+// Each (collective, datatype, size bucket) starts with the static choice of the model
+// followed by the next best algorithm/protocol combinations of the model. Blocking
+// calls, issued in the same order on all ranks, cycle through the candidates and are
+// timed, nSamples times each. The next call gathers the times of all ranks and the
+// fastest candidate is used from then on, by all ranks.
+struct ncclAutoTuneEntry {
+  int nCandidates;
+  int algorithm[NCCL_AUTOTUNE_MAX_CANDIDATES];
+  int protocol[NCCL_AUTOTUNE_MAX_CANDIDATES];
+  float modelTime[NCCL_AUTOTUNE_MAX_CANDIDATES];
+  size_t nBytes;    // Size of the first call, used for the export
+  int calls;        // Exploration calls so far
+  void* samples[NCCL_AUTOTUNE_MAX_CANDIDATES][NCCL_AUTOTUNE_MAX_SAMPLES];
+  float time[NCCL_AUTOTUNE_MAX_CANDIDATES];  // Measured time agreed by all ranks, FLT_MAX if none
+  int decision;     // Candidate used, -1 while exploring
+};
+
+static const char* autoTuneTypeStr[ncclNumTypes] = { "int8", "uint8", "int32", "uint32", "int64", "uint64", "half", "float", "double", "bfloat16" };
+
+ncclResult_t ncclAutoTuneCreate(struct ncclComm* comm, struct ncclAutoTuneOps* ops, int nCandidates, int nSamples, struct ncclAutoTuner** tuner) {
+  struct ncclAutoTuner* t;
+  NCCLCHECK(ncclCalloc(&t, 1));
+  t->ops = *ops;
+  t->rank = comm->rank;
+  t->nRanks = comm->nRanks;
+  t->nCandidates = std::min(std::max(nCandidates, 1), NCCL_AUTOTUNE_MAX_CANDIDATES);
+  t->nSamples = std::min(std::max(nSamples, 1), NCCL_AUTOTUNE_MAX_SAMPLES);
+  if (comm->rank == 0) INFO(NCCL_INIT|NCCL_TUNING, "Autotuning %d candidates with %d samples each", t->nCandidates, t->nSamples);
+  *tuner = t;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclAutoTuneDestroy(struct ncclAutoTuner* tuner) {
+  if (tuner == NULL) return ncclSuccess;
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) for (int d=0; d<ncclNumTypes; d++) for (int b=0; b<NCCL_TUNING_BUCKETS; b++) {
+    struct ncclAutoTuneEntry* e = tuner->entries[c][d][b];
+    if (e == NULL) continue;
+    for (int k=0; k<e->nCandidates; k++) {
+      for (int s=0; s<tuner->nSamples; s++) {
+        if (e->samples[k][s]) NCCLCHECK(tuner->ops.release(tuner->ops.ctx, e->samples[k][s]));
+      }
+    }
+    free(e);
+  }
+  free(tuner);
+  return ncclSuccess;
+}
+
+static ncclResult_t autoTuneNewEntry(struct ncclAutoTuner* tuner, struct ncclInfo* info, int collNetTypeSupport, struct ncclAutoTuneEntry** entry) {
+  struct ncclAutoTuneEntry* e;
+  NCCLCHECK(ncclCalloc(&e, 1));
+  e->nBytes = info->nBytes;
+  e->decision = -1;
+  // Static choice first, then the others sorted by model time
+  e->algorithm[0] = info->algorithm;
+  e->protocol[0] = info->protocol;
+  NCCLCHECK(ncclTopoGetAlgoTime(info, info->algorithm, info->protocol, 1, e->modelTime));
+  e->nCandidates = 1;
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+    if (a == NCCL_ALGO_COLLNET && collNetTypeSupport != 1) continue;
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      if (a == info->algorithm && p == info->protocol) continue;
+      float time;
+      NCCLCHECK(ncclTopoGetAlgoTime(info, a, p, 1, &time));
+      if (time < 0) continue;
+      int k = e->nCandidates;
+      while (k > 1 && e->modelTime[k-1] > time) k--;
+      if (k == tuner->nCandidates) continue;
+      int n = std::min(e->nCandidates, tuner->nCandidates-1);
+      for (int i=n; i>k; i--) {
+        e->algorithm[i] = e->algorithm[i-1];
+        e->protocol[i] = e->protocol[i-1];
+        e->modelTime[i] = e->modelTime[i-1];
+      }
+      e->algorithm[k] = a;
+      e->protocol[k] = p;
+      e->modelTime[k] = time;
+      e->nCandidates = n+1;
+    }
+  }
+  for (int k=0; k<NCCL_AUTOTUNE_MAX_CANDIDATES; k++) e->time[k] = FLT_MAX;
+  // Nothing to explore
+  if (e->nCandidates == 1) e->decision = 0;
+  *entry = e;
+  return ncclSuccess;
+}
+
+static ncclResult_t autoTuneDecide(struct ncclAutoTuner* tuner, struct ncclInfo* info, struct ncclAutoTuneEntry* e) {
+  ncclResult_t ret = ncclSuccess;
+  int n = e->nCandidates;
+  float* times;
+  NCCLCHECK(ncclCalloc(&times, tuner->nRanks*n));
+  float* local = times+tuner->rank*n;
+  for (int k=0; k<n; k++) {
+    local[k] = FLT_MAX;
+    for (int s=0; s<tuner->nSamples; s++) {
+      void* sample = e->samples[k][s];
+      if (sample == NULL) continue;
+      e->samples[k][s] = NULL;
+      float us;
+      NCCLCHECKGOTO(tuner->ops.elapsed(tuner->ops.ctx, sample, &us), ret, end);
+      // Keep the best sample, the first ones are warming up
+      if (us >= 0) local[k] = std::min(local[k], us);
+    }
+  }
+  NCCLCHECKGOTO(tuner->ops.allGather(tuner->ops.ctx, times, n), ret, end);
+
+  // Ranks waiting for the others measure longer times, so average all ranks. All ranks
+  // sum the same values in the same order and reach the same decision.
+  e->decision = 0;
+  for (int k=0; k<n; k++) {
+    float sum = 0;
+    for (int r=0; r<tuner->nRanks; r++) {
+      if (times[r*n+k] == FLT_MAX) { sum = FLT_MAX; break; }
+      sum += times[r*n+k];
+    }
+    e->time[k] = sum == FLT_MAX ? FLT_MAX : sum / tuner->nRanks;
+    if (e->time[k] < e->time[e->decision]) e->decision = k;
+  }
+  if (tuner->rank == 0) {
+    int d = e->decision;
+    INFO(NCCL_TUNING, "Autotuned %s %s %ld bytes : %s/%s %.1f us (model %.1f us), static %s/%s %.1f us (model %.1f us)",
+        ncclFuncStr[info->coll], autoTuneTypeStr[info->datatype], e->nBytes,
+        ncclAlgoStr[e->algorithm[d]], ncclProtoStr[e->protocol[d]], e->time[d], e->modelTime[d],
+        ncclAlgoStr[e->algorithm[0]], ncclProtoStr[e->protocol[0]], e->time[0], e->modelTime[0]);
+  }
+end:
+  free(times);
+  return ret;
+}
+
+ncclResult_t ncclAutoTuneGetAlgo(struct ncclAutoTuner* tuner, struct ncclInfo* info, int collNetTypeSupport, int* tuned) {
+  int explore = tuner->explore;
+  tuner->explore = 0;
+  tuner->sampleEntry = NULL;
+  *tuned = 0;
+  if (info->nBytes == 0) return ncclSuccess;
+
+  int bucket = std::min((int)log2i(info->nBytes>>6), NCCL_TUNING_BUCKETS-1);
+  struct ncclAutoTuneEntry** slot = &tuner->entries[info->coll][info->datatype][bucket];
+  // Only calls which can be timed change the state, so that it stays the same on all ranks
+  if (*slot == NULL) {
+    if (!explore) return ncclSuccess;
+    NCCLCHECK(autoTuneNewEntry(tuner, info, collNetTypeSupport, slot));
+  }
+  struct ncclAutoTuneEntry* e = *slot;
+
+  int k = e->decision;
+  if (k == -1) {
+    if (!explore) return ncclSuccess;
+    if (e->calls == e->nCandidates*tuner->nSamples) {
+      NCCLCHECK(autoTuneDecide(tuner, info, e));
+      k = e->decision;
+    } else {
+      k = e->calls % e->nCandidates;
+      tuner->sampleEntry = e;
+      tuner->sampleCandidate = k;
+      tuner->sampleIndex = e->calls / e->nCandidates;
+      e->calls++;
+    }
+  }
+  // CollNet support depends on the reduction operation, which is not part of the key
+  if (e->algorithm[k] == NCCL_ALGO_COLLNET && collNetTypeSupport != 1) {
+    tuner->sampleEntry = NULL;
+    return ncclSuccess;
+  }
+  // Candidate 0 is the static choice, leave it unchanged
+  if (k == 0) return ncclSuccess;
+  info->algorithm = e->algorithm[k];
+  info->protocol = e->protocol[k];
+  *tuned = 1;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclAutoTuneStart(struct ncclAutoTuner* tuner, hipStream_t stream) {
+  struct ncclAutoTuneEntry* e = tuner->sampleEntry;
+  if (e == NULL) return ncclSuccess;
+  NCCLCHECK(tuner->ops.start(tuner->ops.ctx, stream, &e->samples[tuner->sampleCandidate][tuner->sampleIndex]));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclAutoTuneStop(struct ncclAutoTuner* tuner, hipStream_t stream) {
+  struct ncclAutoTuneEntry* e = tuner->sampleEntry;
+  if (e == NULL) return ncclSuccess;
+  tuner->sampleEntry = NULL;
+  void* sample = e->samples[tuner->sampleCandidate][tuner->sampleIndex];
+  if (sample) NCCLCHECK(tuner->ops.stop(tuner->ops.ctx, stream, sample));
+  return ncclSuccess;
+}
+
+// Measured times are written with a zero latency, so that the tuning table gives back the
+// measured time for the size which was tuned.
+ncclResult_t ncclAutoTuneExport(struct ncclAutoTuner* tuner, struct ncclComm* comm, const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) {
+    WARN("Could not open autotuning file %s : %s", path, strerror(errno));
+    return ncclSuccess;
+  }
+  char ppn[16];
+  if (comm->nRanks % comm->nNodes == 0) sprintf(ppn, "%d", comm->nRanks/comm->nNodes);
+  else sprintf(ppn, "*");
+  fprintf(file, "# RCCL autotuner measures, %d ranks on %d nodes\n", comm->nRanks, comm->nNodes);
+  fprintf(file, "# %-13s %-7s %-6s %6s %4s %10s %10s %10s\n", "coll", "algo", "proto", "nNodes", "ppn", "bytes", "lat(us)", "bw(GB/s)");
+  int nEntries = 0;
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) for (int d=0; d<ncclNumTypes; d++) for (int b=0; b<NCCL_TUNING_BUCKETS; b++) {
+    struct ncclAutoTuneEntry* e = tuner->entries[c][d][b];
+    if (e == NULL || e->decision == -1) continue;
+    for (int k=0; k<e->nCandidates; k++) {
+      if (e->time[k] == FLT_MAX || e->time[k] <= 0) continue;
+      fprintf(file, "%-15s %-7s %-6s %6d %4s %10ld %10.3f %10.6g # %s%s\n", ncclFuncStr[c], ncclAlgoStr[e->algorithm[k]], ncclProtoStr[e->protocol[k]],
+          comm->nNodes, ppn, e->nBytes, 0.0, e->nBytes / (1000.0 * e->time[k]), autoTuneTypeStr[d], k == e->decision ? " chosen" : "");
+      nEntries++;
+    }
+  }
+  fclose(file);
+  INFO(NCCL_TUNING, "Wrote %d autotuning entries to %s", nEntries, path);
+  return ncclSuccess;
+}
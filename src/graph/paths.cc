@@ -14,96 +14,248 @@
 
 // Pre-compute GPU->NIC, GPU->GPU and NIC->GPU paths
 
-struct ncclTopoNodeList {
-  struct ncclTopoNode* list[NCCL_TOPO_MAX_NODES];
+// Hops of all paths live in a pool of chunks owned by the system, so that each
+// path only takes as many pointers as it has hops.
+#define NCCL_TOPO_HOP_CHUNK 16384
+struct ncclTopoHopPool {
+  struct ncclTopoHopPool* next;
+  int used;
+  int size;
+  struct ncclTopoLink* hops[1];
+};
+
+static ncclResult_t ncclTopoAllocHops(struct ncclTopoSystem* system, int count, struct ncclTopoLink*** hops) {
+  struct ncclTopoHopPool* pool = system->hopPool;
+  if (pool == NULL || pool->used + count > pool->size) {
+    int size = std::max(count, NCCL_TOPO_HOP_CHUNK);
+    size_t bytes = sizeof(struct ncclTopoHopPool) + (size-1)*sizeof(struct ncclTopoLink*);
+    pool = (struct ncclTopoHopPool*)malloc(bytes);
+    if (pool == NULL) {
+      WARN("Failed to malloc %ld bytes", bytes);
+      return ncclSystemError;
+    }
+    pool->next = system->hopPool;
+    pool->used = 0;
+    pool->size = size;
+    system->hopPool = pool;
+  }
+  *hops = pool->hops+pool->used;
+  pool->used += count;
+  return ncclSuccess;
+}
+
+// Compact view of the system used by the BFS. Nodes are numbered type by type,
+// and the links of each node are stored contiguously with their reverse link.
+struct ncclTopoAdjEdge {
+  int remIndex;
+  int type;                      // Path type of that hop
+  struct ncclTopoLink* link;
+  struct ncclTopoLink* revLink;  // Link from the remote node back to us
+};
+
+// Paths are built as records pointing to the record of the next node towards
+// the base node, instead of copying the hops at each step. Records are never
+// modified, so a path keeps the hops it had when it was set.
+struct ncclTopoPathRecord {
+  struct ncclTopoLink* link;
+  int next;
   int count;
+  float width;
+  int type;
 };
 
-static ncclResult_t getPath(struct ncclTopoSystem* system, struct ncclTopoNode* node, int t, int64_t id, struct ncclTopoLinkList** path) {
-  for (int i=0; i<system->nodes[t].count; i++) {
-    if (system->nodes[t].nodes[i].id == id) {
-      *path = node->paths[t]+i;
-      return ncclSuccess;
+struct ncclTopoPathSearch {
+  int nNodes;
+  int offset[NCCL_TOPO_NODE_TYPES+1];
+  struct ncclTopoNode** nodes;
+  int* edgeStart;
+  struct ncclTopoAdjEdge* edges;
+  // BFS state, reused for every base node
+  struct ncclTopoPathRecord* records;
+  int nRecords, maxRecords;
+  int* current;                  // Current record of each node, -1 if none
+  uint64_t* touched;             // Nodes seen as neighbors, they get a path array
+  uint64_t* queued;              // Nodes already in the next list
+  int* nodeList;
+  int* nextNodeList;
+};
+
+static void ncclTopoPathSearchFree(struct ncclTopoPathSearch* ps) {
+  free(ps->nodes);
+  free(ps->edgeStart);
+  free(ps->edges);
+  free(ps->records);
+  free(ps->current);
+  free(ps->touched);
+  free(ps->queued);
+  free(ps->nodeList);
+  free(ps->nextNodeList);
+}
+
+static int ncclTopoPathIndex(struct ncclTopoPathSearch* ps, struct ncclTopoSystem* system, struct ncclTopoNode* node) {
+  return ps->offset[node->type] + (node - system->nodes[node->type].nodes);
+}
+
+static ncclResult_t ncclTopoPathSearchInit(struct ncclTopoSystem* system, struct ncclTopoPathSearch* ps) {
+  memset(ps, 0, sizeof(struct ncclTopoPathSearch));
+  int nEdges = 0;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    ps->offset[t] = ps->nNodes;
+    ps->nNodes += system->nodes[t].count;
+    for (int n=0; n<system->nodes[t].count; n++) nEdges += system->nodes[t].nodes[n].nlinks;
+  }
+  ps->offset[NCCL_TOPO_NODE_TYPES] = ps->nNodes;
+  int nWords = DIVUP(ps->nNodes, 64);
+  NCCLCHECK(ncclCalloc(&ps->nodes, ps->nNodes));
+  NCCLCHECK(ncclCalloc(&ps->edgeStart, ps->nNodes+1));
+  NCCLCHECK(ncclCalloc(&ps->edges, std::max(nEdges, 1)));
+  NCCLCHECK(ncclCalloc(&ps->current, ps->nNodes));
+  NCCLCHECK(ncclCalloc(&ps->touched, nWords));
+  NCCLCHECK(ncclCalloc(&ps->queued, nWords));
+  NCCLCHECK(ncclCalloc(&ps->nodeList, ps->nNodes));
+  NCCLCHECK(ncclCalloc(&ps->nextNodeList, ps->nNodes));
+  ps->maxRecords = 4*ps->nNodes;
+  NCCLCHECK(ncclCalloc(&ps->records, ps->maxRecords));
+
+  int e = 0;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoNode* node = system->nodes[t].nodes+n;
+      int i = ps->offset[t]+n;
+      ps->nodes[i] = node;
+      ps->edgeStart[i] = e;
+      for (int l=0; l<node->nlinks; l++) {
+        struct ncclTopoLink* link = node->links+l;
+        struct ncclTopoNode* remNode = link->remNode;
+        struct ncclTopoAdjEdge* edge = ps->edges+e++;
+        edge->remIndex = ncclTopoPathIndex(ps, system, remNode);
+        edge->link = link;
+        edge->revLink = NULL;
+        for (int r=0; r<remNode->nlinks; r++) {
+          if (remNode->links[r].remNode == node) {
+            edge->revLink = remNode->links+r;
+            break;
+          }
+        }
+        // Start with path type = link type. PATH and LINK types are supposed to match.
+        // Don't consider LINK_NET as we only care about the NIC->GPU path.
+        int type = link->type == LINK_NET ? LINK_LOC : link->type;
+        // Differentiate between one and multiple PCI switches
+        if (node->type == PCI && remNode->type == PCI) type = PATH_PXB;
+        // Consider a path going through the CPU as PATH_PHB
+        if (link->type == LINK_PCI && (node->type == CPU || remNode->type == CPU)) type = PATH_PHB;
+        // Set 1 hop NVLink as NVB
+        //if (node->type == GPU && path->type == PATH_NVL && type == PATH_NVL && remPath->count > 1) type = PATH_NVB;
+        edge->type = type;
+      }
     }
   }
-  WARN("Could not find node of type %d id %lx", t, id);
-  return ncclInternalError;
+  ps->edgeStart[ps->nNodes] = e;
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclTopoAddPathRecord(struct ncclTopoPathSearch* ps, int* index) {
+  if (ps->nRecords == ps->maxRecords) {
+    int maxRecords = 2*ps->maxRecords;
+    struct ncclTopoPathRecord* records = (struct ncclTopoPathRecord*)realloc(ps->records, maxRecords*sizeof(struct ncclTopoPathRecord));
+    if (records == NULL) {
+      WARN("Failed to realloc %ld bytes", maxRecords*sizeof(struct ncclTopoPathRecord));
+      return ncclSystemError;
+    }
+    ps->records = records;
+    ps->maxRecords = maxRecords;
+  }
+  *index = ps->nRecords++;
+  return ncclSuccess;
 }
 
 NCCL_PARAM(NvbDisable, "NVB_DISABLE", 0);
 
-static ncclResult_t ncclTopoSetPaths(struct ncclTopoNode* baseNode, struct ncclTopoSystem* system) {
-  if (baseNode->paths[baseNode->type] == NULL) {
-    NCCLCHECK(ncclCalloc(baseNode->paths+baseNode->type, system->nodes[baseNode->type].count));
-  }
+static ncclResult_t ncclTopoSetPaths(struct ncclTopoNode* baseNode, struct ncclTopoSystem* system, struct ncclTopoPathSearch* ps) {
+  int t = baseNode->type;
+  int baseIndex = baseNode - system->nodes[t].nodes;
+  int nWords = DIVUP(ps->nNodes, 64);
+  for (int i=0; i<ps->nNodes; i++) ps->current[i] = -1;
+  memset(ps->touched, 0, nWords*sizeof(uint64_t));
 
   // breadth-first search to set all paths to that node in the system
-  struct ncclTopoNodeList nodeList;
-  struct ncclTopoNodeList nextNodeList;
-  nodeList.count = 1; nodeList.list[0] = baseNode;
-  nextNodeList.count = 0;
-  struct ncclTopoLinkList* basePath;
-  NCCLCHECK(getPath(system, baseNode, baseNode->type, baseNode->id, &basePath));
+  int base = ncclTopoPathIndex(ps, system, baseNode);
+  int nNodes = 1, nNextNodes;
+  ps->nodeList[0] = base;
+  ps->touched[base/64] |= 1ULL<<(base%64);
+  ps->nRecords = 0;
+  NCCLCHECK(ncclTopoAddPathRecord(ps, ps->current+base));
+  struct ncclTopoPathRecord* basePath = ps->records+ps->current[base];
+  basePath->link = NULL;
+  basePath->next = -1;
   basePath->count = 0;
   basePath->width = LOC_WIDTH;
   basePath->type = PATH_LOC;
 
-  while (nodeList.count) {
-    nextNodeList.count = 0;
-    for (int n=0; n<nodeList.count; n++) {
-      struct ncclTopoNode* node = nodeList.list[n];
-      struct ncclTopoLinkList* path;
-      NCCLCHECK(getPath(system, node, baseNode->type, baseNode->id, &path));
-      for (int l=0; l<node->nlinks; l++) {
-        struct ncclTopoLink* link = node->links+l;
-        struct ncclTopoNode* remNode = link->remNode;
-        if (remNode->paths[baseNode->type] == NULL) {
-          NCCLCHECK(ncclCalloc(remNode->paths+baseNode->type, system->nodes[baseNode->type].count));
-        }
-        struct ncclTopoLinkList* remPath;
-        NCCLCHECK(getPath(system, remNode, baseNode->type, baseNode->id, &remPath));
-        float width = std::min(path->width, link->width);
-        if (remPath->width < width) {
-          // Find reverse link
-          for (int l=0; l<remNode->nlinks; l++) {
-            if (remNode->links[l].remNode == node) {
-              remPath->list[0] = remNode->links+l;
-              break;
-            }
-          }
-          if (remPath->list[0] == NULL) {
+  while (nNodes) {
+    nNextNodes = 0;
+    for (int n=0; n<nNodes; n++) {
+      int node = ps->nodeList[n];
+      int pathIndex = ps->current[node];
+      for (int e=ps->edgeStart[node]; e<ps->edgeStart[node+1]; e++) {
+        struct ncclTopoAdjEdge* edge = ps->edges+e;
+        int rem = edge->remIndex;
+        ps->touched[rem/64] |= 1ULL<<(rem%64);
+        struct ncclTopoPathRecord* path = ps->records+pathIndex;
+        float width = std::min(path->width, edge->link->width);
+        float remWidth = ps->current[rem] == -1 ? 0 : ps->records[ps->current[rem]].width;
+        if (remWidth < width) {
+          if (edge->revLink == NULL) {
+            struct ncclTopoNode* remNode = ps->nodes[rem];
             WARN("Failed to find reverse path from remNode %d/%lx nlinks %d to node %d/%lx",
-                 remNode->type, remNode->id, remNode->nlinks, node->type, node->id);
+                 remNode->type, remNode->id, remNode->nlinks, ps->nodes[node]->type, ps->nodes[node]->id);
             return ncclInternalError;
           }
-          // Copy the rest of the path
-          for (int i=0; i<path->count; i++) remPath->list[i+1] = path->list[i];
+          int remPathIndex;
+          NCCLCHECK(ncclTopoAddPathRecord(ps, &remPathIndex));
+          path = ps->records+pathIndex;
+          struct ncclTopoPathRecord* remPath = ps->records+remPathIndex;
+          remPath->link = edge->revLink;
+          remPath->next = pathIndex;
           remPath->count = path->count + 1;
           remPath->width = width;
-
-          // Start with path type = link type. PATH and LINK types are supposed to match.
-          // Don't consider LINK_NET as we only care about the NIC->GPU path.
-          int type = link->type == LINK_NET ? LINK_LOC : link->type;
-          // Differentiate between one and multiple PCI switches
-          if (node->type == PCI && remNode->type == PCI) type = PATH_PXB;
-          // Consider a path going through the CPU as PATH_PHB
-          if (link->type == LINK_PCI && (node->type == CPU || link->remNode->type == CPU)) type = PATH_PHB;
-          // Set 1 hop NVLink as NVB
-          //if (node->type == GPU && path->type == PATH_NVL && type == PATH_NVL && remPath->count > 1) type = PATH_NVB;
-
-          remPath->type = std::max(path->type, type);
+          remPath->type = std::max(path->type, edge->type);
+          ps->current[rem] = remPathIndex;
 
           // Add to the list for the next iteration if not already in the list
           // Disallow GPUs as intermediate steps for now
-          if (remNode->type != GPU) {
-            int i;
-            for (i=0; i<nextNodeList.count; i++) if (nextNodeList.list[i] == remNode) break;
-            if (i == nextNodeList.count) nextNodeList.list[nextNodeList.count++] = remNode;
+          if (ps->nodes[rem]->type != GPU && (ps->queued[rem/64] & (1ULL<<(rem%64))) == 0) {
+            ps->queued[rem/64] |= 1ULL<<(rem%64);
+            ps->nextNodeList[nNextNodes++] = rem;
           }
         }
       }
     }
-    memcpy(&nodeList, &nextNodeList, sizeof(nodeList));
+    for (int n=0; n<nNextNodes; n++) ps->queued[ps->nextNodeList[n]/64] &= ~(1ULL<<(ps->nextNodeList[n]%64));
+    std::swap(ps->nodeList, ps->nextNodeList);
+    nNodes = nNextNodes;
+  }
+
+  // Write the paths to the base node, with hops stored contiguously
+  for (int i=0; i<ps->nNodes; i++) {
+    if ((ps->touched[i/64] & (1ULL<<(i%64))) == 0) continue;
+    struct ncclTopoNode* node = ps->nodes[i];
+    if (node->paths[t] == NULL) {
+      NCCLCHECK(ncclCalloc(node->paths+t, system->nodes[t].count));
+    }
+    if (ps->current[i] == -1) continue;
+    struct ncclTopoPathRecord* record = ps->records+ps->current[i];
+    struct ncclTopoLinkList* path = node->paths[t]+baseIndex;
+    path->count = record->count;
+    path->width = record->width;
+    path->type = record->type;
+    path->list = NULL;
+    if (path->count == 0) continue;
+    NCCLCHECK(ncclTopoAllocHops(system, path->count, &path->list));
+    for (int h=0; h<path->count; h++) {
+      path->list[h] = record->link;
+      record = ps->records+record->next;
+    }
   }
   return ncclSuccess;
 }
@@ -174,35 +326,103 @@ static ncclResult_t addCpuStep(struct ncclTopoSystem* system, int c, int t1, int
   struct ncclTopoNode* cpuNode = system->nodes[CPU].nodes+c;
   struct ncclTopoNode* srcNode = system->nodes[t1].nodes+i1;
 
+  struct ncclTopoLinkList* srcPath = srcNode->paths[CPU]+c;
+  struct ncclTopoLinkList* cpuPath = cpuNode->paths[t2]+i2;
+  struct ncclTopoLinkList* path = srcNode->paths[t2]+i2;
+  struct ncclTopoLink** list;
+  NCCLCHECK(ncclTopoAllocHops(system, srcPath->count+cpuPath->count, &list));
   int l=0;
   // Node 1 -> CPU
-  for (int i=0; i<srcNode->paths[CPU][c].count; i++) srcNode->paths[t2][i2].list[l++] = srcNode->paths[CPU][c].list[i];
+  for (int i=0; i<srcPath->count; i++) list[l++] = srcPath->list[i];
   // CPU -> Node 2
-  for (int i=0; i<cpuNode->paths[t2][i2].count; i++) srcNode->paths[t2][i2].list[l++] = cpuNode->paths[t2][i2].list[i];
+  for (int i=0; i<cpuPath->count; i++) list[l++] = cpuPath->list[i];
 
   // Update path characteristics
-  srcNode->paths[t2][i2].count = l;
-  srcNode->paths[t2][i2].type = std::max(srcNode->paths[CPU][c].type, cpuNode->paths[t2][i2].type);
-  srcNode->paths[t2][i2].width = std::min(srcNode->paths[CPU][c].width, cpuNode->paths[t2][i2].width);
+  path->list = list;
+  path->count = l;
+  path->type = std::max(srcPath->type, cpuPath->type);
+  path->width = std::min(srcPath->width, cpuPath->width);
   return ncclSuccess;
 }
 
-// Remove/free paths for a given type
-static void ncclTopoRemovePathType(struct ncclTopoSystem* system, int nodeType) {
+// Remove/free all paths
+static void ncclTopoFreePaths(struct ncclTopoSystem* system) {
   for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
-    // Remove links _to_ the given type
     for (int n=0; n<system->nodes[t].count; n++) {
       struct ncclTopoNode* node = system->nodes[t].nodes+n;
-      free(node->paths[nodeType]);
-      node->paths[nodeType] = NULL;
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        free(node->paths[p]);
+        node->paths[p] = NULL;
+      }
     }
-    // Remove links _from_ the given type
-    for (int n=0; n<system->nodes[nodeType].count; n++) {
-      struct ncclTopoNode* node = system->nodes[nodeType].nodes+n;
-      free(node->paths[t]);
-      node->paths[t] = NULL;
+  }
+  while (system->hopPool) {
+    struct ncclTopoHopPool* next = system->hopPool->next;
+    free(system->hopPool);
+    system->hopPool = next;
+  }
+  system->pathsValid = 0;
+}
+
+// Find where a link will be once node index of the given type has been removed.
+// Returns NULL if the link belongs to, or leads to, the removed node.
+static struct ncclTopoLink* ncclTopoMoveLink(struct ncclTopoSystem* system, int type, int index, struct ncclTopoLink* link) {
+  struct ncclTopoNode* delNode = system->nodes[type].nodes+index;
+  if (link->remNode == delNode) return NULL;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    struct ncclTopoNode* nodes = system->nodes[t].nodes;
+    if ((char*)link < (char*)nodes || (char*)link >= (char*)(nodes+system->nodes[t].count)) continue;
+    int n = ((char*)link - (char*)nodes) / sizeof(struct ncclTopoNode);
+    struct ncclTopoNode* node = nodes+n;
+    if (node == delNode) return NULL;
+    int l = link - node->links;
+    // Links to the removed node are taken out of the list
+    int newl = l;
+    for (int i=0; i<l; i++) if (node->links[i].remNode == delNode) newl--;
+    if (t == type && n > index) n--;
+    return nodes[n].links+newl;
+  }
+  return NULL;
+}
+
+// Update paths before node index of the given type is removed, so that they do not
+// need to be recomputed. GPUs are never used as intermediate steps and NICs only
+// lead back to their PCI device, so paths between the remaining nodes do not change.
+// Should a remaining path go through the removed node, all paths are dropped and
+// will be recomputed by ncclTopoComputePaths.
+ncclResult_t ncclTopoRemoveNodePaths(struct ncclTopoSystem* system, int type, int index) {
+  if (system->pathsValid == 0) return ncclSuccess;
+  struct ncclTopoNode* delNode = system->nodes[type].nodes+index;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoNode* node = system->nodes[t].nodes+n;
+      if (node == delNode) continue;
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        if (node->paths[p] == NULL) continue;
+        for (int i=0; i<system->nodes[p].count; i++) {
+          if (p == type && i == index) continue;
+          struct ncclTopoLinkList* path = node->paths[p]+i;
+          for (int h=0; h<path->count; h++) {
+            path->list[h] = ncclTopoMoveLink(system, type, index, path->list[h]);
+            if (path->list[h] == NULL) {
+              INFO(NCCL_GRAPH, "Path from %s/%lx to %s/%lx goes through removed node %s/%lx, recomputing all paths",
+                  topoNodeTypeStr[t], node->id, topoNodeTypeStr[p], system->nodes[p].nodes[i].id, topoNodeTypeStr[type], delNode->id);
+              ncclTopoFreePaths(system);
+              return ncclSuccess;
+            }
+          }
+        }
+        // Remove the path to the removed node
+        if (p == type && system->nodes[p].count == 1) {
+          free(node->paths[p]);
+          node->paths[p] = NULL;
+        } else if (p == type) {
+          memmove(node->paths[p]+index, node->paths[p]+index+1, (system->nodes[p].count-index-1)*sizeof(struct ncclTopoLinkList));
+        }
+      }
     }
   }
+  return ncclSuccess;
 }
 
 static const int levelsOldToNew[] = { PATH_LOC, PATH_PIX, PATH_PXB, PATH_PHB, PATH_SYS, PATH_SYS };
@@ -369,21 +589,18 @@ ncclResult_t ncclTopoCheckGdr(struct ncclTopoSystem* system, int64_t busId, int
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclPeerInfo* peerInfos) {
-  // Precompute paths between GPUs/NICs.
-
-  // Remove everything in case we're re-computing
-  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) ncclTopoRemovePathType(system, t);
+static ncclResult_t ncclTopoComputeAllPaths(struct ncclTopoSystem* system, struct ncclPeerInfo* peerInfos, struct ncclTopoPathSearch* ps) {
+  NCCLCHECK(ncclTopoPathSearchInit(system, ps));
 
   // Set direct paths from/to CPUs. We need them in many cases.
   for (int c=0; c<system->nodes[CPU].count; c++) {
-    NCCLCHECK(ncclTopoSetPaths(system->nodes[CPU].nodes+c, system));
+    NCCLCHECK(ncclTopoSetPaths(system->nodes[CPU].nodes+c, system, ps));
   }
 
   // Set direct paths from/to GPUs.
   for (int g=0; g<system->nodes[GPU].count; g++) {
     // Compute paths to GPU g
-    NCCLCHECK(ncclTopoSetPaths(system->nodes[GPU].nodes+g, system));
+    NCCLCHECK(ncclTopoSetPaths(system->nodes[GPU].nodes+g, system, ps));
 
     // Update path when we don't want to / can't use GPU Direct P2P
     for (int p=0; p<system->nodes[GPU].count; p++) {
@@ -417,7 +634,7 @@ ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclPeer
   // Set direct paths from/to NICs.
   for (int n=0; n<system->nodes[NET].count; n++) {
     struct ncclTopoNode* netNode = system->nodes[NET].nodes+n;
-    NCCLCHECK(ncclTopoSetPaths(netNode, system));
+    NCCLCHECK(ncclTopoSetPaths(netNode, system, ps));
 
     for (int g=0; g<system->nodes[GPU].count; g++) {
       // Update path when we dont want to / can't use GPU Direct RDMA.
@@ -435,6 +652,25 @@ ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclPeer
   return ncclSuccess;
 }
 
+ncclResult_t ncclTopoComputePaths(struct ncclTopoSystem* system, struct ncclPeerInfo* peerInfos) {
+  // Precompute paths between GPUs/NICs.
+
+  // Paths are kept up to date when nodes are removed, e.g. by ncclTopoTrimSystem
+  if (system->pathsValid) {
+    TRACE(NCCL_GRAPH, "Paths are up to date");
+    return ncclSuccess;
+  }
+
+  // Remove everything in case we're re-computing
+  ncclTopoFreePaths(system);
+
+  struct ncclTopoPathSearch ps;
+  ncclResult_t ret = ncclTopoComputeAllPaths(system, peerInfos, &ps);
+  ncclTopoPathSearchFree(&ps);
+  if (ret == ncclSuccess) system->pathsValid = 1;
+  return ret;
+}
+
 ncclResult_t ncclTopoTrimSystem(struct ncclTopoSystem* system, struct ncclComm* comm) {
   int *domains;
   int64_t *ids;
@@ -540,7 +776,7 @@ ncclResult_t ncclTopoTrimSystem(struct ncclTopoSystem* system, struct ncclComm*
 }
 
 void ncclTopoFree(struct ncclTopoSystem* system) {
-  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) ncclTopoRemovePathType(system, t);
+  ncclTopoFreePaths(system);
   free(system);
 }
 
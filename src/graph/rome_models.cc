@@ -953,6 +953,19 @@ static ncclResult_t parseRomeSystem(struct ncclTopoSystem* system, struct rcclRo
   return ncclSuccess;
 }
 
+RCCL_PARAM(ModelMatchingExhaustive, "MODEL_MATCHING_EXHAUSTIVE", 0);
+
+#define NUM_ROME_MODELS (sizeof(romeTopoModels)/sizeof(romeTopoModels[0]))
+
+#define NUMA_CPUS 4
+#define NUMA_GPUS 4
+#define NUMA_PERMUTE_COUNT 24
+#define TOTAL_PERMUTE_COUNT (NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT)
+
+/* Exhaustive matching, trying all permutations of GPU and NET ids. It is only
+ * used when RCCL_MODEL_MATCHING_EXHAUSTIVE is set, and as the reference of the
+ * indexed matching below.
+ */
 static bool permuteGpuIds(int *g, int n, int last, struct rcclRomeModel* ref, struct rcclRomeModel* topo, int* time, bool nbio, bool ignore_numa) {
   (*time) ++;
   if (n == last) {
@@ -1027,6 +1040,340 @@ static bool permuteNetIds(int *n, int *g, int s, int last, struct rcclRomeModel*
   return false;
 }
 
+static int searchRome4P2H(struct rcclRomeModel* romeTopo, const char* pattern, bool match_nbio, int* g, int* n) {
+  int ngpus = romeTopo->nGpus;
+  int nnets = romeTopo->nNics;
+  int time = 0;
+  for (int i = 0; i < NUM_ROME_MODELS; i++) {
+    bool ignore_numa = disableNumaMatching(romeTopoModels[i].options);
+    if (!ignore_numa && romeTopo->nCpus != romeTopoModels[i].nCpus) continue;
+    if (romeTopo->nGpus != romeTopoModels[i].nGpus ||
+      romeTopo->nNics != romeTopoModels[i].nNics || romeTopo->nLinks != romeTopoModels[i].nLinks) continue;
+    if (!ignore_numa && strcmp(romeTopoModels[i].pattern, pattern)) continue;
+    // permute GPU IDs
+    for (int j = 0; j < ngpus; j++) g[j] = (j+2)%ngpus;
+    if (!permuteGpuIds(g, 0, ngpus-1, romeTopoModels+i, romeTopo, &time, match_nbio, ignore_numa)) continue;
+    if (nnets > 1) {
+      // permute NET IDs
+      for (int j = 0; j < nnets; j++) n[j] = (j+2)%nnets;
+      if (permuteNetIds(n, g, 0, nnets-1, romeTopoModels+i, romeTopo, &time, ignore_numa)) return i;
+    } else return i;
+  }
+  return -1;
+}
+
+static int search1H16P(struct rcclRomeModel* romeTopo, const char* pattern, int* g16, int* n) {
+  int ngpus = romeTopo->nGpus;
+  int ncpus = romeTopo->nCpus;
+  int nnets = romeTopo->nNics;
+  int *all_gpu_permutations = (int *)malloc(TOTAL_PERMUTE_COUNT*NUMA_CPUS*NUMA_GPUS*sizeof(int));
+  if (all_gpu_permutations == NULL) return -1;
+  for (int i = 0; i < NUM_ROME_MODELS; i++) {
+    if (romeTopo->nCpus != romeTopoModels[i].nCpus || romeTopo->nGpus != romeTopoModels[i].nGpus ||
+      romeTopo->nNics != romeTopoModels[i].nNics || romeTopo->nLinks != romeTopoModels[i].nLinks) continue;
+    if (strcmp(romeTopoModels[i].pattern, pattern)) continue;
+    int j, g[ngpus];
+    int numa_gpu_permutations[NUMA_CPUS][NUMA_PERMUTE_COUNT][NUMA_GPUS];
+    // permute GPUs for each CPU NUMA nodes
+    for (j = 0; j < ncpus; j++) {
+      int ngpusPerNuma = 0, cnt = 0, npermute = 0;
+      for (int k = 0; k < ngpus; k++)
+        if (romeTopoModels[i].gpuNuma[k] == j) ngpusPerNuma++;
+      if (ngpusPerNuma == 0) continue;
+      if (ngpusPerNuma != NUMA_GPUS) break;
+      // init GPU mapping
+      for (int k = 0; k < ngpus; k++) {
+        if (romeTopo->gpuNuma[k] != j) continue;
+        g[(2+cnt++)%ngpusPerNuma] = k;
+      }
+      std::sort(g, g+ngpusPerNuma);
+      do {
+        for (int n = 0; n < ngpusPerNuma; n++)
+          numa_gpu_permutations[j][npermute][n] = g[n];
+        npermute++;
+      } while (std::next_permutation(g, g+ngpusPerNuma));
+      if (npermute != NUMA_PERMUTE_COUNT) break;
+    }
+    if (j < ncpus) continue;
+    // permute GPUs for all CPU NUMA nodes
+    for (int a = 0; a < NUMA_PERMUTE_COUNT; a++) {
+      for (int b = 0; b < NUMA_PERMUTE_COUNT; b++) {
+        for (int c = 0; c < NUMA_PERMUTE_COUNT; c++) {
+          for (int d = 0; d < NUMA_PERMUTE_COUNT; d++) {
+            uint64_t offset = ((a*NUMA_PERMUTE_COUNT+b)*NUMA_PERMUTE_COUNT+c)*NUMA_PERMUTE_COUNT+d;
+            offset *= (NUMA_CPUS*NUMA_GPUS);
+            memcpy(all_gpu_permutations+offset, &numa_gpu_permutations[0][a][0], NUMA_GPUS*sizeof(int));
+            memcpy(all_gpu_permutations+offset+NUMA_GPUS, &numa_gpu_permutations[1][b][0], NUMA_GPUS*sizeof(int));
+            memcpy(all_gpu_permutations+offset+NUMA_GPUS*2, &numa_gpu_permutations[2][c][0], NUMA_GPUS*sizeof(int));
+            memcpy(all_gpu_permutations+offset+NUMA_GPUS*3, &numa_gpu_permutations[3][d][0], NUMA_GPUS*sizeof(int));
+          }
+        }
+      }
+    }
+    // match all GPUs' XGMI connection
+    for (int p = 0; p < TOTAL_PERMUTE_COUNT; p++) {
+      int* perm = all_gpu_permutations+p*NUMA_CPUS*NUMA_GPUS;
+      int k;
+      for (k = 0; k < romeTopoModels[i].nGpus; k++) {
+        int m;
+        for (m = 0; m < romeTopoModels[i].nGpus; m++) {
+          if (romeTopoModels[i].connMatrix[k*romeTopoModels[i].nGpus+m] != romeTopo->connMatrix[perm[k]*romeTopoModels[i].nGpus+perm[m]]) break;
+        }
+        if (m < romeTopoModels[i].nGpus) break;
+      }
+      if (k < romeTopoModels[i].nGpus) continue;
+      if (nnets > 1) {
+        // permute NET IDs
+        int time = 0;
+        for (int m = 0; m < nnets; m++) n[m] = (m+2)%nnets;
+        if (!permuteNetIds(n, perm, 0, nnets-1, romeTopoModels+i, romeTopo, &time, false)) continue;
+      }
+      memcpy(g16, perm, ngpus*sizeof(int));
+      free(all_gpu_permutations);
+      return i;
+    }
+  }
+  free(all_gpu_permutations);
+  return -1;
+}
+
+/* Indexed matching. Reference models are first screened with a hash of
+ * properties which don't depend on the GPU and NET ids, computed once for
+ * all models. GPUs are then mapped by backtracking, in the same order as the
+ * exhaustive matching, but giving up on a permutation as soon as the GPUs
+ * mapped so far don't match the reference. So the mapping found is the same.
+ * GPUs are also only mapped to GPUs with the same signature, refined from
+ * their NUMA node and NBIO and the signatures of the GPUs they are linked to.
+ */
+#define ROME_MATCH_GPU_NUMA 1
+#define ROME_MATCH_NETS     2
+#define ROME_MATCH_NET_NUMA 4
+#define ROME_MATCH_HASHES   8 // Combinations of the flags above
+#define ROME_MATCH_NBIO     8
+#define ROME_MATCH_IDS      16
+#define ROME_MATCH_REFINE   3
+
+static uint64_t romeMix(uint64_t h, uint64_t v) {
+  uint64_t x = h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint64_t romeMixSorted(uint64_t h, const uint64_t* values, int count) {
+  uint64_t sorted[NCCL_TOPO_MAX_NODES];
+  memcpy(sorted, values, count*sizeof(uint64_t));
+  std::sort(sorted, sorted+count);
+  for (int i = 0; i < count; i++) h = romeMix(h, sorted[i]);
+  return h;
+}
+
+static void romeGpuSignatures(struct rcclRomeModel* m, int flags, uint64_t* sig) {
+  int ngpus = m->nGpus;
+  uint64_t prev[NCCL_TOPO_MAX_NODES], links[NCCL_TOPO_MAX_NODES];
+  for (int i = 0; i < ngpus; i++) {
+    sig[i] = romeMix(0, (flags & ROME_MATCH_GPU_NUMA) ? m->gpuNuma[i] : -1);
+    if (flags & ROME_MATCH_NBIO) {
+      int nbio = 0;
+      for (int j = 0; j < ngpus; j++)
+        if ((m->gpuIds[i]&0xf0000) == (m->gpuIds[j]&0xf0000)) nbio++;
+      sig[i] = romeMix(sig[i], nbio);
+    }
+  }
+  for (int r = 0; r < ROME_MATCH_REFINE; r++) {
+    memcpy(prev, sig, ngpus*sizeof(uint64_t));
+    for (int i = 0; i < ngpus; i++) {
+      for (int j = 0; j < ngpus; j++)
+        links[j] = romeMix(romeMix(prev[j], m->connMatrix[i*ngpus+j]), m->connMatrix[j*ngpus+i]);
+      sig[i] = romeMixSorted(prev[i], links, ngpus);
+    }
+  }
+}
+
+static uint64_t romeModelHash(struct rcclRomeModel* m, const char* pattern, int flags) {
+  uint64_t gpuSig[NCCL_TOPO_MAX_NODES], netSig[NCCL_TOPO_MAX_NODES], gdr[NCCL_TOPO_MAX_NODES];
+  uint64_t h = romeMix(romeMix(romeMix(0, m->nGpus), m->nNics), m->nLinks);
+  if (flags & ROME_MATCH_GPU_NUMA) {
+    h = romeMix(h, m->nCpus);
+    for (const char* p = pattern; *p; p++) h = romeMix(h, *p);
+  }
+  romeGpuSignatures(m, flags & ROME_MATCH_GPU_NUMA, gpuSig);
+  h = romeMixSorted(h, gpuSig, m->nGpus);
+  if (flags & ROME_MATCH_NETS) {
+    for (int i = 0; i < m->nNics; i++) {
+      for (int j = 0; j < m->nGpus; j++) gdr[j] = romeMix(gpuSig[j], m->gdrLevel[i*m->nGpus+j]);
+      netSig[i] = romeMixSorted(romeMix(0, (flags & ROME_MATCH_NET_NUMA) ? m->nicNuma[i] : -1), gdr, m->nGpus);
+    }
+    h = romeMixSorted(h, netSig, m->nNics);
+  }
+  return h;
+}
+
+static uint64_t romeModelIndex[NUM_ROME_MODELS][ROME_MATCH_HASHES];
+static bool romeModelIndexReady = false;
+static pthread_mutex_t romeModelIndexLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void romeModelIndexInit() {
+  pthread_mutex_lock(&romeModelIndexLock);
+  if (!romeModelIndexReady) {
+    for (int i = 0; i < NUM_ROME_MODELS; i++)
+      for (int f = 0; f < ROME_MATCH_HASHES; f++)
+        romeModelIndex[i][f] = romeModelHash(romeTopoModels+i, romeTopoModels[i].pattern, f);
+    romeModelIndexReady = true;
+  }
+  pthread_mutex_unlock(&romeModelIndexLock);
+}
+
+struct romeMatch {
+  struct rcclRomeModel* ref;
+  struct rcclRomeModel* topo;
+  int flags;
+  uint64_t refSig[NCCL_TOPO_MAX_NODES];
+  uint64_t topoSig[NCCL_TOPO_MAX_NODES];
+};
+
+static void romeMatchInit(struct romeMatch* m, struct rcclRomeModel* ref, struct rcclRomeModel* topo, int flags) {
+  m->ref = ref;
+  m->topo = topo;
+  m->flags = flags;
+  romeGpuSignatures(ref, flags & (ROME_MATCH_GPU_NUMA|ROME_MATCH_NBIO), m->refSig);
+  romeGpuSignatures(topo, flags & (ROME_MATCH_GPU_NUMA|ROME_MATCH_NBIO), m->topoSig);
+}
+
+// Check reference GPU i mapped to g[i] against GPUs 0 to i
+static bool romeGpuFits(struct romeMatch* m, int* g, int i) {
+  struct rcclRomeModel* ref = m->ref;
+  struct rcclRomeModel* topo = m->topo;
+  int ngpus = ref->nGpus;
+  if (m->refSig[i] != m->topoSig[g[i]]) return false;
+  if ((m->flags & ROME_MATCH_GPU_NUMA) && ref->gpuNuma[i] != topo->gpuNuma[g[i]]) return false;
+  for (int j = 0; j <= i; j++) {
+    if (ref->connMatrix[i*ngpus+j] != topo->connMatrix[g[i]*ngpus+g[j]]) return false;
+    if (ref->connMatrix[j*ngpus+i] != topo->connMatrix[g[j]*ngpus+g[i]]) return false;
+    bool order = (ref->gpuIds[i]-ref->gpuIds[j])*(topo->gpuIds[g[i]]-topo->gpuIds[g[j]]) >= 0;
+    if ((m->flags & ROME_MATCH_IDS) && !order) return false;
+    if ((m->flags & ROME_MATCH_NBIO) && i != j) {
+      bool nbio_ref = (ref->gpuIds[i]&0xf0000) == (ref->gpuIds[j]&0xf0000);
+      bool nbio_topo = (topo->gpuIds[g[i]]&0xf0000) == (topo->gpuIds[g[j]]&0xf0000);
+      if (nbio_ref != nbio_topo || (nbio_ref && !order)) return false;
+    }
+  }
+  return true;
+}
+
+// Same permutations as permuteGpuIds, skipping those which can't match
+static bool matchGpuIds(struct romeMatch* m, int* g, int n, int last) {
+  if (n > 0 && !romeGpuFits(m, g, n-1)) return false;
+  if (n == last) return romeGpuFits(m, g, last);
+  for (int i = n; i <= last; i++) {
+    std::swap(g[n], g[i]);
+    if (matchGpuIds(m, g, n+1, last)) return true;
+    std::swap(g[n], g[i]);
+  }
+  return false;
+}
+
+static bool romeNetFits(struct romeMatch* m, int* n, int* g, int s) {
+  struct rcclRomeModel* ref = m->ref;
+  struct rcclRomeModel* topo = m->topo;
+  if ((m->flags & ROME_MATCH_NET_NUMA) && ref->nicNuma[s] != topo->nicNuma[n[s]]) return false;
+  for (int j = 0; j < ref->nGpus; j++)
+    if (ref->gdrLevel[s*ref->nGpus+j] != topo->gdrLevel[n[s]*ref->nGpus+g[j]]) return false;
+  return true;
+}
+
+// Same permutations as permuteNetIds, skipping those which can't match
+static bool matchNetIds(struct romeMatch* m, int* n, int* g, int s, int last) {
+  if (s > 0 && !romeNetFits(m, n, g, s-1)) return false;
+  if (s == last) return romeNetFits(m, n, g, last);
+  for (int i = s; i <= last; i++) {
+    std::swap(n[s], n[i]);
+    if (matchNetIds(m, n, g, s+1, last)) return true;
+    std::swap(n[s], n[i]);
+  }
+  return false;
+}
+
+static int matchRome4P2H(struct rcclRomeModel* romeTopo, const char* pattern, bool match_nbio, int* g, int* n) {
+  int ngpus = romeTopo->nGpus;
+  int nnets = romeTopo->nNics;
+  uint64_t hashes[ROME_MATCH_HASHES];
+  bool hashed[ROME_MATCH_HASHES] = { false };
+  struct romeMatch m;
+  romeModelIndexInit();
+  for (int i = 0; i < NUM_ROME_MODELS; i++) {
+    bool ignore_numa = disableNumaMatching(romeTopoModels[i].options);
+    if (!ignore_numa && romeTopo->nCpus != romeTopoModels[i].nCpus) continue;
+    if (romeTopo->nGpus != romeTopoModels[i].nGpus ||
+      romeTopo->nNics != romeTopoModels[i].nNics || romeTopo->nLinks != romeTopoModels[i].nLinks) continue;
+    if (!ignore_numa && strcmp(romeTopoModels[i].pattern, pattern)) continue;
+    int flags = ignore_numa ? 0 : ROME_MATCH_GPU_NUMA;
+    if (nnets > 1) flags |= ROME_MATCH_NETS | (ignore_numa ? 0 : ROME_MATCH_NET_NUMA);
+    if (!hashed[flags]) {
+      hashes[flags] = romeModelHash(romeTopo, pattern, flags);
+      hashed[flags] = true;
+    }
+    if (hashes[flags] != romeModelIndex[i][flags]) continue;
+    romeMatchInit(&m, romeTopoModels+i, romeTopo, flags | ROME_MATCH_IDS | (match_nbio ? ROME_MATCH_NBIO : 0));
+    for (int j = 0; j < ngpus; j++) g[j] = (j+2)%ngpus;
+    if (!matchGpuIds(&m, g, 0, ngpus-1)) continue;
+    if (nnets > 1) {
+      for (int j = 0; j < nnets; j++) n[j] = (j+2)%nnets;
+      if (matchNetIds(&m, n, g, 0, nnets-1)) return i;
+    } else return i;
+  }
+  return -1;
+}
+
+// Same permutations as search1H16P : at position k, GPUs of NUMA node
+// k/NUMA_GPUS in increasing order
+static bool match1H16PGpus(struct romeMatch* m, int* g, bool* used, int k, int* n) {
+  int ngpus = m->ref->nGpus;
+  int nnets = m->ref->nNics;
+  if (k == ngpus) {
+    if (nnets <= 1) return true;
+    for (int j = 0; j < nnets; j++) n[j] = (j+2)%nnets;
+    return matchNetIds(m, n, g, 0, nnets-1);
+  }
+  for (int t = 0; t < ngpus; t++) {
+    if (used[t] || m->topo->gpuNuma[t] != k/NUMA_GPUS) continue;
+    g[k] = t;
+    used[t] = true;
+    if (romeGpuFits(m, g, k) && match1H16PGpus(m, g, used, k+1, n)) return true;
+    used[t] = false;
+  }
+  return false;
+}
+
+static int match1H16P(struct rcclRomeModel* romeTopo, const char* pattern, int* g16, int* n) {
+  int ngpus = romeTopo->nGpus;
+  int nnets = romeTopo->nNics;
+  int flags = nnets > 1 ? ROME_MATCH_NETS|ROME_MATCH_NET_NUMA : 0;
+  uint64_t hash = romeModelHash(romeTopo, pattern, flags);
+  struct romeMatch m;
+  romeModelIndexInit();
+  for (int i = 0; i < NUM_ROME_MODELS; i++) {
+    if (romeTopo->nCpus != romeTopoModels[i].nCpus || romeTopo->nGpus != romeTopoModels[i].nGpus ||
+      romeTopo->nNics != romeTopoModels[i].nNics || romeTopo->nLinks != romeTopoModels[i].nLinks) continue;
+    if (strcmp(romeTopoModels[i].pattern, pattern)) continue;
+    if (hash != romeModelIndex[i][flags]) continue;
+    // Each NUMA node needs NUMA_GPUS GPUs
+    int j;
+    for (j = 0; j < romeTopo->nCpus; j++) {
+      int nref = 0, ntopo = 0;
+      for (int k = 0; k < ngpus; k++) {
+        if (romeTopoModels[i].gpuNuma[k] == j) nref++;
+        if (romeTopo->gpuNuma[k] == j) ntopo++;
+      }
+      if (nref != NUMA_GPUS || ntopo != NUMA_GPUS) break;
+    }
+    if (j < romeTopo->nCpus) continue;
+    bool used[NCCL_TOPO_MAX_NODES] = { false };
+    romeMatchInit(&m, romeTopoModels+i, romeTopo, flags);
+    if (match1H16PGpus(&m, g16, used, 0, n)) return i;
+  }
+  return -1;
+}
 
 ncclResult_t parseRome4P2H(struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
   static char ringRemap[64];
@@ -1052,7 +1399,6 @@ ncclResult_t parseRome4P2H(struct ncclTopoSystem* system, struct ncclTopoGraph*
   if (ngpus > 4 && romeTopo.nLinks) system->type |= RCCL_TOPO_4P2H_ROME;
 
   int g[NCCL_TOPO_MAX_NODES], n[NCCL_TOPO_MAX_NODES];
-  int time = 0;
   struct timeval tvs, tve;
   gettimeofday(&tvs, NULL);
 
@@ -1066,30 +1412,17 @@ ncclResult_t parseRome4P2H(struct ncclTopoSystem* system, struct ncclTopoGraph*
   }
   if (i < romeTopo.nGpus) match_nbio = false;
 
-  for (i = 0; i < sizeof(romeTopoModels)/sizeof(romeTopoModels[0]); i++) {
-    bool ignore_numa = disableNumaMatching(romeTopoModels[i].options);
-    if (!ignore_numa && romeTopo.nCpus != romeTopoModels[i].nCpus) continue;
-    if (romeTopo.nGpus != romeTopoModels[i].nGpus ||
-      romeTopo.nNics != romeTopoModels[i].nNics || romeTopo.nLinks != romeTopoModels[i].nLinks) continue;
-    if (!ignore_numa && strcmp(romeTopoModels[i].pattern, pattern)) continue;
-    // permute GPU IDs
-    for (int j = 0; j < ngpus; j++) g[j] = (j+2)%ngpus;
-    if (!permuteGpuIds(g, 0, ngpus-1, romeTopoModels+i, &romeTopo, &time, match_nbio, ignore_numa)) continue;
-    if (nnets > 1) {
-      // permute NET IDs
-      for (int j = 0; j < nnets; j++) n[j] = (j+2)%nnets;
-      if (permuteNetIds(n, g, 0, nnets-1, romeTopoModels+i, &romeTopo, &time, ignore_numa)) break;
-    } else break;
-  }
+  i = rcclParamModelMatchingExhaustive() ? searchRome4P2H(&romeTopo, pattern, match_nbio, g, n) :
+    matchRome4P2H(&romeTopo, pattern, match_nbio, g, n);
   gettimeofday(&tve, NULL);
   float t = (tve.tv_sec - tvs.tv_sec)*1E3 + (tve.tv_usec - tvs.tv_usec)/1E3;
-  if (i >= sizeof(romeTopoModels)/sizeof(romeTopoModels[0])) {
-    //printf("No solution in %.2fms (%d iter)\n", t, time);
+  if (i < 0) {
+    //printf("No solution in %.2fms\n", t);
     return ncclSuccess;
   }
 
   char line[1024];
-  //sprintf(line, "Found matching Rome model index %d in %.2fms (%d iter) with GPU mapping: ", i, t, time);
+  //sprintf(line, "Found matching Rome model index %d in %.2fms with GPU mapping: ", i, t);
   sprintf(line, "Found matching Rome model index %d with GPU mapping: ", i);
   int offset = strlen(line);
   for (int k = 0; k < ngpus; k++) {
@@ -1113,11 +1446,6 @@ ncclResult_t parseRome4P2H(struct ncclTopoSystem* system, struct ncclTopoGraph*
 }
 
 ncclResult_t parse1H16P(struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
-  #define NUMA_CPUS 4
-  #define NUMA_GPUS 4
-  #define NUMA_PERMUTE_COUNT 24
-  #define TOTAL_PERMUTE_COUNT (NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT*NUMA_PERMUTE_COUNT)
-
   static char ringRemap[256];
   int i;
 
@@ -1139,83 +1467,14 @@ ncclResult_t parse1H16P(struct ncclTopoSystem* system, struct ncclTopoGraph* gra
   // only match for system with 16 GPUs
   if (ngpus != 16 || ncpus != NUMA_CPUS) return ncclSuccess;
 
-  int gcnt = 0;
-  int *g16, n[NCCL_TOPO_MAX_NODES];
-  int *all_gpu_permutations = (int *)malloc(TOTAL_PERMUTE_COUNT*NUMA_CPUS*NUMA_GPUS*sizeof(int));
+  int g16[NCCL_TOPO_MAX_NODES], n[NCCL_TOPO_MAX_NODES];
   struct timeval tvs, tve;
   gettimeofday(&tvs, NULL);
-  for (i = 0; i < sizeof(romeTopoModels)/sizeof(romeTopoModels[0]); i++) {
-    if (romeTopo.nCpus != romeTopoModels[i].nCpus || romeTopo.nGpus != romeTopoModels[i].nGpus ||
-      romeTopo.nNics != romeTopoModels[i].nNics || romeTopo.nLinks != romeTopoModels[i].nLinks) continue;
-    if (strcmp(romeTopoModels[i].pattern, pattern)) continue;
-    int j, r[ngpus], g[ngpus];
-    int numa_gpu_permutations[NUMA_CPUS][NUMA_PERMUTE_COUNT][NUMA_GPUS];
-    // permute GPUs for each CPU NUMA nodes
-    for (j = 0; j < ncpus; j++) {
-      int ngpusPerNuma = 0, cnt = 0, npermute = 0;
-      for (int k = 0; k < ngpus; k++) {
-        if (romeTopoModels[i].gpuNuma[k] != j) continue;
-        r[ngpusPerNuma++] = k;
-      }
-      if (ngpusPerNuma == 0) continue;
-      if (ngpusPerNuma != NUMA_GPUS) break;
-      gcnt++;
-      // init GPU mapping
-      for (int k = 0; k < ngpus; k++) {
-        if (romeTopo.gpuNuma[k] != j) continue;
-        g[(2+cnt++)%ngpusPerNuma] = k;
-      }
-      std::sort(g, g+ngpusPerNuma);
-      do {
-        for (int n = 0; n < ngpusPerNuma; n++)
-          numa_gpu_permutations[j][npermute][n] = g[n];
-        npermute++;
-      } while (std::next_permutation(g, g+ngpusPerNuma));
-      if (npermute != NUMA_PERMUTE_COUNT) break;
-    }
-    if (j < ncpus) continue;
-    // permute GPUs for all CPU NUMA nodes
-    for (int a = 0; a < NUMA_PERMUTE_COUNT; a++) {
-      for (int b = 0; b < NUMA_PERMUTE_COUNT; b++) {
-        for (int c = 0; c < NUMA_PERMUTE_COUNT; c++) {
-          for (int d = 0; d < NUMA_PERMUTE_COUNT; d++) {
-            uint64_t offset = ((a*NUMA_PERMUTE_COUNT+b)*NUMA_PERMUTE_COUNT+c)*NUMA_PERMUTE_COUNT+d;
-            //offset = (offset+TOTAL_PERMUTE_COUNT/2)%TOTAL_PERMUTE_COUNT;
-            offset *= (NUMA_CPUS*NUMA_GPUS);
-            memcpy(all_gpu_permutations+offset, &numa_gpu_permutations[0][a][0], NUMA_GPUS*sizeof(int));
-            memcpy(all_gpu_permutations+offset+NUMA_GPUS, &numa_gpu_permutations[1][b][0], NUMA_GPUS*sizeof(int));
-            memcpy(all_gpu_permutations+offset+NUMA_GPUS*2, &numa_gpu_permutations[2][c][0], NUMA_GPUS*sizeof(int));
-            memcpy(all_gpu_permutations+offset+NUMA_GPUS*3, &numa_gpu_permutations[3][d][0], NUMA_GPUS*sizeof(int));
-          }
-        }
-      }
-    }
-    // match all GPUs' XGMI connection
-    int p;
-    for (p = 0; p < TOTAL_PERMUTE_COUNT; p++) {
-      g16 = all_gpu_permutations+p*NUMA_CPUS*NUMA_GPUS;
-      int k;
-      for (k = 0; k < romeTopoModels[i].nGpus; k++) {
-        int m;
-        for (m = 0; m < romeTopoModels[i].nGpus; m++) {
-          if (romeTopoModels[i].connMatrix[k*romeTopoModels[i].nGpus+m] != romeTopo.connMatrix[g16[k]*romeTopoModels[i].nGpus+g16[m]]) break;
-        }
-        if (m < romeTopoModels[i].nGpus) break;
-      }
-      if (k < romeTopoModels[i].nGpus) continue;
-      //printf("found match %d: ", p); for (int n = 0; n < NUMA_CPUS*NUMA_GPUS; n++) printf("%d ", g16[n]); printf("\n");
-      if (nnets > 1) {
-        // permute NET IDs
-        int time = 0;
-        for (int m = 0; m < nnets; m++) n[m] = (m+2)%nnets;
-        if (permuteNetIds(n, g16, 0, nnets-1, romeTopoModels+i, &romeTopo, &time, false)) break;
-      } else break;
-    }
-    if (p < TOTAL_PERMUTE_COUNT) break;
-  }
+  i = rcclParamModelMatchingExhaustive() ? search1H16P(&romeTopo, pattern, g16, n) :
+    match1H16P(&romeTopo, pattern, g16, n);
   gettimeofday(&tve, NULL);
   float t = (tve.tv_sec - tvs.tv_sec)*1E3 + (tve.tv_usec - tvs.tv_usec)/1E3;
-  if (i >= sizeof(romeTopoModels)/sizeof(romeTopoModels[0])) {
+  if (i < 0) {
     //printf("No solution in %.2fms\n", t);
     return ncclSuccess;
   }
@@ -1242,8 +1501,6 @@ ncclResult_t parse1H16P(struct ncclTopoSystem* system, struct ncclTopoGraph* gra
 
   // create 16P1H based on reference and remapped ids
   NCCLCHECK(parseGraph(romeTopoModels[i].ringBase, system, graph, g16, nnets > 1 ? n : NULL));
-  // clean up
-  free(all_gpu_permutations);
   return ncclSuccess;
 }
 
@@ -1343,3 +1600,97 @@ ncclResult_t parse4H4P(struct ncclTopoSystem* system, struct ncclTopoGraph* grap
   NCCLCHECK(parseGraph(rome_model_68.ringBase, system, graph, g_hives, n_hives));
   return ncclSuccess;
 }
+
+#ifdef TOPO_EXPL
+static double romeTimeMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec*1E3 + tv.tv_usec/1E3;
+}
+
+// Build a system like a reference model with GPU and NET ids shuffled. When
+// cut is set, also remove the first XGMI link so that it no longer matches.
+static void romeShuffleModel(struct rcclRomeModel* ref, struct rcclRomeModel* topo, unsigned int* seed, bool cut) {
+  int ngpus = ref->nGpus, nnets = ref->nNics;
+  int p[NCCL_TOPO_MAX_NODES], q[NCCL_TOPO_MAX_NODES];
+  for (int i = 0; i < ngpus; i++) p[i] = i;
+  for (int i = 0; i < nnets; i++) q[i] = i;
+  for (int i = ngpus-1; i > 0; i--) std::swap(p[i], p[rand_r(seed)%(i+1)]);
+  for (int i = nnets-1; i > 0; i--) std::swap(q[i], q[rand_r(seed)%(i+1)]);
+  *topo = *ref;
+  for (int i = 0; i < ngpus; i++) {
+    topo->gpuIds[p[i]] = ref->gpuIds[i];
+    topo->gpuNuma[p[i]] = ref->gpuNuma[i];
+    for (int j = 0; j < ngpus; j++) topo->connMatrix[p[i]*ngpus+p[j]] = ref->connMatrix[i*ngpus+j];
+  }
+  for (int i = 0; i < nnets; i++) {
+    topo->nicIds[q[i]] = ref->nicIds[i];
+    topo->nicNuma[q[i]] = ref->nicNuma[i];
+    for (int j = 0; j < ngpus; j++) topo->gdrLevel[q[i]*ngpus+p[j]] = ref->gdrLevel[i*ngpus+j];
+  }
+  for (int i = 0; cut && i < ngpus*ngpus; i++) {
+    if (topo->connMatrix[i] == 0 || i/ngpus == i%ngpus) continue;
+    topo->connMatrix[i] = topo->connMatrix[(i%ngpus)*ngpus+i/ngpus] = 0;
+    break;
+  }
+}
+
+static bool romeSameMatch(int i0, int i1, int* g0, int* g1, int* n0, int* n1, int ngpus, int nnets) {
+  if (i0 != i1) return false;
+  if (i0 < 0) return true;
+  if (memcmp(g0, g1, ngpus*sizeof(int))) return false;
+  return nnets <= 1 || memcmp(n0, n1, nnets*sizeof(int)) == 0;
+}
+
+// Match shuffled copies of all reference models with the exhaustive and the
+// indexed matching, and count the cases where they don't find the same model
+// and mappings.
+ncclResult_t romeModelsCheckMatch(int nShuffles, int* nChecks, int* nFailures, double* exhaustiveMs, double* indexedMs) {
+  unsigned int seed = 1;
+  *nChecks = *nFailures = 0;
+  *exhaustiveMs = *indexedMs = 0;
+  for (int s = 0; s < nShuffles; s++) {
+    for (int m = 0; m < NUM_ROME_MODELS; m++) {
+      struct rcclRomeModel* ref = romeTopoModels+m;
+      for (int cut = 0; cut < 2; cut++) {
+        struct rcclRomeModel topo;
+        romeShuffleModel(ref, &topo, &seed, cut);
+        int g0[NCCL_TOPO_MAX_NODES], g1[NCCL_TOPO_MAX_NODES], n0[NCCL_TOPO_MAX_NODES], n1[NCCL_TOPO_MAX_NODES];
+        int i0, i1;
+        double t;
+        if (ref->nGpus <= 8) {
+          for (int nbio = 0; nbio < 2; nbio++) {
+            t = romeTimeMs();
+            i0 = searchRome4P2H(&topo, ref->pattern, nbio, g0, n0);
+            *exhaustiveMs += romeTimeMs()-t;
+            t = romeTimeMs();
+            i1 = matchRome4P2H(&topo, ref->pattern, nbio, g1, n1);
+            *indexedMs += romeTimeMs()-t;
+            (*nChecks)++;
+            if (!romeSameMatch(i0, i1, g0, g1, n0, n1, ref->nGpus, ref->nNics)) {
+              WARN("Rome model %d (shuffle %d%s%s) : exhaustive matching found model %d, indexed matching found model %d or another mapping",
+                  m, s, cut ? ", cut" : "", nbio ? ", nbio" : "", i0, i1);
+              (*nFailures)++;
+            }
+          }
+        }
+        if (ref->nGpus == 16 && ref->nCpus == NUMA_CPUS) {
+          t = romeTimeMs();
+          i0 = search1H16P(&topo, ref->pattern, g0, n0);
+          *exhaustiveMs += romeTimeMs()-t;
+          t = romeTimeMs();
+          i1 = match1H16P(&topo, ref->pattern, g1, n1);
+          *indexedMs += romeTimeMs()-t;
+          (*nChecks)++;
+          if (!romeSameMatch(i0, i1, g0, g1, n0, n1, ref->nGpus, ref->nNics)) {
+            WARN("Rome model %d (shuffle %d%s, 16P1H) : exhaustive matching found model %d, indexed matching found model %d or another mapping",
+                m, s, cut ? ", cut" : "", i0, i1);
+            (*nFailures)++;
+          }
+        }
+      }
+    }
+  }
+  return ncclSuccess;
+}
+#endif
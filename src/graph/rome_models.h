@@ -28,4 +28,9 @@ ncclResult_t parseChordalRing(struct ncclTopoSystem* system, struct ncclTopoGrap
 ncclResult_t parse1H16P(struct ncclTopoSystem* system, struct ncclTopoGraph* graph);
 ncclResult_t parse4H4P(struct ncclTopoSystem* system, struct ncclTopoGraph* graph);
 
+#ifdef TOPO_EXPL
+// Compare the exhaustive and the indexed matching on shuffled built-in models
+ncclResult_t romeModelsCheckMatch(int nShuffles, int* nChecks, int* nFailures, double* exhaustiveMs, double* indexedMs);
+#endif
+
 #endif
\ No newline at end of file
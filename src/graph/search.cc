@@ -11,6 +11,11 @@
 #include "xml.h"
 #include <math.h>
 #include <sys/time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
 #include "rome_models.h"
 
 // Initialize system->maxWidth. This is the per-channel (i.e. per-SM)
@@ -62,9 +67,69 @@ static ncclResult_t findRevLink(struct ncclTopoNode* node1, struct ncclTopoNode*
   return ncclInternalError;
 }
 
+/* Pruning : a channel is only started if enough bandwidth is left for the
+ * graph to beat saveGraph (see ncclTopoSearchMaxChannels), and partial
+ * channels which could not be completed are remembered, so that the same
+ * GPUs reached in another order with the same bandwidth left are not
+ * explored again (see ncclTopoSearchMemoKey). Neither skips a graph which
+ * would replace saveGraph, so the same graphs are found in the same order,
+ * only using less of the time budget. */
+RCCL_PARAM(TopoSearchPrune, "TOPO_SEARCH_PRUNE", 1);
+
+#define NCCL_TOPO_SEARCH_MEMO_SIZE (1<<16)
+
+struct ncclTopoSearchMemoEntry {
+  uint64_t key[2];
+  uint64_t search;
+};
+
+// Search state of the calling thread, set by ncclTopoSearchTop.
+// Nothing here may depend on addresses or on previous searches : the steps
+// taken by a search must be the same on all ranks and threads.
+struct ncclTopoSearchCtx {
+  int prune;
+  struct ncclTopoSystem* system;
+  uint64_t linkSig[2];     // Signature of the width left on links
+  uint64_t steps;          // Calls to ncclTopoSearchRecGpu
+  uint64_t channels;       // Channels completed
+  // Partial channels which could not be completed. Kept until the end of
+  // ncclTopoCompute, entries of previous searches are ignored.
+  struct ncclTopoSearchMemoEntry* memo;
+  uint64_t search;
+  int* cancel;             // Set by the threads running speculative searches, see ncclTopoSearchRun
+};
+static thread_local struct ncclTopoSearchCtx ncclTopoSearchCtx;
+static uint64_t ncclTopoSearchTotalSteps = 0;
+
 // This is unfortunately needed since manipulating floats often results in rounding errors.
 #define SUB_ROUND(a, b) (a = roundf((a-b)*1000)/1000)
 
+static uint64_t searchMix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static uint32_t floatBits(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+// Remove speed from the link width, keeping the signature of link widths up to date
+static void subLinkWidth(struct ncclTopoLink* link, float speed) {
+  struct ncclTopoSearchCtx* ctx = &ncclTopoSearchCtx;
+  uint32_t before = floatBits(link->width);
+  SUB_ROUND(link->width, speed);
+  uint64_t delta = (uint64_t)floatBits(link->width) - before;
+  uint64_t id = (char*)link - (char*)ctx->system;
+  ctx->linkSig[0] += (searchMix(id)|1)*delta;
+  ctx->linkSig[1] += (searchMix(id^0x9e3779b97f4a7c15ULL)|1)*delta;
+}
+
 static ncclResult_t followPath(struct ncclTopoLinkList* path, struct ncclTopoNode* start, int maxSteps, float speed, int* steps) {
   float pciSpeed = speed;
   for (int step=0; step<path->count; step++) {
@@ -94,8 +159,8 @@ static ncclResult_t followPath(struct ncclTopoLinkList* path, struct ncclTopoNod
       revSpeed += fwSpeed;
     }
     if (link->width < fwSpeed || (revSpeed && revLink->width < revSpeed)) { *steps = step; return ncclSuccess; }
-    SUB_ROUND(link->width, fwSpeed);
-    if (revSpeed) SUB_ROUND(revLink->width, revSpeed);
+    subLinkWidth(link, fwSpeed);
+    if (revSpeed) subLinkWidth(revLink, revSpeed);
     node = link->remNode;
   }
   *steps = maxSteps;
@@ -265,6 +330,116 @@ ncclResult_t ncclTopoSearchRec(struct ncclTopoSystem* system, struct ncclTopoGra
 #define FORCED_ORDER_PCI 1
 #define FORCED_ORDER_REPLAY 2
 
+// Upper bound on the number of channels which can be added, given the width
+// left on the links going out of GPUs. Each channel goes out of all GPUs but
+// the last one of a tree.
+static int ncclTopoSearchMaxChannels(struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
+  int ngpus = system->nodes[GPU].count;
+  int maxChannels = graph->maxChannels-graph->nChannels;
+  if (ngpus == 1) return maxChannels;
+  float speed = graph->speedIntra;
+  if (system->nodes[NET].count && ngpus != system->nRanks) {
+    speed = std::min(speed, graph->pattern == NCCL_TOPO_PATTERN_BALANCED_TREE ? graph->speedInter/2 : graph->speedInter);
+  }
+  if (speed <= 0) return maxChannels;
+  int caps[NCCL_TOPO_MAX_NODES];
+  for (int g=0; g<ngpus; g++) {
+    struct ncclTopoNode* gpu = system->nodes[GPU].nodes+g;
+    caps[g] = 0;
+    // Leave some margin for the rounding of link widths
+    for (int l=0; l<gpu->nlinks; l++) caps[g] += (int)((gpu->links[l].width+.05)/speed);
+  }
+  if (system->nodes[NET].count && ngpus != system->nRanks) {
+    // Each channel also starts from a NIC, see ncclTopoSearchRecNet
+    float netSpeed = graph->speedInter;
+    if (netSpeed > 0) {
+      int netChannels = 0;
+      for (int n=0; n<system->nodes[NET].count; n++) {
+        struct ncclTopoNode* net = system->nodes[NET].nodes+n;
+        // Ports of the same NIC share their width, count them once
+        int first = 1;
+        for (int m=0; m<n; m++) {
+          struct ncclTopoNode* prev = system->nodes[NET].nodes+m;
+          if (prev->net.asic == net->net.asic && prev->net.port == net->net.port) first = 0;
+        }
+        if (first == 0) continue;
+        float width = 0;
+        int portChannels = 0;
+        for (int m=n; m<system->nodes[NET].count; m++) {
+          struct ncclTopoNode* port = system->nodes[NET].nodes+m;
+          if (port->net.asic != net->net.asic || port->net.port != net->net.port) continue;
+          if (graph->collNet && port->net.collSupport == 0) continue;
+          width = std::max(width, port->net.width);
+          portChannels += port->net.maxChannels;
+        }
+        netChannels += std::min(portChannels, (int)((width+.05)/netSpeed));
+      }
+      maxChannels = std::min(maxChannels, netChannels);
+    }
+  }
+  int hops = graph->pattern == NCCL_TOPO_PATTERN_RING ? ngpus : ngpus-1;
+  int n;
+  for (n=0; n<maxChannels; n++) {
+    int total = 0;
+    for (int g=0; g<ngpus; g++) total += std::min(caps[g], n+1);
+    if (total < (n+1)*hops) break;
+  }
+  return n;
+}
+
+#define MEMO_MIX(key, v) do { \
+  key[0] = searchMix(key[0] ^ (uint64_t)(v)); \
+  key[1] = searchMix(key[1] + (uint64_t)(v)*0x9e3779b97f4a7c15ULL); \
+} while (0)
+
+// Everything which decides whether the current channel can be completed from
+// this step on : GPUs already in the channel, current and first GPU, NICs,
+// and the width left on links.
+static void ncclTopoSearchMemoKey(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoNode* gpu, int step, int backToNet, int backToFirstRank, uint64_t* key) {
+  struct ncclTopoSearchCtx* ctx = &ncclTopoSearchCtx;
+  int ngpus = system->nodes[GPU].count;
+  int c = graph->nChannels;
+  const uint64_t flag = 1ULL<<c;
+  key[0] = ctx->linkSig[0];
+  key[1] = ctx->linkSig[1];
+  // Steps, channels and GPU indexes are below NCCL_TOPO_MAX_NODES
+  int g = gpu-system->nodes[GPU].nodes;
+  MEMO_MIX(key, c | step << 8 | (backToNet & 0xff) << 16 | (backToFirstRank & 0xff) << 24 | (uint64_t)g << 32);
+  MEMO_MIX(key, step == 0 ? gpu->gpu.rank : graph->intra[c*ngpus]);
+  uint64_t used[NCCL_TOPO_MAX_NODES/64] = { 0 };
+  for (int i=0; i<ngpus; i++) {
+    if (system->nodes[GPU].nodes[i].used & flag) used[i/64] |= 1ULL << (i%64);
+  }
+  for (int w=0; w<DIVUP(ngpus, 64); w++) MEMO_MIX(key, used[w]);
+  if (system->nodes[NET].count && ngpus != system->nRanks) {
+    MEMO_MIX(key, graph->inter[c*2]);
+    // Second NIC of balanced trees, once set
+    if (graph->pattern == NCCL_TOPO_PATTERN_BALANCED_TREE && (step > 0 || backToNet != 0)) MEMO_MIX(key, graph->inter[c*2+1]);
+  }
+}
+
+static int ncclTopoSearchMemoFind(struct ncclTopoSearchCtx* ctx, uint64_t* key) {
+  if (ctx->memo == NULL) return 0;
+  struct ncclTopoSearchMemoEntry* entry = ctx->memo+key[0]%NCCL_TOPO_SEARCH_MEMO_SIZE;
+  return entry->search == ctx->search && entry->key[0] == key[0] && entry->key[1] == key[1];
+}
+
+static ncclResult_t ncclTopoSearchMemoAdd(struct ncclTopoSearchCtx* ctx, uint64_t* key) {
+  if (ctx->memo == NULL) {
+    // Most searches only use a few entries, don't touch the whole table
+    ctx->memo = (struct ncclTopoSearchMemoEntry*)calloc(NCCL_TOPO_SEARCH_MEMO_SIZE, sizeof(struct ncclTopoSearchMemoEntry));
+    if (ctx->memo == NULL) {
+      WARN("Failed to allocate the search memo table");
+      return ncclSystemError;
+    }
+  }
+  struct ncclTopoSearchMemoEntry* entry = ctx->memo+key[0]%NCCL_TOPO_SEARCH_MEMO_SIZE;
+  entry->key[0] = key[0];
+  entry->key[1] = key[1];
+  entry->search = ctx->search;
+  return ncclSuccess;
+}
+
 ncclResult_t ncclTopoReplayGetGpu(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int step, int* g) {
   *g = -1;
   if (graph->nChannels == 0) return ncclInternalError;
@@ -342,11 +517,18 @@ ncclResult_t ncclTopoCompareGraphs(struct ncclTopoSystem* system, struct ncclTop
 }
 
 ncclResult_t ncclTopoSearchRecGpu(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoGraph* saveGraph, struct ncclTopoNode* gpu, int step, int backToNet, int backToFirstRank, int forcedOrder, int *time) {
+  struct ncclTopoSearchCtx* ctx = &ncclTopoSearchCtx;
   if ((*time) <= 0) return ncclSuccess;
+  if (((*time) & 1023) == 0 && ctx->cancel && __atomic_load_n(ctx->cancel, __ATOMIC_RELAXED)) {
+    *time = 0;
+    return ncclSuccess;
+  }
   (*time)--;
+  ctx->steps++;
 
   int ngpus = system->nodes[GPU].count;
   if (step == ngpus) {
+    ctx->channels++;
     // Determine whether we found a better solution or not
     int copy = 0;
     graph->nChannels++;
@@ -361,6 +543,16 @@ ncclResult_t ncclTopoSearchRecGpu(struct ncclTopoSystem* system, struct ncclTopo
     graph->nChannels--;
     return ncclSuccess;
   }
+
+  // Skip partial channels we already failed to complete
+  uint64_t key[2];
+  int memo = ctx->prune && forcedOrder == 0;
+  if (memo) {
+    ncclTopoSearchMemoKey(system, graph, gpu, step, backToNet, backToFirstRank, key);
+    if (ncclTopoSearchMemoFind(ctx, key)) return ncclSuccess;
+  }
+  uint64_t channels = ctx->channels;
+
   graph->intra[graph->nChannels*ngpus+step] = gpu->gpu.rank;
   int g = gpu - system->nodes[GPU].nodes;
   if (step == backToNet) {
@@ -426,6 +618,8 @@ ncclResult_t ncclTopoSearchRecGpu(struct ncclTopoSystem* system, struct ncclTopo
     // Next path
     NCCLCHECK(ncclTopoSearchRecGpu(system, graph, saveGraph, gpu, ngpus, -1, -1, forcedOrder, time));
   }
+  // Remember the channel could not be completed, unless we ran out of time
+  if (memo && ctx->channels == channels && *time > 0) NCCLCHECK(ncclTopoSearchMemoAdd(ctx, key));
   return ncclSuccess;
 }
 
@@ -607,6 +801,13 @@ ncclResult_t ncclTopoSearchParams(struct ncclTopoSystem* system, int pattern, in
 }
 
 ncclResult_t ncclTopoSearchRec(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoGraph* saveGraph, int* time) {
+  if (ncclTopoSearchCtx.prune) {
+    // Don't start a channel if we can't beat saveGraph
+    int maxChannels = ncclTopoSearchMaxChannels(system, graph);
+    int nChannels = graph->nChannels + maxChannels;
+    if (maxChannels == 0 || nChannels < graph->minChannels ||
+        nChannels*graph->speedIntra < saveGraph->nChannels*saveGraph->speedIntra) return ncclSuccess;
+  }
   int backToNet, backToFirstRank;
   NCCLCHECK(ncclTopoSearchParams(system, graph->pattern, &backToNet, &backToFirstRank));
   if (system->nodes[NET].count && system->nodes[GPU].count != system->nRanks) {
@@ -633,6 +834,30 @@ ncclResult_t ncclTopoSearchRec(struct ncclTopoSystem* system, struct ncclTopoGra
   return ncclSuccess;
 }
 
+// Search from a clean state of the calling thread
+static ncclResult_t ncclTopoSearchTop(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoGraph* saveGraph, int* time, int* cancel) {
+  struct ncclTopoSearchCtx* ctx = &ncclTopoSearchCtx;
+  ctx->prune = rcclParamTopoSearchPrune();
+  ctx->system = system;
+  ctx->linkSig[0] = ctx->linkSig[1] = 0;
+  ctx->steps = ctx->channels = 0;
+  ctx->search++;
+  ctx->cancel = cancel;
+  ncclResult_t ret = ncclTopoSearchRec(system, graph, saveGraph, time);
+  __atomic_fetch_add(&ncclTopoSearchTotalSteps, ctx->steps, __ATOMIC_RELAXED);
+  return ret;
+}
+
+static void ncclTopoSearchFreeMemo() {
+  free(ncclTopoSearchCtx.memo);
+  ncclTopoSearchCtx.memo = NULL;
+}
+
+ncclResult_t ncclTopoGetSearchSteps(uint64_t* steps) {
+  *steps = __atomic_load_n(&ncclTopoSearchTotalSteps, __ATOMIC_RELAXED);
+  return ncclSuccess;
+}
+
 /************************************/
 /* User defined graph from XML file */
 /************************************/
@@ -770,6 +995,488 @@ float speedArrayInter[] = { 48.0, 30.0, 24.0, 22.0, 18.0, 15.0, 12.0, 10.0, 9.0,
 RCCL_PARAM(ModelMatchingDisable, "MODEL_MATCHING_DISABLE", 0);
 RCCL_PARAM(EnableMultipleSAT, "ENABLE_MULTIPLE_SAT", 0);
 
+/* Graph cache : when NCCL_GRAPH_CACHE_DIR is set, graphs found by the search
+ * are saved there in the NCCL_GRAPH_FILE format, keyed by a hash of the system
+ * and of the search parameters, and reloaded instead of searching again. */
+
+// Bump when the search changes, to invalidate existing caches
+#define NCCL_GRAPH_CACHE_VERSION 1
+
+static uint64_t graphCacheMix(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i=0; i<size; i++) hash = ((hash << 5) + hash) ^ bytes[i];
+  return hash;
+}
+#define GRAPH_CACHE_MIX(hash, value) hash = graphCacheMix(hash, &(value), sizeof(value))
+
+static uint64_t ncclTopoGraphCacheKey(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int crossNic, int ccMin) {
+  uint64_t key = 5381;
+  int version = NCCL_GRAPH_CACHE_VERSION;
+  GRAPH_CACHE_MIX(key, version);
+  // The XML covers nodes and links ; the paths also cover what was trimmed
+  // for this communicator and the P2P/GDR level settings.
+  GRAPH_CACHE_MIX(key, system->xmlHash);
+  GRAPH_CACHE_MIX(key, system->nRanks);
+  GRAPH_CACHE_MIX(key, system->type);
+  GRAPH_CACHE_MIX(key, system->maxWidth);
+  GRAPH_CACHE_MIX(key, system->totalWidth);
+  GRAPH_CACHE_MIX(key, ccMin);
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) GRAPH_CACHE_MIX(key, system->nodes[t].count);
+  for (int g=0; g<system->nodes[GPU].count; g++) {
+    struct ncclTopoNode* gpu = system->nodes[GPU].nodes+g;
+    GRAPH_CACHE_MIX(key, gpu->gpu.dev);
+    GRAPH_CACHE_MIX(key, gpu->gpu.rank);
+    int types[] = { GPU, NET };
+    for (int i=0; i<2; i++) {
+      for (int n=0; n<system->nodes[types[i]].count; n++) {
+        struct ncclTopoLinkList* path = gpu->paths[types[i]]+n;
+        GRAPH_CACHE_MIX(key, path->type);
+        GRAPH_CACHE_MIX(key, path->width);
+        GRAPH_CACHE_MIX(key, path->count);
+      }
+    }
+  }
+  for (int n=0; n<system->nodes[NET].count; n++) GRAPH_CACHE_MIX(key, system->nodes[NET].nodes[n].id);
+  GRAPH_CACHE_MIX(key, graph->id);
+  GRAPH_CACHE_MIX(key, graph->pattern);
+  GRAPH_CACHE_MIX(key, graph->crossNic);
+  GRAPH_CACHE_MIX(key, crossNic);
+  GRAPH_CACHE_MIX(key, graph->collNet);
+  GRAPH_CACHE_MIX(key, graph->minChannels);
+  GRAPH_CACHE_MIX(key, graph->maxChannels);
+  return key;
+}
+
+static void ncclTopoGraphCachePath(const char* dir, uint64_t key, char* path) {
+  snprintf(path, PATH_MAX, "%s/graph-%016lx.xml", dir, key);
+}
+
+static ncclResult_t ncclTopoGraphCacheLoad(const char* dir, uint64_t key, struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int crossNic, int* hit) {
+  *hit = 0;
+  char path[PATH_MAX];
+  ncclTopoGraphCachePath(dir, key, path);
+  if (access(path, R_OK) != 0) return ncclSuccess;
+  // Load into a copy so that a bad entry leaves the search parameters untouched
+  struct ncclXml* xml;
+  struct ncclTopoGraph* cached;
+  NCCLCHECK(ncclCalloc(&xml, 1));
+  NCCLCHECK(ncclCalloc(&cached, 1));
+  memcpy(cached, graph, sizeof(struct ncclTopoGraph));
+  // The search may have settled on crossNic if it was permitted
+  cached->crossNic = crossNic;
+  // A search without solution (e.g. CollNet) is cached with 0 channels
+  int nChannels = -1;
+  ncclResult_t res = ncclTopoGetXmlGraphFromFile(path, xml);
+  if (res == ncclSuccess) res = ncclTopoGetGraphFromXml(xml->nodes, system, cached, &nChannels);
+  if (res != ncclSuccess || nChannels == -1) {
+    // Fall back to the search, which will overwrite the entry
+    INFO(NCCL_GRAPH, "Ignoring graph cache entry %s", path);
+  } else {
+    INFO(NCCL_GRAPH, "Search %d : %d channels loaded from graph cache %s", graph->id, nChannels, path);
+    memcpy(graph, cached, sizeof(struct ncclTopoGraph));
+    *hit = 1;
+  }
+  free(cached);
+  free(xml);
+  return ncclSuccess;
+}
+
+static ncclResult_t ncclTopoGraphCacheSave(const char* dir, uint64_t key, struct ncclTopoSystem* system, struct ncclTopoGraph* graph) {
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    INFO(NCCL_GRAPH, "Could not create graph cache directory %s : %s", dir, strerror(errno));
+    return ncclSuccess;
+  }
+  if (access(dir, W_OK) != 0) return ncclSuccess;
+  char path[PATH_MAX], tmpPath[PATH_MAX];
+  ncclTopoGraphCachePath(dir, key, path);
+  // Write to a private file then rename, so that concurrent ranks never read a partial entry
+  if (snprintf(tmpPath, PATH_MAX, "%s.%d.%lx", path, getpid(), (unsigned long)pthread_self()) >= PATH_MAX) {
+    INFO(NCCL_GRAPH, "Graph cache path %s too long, not saving", path);
+    return ncclSuccess;
+  }
+  struct ncclXml* xml;
+  NCCLCHECK(ncclCalloc(&xml, 1));
+  ncclResult_t res = ncclTopoGetXmlFromGraphs(1, &graph, system, xml);
+  if (res == ncclSuccess) res = ncclTopoDumpXmlToFile(tmpPath, xml);
+  free(xml);
+  // The cache is only an optimization, never fail the init because of it
+  if (res != ncclSuccess) {
+    INFO(NCCL_GRAPH, "Could not write graph cache entry %s", tmpPath);
+    unlink(tmpPath);
+    return ncclSuccess;
+  }
+  if (rename(tmpPath, path) != 0) {
+    INFO(NCCL_GRAPH, "Could not save graph cache entry %s : %s", path, strerror(errno));
+    unlink(tmpPath);
+  }
+  return ncclSuccess;
+}
+
+/******************/
+/* Search passes  */
+/******************/
+
+struct ncclTopoSearchState {
+  int pass;
+  int speedIndex;
+  int64_t globalTimeout;
+  int crossNic;
+  int nspeeds;
+  float* speedArray;
+};
+
+// Prepare tmpGraph for a new search and return its timeout
+static int ncclTopoSearchStart(struct ncclTopoSearchState* state, struct ncclTopoGraph* tmpGraph) {
+  int time = tmpGraph->sameChannels ? NCCL_SEARCH_TIMEOUT_SAMECHANNELS :
+    tmpGraph->pattern == NCCL_TOPO_PATTERN_TREE ? NCCL_SEARCH_TIMEOUT_TREE : NCCL_SEARCH_TIMEOUT;
+  tmpGraph->nChannels = 0;
+  state->globalTimeout -= time;
+  return time;
+}
+
+static int ncclTopoSearchNextPass1(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoGraph* tmpGraph, struct ncclTopoSearchState* state, int time) {
+  int ngpus = system->nodes[GPU].count;
+  // Optimal solution, stop here
+  if (time == -1) return 0;
+  if (graph->nChannels*graph->speedInter >= system->totalWidth) return 0;
+
+  // First pass, we don't have a solution yet ; try other options
+
+  // Try having different channels
+  if (tmpGraph->sameChannels == 1) {
+    tmpGraph->sameChannels = 0;
+    return 1;
+  }
+  tmpGraph->sameChannels = 1;
+
+  if (time != -1) state->globalTimeout += time;
+  else state->globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
+  if (state->globalTimeout < 0 && graph->nChannels) return 0;
+
+  int maxTypeIntra = system->nodes[NET].count > 0 ? tmpGraph->typeInter : PATH_SYS;
+  if (tmpGraph->typeIntra < maxTypeIntra && (graph->nChannels == 0 || tmpGraph->typeIntra < graph->typeIntra)) {
+    tmpGraph->typeIntra += 1;
+    return 1;
+  }
+  tmpGraph->typeIntra = ngpus == 1 ? PATH_LOC : PATH_NVL;
+  if (system->nodes[NET].count > 0 && tmpGraph->typeInter < PATH_SYS && (graph->nChannels == 0 || tmpGraph->typeInter < graph->typeInter || tmpGraph->typeInter < PATH_PXB)) {
+    tmpGraph->typeInter += 1;
+    return 1;
+  }
+  tmpGraph->typeInter = PATH_PIX;
+
+  // Try a simpler tree
+  if (tmpGraph->pattern == NCCL_TOPO_PATTERN_SPLIT_TREE) {
+    tmpGraph->pattern = NCCL_TOPO_PATTERN_TREE;
+    return 1;
+  }
+  tmpGraph->pattern = graph->pattern;
+
+  if (state->crossNic && tmpGraph->crossNic == 0) {
+    // Try again with crossNic if permitted
+    tmpGraph->crossNic = state->crossNic;
+    return 1;
+  }
+  tmpGraph->crossNic = 0;
+
+  // Decrease speed until we find a solution
+  if ((state->speedIndex < state->nspeeds-1) && (graph->nChannels == 0 || (state->speedArray[state->speedIndex+1]/graph->speedInter > .49))) {
+    tmpGraph->speedInter = tmpGraph->speedIntra = state->speedArray[++state->speedIndex];
+    return 1;
+  }
+  return 0;
+}
+
+// Set the parameters of the next search in tmpGraph, given the remaining time
+// of the last one. Returns 0 when we are done.
+static int ncclTopoSearchNext(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, struct ncclTopoGraph* tmpGraph, struct ncclTopoSearchState* state, int time) {
+  if (state->pass == 1) {
+    if (ncclTopoSearchNextPass1(system, graph, tmpGraph, state, time)) return 1;
+    // We have a solution. Start from that solution and move to pass 2.
+    time = -1;
+    memcpy(tmpGraph, graph, sizeof(struct ncclTopoGraph));
+    state->speedIndex = 0;
+    while (state->speedArray[state->speedIndex] > graph->speedInter && state->speedIndex < state->nspeeds-1) state->speedIndex++;
+    tmpGraph->speedIntra = tmpGraph->speedInter = state->speedArray[state->speedIndex];
+    tmpGraph->minChannels = graph->nChannels;
+    state->pass = 2;
+  }
+
+  // 3. See if we can increase speedIntra for trees (2 nodes or collnet)
+  if (time != 0 && graph->pattern != NCCL_TOPO_PATTERN_RING &&
+      tmpGraph->speedIntra == graph->speedIntra && tmpGraph->speedIntra < tmpGraph->speedInter*2 &&
+      state->speedIndex > 0) {
+    tmpGraph->speedIntra = state->speedArray[--state->speedIndex];
+    return 1;
+  }
+  return 0;
+}
+
+/*******************/
+/* Parallel search */
+/*******************/
+
+// Each search depends on the best graph found by the previous ones, and
+// searches share the link bandwidth of the system, so they can't simply run
+// concurrently. Instead, worker threads run ahead the searches which would
+// follow if the best graph did not change and searches timed out, each worker
+// on its own copy of the system. A result is only used if the serial search
+// would have run the same search from the same best graph, so the graphs are
+// the same whatever the number of threads, which matters since ranks build
+// rings from each other's graphs. Searches made useless by a new best graph
+// are cancelled.
+RCCL_PARAM(TopoSearchThreads, "TOPO_SEARCH_THREADS", 0);
+#define NCCL_TOPO_SEARCH_MAX_THREADS 16
+
+// Part of the graph which defines a search: everything up to the channels
+#define NCCL_TOPO_SEARCH_PARAMS_SIZE offsetof(struct ncclTopoGraph, intra)
+
+struct ncclTopoSearchJob {
+  char params[NCCL_TOPO_SEARCH_PARAMS_SIZE];
+  struct ncclTopoGraph graph;     // Search parameters, then work space
+  struct ncclTopoGraph saveGraph; // Best graph when the search was queued, then result
+  int version;                    // Version of the best graph saveGraph was copied from
+  int timeout;
+  int time;                       // Time left at the end of the search
+  int done;
+  int cancel;
+  ncclResult_t ret;
+};
+
+struct ncclTopoSearchPool;
+struct ncclTopoSearchWorker {
+  struct ncclTopoSearchPool* pool;
+  struct ncclTopoSystem* system;
+  pthread_t thread;
+};
+
+struct ncclTopoSearchPool {
+  int nThreads;
+  struct ncclTopoSearchWorker workers[NCCL_TOPO_SEARCH_MAX_THREADS];
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int stop;
+  // Circular queue of searches, in the order they would run serially.
+  // Jobs in [head, next) are running or done, jobs in [next, tail) are waiting.
+  struct ncclTopoSearchJob* jobs;
+  int nJobs;
+  int head, next, tail;
+  int nQueued, nUsed;
+  int version;                      // Incremented every time the best graph changes
+  struct ncclTopoGraph bestGraph;   // Best graph at that version
+  struct ncclTopoGraph predGraph;   // Work space to predict the next searches
+};
+
+// Copy of the system the search can run on. Only paths from GPUs and NICs are needed.
+static ncclResult_t ncclTopoSearchCopySystem(struct ncclTopoSystem* system, struct ncclTopoSystem** copyRet) {
+  struct ncclTopoSystem* copy;
+  NCCLCHECK(ncclCalloc(&copy, 1));
+  // Only copy the nodes in use, the system is mostly empty
+  memcpy(&copy->maxWidth, &system->maxWidth, sizeof(struct ncclTopoSystem)-offsetof(struct ncclTopoSystem, maxWidth));
+  intptr_t offset = (char*)copy - (char*)system;
+  // Drop all paths first so that the copy can be freed at any point below
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    copy->nodes[t].count = system->nodes[t].count;
+    memcpy(copy->nodes[t].nodes, system->nodes[t].nodes, system->nodes[t].count*sizeof(struct ncclTopoNode));
+    for (int n=0; n<copy->nodes[t].count; n++) {
+      struct ncclTopoNode* node = copy->nodes[t].nodes+n;
+      for (int l=0; l<node->nlinks; l++) node->links[l].remNode = (struct ncclTopoNode*)((char*)node->links[l].remNode + offset);
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) node->paths[p] = NULL;
+    }
+  }
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    if (t != GPU && t != NET) continue;
+    for (int n=0; n<copy->nodes[t].count; n++) {
+      struct ncclTopoNode* node = copy->nodes[t].nodes+n;
+      struct ncclTopoNode* orig = system->nodes[t].nodes+n;
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        if (orig->paths[p] == NULL) continue;
+        // Paths and their hops are copied in a single allocation
+        int nHops = 0;
+        for (int i=0; i<system->nodes[p].count; i++) nHops += orig->paths[p][i].count;
+        size_t bytes = system->nodes[p].count*sizeof(struct ncclTopoLinkList) + nHops*sizeof(struct ncclTopoLink*);
+        node->paths[p] = (struct ncclTopoLinkList*)malloc(bytes);
+        if (node->paths[p] == NULL) {
+          WARN("Failed to malloc %ld bytes", bytes);
+          ncclTopoFree(copy);
+          return ncclSystemError;
+        }
+        struct ncclTopoLink** hops = (struct ncclTopoLink**)(node->paths[p]+system->nodes[p].count);
+        for (int i=0; i<system->nodes[p].count; i++) {
+          struct ncclTopoLinkList* src = orig->paths[p]+i;
+          struct ncclTopoLinkList* dst = node->paths[p]+i;
+          dst->list = hops;
+          dst->count = src->count;
+          dst->width = src->width;
+          dst->type = src->type;
+          for (int h=0; h<src->count; h++) dst->list[h] = (struct ncclTopoLink*)((char*)src->list[h] + offset);
+          hops += src->count;
+        }
+      }
+    }
+  }
+  *copyRet = copy;
+  return ncclSuccess;
+}
+
+static void* ncclTopoSearchWorkerMain(void* arg) {
+  struct ncclTopoSearchWorker* worker = (struct ncclTopoSearchWorker*)arg;
+  struct ncclTopoSearchPool* pool = worker->pool;
+  pthread_mutex_lock(&pool->mutex);
+  while (!pool->stop) {
+    if (pool->next == pool->tail) {
+      pthread_cond_wait(&pool->cond, &pool->mutex);
+      continue;
+    }
+    struct ncclTopoSearchJob* job = pool->jobs+(pool->next++)%pool->nJobs;
+    pthread_mutex_unlock(&pool->mutex);
+    job->time = job->timeout;
+    job->ret = ncclTopoSearchTop(worker->system, &job->graph, &job->saveGraph, &job->time, &job->cancel);
+    pthread_mutex_lock(&pool->mutex);
+    job->done = 1;
+    pthread_cond_broadcast(&pool->cond);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  ncclTopoSearchFreeMemo();
+  return NULL;
+}
+
+static void ncclTopoSearchPoolDestroy(struct ncclTopoSearchPool* pool, int id);
+
+static ncclResult_t ncclTopoSearchPoolCreate(struct ncclTopoSystem* system, struct ncclTopoGraph* graph, int nThreads, struct ncclTopoSearchPool** poolRet) {
+  struct ncclTopoSearchPool* pool;
+  ncclResult_t ret = ncclSuccess;
+  int w;
+  NCCLCHECK(ncclCalloc(&pool, 1));
+  nThreads = std::min(nThreads, NCCL_TOPO_SEARCH_MAX_THREADS);
+  // One job per thread, plus the one we wait for
+  pool->nJobs = nThreads+1;
+  memcpy(&pool->bestGraph, graph, sizeof(struct ncclTopoGraph));
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  NCCLCHECKGOTO(ncclCalloc(&pool->jobs, pool->nJobs), ret, fail);
+  // nThreads only counts the workers started, which are the ones Destroy joins
+  for (w=0; w<nThreads; w++) {
+    struct ncclTopoSearchWorker* worker = pool->workers+w;
+    worker->pool = pool;
+    NCCLCHECKGOTO(ncclTopoSearchCopySystem(system, &worker->system), ret, fail);
+    if (pthread_create(&worker->thread, NULL, ncclTopoSearchWorkerMain, worker) != 0) {
+      WARN("Search %d : failed to create search thread %d", graph->id, w);
+      ncclTopoFree(worker->system);
+      ret = ncclSystemError;
+      goto fail;
+    }
+    pool->nThreads++;
+  }
+  INFO(NCCL_GRAPH, "Search %d : using %d threads", graph->id, pool->nThreads);
+  *poolRet = pool;
+  return ncclSuccess;
+fail:
+  ncclTopoSearchPoolDestroy(pool, graph->id);
+  return ret;
+}
+
+// Cancel jobs from position 'from' in the queue. Called with the mutex held.
+static void ncclTopoSearchTruncate(struct ncclTopoSearchPool* pool, int from) {
+  for (int j=from; j<pool->tail; j++) __atomic_store_n(&pool->jobs[j%pool->nJobs].cancel, 1, __ATOMIC_RELAXED);
+  // Running jobs notice they were cancelled quickly ; wait for them before reusing their slots
+  for (int j=from; j<pool->next; j++) {
+    while (pool->jobs[j%pool->nJobs].done == 0) pthread_cond_wait(&pool->cond, &pool->mutex);
+  }
+  if (pool->next > from) pool->next = from;
+  pool->tail = from;
+}
+
+static void ncclTopoSearchPoolDestroy(struct ncclTopoSearchPool* pool, int id) {
+  INFO(NCCL_GRAPH, "Search %d : used %d/%d searches run ahead", id, pool->nUsed, pool->nQueued);
+  pthread_mutex_lock(&pool->mutex);
+  ncclTopoSearchTruncate(pool, pool->head);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->mutex);
+  for (int w=0; w<pool->nThreads; w++) {
+    pthread_join(pool->workers[w].thread, NULL);
+    ncclTopoFree(pool->workers[w].system);
+  }
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->cond);
+  free(pool->jobs);
+  free(pool);
+}
+
+static int ncclTopoSearchJobMatch(struct ncclTopoSearchPool* pool, struct ncclTopoSearchJob* job, struct ncclTopoGraph* tmpGraph, int timeout) {
+  return job->version == pool->version && job->timeout == timeout &&
+    memcmp(job->params, tmpGraph, NCCL_TOPO_SEARCH_PARAMS_SIZE) == 0;
+}
+
+// Queue the searches following the current one, keeping the jobs already
+// queued from position 'pos' if they are still the right ones. Called with
+// the mutex held.
+static void ncclTopoSearchPredict(struct ncclTopoSearchPool* pool, struct ncclTopoSystem* system, struct ncclTopoSearchState* current, struct ncclTopoGraph* tmpGraph, int pos) {
+  struct ncclTopoGraph* graph = &pool->bestGraph;
+  struct ncclTopoGraph* pred = &pool->predGraph;
+  struct ncclTopoSearchState state = *current;
+  memcpy(pred, tmpGraph, NCCL_TOPO_SEARCH_PARAMS_SIZE);
+  while (pos - pool->head < pool->nJobs && ncclTopoSearchNext(system, graph, pred, &state, 0)) {
+    int timeout = ncclTopoSearchStart(&state, pred);
+    if (pos < pool->tail) {
+      if (ncclTopoSearchJobMatch(pool, pool->jobs+pos%pool->nJobs, pred, timeout)) {
+        pos++;
+        continue;
+      }
+      ncclTopoSearchTruncate(pool, pos);
+    }
+    struct ncclTopoSearchJob* job = pool->jobs+pos%pool->nJobs;
+    memcpy(job->params, pred, NCCL_TOPO_SEARCH_PARAMS_SIZE);
+    memcpy(&job->graph, pred, NCCL_TOPO_SEARCH_PARAMS_SIZE);
+    memcpy(&job->saveGraph, graph, sizeof(struct ncclTopoGraph));
+    job->version = pool->version;
+    job->timeout = timeout;
+    job->done = job->cancel = 0;
+    pool->tail = ++pos;
+    pool->nQueued++;
+  }
+  if (pos < pool->tail) ncclTopoSearchTruncate(pool, pos);
+}
+
+// Run the search defined by tmpGraph, either by taking the result from a
+// worker thread if it ran the same search, or here on the system.
+static ncclResult_t ncclTopoSearchRun(struct ncclTopoSearchPool* pool, struct ncclTopoSystem* system, struct ncclTopoGraph* tmpGraph, struct ncclTopoGraph* graph, struct ncclTopoSearchState* state, int* time) {
+  if (pool == NULL) return ncclTopoSearchTop(system, tmpGraph, graph, time, NULL);
+
+  pthread_mutex_lock(&pool->mutex);
+  struct ncclTopoSearchJob* job = NULL;
+  if (pool->head < pool->tail && ncclTopoSearchJobMatch(pool, pool->jobs+pool->head%pool->nJobs, tmpGraph, *time)) {
+    job = pool->jobs+pool->head%pool->nJobs;
+  } else {
+    ncclTopoSearchTruncate(pool, pool->head);
+  }
+  ncclTopoSearchPredict(pool, system, state, tmpGraph, pool->head + (job ? 1 : 0));
+  pthread_cond_broadcast(&pool->cond);
+
+  ncclResult_t ret = ncclSuccess;
+  if (job) {
+    while (job->done == 0) pthread_cond_wait(&pool->cond, &pool->mutex);
+    pool->head++;
+    pool->nUsed++;
+    ret = job->ret;
+    *time = job->time;
+    memcpy(graph, &job->saveGraph, sizeof(struct ncclTopoGraph));
+  } else {
+    pthread_mutex_unlock(&pool->mutex);
+    ret = ncclTopoSearchTop(system, tmpGraph, graph, time, NULL);
+    pthread_mutex_lock(&pool->mutex);
+  }
+  if (ret == ncclSuccess && memcmp(graph, &pool->bestGraph, sizeof(struct ncclTopoGraph)) != 0) {
+    // New best graph, other searches need to restart from it
+    memcpy(&pool->bestGraph, graph, sizeof(struct ncclTopoGraph));
+    pool->version++;
+    ncclTopoSearchTruncate(pool, pool->head);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return ret;
+}
+
 ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph) {
   int ngpus = system->nodes[GPU].count;
   int crossNic = (system->nodes[NET].count > 1) && graph->crossNic ? 1 : 0;
@@ -829,121 +1536,59 @@ ncclResult_t ncclTopoCompute(ncclTopoSystem* system, struct ncclTopoGraph* graph
   int ccMin;
   NCCLCHECK(ncclTopoGetCompCap(system, &ccMin, NULL));
 
-  struct ncclTopoGraph tmpGraph;
-  memcpy(&tmpGraph, graph, sizeof(struct ncclTopoGraph));
+  char* cacheDir = getenv("NCCL_GRAPH_CACHE_DIR");
+  uint64_t cacheKey = 0;
+  if (cacheDir) {
+    cacheKey = ncclTopoGraphCacheKey(system, graph, crossNic, ccMin);
+    int hit;
+    NCCLCHECK(ncclTopoGraphCacheLoad(cacheDir, cacheKey, system, graph, crossNic, &hit));
+    if (hit) return ncclSuccess;
+  }
 
   // First try crossnic, then decrease speed and finally increase speedIntra.
-  int nspeeds = 0;
-  float* speedArray = NULL;
+  struct ncclTopoSearchState state;
+  state.crossNic = crossNic;
   if (system->nodes[NET].count == 0) {
-    nspeeds = NSPEEDSINTRA;
-    speedArray = speedArrayIntra;
+    state.nspeeds = NSPEEDSINTRA;
+    state.speedArray = speedArrayIntra;
   } else {
-    nspeeds = NSPEEDSINTER;
-    speedArray = speedArrayInter;
-  }
-  int pass = 1;
-  int speedIndex = 0;
-  while (speedArray[speedIndex] > system->maxWidth && speedIndex < nspeeds-1) speedIndex++;
-  tmpGraph.speedIntra = tmpGraph.speedInter = speedArray[speedIndex];
-  int64_t globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
-
-search:
-  int time = tmpGraph.sameChannels ? NCCL_SEARCH_TIMEOUT_SAMECHANNELS :
-    tmpGraph.pattern == NCCL_TOPO_PATTERN_TREE ? NCCL_SEARCH_TIMEOUT_TREE : NCCL_SEARCH_TIMEOUT;
-  tmpGraph.nChannels = 0;
-  globalTimeout -= time;
-
-  NCCLCHECK(ncclTopoSearchRec(system, &tmpGraph, graph, &time));
-#if 0
-  printf("Pattern %d, crossNic %d, Speed %g/%g, type %d/%d, channels %d-%d sameChannels %d -> nChannels %dx%g/%g %s\n", tmpGraph.pattern, tmpGraph.crossNic, tmpGraph.speedInter, tmpGraph.speedIntra, tmpGraph.typeInter, tmpGraph.typeIntra, tmpGraph.minChannels, tmpGraph.maxChannels, tmpGraph.sameChannels, graph->nChannels, graph->speedInter, graph->speedIntra, time == 0 ? "TIMEOUT" : time == -1 ? "PERFECT" : "");
-  for (int c=0; c<graph->nChannels; c++) {
-    printf("%2d : ", c);
-    for (int g=0; g<ngpus; g++) {
-      printf("%d ", graph->intra[c*ngpus+g]);
-    }
-    printf("[%d %d]", graph->inter[c*2+0], graph->inter[c*2+1]);
-    printf("\n");
-  }
-#endif
-  // Optimal solution, stop here
-  if (time == -1) goto done;
-  if (graph->nChannels*graph->speedInter >= system->totalWidth) goto done;
-
-  if (pass == 1) {
-    // First pass, we don't have a solution yet ; try other options
-
-    // Try having different channels
-    if (tmpGraph.sameChannels == 1) {
-      tmpGraph.sameChannels = 0;
-      goto search;
-    }
-    tmpGraph.sameChannels = 1;
-
-    if (time != -1) globalTimeout += time;
-    else globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
-    if (globalTimeout < 0 && graph->nChannels) goto done;
-
-    int maxTypeIntra = system->nodes[NET].count > 0 ? tmpGraph.typeInter : PATH_SYS;
-    if (tmpGraph.typeIntra < maxTypeIntra && (graph->nChannels == 0 || tmpGraph.typeIntra < graph->typeIntra)) {
-      tmpGraph.typeIntra += 1;
-      goto search;
-    }
-    tmpGraph.typeIntra = ngpus == 1 ? PATH_LOC : PATH_NVL;
-    if (system->nodes[NET].count > 0 && tmpGraph.typeInter < PATH_SYS && (graph->nChannels == 0 || tmpGraph.typeInter < graph->typeInter || tmpGraph.typeInter < PATH_PXB)) {
-      tmpGraph.typeInter += 1;
-      goto search;
-    }
-    tmpGraph.typeInter = PATH_PIX;
-
-    // Try a simpler tree
-    if (tmpGraph.pattern == NCCL_TOPO_PATTERN_SPLIT_TREE) {
-      tmpGraph.pattern = NCCL_TOPO_PATTERN_TREE;
-      goto search;
-    }
-    tmpGraph.pattern = graph->pattern;
-
-    if (crossNic && tmpGraph.crossNic == 0) {
-      // Try again with crossNic if permitted
-      tmpGraph.crossNic = crossNic;
-      goto search;
-    }
-    tmpGraph.crossNic = 0;
-
-    // Decrease speed until we find a solution
-    if ((speedIndex < nspeeds-1) && (graph->nChannels == 0 || (speedArray[speedIndex+1]/graph->speedInter > .49))) {
-      tmpGraph.speedInter = tmpGraph.speedIntra = speedArray[++speedIndex];
-      goto search;
-    }
-    speedIndex = 0;
-    while (speedArray[speedIndex] > system->maxWidth && speedIndex < nspeeds-1) speedIndex++;
-    tmpGraph.speedIntra = tmpGraph.speedInter = speedArray[speedIndex];
-
+    state.nspeeds = NSPEEDSINTER;
+    state.speedArray = speedArrayInter;
   }
+  state.pass = 1;
+  state.speedIndex = 0;
+  while (state.speedArray[state.speedIndex] > system->maxWidth && state.speedIndex < state.nspeeds-1) state.speedIndex++;
+  state.globalTimeout = NCCL_SEARCH_GLOBAL_TIMEOUT;
 
-done:
-  // We have a solution. Start from that solution and move to pass 2.
-  if (pass == 1) {
-    time = -1;
-    memcpy(&tmpGraph, graph, sizeof(tmpGraph));
-    speedIndex = 0;
-    while (speedArray[speedIndex] > graph->speedInter && speedIndex < nspeeds-1) speedIndex++;
-    tmpGraph.speedIntra = tmpGraph.speedInter = speedArray[speedIndex];
-    tmpGraph.minChannels = graph->nChannels;
-    pass = 2;
-  }
-
-  // 3. See if we can increase speedIntra for trees (2 nodes or collnet)
-  if (pass == 2) {
-    if (time != 0 && graph->pattern != NCCL_TOPO_PATTERN_RING &&
-        tmpGraph.speedIntra == graph->speedIntra && tmpGraph.speedIntra < tmpGraph.speedInter*2 &&
-        speedIndex > 0) {
-      tmpGraph.speedIntra = speedArray[--speedIndex];
-      goto search;
+  struct ncclTopoGraph tmpGraph;
+  memcpy(&tmpGraph, graph, sizeof(struct ncclTopoGraph));
+  tmpGraph.speedIntra = tmpGraph.speedInter = state.speedArray[state.speedIndex];
+
+  struct ncclTopoSearchPool* pool = NULL;
+  int nThreads = rcclParamTopoSearchThreads();
+  ncclResult_t ret = ncclSuccess;
+  int time;
+  do {
+    time = ncclTopoSearchStart(&state, &tmpGraph);
+    NCCLCHECKGOTO(ncclTopoSearchRun(pool, system, &tmpGraph, graph, &state, &time), ret, out);
+    // Start threads once a search times out ; most searches are too short to need them
+    if (time == 0 && pool == NULL && nThreads > 1) NCCLCHECKGOTO(ncclTopoSearchPoolCreate(system, graph, nThreads, &pool), ret, out);
+#if 0
+    printf("Pattern %d, crossNic %d, Speed %g/%g, type %d/%d, channels %d-%d sameChannels %d -> nChannels %dx%g/%g %s\n", tmpGraph.pattern, tmpGraph.crossNic, tmpGraph.speedInter, tmpGraph.speedIntra, tmpGraph.typeInter, tmpGraph.typeIntra, tmpGraph.minChannels, tmpGraph.maxChannels, tmpGraph.sameChannels, graph->nChannels, graph->speedInter, graph->speedIntra, time == 0 ? "TIMEOUT" : time == -1 ? "PERFECT" : "");
+    for (int c=0; c<graph->nChannels; c++) {
+      printf("%2d : ", c);
+      for (int g=0; g<ngpus; g++) {
+        printf("%d ", graph->intra[c*ngpus+g]);
+      }
+      printf("[%d %d]", graph->inter[c*2+0], graph->inter[c*2+1]);
+      printf("\n");
     }
-    time = -1;
-    memcpy(&tmpGraph, graph, sizeof(tmpGraph));
-  }
+#endif
+  } while (ncclTopoSearchNext(system, graph, &tmpGraph, &state, time));
+out:
+  if (pool) ncclTopoSearchPoolDestroy(pool, graph->id);
+  ncclTopoSearchFreeMemo();
+  NCCLCHECK(ret);
 
   if (graph->nChannels == 0 && graph->collNet == 0) {
     WARN("Could not find a path for pattern %d, falling back to simple order", graph->pattern);
@@ -963,6 +1608,7 @@ done:
     graph->speedInter /= DIVUP(dupChannels, graph->nChannels);
     graph->nChannels = dupChannels;
   }
+  if (cacheDir) NCCLCHECK(ncclTopoGraphCacheSave(cacheDir, cacheKey, system, graph));
   return ncclSuccess;
 }
 
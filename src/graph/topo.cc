@@ -108,6 +108,8 @@ ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNo
   }
   struct ncclTopoNode* n = system->nodes[type].nodes+system->nodes[type].count;
   system->nodes[type].count++;
+  // Paths need to be recomputed
+  system->pathsValid = 0;
   n->type = type;
   n->id = id;
   if (type == GPU) {
@@ -134,8 +136,10 @@ ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNo
 
 ncclResult_t ncclTopoRemoveNode(struct ncclTopoSystem* system, int type, int index) {
   struct ncclTopoNode* delNode = system->nodes[type].nodes+index;
+  NCCLCHECK(ncclTopoRemoveNodePaths(system, type, index));
   for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
     free(delNode->paths[t]);
+    delNode->paths[t] = NULL;
     for (int n=0; n<system->nodes[t].count; n++) {
       struct ncclTopoNode* node = system->nodes[t].nodes+n;
       if (node == delNode) continue;
@@ -613,6 +617,7 @@ ncclResult_t ncclTopoGetSystemFromXml(struct ncclXml* xml, struct ncclTopoSystem
   NCCLCHECK(ncclCalloc(topoSystem, 1));
   struct ncclXmlNode* topNode;
   NCCLCHECK(xmlFindTag(xml, "system", &topNode));
+  NCCLCHECK(ncclTopoXmlHash(topNode, &(*topoSystem)->xmlHash));
   for (int s=0; s<topNode->nSubs; s++) {
     struct ncclXmlNode* node = topNode->subs[s];
     if (strcmp(node->name, "cpu") == 0) NCCLCHECK(ncclTopoAddCpu(node, *topoSystem));
@@ -655,9 +660,18 @@ static ncclResult_t xmlInitAttrUint64(struct ncclXmlNode* node, const char* attr
 }
 
 
+static double topoTimeMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e3 + ts.tv_nsec*1e-6;
+}
+
 ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** system) {
   struct ncclXml* xml;
   NCCLCHECK(ncclCalloc(&xml, 1));
+  double start = topoTimeMs();
+  uint64_t sysReads, sysHits;
+  NCCLCHECK(ncclTopoSysCacheStats(&sysReads, &sysHits));
   char* xmlTopoFile = getenv("NCCL_TOPO_FILE");
   if (xmlTopoFile) {
     INFO(NCCL_ENV, "NCCL_TOPO_FILE set by environment to %s", xmlTopoFile);
@@ -723,6 +737,11 @@ ncclResult_t ncclTopoGetSystem(struct ncclComm* comm, struct ncclTopoSystem** sy
     NCCLCHECK(xmlInitAttrInt(netNode, "gdr", props.ptrSupport & NCCL_PTR_CUDA ? 1 : 0));
   }
 
+  uint64_t sysReadsEnd, sysHitsEnd;
+  NCCLCHECK(ncclTopoSysCacheStats(&sysReadsEnd, &sysHitsEnd));
+  INFO(NCCL_GRAPH, "Topology detection took %.2f ms, %lu sysfs reads, %lu from cache",
+      topoTimeMs()-start, sysReadsEnd-sysReads, sysHitsEnd-sysHits);
+
   // Remove XML branches which don't have a node with keep="1" (typically when importing a topology)
   NCCLCHECK(ncclTopoTrimXml(xml));
 
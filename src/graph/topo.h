@@ -66,10 +66,9 @@ struct ncclTopoLink {
   struct ncclTopoNode* remNode;
 };
 #define NCCL_TOPO_MAX_LINKS 32
-#define NCCL_TOPO_MAX_HOPS (NCCL_TOPO_MAX_NODES*NCCL_TOPO_NODE_TYPES)
 
 struct ncclTopoLinkList {
-  struct ncclTopoLink* list[NCCL_TOPO_MAX_HOPS];
+  struct ncclTopoLink** list; // count hops, see ncclTopoAllocHops
   int count;
   float width;
   int type;
@@ -130,13 +129,17 @@ struct ncclTopoNodeSet {
   struct ncclTopoNode nodes[NCCL_TOPO_MAX_NODES];
 };
 
+struct ncclTopoHopPool;
 struct ncclTopoSystem {
   struct ncclTopoNodeSet nodes[NCCL_TOPO_NODE_TYPES];
+  struct ncclTopoHopPool* hopPool; // Storage for the hops of all paths
+  int pathsValid;                  // Paths are up to date with the nodes
   float maxWidth;
   float totalWidth;
   int type;
   int nRanks;
   int netGdrLevel;
+  uint64_t xmlHash; // Fingerprint of the XML the system was built from
 
   bool pivotA2AEnabled;
   int pivotA2ANumBiRings;
@@ -145,6 +148,7 @@ struct ncclTopoSystem {
 ncclResult_t ncclTopoGetNode(struct ncclTopoSystem* system, struct ncclTopoNode** node, int type, uint64_t id);
 ncclResult_t ncclTopoCreateNode(struct ncclTopoSystem* system, struct ncclTopoNode** node, int type, uint64_t id);
 ncclResult_t ncclTopoRemoveNode(struct ncclTopoSystem* system, int type, int id);
+ncclResult_t ncclTopoRemoveNodePaths(struct ncclTopoSystem* system, int type, int index);
 ncclResult_t ncclTopoConnectNodes(struct ncclTopoNode* node, struct ncclTopoNode* remNode, int type, float width);
 ncclResult_t ncclTopoPrintPaths(struct ncclTopoSystem* system);
 ncclResult_t ncclTopoLoadSystem(const char* xmlTopoFile, struct ncclTopoSystem* system);
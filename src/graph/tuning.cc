@@ -180,6 +180,13 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
     }
   }
 
+  // Measured performance from the user, used by ncclTopoGetAlgoTime instead of the model
+  const char* tuningFile = getenv("NCCL_TUNING_FILE");
+  if (tuningFile) {
+    INFO(NCCL_ENV, "NCCL_TUNING_FILE set by environment to %s", tuningFile);
+    NCCLCHECK(ncclTopoLoadTuningTable(comm, tuningFile));
+  }
+
   // Protocols/Algorithms enable/disable, and user overrides.
   // All are enabled except ll128 which is enabled by default only in certain cases.
   int protoEnable[NCCL_NUM_PROTOCOLS] = { 1, 2, 1 };
@@ -276,18 +283,93 @@ ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCom
       comm->threadThresholds[NCCL_ALGO_COLLNET][NCCL_PROTO_LL],
       comm->threadThresholds[NCCL_ALGO_COLLNET][NCCL_PROTO_LL128],
       comm->threadThresholds[NCCL_ALGO_COLLNET][NCCL_PROTO_SIMPLE]);
+
+  NCCLCHECK(ncclTopoComputeAlgoTable(comm));
+  return ncclSuccess;
+}
+
+static int tuningFindStr(const char* str, const char* elems[], int nelems) {
+  for (int i=0; i<nelems; i++) if (strcasecmp(str, elems[i]) == 0) return i;
+  return -1;
+}
+
+// 2 if str is value, 1 if str is '*', 0 if str is another value, -1 if str is not a number
+static int tuningMatch(const char* str, int value) {
+  if (strcmp(str, "*") == 0) return 1;
+  char* end;
+  long v = strtol(str, &end, 10);
+  if (end == str || *end != '\0') return -1;
+  return v == value ? 2 : 0;
+}
+
+// Tuning table files have one entry per line:
+//   <coll> <algo> <proto> <nNodes> <ppn> <bytes> <latency (us)> <algorithm bandwidth (GB/s)>
+// Entries set the latency and bandwidth of the log2 size bucket of <bytes>, for
+// communicators with nNodes nodes and ppn ranks per node. nNodes and ppn can be '*'
+// to match any communicator. Entries matching nNodes then ppn exactly take precedence,
+// otherwise later entries override earlier ones. '#' starts a comment.
+// tools/scripts/rccl_tuning_table.py generates tables from rccl-tests logs.
+ncclResult_t ncclTopoLoadTuningTable(struct ncclComm* comm, const char* path) {
+  free(comm->tuningTable);
+  comm->tuningTable = NULL;
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    WARN("Could not open tuning file %s : %s", path, strerror(errno));
+    return ncclSuccess;
+  }
+  struct ncclTuningTable* table;
+  NCCLCHECK(ncclCalloc(&table, 1));
+  char score[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS][NCCL_TUNING_BUCKETS];
+  memset(score, 0, sizeof(score));
+  int ppn = comm->nRanks % comm->nNodes == 0 ? comm->nRanks / comm->nNodes : -1;
+  int nEntries = 0, nBuckets = 0, lineNum = 0;
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    lineNum++;
+    char* comment = strchr(line, '#');
+    if (comment) *comment = '\0';
+    char collStr[32], algoStr[32], protoStr[32], nodesStr[32], ppnStr[32];
+    long bytes;
+    float lat, bw;
+    int n = sscanf(line, "%31s %31s %31s %31s %31s %ld %f %f", collStr, algoStr, protoStr, nodesStr, ppnStr, &bytes, &lat, &bw);
+    if (n <= 0) continue;
+    int c = n == 8 ? tuningFindStr(collStr, ncclFuncStr, NCCL_NUM_FUNCTIONS) : -1;
+    int a = n == 8 ? tuningFindStr(algoStr, ncclAlgoStr, NCCL_NUM_ALGORITHMS) : -1;
+    int p = n == 8 ? tuningFindStr(protoStr, ncclProtoStr, NCCL_NUM_PROTOCOLS) : -1;
+    int nodesMatch = n == 8 ? tuningMatch(nodesStr, comm->nNodes) : -1;
+    int ppnMatch = n == 8 ? tuningMatch(ppnStr, ppn) : -1;
+    if (c < 0 || a < 0 || p < 0 || nodesMatch < 0 || ppnMatch < 0 || bytes < 0 || lat < 0 || bw <= 0) {
+      WARN("Invalid tuning table entry %s:%d, ignoring the file", path, lineNum);
+      fclose(file);
+      free(table);
+      return ncclSuccess;
+    }
+    nEntries++;
+    if (nodesMatch == 0 || ppnMatch == 0) continue;
+    int b = std::min((int)log2i(bytes>>6), NCCL_TUNING_BUCKETS-1);
+    int s = (nodesMatch-1)*2 + ppnMatch;
+    if (s < score[c][a][p][b]) continue;
+    if (score[c][a][p][b] == 0) nBuckets++;
+    score[c][a][p][b] = s;
+    table->lat[c][a][p][b] = lat;
+    table->bw[c][a][p][b] = bw;
+  }
+  fclose(file);
+  INFO(NCCL_TUNING, "Tuning table %s : %d entries, %d used for %d nodes with %d ranks per node", path, nEntries, nBuckets, comm->nNodes, ppn);
+  if (nBuckets) comm->tuningTable = table;
+  else free(table);
   return ncclSuccess;
 }
 
 // Trees are not perfectly sticking to the model for medium sizes. Applying a static correction
 // factor is not ideal but works quite well. Powers of two, 64 B to 128MB.
-static float treeCorrectionFactor[NCCL_NUM_PROTOCOLS][27] = {
+static float treeCorrectionFactor[NCCL_NUM_PROTOCOLS][NCCL_TUNING_BUCKETS] = {
   { 0.5, 0.4, 0.7, 0.6, 1.0, 1.0, 0.5, 0.4, 0.1, 0.5, 0.4, 0.6, 1.0, 1.0, 1.0, 1.0, 1.0, 0.8, 0.6, 0.5, 0.4, 0.4, 0.3, 0.2, 0.1, 0.1, 0.1, },
   { 0.5, 0.4, 0.7, 0.6, 1.0, 1.0, 0.5, 0.4, 0.1, 0.5, 0.4, 0.6, 1.0, 1.0, 1.0, 1.0, 1.0, 0.8, 0.6, 0.5, 0.4, 0.4, 0.3, 0.2, 0.1, 0.1, 0.1, },
   { 0.1, 0.1, 0.1, 0.1, 0.1, 0.3, 0.4, 0.5, 0.1, 0.6, 1.0, 1.0, 1.0, 0.6, 0.5, 0.7, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 0.7, 0.5, 0.3, 0.3, },
 };
 
-static float ringCorrectionFactor[NCCL_NUM_PROTOCOLS][27] = {
+static float ringCorrectionFactor[NCCL_NUM_PROTOCOLS][NCCL_TUNING_BUCKETS] = {
   { 1.0, 0.5, 1.0, 1.0, 0.6, 0.7, 1.0, 1.0, 0.2, 1.0, 0.9, 0.7, 1.0, 1.0, 1.0, 0.9, 0.9, 0.8, 0.8, 0.7, 0.6, 0.5, 0.5, 0.3, 0.2, 0.1, 0.1, },
   { 1.0, 0.5, 1.0, 1.0, 0.6, 0.7, 1.0, 1.0, 0.2, 1.0, 0.9, 0.7, 1.0, 1.0, 1.0, 0.9, 0.9, 0.8, 0.8, 0.7, 0.6, 0.5, 0.5, 0.3, 0.2, 0.1, 0.1, },
   { 0.3, 1.0, 0.3, 0.1, 0.1, 0.1, 0.3, 0.7, 1.0, 0.2, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.1, 0.2, 0.3, 0.5, 0.9, 1.0, 1.0, 1.0, 1.0, },
@@ -302,23 +384,109 @@ ncclResult_t ncclTopoGetAlgoTime(struct ncclInfo* info, int algorithm, int proto
   }
   int logSize = log2i(info->nBytes>>6);
 
+  struct ncclTuningTable* table = info->comm->tuningTable;
+  int bucket = std::min(logSize, NCCL_TUNING_BUCKETS-1);
+  if (table && table->bw[info->coll][algorithm][protocol][bucket] > 0) {
+    // Measured performance replaces the model and its correction factors
+    bw = table->bw[info->coll][algorithm][protocol][bucket];
+    lat = table->lat[info->coll][algorithm][protocol][bucket];
+  } else {
 #if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
-  if (algorithm == NCCL_ALGO_TREE) {
-    if (logSize < 27) bw *= treeCorrectionFactor[protocol][logSize];
-    else bw *= treeCorrectionFactor[protocol][26];
-  }
-  else if (algorithm == NCCL_ALGO_RING) {
-    if(logSize < 27) bw *= ringCorrectionFactor[protocol][logSize];
-    else bw *= ringCorrectionFactor[protocol][26];
-  }
+    if (algorithm == NCCL_ALGO_TREE) {
+      if (logSize < NCCL_TUNING_BUCKETS) bw *= treeCorrectionFactor[protocol][logSize];
+      else bw *= treeCorrectionFactor[protocol][NCCL_TUNING_BUCKETS-1];
+    }
+    else if (algorithm == NCCL_ALGO_RING) {
+      if(logSize < NCCL_TUNING_BUCKETS) bw *= ringCorrectionFactor[protocol][logSize];
+      else bw *= ringCorrectionFactor[protocol][NCCL_TUNING_BUCKETS-1];
+    }
 #else
-  if (algorithm == NCCL_ALGO_TREE && logSize < 23) bw *= treeCorrectionFactor[protocol][logSize];
-  if (info->nChannels != 0) bw = bw / info->comm->nChannels * info->nChannels;
-  if (algorithm == NCCL_ALGO_RING && protocol == NCCL_PROTO_SIMPLE && info->comm->nNodes > 1
-      && info->coll == ncclFuncAllReduce && info->nBytes >= info->comm->nRanks/16.0*65536) lat *= 1.9; // Plateau effect of ring
-#endif    
+    if (algorithm == NCCL_ALGO_TREE && logSize < 23) bw *= treeCorrectionFactor[protocol][logSize];
+    if (info->nChannels != 0) bw = bw / info->comm->nChannels * info->nChannels;
+    if (algorithm == NCCL_ALGO_RING && protocol == NCCL_PROTO_SIMPLE && info->comm->nNodes > 1
+        && info->coll == ncclFuncAllReduce && info->nBytes >= info->comm->nRanks/16.0*65536) lat *= 1.9; // Plateau effect of ring
+#endif
+  }
   // Tree pipelining saves latency in aggregation cases
   int latCount = algorithm == NCCL_ALGO_RING ? numPipeOps : DIVUP(numPipeOps, NCCL_MAX_WORK_ELEMENTS);
   *time = lat * latCount + (info->nBytes) / (1000 * bw);
   return ncclSuccess;
 }
+
+ncclResult_t ncclTopoGetBestAlgo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps, int* algorithm, int* protocol, float* time) {
+  float minTime = 3600000000.0; // Hopefully no operation will take an hour to complete.
+  *algorithm = -1;
+  *protocol = -1;
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+    if (a == NCCL_ALGO_COLLNET && collNetTypeSupport != 1) continue;
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      float t;
+      NCCLCHECK(ncclTopoGetAlgoTime(info, a, p, numPipeOps, &t));
+      if (t >= 0 && t < minTime) {
+        *algorithm = a;
+        *protocol = p;
+        minTime = t;
+      }
+    }
+  }
+  if (time) *time = minTime;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTopoComputeAlgoTable(struct ncclComm* comm) {
+  free(comm->algoTable);
+  comm->algoTable = NULL;
+#if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
+  // Only the HIP model is linear within a bucket, the CUDA one has a size threshold for rings
+  struct ncclAlgoTable* table;
+  NCCLCHECK(ncclCalloc(&table, 1));
+  struct ncclInfo info;
+  memset(&info, 0, sizeof(info));
+  info.comm = comm;
+  int nBuckets = 0, nSegments = 0;
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+    if (c == ncclFuncSendRecv || c == ncclFuncAllToAllPivot) continue;
+    info.coll = (ncclFunc_t)c;
+    for (int b=0; b<NCCL_TUNING_BUCKETS; b++) {
+      size_t first = b == 0 ? 0 : 64UL<<b;
+      size_t last = (64UL<<(b+1))-1;
+      int n = 0;
+      while (first <= last) {
+        int a, p;
+        info.nBytes = first;
+        NCCLCHECK(ncclTopoGetBestAlgo(&info, 0, 1, &a, &p, NULL));
+        // Leave buckets without any algorithm, or with too many crossovers, to getAlgoInfo
+        if (a == -1 || n == NCCL_ALGO_TABLE_SEGMENTS) {
+          n = 0;
+          break;
+        }
+        // Once another combination is faster, it stays faster until the end of the bucket
+        size_t same = first, other = last+1;
+        while (other-same > 1) {
+          int a1, p1;
+          info.nBytes = same+(other-same)/2;
+          NCCLCHECK(ncclTopoGetBestAlgo(&info, 0, 1, &a1, &p1, NULL));
+          if (a1 == a && p1 == p) same = info.nBytes;
+          else other = info.nBytes;
+        }
+        struct ncclAlgoSegment* segment = table->segments[c][b]+n;
+        segment->maxBytes = same;
+        segment->algorithm = a;
+        segment->protocol = p;
+        segment->nThreads = comm->maxThreads[a][p];
+        segment->channelBytes = (ssize_t)segment->nThreads*(int)comm->threadThresholds[a][p];
+        n++;
+        first = same+1;
+      }
+      table->nSegments[c][b] = n;
+      if (n) {
+        nBuckets++;
+        nSegments += n;
+      }
+    }
+  }
+  comm->algoTable = table;
+  if (comm->rank == 0) INFO(NCCL_TUNING, "Precomputed %d algorithm decisions for %d size buckets", nSegments, nBuckets);
+#endif
+  return ncclSuccess;
+}
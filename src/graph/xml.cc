@@ -19,23 +19,36 @@
 /* XML File Parser */
 /*******************/
 
-ncclResult_t xmlGetChar(FILE* file, char* c) {
-  if (fread(c, 1, 1, file) == 0) {
+// XML files are read at once, then parsed from memory
+struct xmlReader {
+  const char* data;
+  size_t size;
+  size_t offset;
+};
+
+static inline int xmlNextChar(struct xmlReader* reader, char* c) {
+  if (reader->offset == reader->size) return 0;
+  *c = reader->data[reader->offset++];
+  return 1;
+}
+
+ncclResult_t xmlGetChar(struct xmlReader* reader, char* c) {
+  if (xmlNextChar(reader, c) == 0) {
     WARN("XML Parse : Unexpected EOF");
     return ncclInternalError;
   }
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetValue(FILE* file, char* value, char* last) {
+ncclResult_t xmlGetValue(struct xmlReader* reader, char* value, char* last) {
   char c;
-  NCCLCHECK(xmlGetChar(file, &c));
+  NCCLCHECK(xmlGetChar(reader, &c));
   if (c != '"' && c != '\'') {
 #if INT_OK
     int o = 0;
     do {
       value[o++] = c;
-      NCCLCHECK(xmlGetChar(file, &c));
+      NCCLCHECK(xmlGetChar(reader, &c));
     } while (c >= '0' && c <= '9');
     value[o] = '\0';
     *last = c;
@@ -47,27 +60,27 @@ ncclResult_t xmlGetValue(FILE* file, char* value, char* last) {
   }
   int o = 0;
   do {
-    NCCLCHECK(xmlGetChar(file, &c));
+    NCCLCHECK(xmlGetChar(reader, &c));
     value[o++] = c;
   } while (c != '"');
   value[o-1] = '\0';
-  NCCLCHECK(xmlGetChar(file, last));
+  NCCLCHECK(xmlGetChar(reader, last));
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetToken(FILE* file, char* name, char* value, char* last) {
+ncclResult_t xmlGetToken(struct xmlReader* reader, char* name, char* value, char* last) {
   char c;
   char* ptr = name;
   int o = 0;
   do {
-    NCCLCHECK(xmlGetChar(file, &c));
+    NCCLCHECK(xmlGetChar(reader, &c));
     if (c == '=') {
       ptr[o] = '\0';
       if (value == NULL) {
         WARN("XML Parse : Unexpected value with name %s", ptr);
         return ncclInternalError;
       }
-      return xmlGetValue(file, value, last);
+      return xmlGetValue(reader, value, last);
     }
     ptr[o] = c;
     if (o == MAX_STR_LEN-1) {
@@ -84,7 +97,7 @@ ncclResult_t xmlGetToken(FILE* file, char* name, char* value, char* last) {
 
 // Shift the 3-chars string by one char and append c at the end
 #define SHIFT_APPEND(s, c) do { s[0]=s[1]; s[1]=s[2]; s[2]=c; } while(0)
-ncclResult_t xmlSkipComment(FILE* file, char* start, char next) {
+ncclResult_t xmlSkipComment(struct xmlReader* reader, char* start, char next) {
   // Start from something neutral with \0 at the end.
   char end[4] = "...";
 
@@ -95,8 +108,8 @@ ncclResult_t xmlSkipComment(FILE* file, char* start, char next) {
 
   // Stop when we find "-->"
   while (strcmp(end, "-->") != 0) {
-    int c;
-    if (fread(&c, 1, 1, file) != 1) {
+    char c;
+    if (xmlNextChar(reader, &c) != 1) {
       WARN("XML Parse error : unterminated comment");
       return ncclInternalError;
     }
@@ -105,30 +118,30 @@ ncclResult_t xmlSkipComment(FILE* file, char* start, char next) {
   return ncclSuccess;
 }
 
-ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
+ncclResult_t xmlGetNode(struct xmlReader* reader, struct ncclXmlNode* node) {
   node->type = NODE_TYPE_NONE;
   char c = ' ';
   while (c == ' ' || c == '\n' || c == '\r') {
-    if (fread(&c, 1, 1, file) == 0) return ncclSuccess;
+    if (xmlNextChar(reader, &c) == 0) return ncclSuccess;
   }
   if (c != '<') {
     WARN("XML Parse error : expecting '<', got '%c'", c);
     return ncclInternalError;
   }
   // Read XML element name
-  NCCLCHECK(xmlGetToken(file, node->name, NULL, &c));
+  NCCLCHECK(xmlGetToken(reader, node->name, NULL, &c));
 
   // Check for comments
   if (strncmp(node->name, "!--", 3) == 0) {
-    NCCLCHECK(xmlSkipComment(file, node->name+3, c));
-    return xmlGetNode(file, node);
+    NCCLCHECK(xmlSkipComment(reader, node->name+3, c));
+    return xmlGetNode(reader, node);
   }
 
   // Check for closing tag
   if (node->name[0] == '\0' && c == '/') {
     node->type = NODE_TYPE_CLOSE;
     // Re-read the name, we got '/' in the first call
-    NCCLCHECK(xmlGetToken(file, node->name, NULL, &c));
+    NCCLCHECK(xmlGetToken(reader, node->name, NULL, &c));
     if (c != '>') {
       WARN("XML Parse error : unexpected trailing %c in closing tag %s", c, node->name);
       return ncclInternalError;
@@ -141,7 +154,7 @@ ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
   // Get Attributes
   int a = 0;
   while (c == ' ') {
-    NCCLCHECK(xmlGetToken(file, node->attrs[a].key, node->attrs[a].value, &c));
+    NCCLCHECK(xmlGetToken(reader, node->attrs[a].key, node->attrs[a].value, &c));
     if (a == MAX_ATTR_COUNT) {
       INFO(NCCL_GRAPH, "XML Parse : Ignoring extra attributes (max %d)", MAX_ATTR_COUNT);
       // Actually we need to still consume the extra attributes so we have an extra one.
@@ -151,7 +164,7 @@ ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
   if (c == '/') {
     node->type = NODE_TYPE_SINGLE;
     char str[MAX_STR_LEN];
-    NCCLCHECK(xmlGetToken(file, str, NULL, &c));
+    NCCLCHECK(xmlGetToken(reader, str, NULL, &c));
   }
   if (c != '>') {
     WARN("XML Parse : expected >, got '%c'", c);
@@ -160,14 +173,14 @@ ncclResult_t xmlGetNode(FILE* file, struct ncclXmlNode* node) {
   return ncclSuccess;
 }
 
-typedef ncclResult_t (*xmlHandlerFunc_t)(FILE*, struct ncclXml*, struct ncclXmlNode*);
+typedef ncclResult_t (*xmlHandlerFunc_t)(struct xmlReader*, struct ncclXml*, struct ncclXmlNode*);
 
 struct xmlHandler {
   const char * name;
   xmlHandlerFunc_t func;
 };
 
-ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head, struct xmlHandler handlers[], int nHandlers) {
+ncclResult_t xmlLoadSub(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head, struct xmlHandler handlers[], int nHandlers) {
   if (head && head->type == NODE_TYPE_SINGLE) return ncclSuccess;
   while (1) {
     if (xml->maxIndex == MAX_NODES) {
@@ -175,8 +188,12 @@ ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* hea
       return ncclInternalError;
     }
     struct ncclXmlNode* node = xml->nodes+xml->maxIndex;
-    memset(node, 0, sizeof(struct ncclXmlNode));
-    NCCLCHECK(xmlGetNode(file, node));
+    // Nodes are large, only clear what the parser doesn't set
+    node->name[0] = '\0';
+    node->nAttrs = 0;
+    node->parent = NULL;
+    node->nSubs = 0;
+    NCCLCHECK(xmlGetNode(reader, node));
     if (node->type == NODE_TYPE_NONE) {
       if (head) {
         WARN("XML Parse : unterminated %s", head->name);
@@ -200,14 +217,14 @@ ncclResult_t xmlLoadSub(FILE* file, struct ncclXml* xml, struct ncclXmlNode* hea
         node->parent = head;
         node->nSubs = 0;
         xml->maxIndex++;
-        NCCLCHECK(handlers[h].func(file, xml, node));
+        NCCLCHECK(handlers[h].func(reader, xml, node));
         found = 1;
         break;
       }
     }
     if (!found) {
       if (nHandlers) INFO(NCCL_GRAPH, "Ignoring element %s", node->name);
-      NCCLCHECK(xmlLoadSub(file, xml, node, NULL, 0));
+      NCCLCHECK(xmlLoadSub(reader, xml, node, NULL, 0));
     }
   }
 }
@@ -251,45 +268,45 @@ ncclResult_t ncclTopoDumpXmlToFile(const char* xmlTopoFile, struct ncclXml* xml)
 /* Parser rules for our specific format */
 /****************************************/
 
-ncclResult_t ncclTopoXmlLoadNvlink(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlLoadNvlink(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(reader, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadGpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadGpu(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
 #if defined(__HIP_PLATFORM_HCC__) || defined(__HCC__) || defined(__HIPCC__)
   struct xmlHandler handlers[] = { { "xgmi", ncclTopoXmlLoadNvlink } };
 #else
   struct xmlHandler handlers[] = { { "nvlink", ncclTopoXmlLoadNvlink } };
 #endif
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadNet(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlLoadNet(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(reader, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadNic(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadNic(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "net", ncclTopoXmlLoadNet } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadPci(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadPci(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "pci", ncclTopoXmlLoadPci }, { "gpu", ncclTopoXmlLoadGpu }, { "nic", ncclTopoXmlLoadNic} };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 3));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 3));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadCpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadCpu(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "pci", ncclTopoXmlLoadPci }, { "nic", ncclTopoXmlLoadNic } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 2));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 2));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlLoadSystem(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlLoadSystem(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   int version;
   NCCLCHECK(xmlGetAttrInt(head, "version", &version));
   if (version != NCCL_TOPO_XML_VERSION) {
@@ -302,24 +319,75 @@ ncclResult_t ncclTopoXmlLoadSystem(FILE* file, struct ncclXml* xml, struct ncclX
   else INFO(NCCL_GRAPH, "Loading unnamed topology");
 
   struct xmlHandler handlers[] = { { "cpu", ncclTopoXmlLoadCpu } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 1));
+  return ncclSuccess;
+}
+
+// Read a whole file. Buffer is NULL, with errno set, if it can't be opened.
+static ncclResult_t xmlReadFile(const char* path, char** buffer, size_t* size) {
+  *buffer = NULL;
+  *size = 0;
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return ncclSuccess;
+  struct stat st;
+  size_t capacity = 4096;
+  // Files like those of /proc have no size, grow the buffer as needed
+  if (fstat(fd, &st) == 0 && st.st_size > 0) capacity = st.st_size+1;
+  char* data = NULL;
+  ncclResult_t ret = ncclSuccess;
+  while (1) {
+    if (data == NULL || *size == capacity) {
+      if (data) capacity *= 2;
+      char* newData = (char*)realloc(data, capacity);
+      if (newData == NULL) {
+        WARN("Could not allocate %ld bytes to read %s", capacity, path);
+        ret = ncclSystemError;
+        break;
+      }
+      data = newData;
+    }
+    ssize_t bytes = read(fd, data+*size, capacity-*size);
+    if (bytes == -1 && errno == EINTR) continue;
+    if (bytes == -1) {
+      WARN("Could not read %s : %s", path, strerror(errno));
+      ret = ncclSystemError;
+      break;
+    }
+    if (bytes == 0) break;
+    *size += bytes;
+  }
+  close(fd);
+  if (ret != ncclSuccess) {
+    free(data);
+    *size = 0;
+    return ret;
+  }
+  *buffer = data;
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTopoGetXmlFromBuffer(const char* buffer, size_t size, struct ncclXml* xml) {
+  struct xmlReader reader = { buffer, size, 0 };
+  struct xmlHandler handlers[] = { { "system", ncclTopoXmlLoadSystem } };
+  xml->maxIndex = 0;
+  NCCLCHECK(xmlLoadSub(&reader, xml, NULL, handlers, 1));
   return ncclSuccess;
 }
 
 ncclResult_t ncclTopoGetXmlFromFile(const char* xmlTopoFile, struct ncclXml* xml, int warn) {
-  FILE* file = fopen(xmlTopoFile, "r");
-  if (file == NULL) {
+  char* buffer;
+  size_t size;
+  NCCLCHECK(xmlReadFile(xmlTopoFile, &buffer, &size));
+  if (buffer == NULL) {
     if (warn) {
       WARN("Could not open XML topology file %s : %s", xmlTopoFile, strerror(errno));
     }
     return ncclSuccess;
   }
   INFO(NCCL_GRAPH, "Loading topology file %s", xmlTopoFile);
-  struct xmlHandler handlers[] = { { "system", ncclTopoXmlLoadSystem } };
-  xml->maxIndex = 0;
-  NCCLCHECK(xmlLoadSub(file, xml, NULL, handlers, 1));
-  fclose(file);
-  return ncclSuccess;
+  ncclResult_t ret = ncclTopoGetXmlFromBuffer(buffer, size, xml);
+  free(buffer);
+  return ret;
 }
 
 /**********************/
@@ -327,16 +395,131 @@ ncclResult_t ncclTopoGetXmlFromFile(const char* xmlTopoFile, struct ncclXml* xml
 /* from autodetection */
 /**********************/
 
+/* Sysfs cache. Every communicator detects the topology again, walking the
+ * same sysfs files, so the real paths and the content of sysfs files are
+ * kept for the whole process. RCCL_TOPO_SYS_CACHE=0 disables it, and entries
+ * older than RCCL_TOPO_SYS_CACHE_TIMEOUT seconds (if set) are read again.
+ */
+RCCL_PARAM(TopoSysCache, "TOPO_SYS_CACHE", 1);
+RCCL_PARAM(TopoSysCacheTimeout, "TOPO_SYS_CACHE_TIMEOUT", 0);
+
+#define SYS_CACHE_BUCKETS 256
+
+struct ncclTopoSysEntry {
+  char* key;                   // 'R' for real paths or 'F' for file contents, then the path
+  char* value;                 // NULL if the path could not be resolved
+  double time;
+  struct ncclTopoSysEntry* next;
+};
+
+static struct ncclTopoSysEntry* sysCache[SYS_CACHE_BUCKETS];
+static pthread_mutex_t sysCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t sysCacheReads, sysCacheHits;
+
+static double sysCacheTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static uint64_t sysCacheHash(const char* key) {
+  uint64_t hash = 5381;
+  for (; *key; key++) hash = ((hash << 5) + hash) ^ *key;
+  return hash;
+}
+
+// Get the value of key, found says whether there was a valid entry
+static ncclResult_t sysCacheGet(const char* key, char** value, int* found) {
+  *found = 0;
+  *value = NULL;
+  if (rcclParamTopoSysCache() == 0) return ncclSuccess;
+  int64_t timeout = rcclParamTopoSysCacheTimeout();
+  pthread_mutex_lock(&sysCacheLock);
+  for (struct ncclTopoSysEntry* e = sysCache[sysCacheHash(key)%SYS_CACHE_BUCKETS]; e; e = e->next) {
+    if (strcmp(e->key, key) != 0) continue;
+    if (timeout > 0 && sysCacheTime()-e->time > timeout) break;
+    if (e->value && (*value = strdup(e->value)) == NULL) {
+      pthread_mutex_unlock(&sysCacheLock);
+      WARN("Could not allocate sysfs cache value");
+      return ncclSystemError;
+    }
+    *found = 1;
+    sysCacheHits++;
+    break;
+  }
+  pthread_mutex_unlock(&sysCacheLock);
+  return ncclSuccess;
+}
+
+static ncclResult_t sysCacheSet(const char* key, const char* value) {
+  pthread_mutex_lock(&sysCacheLock);
+  sysCacheReads++;
+  ncclResult_t ret = ncclSuccess;
+  if (rcclParamTopoSysCache()) {
+    struct ncclTopoSysEntry** bucket = sysCache+sysCacheHash(key)%SYS_CACHE_BUCKETS;
+    struct ncclTopoSysEntry* e;
+    for (e = *bucket; e; e = e->next) if (strcmp(e->key, key) == 0) break;
+    if (e == NULL && (e = (struct ncclTopoSysEntry*)calloc(1, sizeof(struct ncclTopoSysEntry))) != NULL) {
+      if ((e->key = strdup(key)) == NULL) {
+        free(e);
+        e = NULL;
+      } else {
+        e->next = *bucket;
+        *bucket = e;
+      }
+    }
+    if (e) {
+      free(e->value);
+      e->value = value ? strdup(value) : NULL;
+      e->time = sysCacheTime();
+    }
+    if (e == NULL || (value && e->value == NULL)) {
+      WARN("Could not allocate sysfs cache entry");
+      ret = ncclSystemError;
+    }
+  }
+  pthread_mutex_unlock(&sysCacheLock);
+  return ret;
+}
+
+ncclResult_t ncclTopoSysCacheStats(uint64_t* reads, uint64_t* hits) {
+  pthread_mutex_lock(&sysCacheLock);
+  *reads = sysCacheReads;
+  *hits = sysCacheHits;
+  pthread_mutex_unlock(&sysCacheLock);
+  return ncclSuccess;
+}
+
+// Root of sysfs, RCCL_TOPO_SYS_ROOT lets tests use a fake tree
+static const char* sysRoot() {
+  const char* root = getenv("RCCL_TOPO_SYS_ROOT");
+  return root ? root : "/sys";
+}
+
+// Cached realpath(), *real is NULL if path can't be resolved
+static ncclResult_t sysRealPath(const char* path, char** real) {
+  char key[PATH_MAX+1];
+  snprintf(key, sizeof(key), "R%s", path);
+  int found;
+  NCCLCHECK(sysCacheGet(key, real, &found));
+  if (found) return ncclSuccess;
+  *real = realpath(path, NULL);
+  NCCLCHECK(sysCacheSet(key, *real));
+  return ncclSuccess;
+}
+
 #define BUSID_SIZE (sizeof("0000:00:00.0"))
 #define BUSID_REDUCED_SIZE (sizeof("0000:00"))
 static void memcpylower(char* dst, const char* src, const size_t size) {
   for (int i=0; i<size; i++) dst[i] = tolower(src[i]);
 }
 static ncclResult_t getPciPath(const char* busId, char** path) {
-  char busPath[] = "/sys/class/pci_bus/0000:00/../../0000:00:00.0";
-  memcpylower(busPath+sizeof("/sys/class/pci_bus/")-1, busId, BUSID_REDUCED_SIZE-1);
-  memcpylower(busPath+sizeof("/sys/class/pci_bus/0000:00/../../")-1, busId, BUSID_SIZE-1);
-  *path = realpath(busPath, NULL);
+  char lowerId[BUSID_SIZE];
+  memcpylower(lowerId, busId, BUSID_SIZE-1);
+  lowerId[BUSID_SIZE-1] = '\0';
+  char busPath[PATH_MAX];
+  snprintf(busPath, sizeof(busPath), "%s/class/pci_bus/%.*s/../../%s", sysRoot(), (int)BUSID_REDUCED_SIZE-1, lowerId, lowerId);
+  NCCLCHECK(sysRealPath(busPath, path));
   if (*path == NULL) {
     WARN("Could not find real path of %s", busPath);
     return ncclSystemError;
@@ -347,21 +530,33 @@ static ncclResult_t getPciPath(const char* busId, char** path) {
 ncclResult_t ncclTopoGetStrFromSys(const char* path, const char* fileName, char* strValue) {
   char filePath[PATH_MAX];
   sprintf(filePath, "%s/%s", path, fileName);
-  int offset = 0;
-  FILE* file;
-  if ((file = fopen(filePath, "r")) != NULL) {
-    while (feof(file) == 0 && ferror(file) == 0 && offset < MAX_STR_LEN) {
-      int len = fread(strValue+offset, 1, MAX_STR_LEN-offset, file);
-      offset += len;
+  char key[PATH_MAX+1];
+  snprintf(key, sizeof(key), "F%s", filePath);
+  char* cached;
+  int found;
+  NCCLCHECK(sysCacheGet(key, &cached, &found));
+  if (found) {
+    if (cached) {
+      strcpy(strValue, cached);
+      free(cached);
+      return ncclSuccess;
     }
-    fclose(file);
-  }
-  if (offset == 0) {
-    strValue[0] = '\0';
-    INFO(NCCL_GRAPH, "Topology detection : could not read %s, ignoring", filePath);
   } else {
-    strValue[offset-1] = '\0';
+    int offset = 0;
+    FILE* file;
+    if ((file = fopen(filePath, "r")) != NULL) {
+      while (feof(file) == 0 && ferror(file) == 0 && offset < MAX_STR_LEN) {
+        int len = fread(strValue+offset, 1, MAX_STR_LEN-offset, file);
+        offset += len;
+      }
+      fclose(file);
+    }
+    if (offset) strValue[offset-1] = '\0';
+    NCCLCHECK(sysCacheSet(key, offset ? strValue : NULL));
+    if (offset) return ncclSuccess;
   }
+  strValue[0] = '\0';
+  INFO(NCCL_GRAPH, "Topology detection : could not read %s, ignoring", filePath);
   return ncclSuccess;
 }
 
@@ -384,8 +579,8 @@ ncclResult_t ncclTopoGetXmlFromCpu(struct ncclXmlNode* cpuNode, struct ncclXml*
       return ncclInternalError;
     }
     // Set affinity
-    char cpumaskPath[] = "/sys/devices/system/node/node0000";
-    sprintf(cpumaskPath, "/sys/devices/system/node/node%s", numaId);
+    char cpumaskPath[PATH_MAX];
+    snprintf(cpumaskPath, sizeof(cpumaskPath), "%s/devices/system/node/node%s", sysRoot(), numaId);
     NCCLCHECK(ncclTopoSetAttrFromSys(cpuNode, cpumaskPath, "cpumap", "affinity"));
   }
 
@@ -436,7 +631,7 @@ ncclResult_t ncclTopoGetXmlFromCpu(struct ncclXmlNode* cpuNode, struct ncclXml*
       };
       uint32_t val;
     } cpuid1;
-    asm volatile("cpuid" : "=a" (cpuid1.val) : "a" (1) : "memory");
+    asm volatile("cpuid" : "=a" (cpuid1.val) : "a" (1) : "ebx", "ecx", "edx", "memory");
     int familyId = cpuid1.familyId + (cpuid1.extFamilyId << 4);
     int modelId = cpuid1.modelId + (cpuid1.extModelId << 4);
     NCCLCHECK(xmlSetAttrInt(cpuNode, "familyid", familyId));
@@ -799,7 +994,8 @@ ncclResult_t ncclTopoFillGpu(struct ncclXml* xml, const char* busId, struct nccl
 ncclResult_t ncclTopoGetSubsystem(const char* sysPath, char* subSys) {
   char subSysPath[PATH_MAX];
   sprintf(subSysPath, "%s/subsystem", sysPath);
-  char* path = realpath(subSysPath, NULL);
+  char* path;
+  NCCLCHECK(sysRealPath(subSysPath, &path));
   if (path == NULL) {
     subSys[0] = '\0';
   } else {
@@ -875,33 +1071,53 @@ ncclResult_t ncclTopoTrimXml(struct ncclXml* xml) {
   return ncclSuccess;
 }
 
+static uint64_t xmlHashStr(uint64_t hash, const char* str) {
+  // DJB2a, including the terminating 0 so that "ab","c" differs from "a","bc"
+  do { hash = ((hash << 5) + hash) ^ *str; } while (*str++);
+  return hash;
+}
+static void ncclTopoXmlHashRec(struct ncclXmlNode* node, uint64_t* hash) {
+  *hash = xmlHashStr(*hash, node->name);
+  for (int a=0; a<node->nAttrs; a++) {
+    *hash = xmlHashStr(*hash, node->attrs[a].key);
+    *hash = xmlHashStr(*hash, node->attrs[a].value);
+  }
+  for (int s=0; s<node->nSubs; s++) ncclTopoXmlHashRec(node->subs[s], hash);
+  *hash = xmlHashStr(*hash, "/");
+}
+ncclResult_t ncclTopoXmlHash(struct ncclXmlNode* node, uint64_t* hash) {
+  *hash = 5381;
+  ncclTopoXmlHashRec(node, hash);
+  return ncclSuccess;
+}
+
 /**************************************************/
 /* Parser rules for the user-defined graph search */
 /**************************************************/
 
-ncclResult_t ncclTopoXmlGraphLoadGpu(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlGraphLoadGpu(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(reader, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadNet(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
-  NCCLCHECK(xmlLoadSub(file, xml, head, NULL, 0));
+ncclResult_t ncclTopoXmlGraphLoadNet(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
+  NCCLCHECK(xmlLoadSub(reader, xml, head, NULL, 0));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadChannel(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadChannel(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "net", ncclTopoXmlGraphLoadNet }, { "gpu", ncclTopoXmlGraphLoadGpu } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 2));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 2));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadGraph(FILE* file, struct ncclXml* xml, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadGraph(struct xmlReader* reader, struct ncclXml* xml, struct ncclXmlNode* head) {
   struct xmlHandler handlers[] = { { "channel", ncclTopoXmlGraphLoadChannel } };
-  NCCLCHECK(xmlLoadSub(file, xml, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xml, head, handlers, 1));
   return ncclSuccess;
 }
 
-ncclResult_t ncclTopoXmlGraphLoadGraphs(FILE* file, struct ncclXml* xmlGraph, struct ncclXmlNode* head) {
+ncclResult_t ncclTopoXmlGraphLoadGraphs(struct xmlReader* reader, struct ncclXml* xmlGraph, struct ncclXmlNode* head) {
   int version;
   NCCLCHECK(xmlGetAttrInt(head, "version", &version));
   if (version != NCCL_GRAPH_XML_VERSION) {
@@ -914,19 +1130,27 @@ ncclResult_t ncclTopoXmlGraphLoadGraphs(FILE* file, struct ncclXml* xmlGraph, st
   else INFO(NCCL_GRAPH, "Loading graphs");
 
   struct xmlHandler handlers[] = { { "graph", ncclTopoXmlGraphLoadGraph } };
-  NCCLCHECK(xmlLoadSub(file, xmlGraph, head, handlers, 1));
+  NCCLCHECK(xmlLoadSub(reader, xmlGraph, head, handlers, 1));
+  return ncclSuccess;
+}
+
+ncclResult_t ncclTopoGetXmlGraphFromBuffer(const char* buffer, size_t size, struct ncclXml* xml) {
+  struct xmlReader reader = { buffer, size, 0 };
+  struct xmlHandler handlers[] = { { "graphs", ncclTopoXmlGraphLoadGraphs } };
+  xml->maxIndex = 0;
+  NCCLCHECK(xmlLoadSub(&reader, xml, NULL, handlers, 1));
   return ncclSuccess;
 }
 
 ncclResult_t ncclTopoGetXmlGraphFromFile(const char* xmlGraphFile, struct ncclXml* xml) {
-  FILE* file = fopen(xmlGraphFile, "r");
-  if (file == NULL) {
+  char* buffer;
+  size_t size;
+  NCCLCHECK(xmlReadFile(xmlGraphFile, &buffer, &size));
+  if (buffer == NULL) {
     WARN("Could not open XML graph file %s : %s", xmlGraphFile, strerror(errno));
     return ncclSystemError;
   }
-  struct xmlHandler handlers[] = { { "graphs", ncclTopoXmlGraphLoadGraphs } };
-  xml->maxIndex = 0;
-  NCCLCHECK(xmlLoadSub(file, xml, NULL, handlers, 1));
-  fclose(file);
-  return ncclSuccess;
+  ncclResult_t ret = ncclTopoGetXmlGraphFromBuffer(buffer, size, xml);
+  free(buffer);
+  return ret;
 }
@@ -49,13 +49,23 @@ ncclResult_t ncclTopoDumpXmlToFile(const char* xmlTopoFile, struct ncclXml* xml)
 #define NCCL_GRAPH_XML_VERSION 1
 ncclResult_t ncclTopoGetXmlGraphFromFile(const char* xmlGraphFile, struct ncclXml* xml);
 
+/* Same as above, from XML already in memory, e.g. received from another rank */
+ncclResult_t ncclTopoGetXmlFromBuffer(const char* buffer, size_t size, struct ncclXml* xml);
+ncclResult_t ncclTopoGetXmlGraphFromBuffer(const char* buffer, size_t size, struct ncclXml* xml);
+
 /* Auto-detect functions */
 ncclResult_t ncclTopoFillGpu(struct ncclXml* xml, const char* busId, struct ncclXmlNode** gpuNode);
 ncclResult_t ncclTopoFillNet(struct ncclXml* xml, const char* pciPath, const char* netName, struct ncclXmlNode** netNode);
 
+/* Sysfs reads done and served from the cache so far */
+ncclResult_t ncclTopoSysCacheStats(uint64_t* reads, uint64_t* hits);
+
 /* Remove unneeded parts */
 ncclResult_t ncclTopoTrimXml(struct ncclXml* xml);
 
+/* Hash of a (trimmed) XML tree, used to fingerprint the system */
+ncclResult_t ncclTopoXmlHash(struct ncclXmlNode* node, uint64_t* hash);
+
 /**************/
 /* XML Struct */
 /* Functions  */
@@ -423,13 +423,17 @@ group_cleanup:
         }
         /* Free all proxy ops in state->nextOps */
         struct ncclProxyState* state = &comm->proxyState;
-	pthread_mutex_lock(&state->poolMutex);
-	for (struct ncclProxyArgs *op = state->nextOps; op; op = op->next) {
-          op->next = state->pool;
-          state->pool = op;
+        for (int t=0; t<NCCL_PROXY_MAX_THREADS; t++) {
+          struct ncclProxyThread* thread = state->threads+t;
+          struct ncclProxyArgs *op = thread->nextOps;
+          while (op) {
+            struct ncclProxyArgs *next = op->next;
+            op->next = state->pool;
+            state->pool = op;
+            op = next;
+          }
+          thread->nextOps = thread->nextOpsEnd = NULL;
         }
-	pthread_mutex_unlock(&state->poolMutex);
-        state->nextOps = NULL;
 
         ncclLaunchReset(comm);
       }
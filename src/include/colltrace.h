@@ -0,0 +1,95 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifndef NCCL_COLLTRACE_H_
+#define NCCL_COLLTRACE_H_
+
+#ifdef ENABLE_COLLTRACE
+#include "core.h"
+#include "devcomm.h"
+#include "collectives.h"
+
+extern const char* ncclDevRedOpStr[ncclNumDevRedOps];
+extern const char* ncclTypeStr[ncclNumTypes];
+
+#define COLLTRACE_TIMER_FREQUENCY 2.5E7 // Vega GPU RTC
+#define COLLTRACE_NAME_LENGTH 64
+#define COLLTRACE_NUM_NAMES (FUNC_INDEX_P2P+1)
+
+// Kernel function names indexed by funcIndex, COLLTRACE_NAME_LENGTH bytes each
+ncclResult_t ncclCollTraceGetNames(char** names);
+// Text form of a record, as printed with NCCL_DEBUG=INFO. line must hold 1024 bytes.
+void ncclCollTraceFormat(const struct ncclCollTrace* td, const char* names, int rank, int64_t busId, int nRanks, char* line);
+
+// Binary trace file (RCCL_KERNEL_COLL_TRACE_FILE) : the header, the function names, then
+// the raw ncclCollTrace records from dataOffset. The file is mapped and grown as needed;
+// nRecords is updated after each batch so that the file stays readable if the process dies.
+// tools/scripts/rccl_colltrace_json.py converts it to a Chrome trace / Perfetto JSON file.
+#define COLLTRACE_FILE_MAGIC "RCCLCTRC"
+#define COLLTRACE_FILE_VERSION 1
+struct ncclCollTraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;    // sizeof(struct ncclCollTrace)
+  uint32_t nameLength;
+  uint32_t nNames;
+  uint64_t dataOffset;    // First record
+  uint64_t nRecords;      // Records written so far
+  uint64_t lost;          // Records overwritten by the GPU before they were read
+  double timerFreq;       // Frequency of timeStamp, in Hz
+  int64_t busId;
+  int32_t rank;
+  int32_t nRanks;
+  int32_t pid;
+  char hostname[52];
+};
+static_assert(sizeof(struct ncclCollTraceFileHeader) == 128, "ncclCollTraceFileHeader must be 128 bytes");
+
+struct ncclCollTraceFile {
+  int fd;
+  char* base;             // Mapping of the whole file
+  size_t size;            // File size
+  uint64_t nRecords;      // Records written, including the ones not committed yet
+};
+
+// %h in path is replaced by the hostname, %p by the pid and %r by the rank
+ncclResult_t ncclCollTraceFileOpen(const char* path, int rank, int nRanks, int64_t busId, const char* names, struct ncclCollTraceFile** file);
+ncclResult_t ncclCollTraceFileWrite(struct ncclCollTraceFile* file, const struct ncclCollTrace* td);
+// Make the records written so far visible to readers of the file
+void ncclCollTraceFileCommit(struct ncclCollTraceFile* file, uint64_t lost);
+ncclResult_t ncclCollTraceFileClose(struct ncclCollTraceFile* file);
+
+// Reader of the ring filled by the kernels, writing the records to a binary trace file if
+// path is set and printing them with INFO otherwise.
+struct ncclCollTraceReader {
+  struct ncclCollTrace* ring;     // COLLTRACE_NUM_ITEMS records
+  uint32_t* tail;
+  uint32_t head;                  // Records taken from the ring, not wrapped around
+  uint64_t lost;
+  char* names;
+  struct ncclCollTraceFile* file;
+  int rank;
+  int nRanks;
+  int64_t busId;
+};
+ncclResult_t ncclCollTraceReaderInit(struct ncclCollTraceReader* reader, struct ncclCollTrace* ring, uint32_t* tail, uint32_t head,
+    int rank, int nRanks, int64_t busId, const char* path);
+// Take the ready records out of the ring. Returns the number of records found in the ring.
+int ncclCollTraceReaderPoll(struct ncclCollTraceReader* reader);
+ncclResult_t ncclCollTraceReaderFinalize(struct ncclCollTraceReader* reader);
+
+// Poll interval of the trace thread after finding count records in the ring. It aims at
+// batches of COLLTRACE_NUM_ITEMS/64 to COLLTRACE_NUM_ITEMS/16 records, backing off while
+// idle and coming back to minUs at once when the ring fills up.
+static inline int ncclCollTracePollInterval(int interval, int count, int minUs, int maxUs) {
+  if (count >= COLLTRACE_NUM_ITEMS/4) interval = minUs;
+  else if (count >= COLLTRACE_NUM_ITEMS/16) interval /= 2;
+  else if (count < COLLTRACE_NUM_ITEMS/64) interval *= 2;
+  return std::min(std::max(interval, minUs), maxUs);
+}
+#endif
+
+#endif
@@ -147,6 +147,12 @@ struct ncclComm {
   float latencies[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   float bandwidths[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
   int maxThreads[NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS];
+  // Measured performance overriding the model, NULL if none
+  struct ncclTuningTable* tuningTable;
+  // Precomputed decisions of the model, NULL if not available
+  struct ncclAlgoTable* algoTable;
+  // Online algorithm/protocol tuning, NULL unless RCCL_AUTOTUNE is set
+  struct ncclAutoTuner* autoTuner;
 
   // An internal CUDA stream for NCCL kernel CGMD launches
   int groupCudaStream;
@@ -182,8 +188,7 @@ struct ncclComm {
   struct ncclWorkElem args;
   void* argsptr;
 
-  // Global proxy thread
-  pthread_t proxyThread;
+  // Proxy threads
   struct ncclProxyState proxyState;
 
   // Whether this communicator uses collNet
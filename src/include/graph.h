@@ -86,6 +86,8 @@ struct ncclTopoGraph {
   int intraNets[MAXCHANNELS*NCCL_TOPO_MAX_NODES*2];
 };
 ncclResult_t ncclTopoCompute(struct ncclTopoSystem* system, struct ncclTopoGraph* graph);
+// Search steps taken by all ncclTopoCompute calls so far
+ncclResult_t ncclTopoGetSearchSteps(uint64_t* steps);
 
 ncclResult_t ncclTopoPrintGraph(struct ncclTopoSystem* system, struct ncclTopoGraph* graph);
 ncclResult_t ncclTopoDumpGraphs(struct ncclTopoSystem* system, int ngraphs, struct ncclTopoGraph** graphs);
@@ -108,7 +110,80 @@ ncclResult_t ncclTopoPostset(struct ncclComm* comm, int* firstRanks, int* treePa
     struct ncclTopoRanks** allTopoRanks, int* rings, struct ncclTopoGraph* collNetGraph, int nc);
 
 ncclResult_t ncclTopoTuneModel(struct ncclComm* comm, int minCompCap, int maxCompCap, struct ncclTopoGraph* treeGraph, struct ncclTopoGraph* ringGraph, struct ncclTopoGraph* collNetGraph, int gcn);
+
+// Measured latency and bandwidth per log2 size bucket from 64 B, loaded from NCCL_TUNING_FILE
+#define NCCL_TUNING_BUCKETS 27
+struct ncclTuningTable {
+  float lat[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS][NCCL_TUNING_BUCKETS];
+  float bw[NCCL_NUM_FUNCTIONS][NCCL_NUM_ALGORITHMS][NCCL_NUM_PROTOCOLS][NCCL_TUNING_BUCKETS]; // 0 : use the model
+};
+ncclResult_t ncclTopoLoadTuningTable(struct ncclComm* comm, const char* path);
 #include "info.h"
 ncclResult_t ncclTopoGetAlgoTime(struct ncclInfo* info, int algorithm, int protocol, int numPipeOps, float* time);
+// Fastest algorithm/protocol of the model, CollNet only if collNetTypeSupport is 1. algorithm is -1 if none.
+ncclResult_t ncclTopoGetBestAlgo(struct ncclInfo* info, int collNetTypeSupport, int numPipeOps, int* algorithm, int* protocol, float* time);
+
+// Decisions of the model for single operations without CollNet, precomputed by ncclTopoTuneModel.
+// Within a size bucket, the model times are linear in the size so that the fastest algorithm only
+// changes at a few crossover sizes, which split the bucket into segments. Sizes where two model
+// times are equal to float precision may get either combination.
+#define NCCL_ALGO_TABLE_SEGMENTS 4
+struct ncclAlgoSegment {
+  size_t maxBytes;      // Last size of the segment
+  int algorithm;
+  int protocol;
+  int nThreads;
+  ssize_t channelBytes; // Bytes per channel below which fewer channels are used
+};
+struct ncclAlgoTable {
+  int nSegments[NCCL_NUM_FUNCTIONS][NCCL_TUNING_BUCKETS]; // 0 : not precomputed
+  struct ncclAlgoSegment segments[NCCL_NUM_FUNCTIONS][NCCL_TUNING_BUCKETS][NCCL_ALGO_TABLE_SEGMENTS];
+};
+ncclResult_t ncclTopoComputeAlgoTable(struct ncclComm* comm);
+
+static inline struct ncclAlgoSegment* ncclTopoLookupAlgo(struct ncclAlgoTable* table, ncclFunc_t coll, size_t nBytes) {
+  // Same bucket as log2i(nBytes>>6)
+  int bucket = nBytes < 128 ? 0 : 63-__builtin_clzll(nBytes>>6);
+  if (bucket >= NCCL_TUNING_BUCKETS) return NULL;
+  struct ncclAlgoSegment* segment = table->segments[coll][bucket];
+  for (int s=0; s<table->nSegments[coll][bucket]; s++, segment++) {
+    if (nBytes <= segment->maxBytes) return segment;
+  }
+  return NULL;
+}
+
+// Online autotuner (RCCL_AUTOTUNE) : per (collective, datatype, size bucket), time the
+// top candidates of the model over the first calls then stick to the fastest one.
+#define NCCL_AUTOTUNE_MAX_CANDIDATES 8
+#define NCCL_AUTOTUNE_MAX_SAMPLES 16
+struct ncclAutoTuneOps {
+  // Record the start/stop of the timed operation on stream. Samples are opaque.
+  ncclResult_t (*start)(void* ctx, hipStream_t stream, void** sample);
+  ncclResult_t (*stop)(void* ctx, hipStream_t stream, void* sample);
+  // Wait for the sample, return its duration in us and release it
+  ncclResult_t (*elapsed)(void* ctx, void* sample, float* us);
+  ncclResult_t (*release)(void* ctx, void* sample);
+  // Gather n floats from all ranks into data[rank*n ...]. Called in the same order on all ranks.
+  ncclResult_t (*allGather)(void* ctx, float* data, int n);
+  void* ctx;
+};
+struct ncclAutoTuneEntry;
+struct ncclAutoTuner {
+  struct ncclAutoTuneOps ops;
+  int rank, nRanks;
+  int nCandidates, nSamples;
+  int explore;                          // Set for the next call, when it can be timed
+  struct ncclAutoTuneEntry* sampleEntry;  // Call being timed
+  int sampleCandidate, sampleIndex;
+  struct ncclAutoTuneEntry* entries[NCCL_NUM_FUNCTIONS][ncclNumTypes][NCCL_TUNING_BUCKETS];
+};
+ncclResult_t ncclAutoTuneCreate(struct ncclComm* comm, struct ncclAutoTuneOps* ops, int nCandidates, int nSamples, struct ncclAutoTuner** tuner);
+ncclResult_t ncclAutoTuneDestroy(struct ncclAutoTuner* tuner);
+// Replace the static choice in info->algorithm/protocol. Sets *tuned if the tuner made the choice.
+ncclResult_t ncclAutoTuneGetAlgo(struct ncclAutoTuner* tuner, struct ncclInfo* info, int collNetTypeSupport, int* tuned);
+ncclResult_t ncclAutoTuneStart(struct ncclAutoTuner* tuner, hipStream_t stream);
+ncclResult_t ncclAutoTuneStop(struct ncclAutoTuner* tuner, hipStream_t stream);
+// Write converged decisions as a NCCL_TUNING_FILE tuning table
+ncclResult_t ncclAutoTuneExport(struct ncclAutoTuner* tuner, struct ncclComm* comm, const char* path);
 
 #endif
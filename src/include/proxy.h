@@ -82,20 +82,42 @@ struct ncclProxySharedBuffers {
 };
 
 struct ncclProxyPool;
-struct ncclProxyState {
+
+// Operations are sharded between proxy threads by channel
+#define NCCL_PROXY_MAX_THREADS 16
+
+struct ncclProxyThread {
+  struct ncclComm* comm;
+  int id;
+  pthread_t thread;
+  cpu_set_t affinity;
   pthread_cond_t cond;
-  pthread_mutex_t opsMutex;
-  pthread_mutex_t poolMutex;
-  bool stop;
-  struct ncclProxySharedBuffers sharedBuffs;
+  pthread_mutex_t opsMutex;            // Only used to park the proxy thread on cond
+  int parked;                          // Proxy thread is going to sleep, posting must wake it up
+  int spinUsec;                        // Current spin budget of the proxy thread before parking
   struct ncclProxyArgs* ops;           // Running operations, used by proxy thread
-  struct ncclProxyArgs* postedOps;     // Posted operations, shared between proxy and main thread, locked with opsMutex
+  struct ncclProxyArgs* postedHead;    // Lock-free queue of posted operations, written by main threads,
+  struct ncclProxyArgs** postedTail;   // emptied by the proxy thread. postedTail points to the last next field.
+  struct ncclProxyArgs* postedOps;     // Posted operations taken from the queue, used by proxy thread
   struct ncclProxyArgs* postedOpsEnd;
   struct ncclProxyArgs* nextOps;       // Pending operations, used by main thread (could still be cancelled)
   struct ncclProxyArgs* nextOpsEnd;
-  struct ncclProxyArgs* pool;          // Free operations for main thread
   struct ncclProxyArgs* poolFreed;     // Freed operations by the progress thread
-  struct ncclProxyArgs* poolReturned;  // Shared between main and progress thread, lock with poolMutex
+
+  // Utilization, updated by the proxy thread only
+  uint64_t nOps;                       // Operations completed
+  double busyUsec;                     // Progressing operations, some of which moved
+  double pollUsec;                     // Progressing operations, none of which moved, or spinning for new ones
+  double waitUsec;                     // Asleep until operations are posted
+};
+
+struct ncclProxyState {
+  bool stop;
+  int nThreads;
+  struct ncclProxyThread threads[NCCL_PROXY_MAX_THREADS];
+  struct ncclProxySharedBuffers sharedBuffs;
+  struct ncclProxyArgs* pool;          // Free operations for main thread
+  struct ncclProxyArgs* poolReturned;  // Lock-free list, pushed to by the progress threads, taken whole by main thread
 
   struct ncclProxyPool* pools;
 };
@@ -17,6 +17,7 @@
 #include "enqueue.h"
 #include "graph.h"
 #include "argcheck.h"
+#include "colltrace.h"
 #include <fcntl.h>
 #include <unistd.h>
 #include <hip/hip_runtime.h>
@@ -204,103 +205,30 @@ void NCCL_NO_OPTIMIZE commPoison(ncclComm_t comm) {
 RCCL_PARAM(KernelCollTraceEnable, "KERNEL_COLL_TRACE_ENABLE", 0);
 
 #ifdef ENABLE_COLLTRACE
+RCCL_PARAM(KernelCollTracePollMin, "KERNEL_COLL_TRACE_POLL_MIN", 10);
+RCCL_PARAM(KernelCollTracePollMax, "KERNEL_COLL_TRACE_POLL_MAX", 1000);
+
 void *ncclCommThreadMain(void *arg) {
   ncclComm_t comm = (ncclComm_t)arg;
-  int head = comm->hostDevComm.collTraceHead;
-  #define MAX_NAME_LENGTH 64
-  char* func_names = (char *)malloc(MAX_NAME_LENGTH*(FUNC_INDEX_P2P+1));
-  for (int func = 0; func < NCCL_NUM_FUNCTIONS; func++) {
-    for (int al = 0; al < NCCL_NUM_ALGORITHMS; al++) {
-      for (int type = 0; type < ncclNumTypes; type++) {
-        for (int pr = 0; pr < NCCL_NUM_PROTOCOLS; pr++) {
-          for (int devredop = 0; devredop < ncclNumDevRedOps; devredop++) {
-            char* line = func_names+MAX_NAME_LENGTH*FUNC_INDEX(func, devredop, type, al, pr);
-            sprintf(line, "%s%s%s%s%s", ncclFuncStr[func], ncclAlgoStr[al], ncclProtoStr[pr],
-              ncclDevRedOpStr[devredop], ncclTypeStr[type]);
-          }
-        }
-      }
-    }
-  }
-  for (int type = 0; type < ncclNumTypes; type++) {
-    char* line = func_names+MAX_NAME_LENGTH*(FUNC_INDEX_P2P-ncclNumTypes+type);
-    sprintf(line, "OneRankReducePreMulSum%s", ncclTypeStr[type]);
-  }
-  char* line = func_names+MAX_NAME_LENGTH*FUNC_INDEX_P2P;
-  sprintf(line, "SendRecvRingSimpleSum_i8");
+  struct ncclCollTraceReader reader;
+  if (ncclCollTraceReaderInit(&reader, comm->hostDevComm.collTrace, comm->hostDevComm.collTraceTail, comm->hostDevComm.collTraceHead,
+      comm->rank, comm->nRanks, comm->busId, getenv("RCCL_KERNEL_COLL_TRACE_FILE")) != ncclSuccess)
+    pthread_exit(NULL);
+  int pollMin = std::max((int)rcclParamKernelCollTracePollMin(), 1);
+  int pollMax = std::max((int)rcclParamKernelCollTracePollMax(), pollMin);
+  int interval = pollMin;
   do {
-    int tail = LOAD(comm->hostDevComm.collTraceTail)%COLLTRACE_NUM_ITEMS;
-    int count;
-    if (head <= tail)
-      count = tail - head;
-    else
-      count = COLLTRACE_NUM_ITEMS + head - tail;
-    if (!count) {
-      if(LOAD(&comm->hostDevComm.collTraceExit))
-        break;
-      else {
-        usleep(1000); //sleep 1ms
-        continue;
-      }
-    }
-    for (int i = 0; i < count; i++) {
-      struct ncclCollTrace *td = comm->hostDevComm.collTrace+head;
-      uint8_t type = LOAD(&(td->type));
-      if (type == ncclCollTraceNotReady)
-        break;
-      char line[1024];
-      int offset = 0;
-      uint16_t fIdx = td->funcIndex;
-      #define VEGA_GPU_RTC_FREQUENCY 2.5E7
-      if (type == ncclCollTraceDataType) {
-        sprintf(line, "## [%12.6f] [%02d:%02d] L:%04d DT %08x %016lx %016lx",
-          (double)(td->timeStamp)/VEGA_GPU_RTC_FREQUENCY, comm->rank, td->bid,
-          fIdx, td->data_0, td->opCount, td->data_1);
-      } else {
-        sprintf(line, "## [%12.6f] [%02d:%02d] %06lx",
-          (double)(td->timeStamp)/VEGA_GPU_RTC_FREQUENCY, comm->rank, td->bid, fIdx == FUNC_INDEX_P2P ? (td->opCount + 0x100000): td->opCount);
-        offset = strlen(line);
-        switch (type) {
-          case ncclCollTraceKernelLaunchType:
-            sprintf(line+offset, " KL HWID %8x %s ",
-              td->data_0, func_names+MAX_NAME_LENGTH*fIdx);
-            offset = strlen(line);
-            if (fIdx > FUNC_INDEX_P2P)
-              sprintf(line+offset, "ERROR bad function index %d", fIdx);
-            else if (fIdx == FUNC_INDEX_P2P)
-              sprintf(line+offset, "nt %d dt %d busId %lx nRanks %d", td->p2p.nThreads, td->p2p.delta, comm->busId, comm->nRanks);
-            else
-              sprintf(line+offset, "nt %d bi %d nc %d busId %lx nRanks %d", td->coll.nThreads, td->coll.bid, td->coll.nChannels, comm->busId, comm->nRanks);
-            break;
-          case ncclCollTraceCollEndType:
-            sprintf(line+offset, " CE %s ", func_names+MAX_NAME_LENGTH*fIdx);
-            offset = strlen(line);
-            if (fIdx > FUNC_INDEX_P2P)
-              sprintf(line+offset, "ERROR bad function index %d", fIdx);
-            else if (fIdx == FUNC_INDEX_P2P)
-              sprintf(line+offset, "nt %d dt %d busId %lx nRanks %d", td->p2p.nThreads, td->p2p.delta, comm->busId, comm->nRanks);
-            else
-              sprintf(line+offset, "nt %d bi %d nc %d busId %lx nRanks %d", td->coll.nThreads, td->coll.bid, td->coll.nChannels, comm->busId, comm->nRanks);
-            break;
-          case ncclCollTraceKernelEndType:
-            sprintf(line+offset, " KE busId %lx nRanks %d", comm->busId, comm->nRanks);
-            break;
-          case ncclCollTraceAbortType:
-            sprintf(line+offset, " Abort");
-            break;
-          default:
-            sprintf(line+offset, " unknown collective trace data type");
-            break;
-        }
-      }
-      INFO(NCCL_COLL, "%s", line);
-      STORE(&(td->type), ncclCollTraceNotReady);
-      head ++;
-      head %= COLLTRACE_NUM_ITEMS;
-    }
+    // Kernels are done once exit is set, so the poll after reading it gets all records.
+    // Do not wait for an empty poll, the count includes slots reserved but never filled.
+    int done = LOAD(&comm->hostDevComm.collTraceExit);
+    int count = ncclCollTraceReaderPoll(&reader);
+    if (done)
+      break;
+    interval = ncclCollTracePollInterval(interval, count, pollMin, pollMax);
+    usleep(interval);
   } while(1);
-  free(func_names);
-  comm->hostDevComm.collTraceHead = head;
+  comm->hostDevComm.collTraceHead = reader.head%COLLTRACE_NUM_ITEMS;
+  ncclCollTraceReaderFinalize(&reader);
   pthread_exit(NULL);
 }
 #endif
@@ -435,7 +363,14 @@ static ncclResult_t commFree(ncclComm_t comm) {
   NCCLCHECK(ncclCudaHostFree((void *)comm->hostDevComm.collTraceTail));
 #endif
 
+  if (comm->autoTuner) {
+    const char* autoTuneFile = getenv("RCCL_AUTOTUNE_FILE");
+    if (autoTuneFile && comm->rank == 0) NCCLCHECK(ncclAutoTuneExport(comm->autoTuner, comm, autoTuneFile));
+    NCCLCHECK(ncclAutoTuneDestroy(comm->autoTuner));
+  }
   free(comm->peerInfo);
+  free(comm->tuningTable);
+  free(comm->algoTable);
   ncclTopoFree(comm->topo);
 
   if (comm->bootstrap)
@@ -535,7 +470,7 @@ static ncclResult_t commAlloc(ncclComm_t* comret, int ndev, int rank) {
   NCCLCHECK(ncclCudaHostCalloc(&comm->hostDevComm.collTrace, COLLTRACE_NUM_ITEMS));
   memset(comm->hostDevComm.collTrace, 0, sizeof(struct ncclCollTrace) * COLLTRACE_NUM_ITEMS);
   comm->hostDevComm.collTraceExit = comm->hostDevComm.collTraceHead = *comm->hostDevComm.collTraceTail = 0;
-  if ((ncclDebugLevel >= NCCL_LOG_INFO) && rcclParamKernelCollTraceEnable())
+  if ((ncclDebugLevel >= NCCL_LOG_INFO || getenv("RCCL_KERNEL_COLL_TRACE_FILE")) && rcclParamKernelCollTraceEnable())
     pthread_create(&comm->hostDevComm.collTraceThread, NULL, ncclCommThreadMain, (void *)comm);
   else
     comm->hostDevComm.collTraceThread = 0;
@@ -781,6 +716,77 @@ NCCL_PARAM(CrossNic, "CROSS_NIC", 2);
 NCCL_PARAM(GraphDumpFileRank, "GRAPH_DUMP_FILE_RANK", 0);
 NCCL_PARAM(CollNetNodeThreshold, "COLLNET_NODE_THRESHOLD", 2);
 NCCL_PARAM(NvbPreconnect, "NVB_PRECONNECT", 1);
+RCCL_PARAM(AutoTune, "AUTOTUNE", 0);
+RCCL_PARAM(AutoTuneCandidates, "AUTOTUNE_CANDIDATES", 3);
+RCCL_PARAM(AutoTuneSamples, "AUTOTUNE_SAMPLES", 4);
+
+// Autotuner samples are timed with HIP events, ranks agree through the bootstrap network
+struct autoTuneSample {
+  hipEvent_t start;
+  hipEvent_t stop;
+};
+
+static ncclResult_t autoTuneStart(void* ctx, hipStream_t stream, void** sample) {
+  struct autoTuneSample* s;
+  NCCLCHECK(ncclCalloc(&s, 1));
+  CUDACHECK(hipEventCreate(&s->start));
+  CUDACHECK(hipEventCreate(&s->stop));
+  CUDACHECK(hipEventRecord(s->start, stream));
+  *sample = s;
+  return ncclSuccess;
+}
+
+static ncclResult_t autoTuneStop(void* ctx, hipStream_t stream, void* sample) {
+  struct autoTuneSample* s = (struct autoTuneSample*)sample;
+  CUDACHECK(hipEventRecord(s->stop, stream));
+  return ncclSuccess;
+}
+
+static ncclResult_t autoTuneRelease(void* ctx, void* sample) {
+  struct autoTuneSample* s = (struct autoTuneSample*)sample;
+  CUDACHECK(hipEventDestroy(s->start));
+  CUDACHECK(hipEventDestroy(s->stop));
+  free(s);
+  return ncclSuccess;
+}
+
+static ncclResult_t autoTuneElapsed(void* ctx, void* sample, float* us) {
+  struct autoTuneSample* s = (struct autoTuneSample*)sample;
+  float ms;
+  CUDACHECK(hipEventSynchronize(s->stop));
+  // The stop event is not recorded if the launch failed
+  *us = hipEventElapsedTime(&ms, s->start, s->stop) == hipSuccess ? ms*1000 : -1;
+  NCCLCHECK(autoTuneRelease(ctx, sample));
+  return ncclSuccess;
+}
+
+static ncclResult_t autoTuneAllGather(void* ctx, float* data, int n) {
+  struct ncclComm* comm = (struct ncclComm*)ctx;
+  NCCLCHECK(bootstrapAllGather(comm->bootstrap, data, n*sizeof(float)));
+  return ncclSuccess;
+}
+
+// Each rank reads NCCL_TUNING_FILE on its own. Ranks using different tables could pick
+// different algorithms for the same collective and hang, so drop the table on all ranks
+// unless they all loaded the same one.
+static ncclResult_t checkTuningTable(struct ncclComm* comm) {
+  uint64_t* hashes;
+  NCCLCHECK(ncclCalloc(&hashes, comm->nRanks));
+  struct ncclTuningTable* table = comm->tuningTable;
+  hashes[comm->rank] = table ? getHash((const char*)table, sizeof(*table)) : 0;
+  NCCLCHECK(bootstrapAllGather(comm->bootstrap, hashes, sizeof(uint64_t)));
+  int peer = -1;
+  for (int r = 0; r < comm->nRanks; r++) {
+    if (hashes[r] != hashes[0]) { peer = r; break; }
+  }
+  free(hashes);
+  if (peer == -1) return ncclSuccess;
+  if (comm->rank == 0) WARN("Tuning table of rank %d differs from rank 0, check NCCL_TUNING_FILE on all ranks. Ignoring the tuning table", peer);
+  free(comm->tuningTable);
+  comm->tuningTable = NULL;
+  NCCLCHECK(ncclTopoComputeAlgoTable(comm));
+  return ncclSuccess;
+}
 
 static ncclResult_t initTransportsRank(struct ncclComm* comm, ncclUniqueId* commId) {
   // We use 2 AllGathers
@@ -1246,6 +1252,11 @@ collnet_cleanup:
 
   // Compute time models for algorithm and protocol combinations
   NCCLCHECK(ncclTopoTuneModel(comm, minCompCap, maxCompCap, &treeGraph, &ringGraph, &collNetGraph, comm->topo->nodes[GPU].nodes[0].gpu.gcn));
+  NCCLCHECK(checkTuningTable(comm));
+  if (rcclParamAutoTune()) {
+    struct ncclAutoTuneOps ops = { autoTuneStart, autoTuneStop, autoTuneElapsed, autoTuneRelease, autoTuneAllGather, comm };
+    NCCLCHECK(ncclAutoTuneCreate(comm, &ops, rcclParamAutoTuneCandidates(), rcclParamAutoTuneSamples(), &comm->autoTuner));
+  }
 
   // Compute nChannels per peer for p2p
   NCCLCHECK(ncclTopoComputeP2pChannels(comm));
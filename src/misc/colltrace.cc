@@ -0,0 +1,265 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+#ifdef ENABLE_COLLTRACE
+#include "colltrace.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+ncclResult_t ncclCollTraceGetNames(char** names) {
+  char* func_names;
+  NCCLCHECK(ncclCalloc(&func_names, COLLTRACE_NAME_LENGTH*COLLTRACE_NUM_NAMES));
+  for (int func = 0; func < NCCL_NUM_FUNCTIONS; func++) {
+    for (int al = 0; al < NCCL_NUM_ALGORITHMS; al++) {
+      for (int type = 0; type < ncclNumTypes; type++) {
+        for (int pr = 0; pr < NCCL_NUM_PROTOCOLS; pr++) {
+          for (int devredop = 0; devredop < ncclNumDevRedOps; devredop++) {
+            char* line = func_names+COLLTRACE_NAME_LENGTH*FUNC_INDEX(func, devredop, type, al, pr);
+            sprintf(line, "%s%s%s%s%s", ncclFuncStr[func], ncclAlgoStr[al], ncclProtoStr[pr],
+              ncclDevRedOpStr[devredop], ncclTypeStr[type]);
+          }
+        }
+      }
+    }
+  }
+  for (int type = 0; type < ncclNumTypes; type++) {
+    char* line = func_names+COLLTRACE_NAME_LENGTH*(FUNC_INDEX_P2P-ncclNumTypes+type);
+    sprintf(line, "OneRankReducePreMulSum%s", ncclTypeStr[type]);
+  }
+  char* line = func_names+COLLTRACE_NAME_LENGTH*FUNC_INDEX_P2P;
+  sprintf(line, "SendRecvRingSimpleSum_i8");
+  *names = func_names;
+  return ncclSuccess;
+}
+
+void ncclCollTraceFormat(const struct ncclCollTrace* td, const char* names, int rank, int64_t busId, int nRanks, char* line) {
+  int offset = 0;
+  uint8_t type = td->type;
+  uint16_t fIdx = td->funcIndex;
+  if (type == ncclCollTraceDataType) {
+    sprintf(line, "## [%12.6f] [%02d:%02d] L:%04d DT %08x %016lx %016lx",
+      (double)(td->timeStamp)/COLLTRACE_TIMER_FREQUENCY, rank, td->bid,
+      fIdx, td->data_0, td->opCount, td->data_1);
+    return;
+  }
+  sprintf(line, "## [%12.6f] [%02d:%02d] %06lx",
+    (double)(td->timeStamp)/COLLTRACE_TIMER_FREQUENCY, rank, td->bid, fIdx == FUNC_INDEX_P2P ? (td->opCount + 0x100000): td->opCount);
+  offset = strlen(line);
+  switch (type) {
+    case ncclCollTraceKernelLaunchType:
+    case ncclCollTraceCollEndType:
+      if (fIdx > FUNC_INDEX_P2P) {
+        sprintf(line+offset, " %s ERROR bad function index %d", type == ncclCollTraceCollEndType ? "CE" : "KL", fIdx);
+        break;
+      }
+      if (type == ncclCollTraceKernelLaunchType)
+        sprintf(line+offset, " KL HWID %8x %s ", td->data_0, names+COLLTRACE_NAME_LENGTH*fIdx);
+      else
+        sprintf(line+offset, " CE %s ", names+COLLTRACE_NAME_LENGTH*fIdx);
+      offset = strlen(line);
+      if (fIdx == FUNC_INDEX_P2P)
+        sprintf(line+offset, "nt %d dt %d busId %lx nRanks %d", td->p2p.nThreads, td->p2p.delta, busId, nRanks);
+      else
+        sprintf(line+offset, "nt %d bi %d nc %d busId %lx nRanks %d", td->coll.nThreads, td->coll.bid, td->coll.nChannels, busId, nRanks);
+      break;
+    case ncclCollTraceKernelEndType:
+      sprintf(line+offset, " KE busId %lx nRanks %d", busId, nRanks);
+      break;
+    case ncclCollTraceAbortType:
+      sprintf(line+offset, " Abort");
+      break;
+    default:
+      sprintf(line+offset, " unknown collective trace data type");
+      break;
+  }
+}
+
+// Grow the file by this many bytes at a time
+#define COLLTRACE_FILE_CHUNK (1<<24)
+
+static void collTraceExpandPath(const char* path, int rank, char* filename) {
+  char* fn = filename;
+  char* end = filename+PATH_MAX;
+  for (int c = 0; path[c] != '\0' && fn < end-1; c++) {
+    if (path[c] != '%' || path[c+1] == '\0') {
+      *fn++ = path[c];
+      continue;
+    }
+    switch (path[++c]) {
+      case 'h':
+        getHostName(fn, end-fn, '.');
+        break;
+      case 'p':
+        snprintf(fn, end-fn, "%d", getpid());
+        break;
+      case 'r':
+        snprintf(fn, end-fn, "%d", rank);
+        break;
+      case '%':
+        snprintf(fn, end-fn, "%%");
+        break;
+      default: // Echo everything we don't understand
+        snprintf(fn, end-fn, "%%%c", path[c]);
+        break;
+    }
+    fn += strlen(fn);
+  }
+  *fn = '\0';
+}
+
+ncclResult_t ncclCollTraceFileOpen(const char* path, int rank, int nRanks, int64_t busId, const char* names, struct ncclCollTraceFile** file) {
+  char filename[PATH_MAX+1];
+  collTraceExpandPath(path, rank, filename);
+  uint64_t dataOffset = ROUNDUP(sizeof(struct ncclCollTraceFileHeader)+COLLTRACE_NAME_LENGTH*COLLTRACE_NUM_NAMES, 4096);
+  size_t size = dataOffset+COLLTRACE_FILE_CHUNK;
+
+  int fd = open(filename, O_RDWR|O_CREAT|O_TRUNC, 0644);
+  if (fd == -1) {
+    WARN("Could not open collective trace file %s : %s", filename, strerror(errno));
+    return ncclSystemError;
+  }
+  if (ftruncate(fd, size) != 0) {
+    WARN("Could not resize collective trace file %s to %ld bytes : %s", filename, size, strerror(errno));
+    close(fd);
+    return ncclSystemError;
+  }
+  char* base = (char*)mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+    WARN("Could not map collective trace file %s : %s", filename, strerror(errno));
+    close(fd);
+    return ncclSystemError;
+  }
+
+  struct ncclCollTraceFileHeader* header = (struct ncclCollTraceFileHeader*)base;
+  memcpy(header->magic, COLLTRACE_FILE_MAGIC, sizeof(header->magic));
+  header->version = COLLTRACE_FILE_VERSION;
+  header->recordSize = sizeof(struct ncclCollTrace);
+  header->nameLength = COLLTRACE_NAME_LENGTH;
+  header->nNames = COLLTRACE_NUM_NAMES;
+  header->dataOffset = dataOffset;
+  header->timerFreq = COLLTRACE_TIMER_FREQUENCY;
+  header->busId = busId;
+  header->rank = rank;
+  header->nRanks = nRanks;
+  header->pid = getpid();
+  getHostName(header->hostname, sizeof(header->hostname), '.');
+  memcpy(base+sizeof(struct ncclCollTraceFileHeader), names, COLLTRACE_NAME_LENGTH*COLLTRACE_NUM_NAMES);
+
+  struct ncclCollTraceFile* f;
+  NCCLCHECK(ncclCalloc(&f, 1));
+  f->fd = fd;
+  f->base = base;
+  f->size = size;
+  *file = f;
+  INFO(NCCL_INIT, "Writing collective trace of rank %d to %s", rank, filename);
+  return ncclSuccess;
+}
+
+ncclResult_t ncclCollTraceFileWrite(struct ncclCollTraceFile* file, const struct ncclCollTrace* td) {
+  struct ncclCollTraceFileHeader* header = (struct ncclCollTraceFileHeader*)file->base;
+  size_t offset = header->dataOffset+file->nRecords*sizeof(struct ncclCollTrace);
+  if (offset+sizeof(struct ncclCollTrace) > file->size) {
+    size_t size = file->size+COLLTRACE_FILE_CHUNK;
+    if (ftruncate(file->fd, size) != 0) {
+      WARN("Could not resize collective trace file to %ld bytes : %s", size, strerror(errno));
+      return ncclSystemError;
+    }
+    char* base = (char*)mremap(file->base, file->size, size, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) {
+      WARN("Could not map collective trace file : %s", strerror(errno));
+      return ncclSystemError;
+    }
+    file->base = base;
+    file->size = size;
+  }
+  memcpy(file->base+offset, td, sizeof(struct ncclCollTrace));
+  file->nRecords++;
+  return ncclSuccess;
+}
+
+void ncclCollTraceFileCommit(struct ncclCollTraceFile* file, uint64_t lost) {
+  struct ncclCollTraceFileHeader* header = (struct ncclCollTraceFileHeader*)file->base;
+  header->lost = lost;
+  __atomic_store_n(&header->nRecords, file->nRecords, __ATOMIC_RELEASE);
+}
+
+ncclResult_t ncclCollTraceFileClose(struct ncclCollTraceFile* file) {
+  ncclResult_t ret = ncclSuccess;
+  struct ncclCollTraceFileHeader* header = (struct ncclCollTraceFileHeader*)file->base;
+  size_t size = header->dataOffset+header->nRecords*sizeof(struct ncclCollTrace);
+  munmap(file->base, file->size);
+  // Drop the unused end of the last chunk
+  if (ftruncate(file->fd, size) != 0) {
+    WARN("Could not resize collective trace file to %ld bytes : %s", size, strerror(errno));
+    ret = ncclSystemError;
+  }
+  close(file->fd);
+  free(file);
+  return ret;
+}
+ncclResult_t ncclCollTraceReaderInit(struct ncclCollTraceReader* reader, struct ncclCollTrace* ring, uint32_t* tail, uint32_t head,
+    int rank, int nRanks, int64_t busId, const char* path) {
+  memset(reader, 0, sizeof(struct ncclCollTraceReader));
+  reader->ring = ring;
+  reader->tail = tail;
+  reader->head = head;
+  reader->rank = rank;
+  reader->nRanks = nRanks;
+  reader->busId = busId;
+  NCCLCHECK(ncclCollTraceGetNames(&reader->names));
+  // Fall back to INFO if the file cannot be written
+  if (path && ncclCollTraceFileOpen(path, rank, nRanks, busId, reader->names, &reader->file) != ncclSuccess)
+    reader->file = NULL;
+  return ncclSuccess;
+}
+
+int ncclCollTraceReaderPoll(struct ncclCollTraceReader* reader) {
+  uint32_t count = LOAD(reader->tail) - reader->head;
+  if (count > COLLTRACE_NUM_ITEMS) {
+    // The GPU went around the ring, the oldest records were overwritten
+    if (reader->lost == 0) WARN("Collective trace of rank %d lost records, consider lowering RCCL_KERNEL_COLL_TRACE_POLL_MAX", reader->rank);
+    reader->lost += count - COLLTRACE_NUM_ITEMS;
+    reader->head += count - COLLTRACE_NUM_ITEMS;
+    count = COLLTRACE_NUM_ITEMS;
+  }
+  uint32_t n;
+  for (n = 0; n < count; n++) {
+    struct ncclCollTrace *slot = reader->ring+(reader->head+n)%COLLTRACE_NUM_ITEMS;
+    uint8_t type = LOAD(&(slot->type));
+    if (type == ncclCollTraceNotReady)
+      break;
+    struct ncclCollTrace td = *slot;
+    // The slot was reused while it was copied, leave it to the lost records of the next poll
+    if (LOAD(reader->tail) - (reader->head+n) > COLLTRACE_NUM_ITEMS)
+      break;
+    if (reader->file) {
+      if (ncclCollTraceFileWrite(reader->file, &td) != ncclSuccess) {
+        ncclCollTraceFileClose(reader->file);
+        reader->file = NULL;
+      }
+    } else {
+      char line[1024];
+      ncclCollTraceFormat(&td, reader->names, reader->rank, reader->busId, reader->nRanks, line);
+      INFO(NCCL_COLL, "%s", line);
+    }
+    STORE(&(slot->type), ncclCollTraceNotReady);
+  }
+  reader->head += n;
+  if (reader->file && n) ncclCollTraceFileCommit(reader->file, reader->lost);
+  return count;
+}
+
+ncclResult_t ncclCollTraceReaderFinalize(struct ncclCollTraceReader* reader) {
+  ncclResult_t ret = ncclSuccess;
+  if (reader->file) {
+    ncclCollTraceFileCommit(reader->file, reader->lost);
+    ret = ncclCollTraceFileClose(reader->file);
+  }
+  free(reader->names);
+  return ret;
+}
+#endif
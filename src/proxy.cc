@@ -36,11 +36,8 @@ static ncclResult_t allocateArgs(struct ncclComm* comm, struct ncclProxyArgs** a
   struct ncclProxyArgs* elem;
   if (state->pool == NULL) {
     // Check whether there are freed elements
-    if (state->poolReturned) {
-      pthread_mutex_lock(&state->poolMutex);
-      state->pool = state->poolReturned;
-      state->poolReturned = NULL;
-      pthread_mutex_unlock(&state->poolMutex);
+    if (__atomic_load_n(&state->poolReturned, __ATOMIC_RELAXED)) {
+      state->pool = __atomic_exchange_n(&state->poolReturned, NULL, __ATOMIC_ACQUIRE);
     } else {
       // Allocate a new pool of elements. Make sure we allocate the memory close
       // to the network thread
@@ -81,9 +78,9 @@ static ncclResult_t allocateArgs(struct ncclComm* comm, struct ncclProxyArgs** a
 #define DEBUG_PROXY_PRINT(...)
 #endif
 
-#define OP_INDEX(op) ((op) ? (op)-state->pools->elems : -1)
+#define OP_INDEX(op) ((op) ? (op)-state->comm->proxyState.pools->elems : -1)
 #define OP_SEEN 0x100000
-ncclResult_t dumpProxyState(struct ncclProxyState* state) {
+ncclResult_t dumpProxyState(struct ncclProxyThread* state) {
 #ifdef DEBUG_PROXY
   struct ncclProxyArgs* op = state->ops;
   while (op) {
@@ -106,7 +103,7 @@ ncclResult_t dumpProxyState(struct ncclProxyState* state) {
   }
   printf("[X]\n");
 
-  struct ncclProxyArgs* free = state->pool;
+  struct ncclProxyArgs* free = state->comm->proxyState.pool;
   while (free) {
     if (free->idle & OP_SEEN) {
       WARN("Free list loop at element %ld", OP_INDEX(free));
@@ -115,13 +112,13 @@ ncclResult_t dumpProxyState(struct ncclProxyState* state) {
     free = free->next;
   }
 
-  struct ncclProxyPool* p = state->pools;
+  struct ncclProxyPool* p = state->comm->proxyState.pools;
   int i = 0;
   while (p) {
     for (int e=0; e<PROXYARGS_ALLOCATE_SIZE; e++) {
       if ((p->elems[e].idle & OP_SEEN) == 0) {
         WARN("Element %d of pool %d has been lost", e, i);
-        struct ncclProxyArgs* free = state->pool;
+        struct ncclProxyArgs* free = state->comm->proxyState.pool;
         printf("Free list ");
         while (free) {
           printf("--> %ld ", OP_INDEX(free));
@@ -139,7 +136,7 @@ ncclResult_t dumpProxyState(struct ncclProxyState* state) {
   return ncclSuccess;
 }
 
-static ncclResult_t ProxyAppend(struct ncclProxyState* state, struct ncclProxyArgs* args) {
+static ncclResult_t ProxyAppend(struct ncclProxyThread* state, struct ncclProxyArgs* args) {
   struct ncclProxyArgs* proxyAppend = *args->proxyAppendPtr;
   int shared = args->subs[0].connector->conn.shared;
   if (proxyAppend) {
@@ -186,6 +183,20 @@ static ncclResult_t ProxyAppend(struct ncclProxyState* state, struct ncclProxyAr
   return ncclSuccess;
 }
 
+// Thread progressing the operations of a connector. Operations which may be
+// merged through a shared proxyAppend must go to the same thread: CollNet
+// shares them per network device, everything else per channel.
+static struct ncclProxyThread* proxyThreadOf(struct ncclConnector* connector, struct ncclChannel* channel) {
+  struct ncclProxyState* state = &connector->comm->proxyState;
+  if (state->nThreads <= 1) return state->threads;
+  int shard = channel->id;
+  struct ncclProxyArgs** collNet = state->sharedBuffs.proxyAppendCollNet;
+  if (connector->proxyAppendPtr >= collNet && connector->proxyAppendPtr < collNet+2*MAXCHANNELS) {
+    shard = (connector->proxyAppendPtr-collNet)/2;
+  }
+  return state->threads + shard%state->nThreads;
+}
+
 static ncclResult_t SaveProxy(int type, int peer, struct ncclProxyArgs* args, int connIndex) {
   if (peer < 0) return ncclSuccess;
 
@@ -199,7 +210,7 @@ static ncclResult_t SaveProxy(int type, int peer, struct ncclProxyArgs* args, in
   }
   if (connector->transportComm->proxy == NULL) return ncclSuccess;
 
-  struct ncclProxyState* state = &connector->comm->proxyState;
+  struct ncclProxyThread* state = proxyThreadOf(connector, channel);
   struct ncclProxyArgs* op;
   NCCLCHECK(allocateArgs(connector->comm, &op));
   memcpy(op, args, sizeof(struct ncclProxyArgs));
@@ -314,7 +325,7 @@ ncclResult_t ncclProxySaveP2p(struct ncclComm* comm, struct ncclProxyArgs* args)
   return ncclSuccess;
 }
 
-static ncclResult_t removeOp(struct ncclProxyState* state, struct ncclProxyArgs** opPtr, struct ncclProxyArgs** prevOpPtr) {
+static ncclResult_t removeOp(struct ncclProxyThread* state, struct ncclProxyArgs** opPtr, struct ncclProxyArgs** prevOpPtr) {
   struct ncclProxyArgs* freeOp = *opPtr;
   DEBUG_PROXY_PRINT("Remove %ld -> %ld -> %ld\n", OP_INDEX(*prevOpPtr), OP_INDEX(freeOp), OP_INDEX(freeOp->next));
   struct ncclProxyArgs* next = freeOp->next;
@@ -344,7 +355,7 @@ static ncclResult_t removeOp(struct ncclProxyState* state, struct ncclProxyArgs*
   return ncclSuccess;
 }
 
-static ncclResult_t progressOps(struct ncclProxyState* state, struct ncclProxyArgs** opsPtr, int* idle, struct ncclComm* comm) {
+static ncclResult_t progressOps(struct ncclProxyThread* state, struct ncclProxyArgs** opsPtr, int* idle, struct ncclComm* comm) {
   struct ncclProxyArgs* prevOp = NULL;
   struct ncclProxyArgs* op = *opsPtr;
   while (op) {
@@ -352,6 +363,7 @@ static ncclResult_t progressOps(struct ncclProxyState* state, struct ncclProxyAr
     NCCLCHECK(op->progress(op));
     *idle &= op->idle;
     if (op->state == ncclProxyOpNone) {
+      state->nOps++;
       NCCLCHECK(removeOp(state, &op, &prevOp));
     } else {
       prevOp = op;
@@ -361,24 +373,109 @@ static ncclResult_t progressOps(struct ncclProxyState* state, struct ncclProxyAr
   return ncclSuccess;
 }
 
-ncclResult_t ncclProxyAppendPosted(struct ncclProxyState* state) {
-  // Return any freed element first
-  if (state->poolFreed) {
-    struct ncclProxyArgs* end = state->poolFreed;
-    while (end->next) end = end->next;
-    pthread_mutex_lock(&state->poolMutex);
-    end->next = state->poolReturned;
-    state->poolReturned = state->poolFreed;
-    pthread_mutex_unlock(&state->poolMutex);
-    state->poolFreed = NULL;
+// Give freed elements back to the main thread
+static void ncclProxyReturnFreed(struct ncclProxyThread* state) {
+  if (state->poolFreed == NULL) return;
+  struct ncclProxyArgs* end = state->poolFreed;
+  while (end->next) end = end->next;
+  struct ncclProxyArgs** poolReturned = &state->comm->proxyState.poolReturned;
+  struct ncclProxyArgs* head = __atomic_load_n(poolReturned, __ATOMIC_RELAXED);
+  do {
+    end->next = head;
+  } while (!__atomic_compare_exchange_n(poolReturned, &head, state->poolFreed, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  state->poolFreed = NULL;
+}
+
+static bool ncclProxyHasPosted(struct ncclProxyThread* state) {
+  return __atomic_load_n(&state->postedTail, __ATOMIC_SEQ_CST) != &state->postedHead;
+}
+
+// Move everything posted by ncclProxyStart to postedOps
+static void ncclProxyTakePosted(struct ncclProxyThread* state) {
+  struct ncclProxyArgs* first = __atomic_load_n(&state->postedHead, __ATOMIC_ACQUIRE);
+  // Empty, or the first poster did not link its operations yet
+  if (first == NULL) return;
+  // postedTail is not &postedHead, so posters don't write postedHead until
+  // we reset postedTail below
+  __atomic_store_n(&state->postedHead, NULL, __ATOMIC_RELAXED);
+  struct ncclProxyArgs* last = first;
+  while (1) {
+    struct ncclProxyArgs* next = __atomic_load_n(&last->next, __ATOMIC_ACQUIRE);
+    if (next) {
+      last = next;
+      continue;
+    }
+    struct ncclProxyArgs** expected = &last->next;
+    if (__atomic_compare_exchange_n(&state->postedTail, &expected, &state->postedHead, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) break;
+    // Someone is posting after last. Wait for it to link its operations;
+    // we can't hand last to ProxyAppend before that.
+    while (__atomic_load_n(&last->next, __ATOMIC_ACQUIRE) == NULL) sched_yield();
   }
+  if (state->postedOps) state->postedOpsEnd->next = first;
+  else state->postedOps = first;
+  state->postedOpsEnd = last;
+}
+
+static double ncclProxyTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
 
-  // Then wait until we have new work to do
+NCCL_PARAM(ProxySpinUsec, "PROXY_SPIN_USEC", 50);
+
+// Wait for operations to be posted. Spin for a while first, as operations
+// often come in bursts, then sleep until ncclProxyStart wakes us up. The spin
+// budget grows when spinning finds work and shrinks when it doesn't.
+// Time spent spinning counts as polling, only time spent asleep as waiting.
+static void ncclProxyWaitPosted(struct ncclProxyThread* state) {
+  int maxSpinUsec = ncclParamProxySpinUsec();
+  if (maxSpinUsec > 0) {
+    double start = ncclProxyTime();
+    for (int i=0; ; i++) {
+      ncclProxyTakePosted(state);
+      if (state->postedOps) {
+        state->spinUsec = std::min(std::max(2*state->spinUsec, 1), maxSpinUsec);
+        state->pollUsec += ncclProxyTime() - start;
+        return;
+      }
+      if (state->comm->proxyState.stop) return;
+      // Only look at the time once in a while, it is not free either
+      if ((i & 0xf) == 0xf && ncclProxyTime() - start > state->spinUsec) break;
+      sched_yield();
+    }
+    state->spinUsec = std::max(state->spinUsec/2, std::max(maxSpinUsec/16, 1));
+    state->pollUsec += ncclProxyTime() - start;
+  }
+
+  // Tell posters they need to wake us up, then make sure nothing was posted
+  // in the meantime. Pairs with the exchange then load in ncclProxyStart.
+  double start = ncclProxyTime();
+  __atomic_store_n(&state->parked, 1, __ATOMIC_SEQ_CST);
   pthread_mutex_lock(&state->opsMutex);
-  while (state->postedOps == NULL) {
-    if (state->stop) return ncclSuccess;
+  while (!ncclProxyHasPosted(state) && !state->comm->proxyState.stop) {
     pthread_cond_wait(&state->cond, &state->opsMutex);
   }
+  pthread_mutex_unlock(&state->opsMutex);
+  __atomic_store_n(&state->parked, 0, __ATOMIC_RELAXED);
+  state->waitUsec += ncclProxyTime() - start;
+  ncclProxyTakePosted(state);
+}
+
+// Append the posted operations of the next launch to the running ones. When
+// wait is set, wait for a launch if there is none.
+ncclResult_t ncclProxyAppendPosted(struct ncclProxyThread* state, int wait) {
+  // Return any freed element first
+  ncclProxyReturnFreed(state);
+
+  ncclProxyTakePosted(state);
+  if (state->postedOps == NULL) {
+    if (wait == 0) return ncclSuccess;
+    // Then wait until we have new work to do
+    ncclProxyWaitPosted(state);
+    // Stopping, or an operation is still being linked; we'll be back
+    if (state->postedOps == NULL) return ncclSuccess;
+  }
 
   // Sort operations as we append them : collectives and
   // receives first, then sends.
@@ -405,28 +502,21 @@ ncclResult_t ncclProxyAppendPosted(struct ncclProxyState* state) {
   state->postedOps = op;
   if (op == NULL) state->postedOpsEnd = NULL;
   NCCLCHECK(dumpProxyState(state));
-  pthread_mutex_unlock(&state->opsMutex);
 
-  if (state->poolFreed) {
-    struct ncclProxyArgs* end = state->poolFreed;
-    while (end->next) end = end->next;
-    pthread_mutex_lock(&state->poolMutex);
-    end->next = state->poolReturned;
-    state->poolReturned = state->poolFreed;
-    pthread_mutex_unlock(&state->poolMutex);
-    state->poolFreed = NULL;
-  }
+  ncclProxyReturnFreed(state);
 
   return ncclSuccess;
 }
 
 
-void* persistentThread(void *comm_) {
-  struct ncclComm* comm = (struct ncclComm*)comm_;
-  struct ncclProxyState* state = &comm->proxyState;
+void* persistentThread(void *thread_) {
+  struct ncclProxyThread* state = (struct ncclProxyThread*)thread_;
+  struct ncclComm* comm = state->comm;
   char threadName[16];
-  sprintf(threadName, "NCCLproxy %5d", comm->rank);
+  if (comm->proxyState.nThreads == 1) sprintf(threadName, "NCCLproxy %5d", comm->rank);
+  else sprintf(threadName, "NCCLprx%2d %5d", state->id, comm->rank);
   nvtxNameOsThreadA(syscall(SYS_gettid), threadName);
+  if (CPU_COUNT(&state->affinity)) sched_setaffinity(0, sizeof(cpu_set_t), &state->affinity);
 
   struct ncclProxyArgs** opsPtr = &state->ops;
   while (1) {
@@ -435,11 +525,11 @@ void* persistentThread(void *comm_) {
     }
 
     while (*opsPtr == NULL) {
-      if (state->stop) {
+      if (comm->proxyState.stop) {
         // No more commands to process and proxy has been requested to stop
         return NULL;
       }
-      ncclResult_t ret = ncclProxyAppendPosted(state);
+      ncclResult_t ret = ncclProxyAppendPosted(state, 1);
       if (ret != ncclSuccess) {
         comm->fatalError = ret;
         INFO(NCCL_ALL,"%s:%d -> %d [Proxy Thread]", __FILE__, __LINE__, ret);
@@ -447,6 +537,7 @@ void* persistentThread(void *comm_) {
       }
     }
     int idle = 1;
+    double start = ncclProxyTime();
     ncclResult_t ret = progressOps(state, opsPtr, &idle, comm);
     if (ret != ncclSuccess) {
       comm->fatalError = ret;
@@ -454,22 +545,46 @@ void* persistentThread(void *comm_) {
       return NULL;
     }
     if (idle) {
-      sched_yield(); // No request progressed. Let others run.
+      // No request progressed. Pick up new operations now rather than when
+      // the running ones complete, or let others run.
+      if (state->postedOps || ncclProxyHasPosted(state)) {
+        ret = ncclProxyAppendPosted(state, 0);
+        if (ret != ncclSuccess) {
+          comm->fatalError = ret;
+          INFO(NCCL_ALL,"%s:%d -> %d [Proxy Thread]", __FILE__, __LINE__, ret);
+          return NULL;
+        }
+      } else {
+        sched_yield();
+      }
+      state->pollUsec += ncclProxyTime() - start;
+    } else {
+      state->busyUsec += ncclProxyTime() - start;
     }
   }
 }
 
+// Post the operations of this launch to the proxy threads. Posters append
+// them to the queue with a single exchange on postedTail, then link them to
+// the previous tail; the proxy thread copes with the short window in between.
 ncclResult_t ncclProxyStart(struct ncclComm* comm) {
-  struct ncclProxyState* state = &comm->proxyState;
-  if (state->nextOps == NULL) return ncclSuccess;
-  pthread_mutex_lock(&state->opsMutex);
-  if (state->postedOps) state->postedOpsEnd->next = state->nextOps;
-  else state->postedOps = state->nextOps;
-  state->postedOpsEnd = state->nextOpsEnd;
-  state->nextOps = state->nextOpsEnd = NULL;
-  pthread_cond_signal(&state->cond);
-  pthread_mutex_unlock(&state->opsMutex);
-  comm->opCount++;
+  struct ncclProxyState* proxyState = &comm->proxyState;
+  bool posted = false;
+  for (int t=0; t<proxyState->nThreads; t++) {
+    struct ncclProxyThread* state = proxyState->threads+t;
+    if (state->nextOps == NULL) continue;
+    state->nextOpsEnd->next = NULL;
+    struct ncclProxyArgs** prevTail = __atomic_exchange_n(&state->postedTail, &state->nextOpsEnd->next, __ATOMIC_SEQ_CST);
+    __atomic_store_n(prevTail, state->nextOps, __ATOMIC_RELEASE);
+    state->nextOps = state->nextOpsEnd = NULL;
+    if (__atomic_load_n(&state->parked, __ATOMIC_SEQ_CST)) {
+      pthread_mutex_lock(&state->opsMutex);
+      pthread_cond_signal(&state->cond);
+      pthread_mutex_unlock(&state->opsMutex);
+    }
+    posted = true;
+  }
+  if (posted) comm->opCount++;
   return ncclSuccess;
 }
 
@@ -520,13 +635,40 @@ ncclResult_t ncclProxySharedBuffersDestroy(struct ncclComm* comm) {
   return ncclSuccess;
 }
 
+NCCL_PARAM(ProxyNThreads, "PROXY_NTHREADS", 1);
+
+// Split the CPUs close to the GPU between proxy threads when there are
+// enough of them, otherwise let all threads use all of them.
+static void proxyThreadAffinity(struct ncclComm* comm, int t, int nThreads, cpu_set_t* affinity) {
+  *affinity = comm->cpuAffinity;
+  if (nThreads == 1 || CPU_COUNT(&comm->cpuAffinity) < nThreads) return;
+  CPU_ZERO(affinity);
+  for (int cpu=0, n=0; cpu<CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &comm->cpuAffinity)) continue;
+    if (n++ % nThreads == t) CPU_SET(cpu, affinity);
+  }
+}
+
 ncclResult_t ncclProxyCreate(struct ncclComm* comm) {
-  if (!comm->proxyThread) {
-    comm->proxyState.cond = PTHREAD_COND_INITIALIZER;
-    comm->proxyState.opsMutex = PTHREAD_MUTEX_INITIALIZER;
-    comm->proxyState.poolMutex = PTHREAD_MUTEX_INITIALIZER;
-    comm->proxyState.ops = NULL;
-    pthread_create(&comm->proxyThread, NULL, persistentThread, comm);
+  struct ncclProxyState* state = &comm->proxyState;
+  if (state->nThreads == 0) {
+    int nThreads = std::min(std::max((int)ncclParamProxyNThreads(), 1), NCCL_PROXY_MAX_THREADS);
+    for (int t=0; t<nThreads; t++) {
+      struct ncclProxyThread* thread = state->threads+t;
+      thread->comm = comm;
+      thread->id = t;
+      thread->cond = PTHREAD_COND_INITIALIZER;
+      thread->opsMutex = PTHREAD_MUTEX_INITIALIZER;
+      thread->ops = NULL;
+      thread->postedHead = NULL;
+      thread->postedTail = &thread->postedHead;
+      thread->spinUsec = ncclParamProxySpinUsec();
+      proxyThreadAffinity(comm, t, nThreads, &thread->affinity);
+    }
+    // Operations can only be saved once the threads they go to are set up
+    state->nThreads = nThreads;
+    for (int t=0; t<nThreads; t++) pthread_create(&state->threads[t].thread, NULL, persistentThread, state->threads+t);
+    if (nThreads > 1) INFO(NCCL_INIT|NCCL_NET, "comm %p rank %d using %d proxy threads", comm, comm->rank, nThreads);
   }
   return ncclSuccess;
 }
@@ -534,22 +676,31 @@ ncclResult_t ncclProxyCreate(struct ncclComm* comm) {
 ncclResult_t ncclProxyDestroy(struct ncclComm* comm) {
   struct ncclProxyState* state = &comm->proxyState;
 
-  // Request the proxy to stop and then wake it
-  pthread_mutex_lock(&state->opsMutex);
+  // Request the proxy threads to stop and then wake them
   state->stop = true;
-  pthread_cond_signal(&state->cond);
-  pthread_mutex_unlock(&state->opsMutex);
-  if (comm->proxyThread) pthread_join(comm->proxyThread, NULL);
+  for (int t=0; t<state->nThreads; t++) {
+    struct ncclProxyThread* thread = state->threads+t;
+    pthread_mutex_lock(&thread->opsMutex);
+    pthread_cond_signal(&thread->cond);
+    pthread_mutex_unlock(&thread->opsMutex);
+  }
+  for (int t=0; t<state->nThreads; t++) {
+    struct ncclProxyThread* thread = state->threads+t;
+    pthread_join(thread->thread, NULL);
+    double total = thread->busyUsec + thread->pollUsec + thread->waitUsec;
+    if (total > 0) {
+      INFO(NCCL_NET, "comm %p rank %d proxy thread %d : %lu ops, busy %.1f%% polling %.1f%% waiting %.1f%%", comm, comm->rank, t,
+          thread->nOps, 100*thread->busyUsec/total, 100*thread->pollUsec/total, 100*thread->waitUsec/total);
+    }
+  }
 
   // Free off any memory allocated for the proxy arg pools
-  pthread_mutex_lock(&state->poolMutex);
   struct ncclProxyState* proxyState = &comm->proxyState;
   while (proxyState->pools != NULL) {
     struct ncclProxyPool *next = proxyState->pools->next;
     free(proxyState->pools);
     proxyState->pools = next;
   }
-  pthread_mutex_unlock(&state->poolMutex);
 
   NCCLCHECK(ncclProxySharedBuffersDestroy(comm));
 
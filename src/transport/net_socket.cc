@@ -15,6 +15,13 @@
 #include <poll.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
 
 /* Init functions */
 static int ncclNetIfs = -1;
@@ -117,11 +124,49 @@ ncclResult_t GetSocketAddr(int dev, union socketAddress* addr) {
 
 NCCL_PARAM(SocketNsocksPerThread, "NSOCKS_PERTHREAD", -2);
 NCCL_PARAM(SocketNthreads, "SOCKET_NTHREADS", -2);
+NCCL_PARAM(SocketZeroCopy, "SOCKET_ZEROCOPY", 1);
+NCCL_PARAM(SocketZeroCopyThreshold, "SOCKET_ZEROCOPY_THRESHOLD", 256*1024);
+NCCL_PARAM(SocketAdaptiveStriping, "SOCKET_ADAPTIVE_STRIPING", 1);
+NCCL_PARAM(SocketCalibrate, "SOCKET_CALIBRATE", 0);
+NCCL_PARAM(SocketCalibrateMs, "SOCKET_CALIBRATE_MS", 20);
+
+// Older system headers may lack the MSG_ZEROCOPY definitions (Linux 4.14+)
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#define MAX_SEND_IOVS 16
+
+// Upper bound of the adaptive chunk size (the lower one is MIN_CHUNKSIZE), and
+// how often the kernel is asked about the state of the data sockets when striping
+#define MAX_STRIPE_CHUNKSIZE (4*1024*1024)
+#define STRIPE_SAMPLE_USEC 1000
+
+// MSG_ZEROCOPY state of a sending socket. Every sendmsg() issued with
+// MSG_ZEROCOPY gets the next sequence number and the kernel reports completed
+// ranges on the socket error queue; only then may the buffer be reused.
+struct ncclSocketZeroCopy {
+  int enabled;
+  uint32_t issued;
+  uint32_t completed;
+};
+
+// nSocks is NCCL_SOCKET_CALIBRATE when the listener leaves the choice to a
+// bandwidth probe run by the connecting side against probePort.
+#define NCCL_SOCKET_CALIBRATE -1
+#define PROBE_BUFFSIZE (1024*1024)
 
 struct ncclSocketHandle {
   union socketAddress connectAddr;
   int nSocks;
   int nThreads;
+  uint16_t probePort;
 };
 
 struct ncclSocketTask {
@@ -130,11 +175,35 @@ struct ncclSocketTask {
   int size;
   int fd;
   union socketAddress *addr;
-  int offset;
-  int used;
+  int offset;    // published by the helper thread
+  int used;      // owned by the main thread
+  int sock;      // index of the socket within the helper thread
+  int sent;      // bytes handed to the kernel with MSG_ZEROCOPY
+  int zc;
+  uint32_t zcSeq;
+  struct ncclSocketTask* next; // next task on the same socket (helper thread)
   ncclResult_t result;
 };
 
+struct ncclSocketTaskList {
+  struct ncclSocketTask* head;
+  struct ncclSocketTask* tail;
+};
+
+// Control message sent ahead of the data. With helper threads, the sender
+// decides how the message is striped over the data sockets and the receiver
+// follows the same plan; only the first nChunks entries go on the wire.
+struct ncclSocketChunk {
+  int sock;
+  int size;
+};
+
+struct ncclSocketHeader {
+  int size;
+  int nChunks;
+  struct ncclSocketChunk chunks[MAX_SOCKETS];
+};
+
 struct ncclSocketRequest {
   int op;
   void* data;
@@ -143,90 +212,390 @@ struct ncclSocketRequest {
   union socketAddress *addr;
   int offset;
   int used;
+  struct ncclSocketHeader hdr;
+  int hdrSize;
+  int hdrOffset;
+  int zc;
+  uint32_t zcSeq;
   struct ncclSocketComm* comm;
   struct ncclSocketTask* tasks[MAX_SOCKETS];
   int nSubs;
 };
 
+// Tasks are allocated from a pool by the main thread and handed to the helper
+// thread through a single-producer/single-consumer ring. The pool holds as
+// many tasks as the ring, so the ring never overflows. The producer only
+// signals the eventfd when the helper thread announced it is about to block.
 struct ncclSocketTaskQueue {
   int next;
   int len;
   struct ncclSocketTask* tasks;
+  struct ncclSocketTask** ring;
+  char pad1[CACHE_LINE_SIZE];
+  uint64_t tail;  // main thread
+  char pad2[CACHE_LINE_SIZE-sizeof(uint64_t)];
+  uint64_t head;  // helper thread
+  int parked;     // helper thread
+  char pad3[CACHE_LINE_SIZE-sizeof(uint64_t)-sizeof(int)];
 };
 
 enum threadState {start, stop};
 
+// Readiness of a socket owned by a helper thread. Sockets are registered
+// edge-triggered, so a direction stays ready until a send/recv hits EAGAIN.
+// Tasks of a socket are progressed in the order they were posted.
+struct ncclSocketThreadSock {
+  int fd;
+  uint32_t ready; // EPOLLIN/EPOLLOUT
+  struct ncclSocketTaskList pending;
+  struct ncclSocketTaskList zcWait; // fully sent, waiting for zerocopy completion
+  int errQueue;    // zerocopy completions may be waiting on the error queue
+  uint64_t bytes;  // bytes handed to the kernel (helper thread)
+  struct ncclSocketZeroCopy zc;
+};
+
+// Send side view of the load of a data socket, used to stripe messages.
+// Bytes are delivered once the kernel no longer holds them (SIOCOUTQ).
+struct ncclSocketLoad {
+  uint64_t queued;    // bytes assigned to the socket
+  uint64_t delivered; // at the last sample
+  float bw;           // delivery rate in bytes/usec while busy, 0 if unknown
+  float rtt;          // smoothed RTT in usec, 0 if unknown
+  int busy;           // the socket had a backlog at the last sample
+};
+
+#define NCCL_SOCKET_EVENT_WAKEUP MAX_SOCKETS
+
 struct ncclSocketThreadResources {
   struct ncclSocketTaskQueue threadTaskQueue;
   enum threadState state;
   struct ncclSocketComm* comm;
-  pthread_mutex_t threadLock;
-  pthread_cond_t  threadCond;
+  int epollFd;
+  int eventFd;
+  int nSocks;
+  struct ncclSocketThreadSock socks[MAX_SOCKETS];
 };
 
 struct ncclSocketListenComm {
   int fd;
   int nSocks;
   int nThreads;
+  int dev;
+  int probeFd;
+  pthread_t probeThread;
+  // Sockets the probe thread may block on, so that closing the listen comm can
+  // wake it up. Guarded by ncclSocketLock.
+  int probeCtrlFd;
+  int probeFds[MAX_THREADS];
+  int probeClosing;
 };
 
 struct ncclSocketComm {
   int ctrlFd;
+  int ctrlEpollFd;
+  uint32_t ctrlReady;
+  struct ncclSocketZeroCopy ctrlZc;
+  // Send requests whose header or data still have to be pushed, in posting order
+  struct ncclSocketRequest* sendQueue[MAX_REQUESTS];
+  int sendHead;
+  int nSendQueued;
   union socketAddress addr;
   int fds[MAX_SOCKETS];
   int nSocks;
   int nThreads;
   int nextFd;
+  struct ncclSocketLoad loads[MAX_SOCKETS];
+  double lastSample;
   struct ncclSocketRequest requests[MAX_REQUESTS];
   pthread_t helperThread[MAX_THREADS];
   struct ncclSocketThreadResources threadResources[MAX_THREADS];
 };
 
+static inline uint32_t socketOpEvent(int op) {
+  return op == NCCL_SOCKET_RECV ? EPOLLIN : EPOLLOUT;
+}
+
+static double socketTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+static void socketZeroCopyInit(int fd, struct ncclSocketZeroCopy* zc) {
+  static int shown = 0;
+  zc->issued = zc->completed = 0;
+  zc->enabled = 0;
+  if (ncclParamSocketZeroCopy() == 0) return;
+  int one = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0) {
+    zc->enabled = 1;
+  } else if (shown++ == 0) {
+    INFO(NCCL_NET, "NET/Socket : MSG_ZEROCOPY not available (%s), using regular sends", strerror(errno));
+  }
+}
+
+static inline int socketZeroCopyDone(struct ncclSocketZeroCopy* zc, uint32_t seq) {
+  return (int32_t)(zc->completed - seq) >= 0;
+}
+
+// Drain zerocopy completion notifications from the socket error queue
+static ncclResult_t socketZeroCopyReap(int fd, struct ncclSocketZeroCopy* zc) {
+  while (zc->completed != zc->issued) {
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err)+sizeof(struct sockaddr_in6))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE|MSG_DONTWAIT) == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return ncclSuccess;
+      WARN("NET/Socket : recvmsg(MSG_ERRQUEUE) failed : %s", strerror(errno));
+      return ncclSystemError;
+    }
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (!(cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_RECVERR) &&
+          !(cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_RECVERR)) continue;
+      struct sock_extended_err* err = (struct sock_extended_err*)CMSG_DATA(cm);
+      if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0) {
+        WARN("NET/Socket : unexpected socket error queue message, origin %d errno %d", err->ee_origin, err->ee_errno);
+        return ncclSystemError;
+      }
+      // Completions cover the calls [ee_info, ee_data] and arrive in order on TCP
+      uint32_t next = err->ee_data+1;
+      if ((int32_t)(next - zc->completed) > 0) zc->completed = next;
+    }
+  }
+  return ncclSuccess;
+}
+
+// Non-blocking scatter/gather send. Uses MSG_ZEROCOPY when asked to and
+// supported by the socket, falling back to a copy when the kernel runs out of
+// notification memory. *zcUsed tells whether the sent bytes belong to
+// zerocopy call zc->issued. *full is set when the socket buffer is full
+// (EAGAIN), i.e. when the caller has to wait for the next writable edge.
+static ncclResult_t socketSendmsg(int fd, union socketAddress* addr, struct iovec* iov, int niov, int zeroCopy,
+    struct ncclSocketZeroCopy* zc, int* sent, int* zcUsed, int* full) {
+  char line[SOCKET_NAME_MAXLEN+1];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = iov;
+  msg.msg_iovlen = niov;
+  int flags = MSG_DONTWAIT;
+  if (zeroCopy && zc->enabled) flags |= MSG_ZEROCOPY;
+  ssize_t bytes;
+  do {
+    bytes = sendmsg(fd, &msg, flags);
+    if (bytes == -1 && errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+      flags &= ~MSG_ZEROCOPY;
+      bytes = sendmsg(fd, &msg, flags);
+    }
+  } while (bytes == -1 && errno == EINTR);
+  *full = 0;
+  if (bytes == -1) {
+    if (errno != EWOULDBLOCK && errno != EAGAIN) {
+      WARN("Net : Call to sendmsg to %s failed : %s", socketToString(addr, line), strerror(errno));
+      return ncclSystemError;
+    }
+    bytes = 0;
+    *full = 1;
+  }
+  *sent = bytes;
+  *zcUsed = bytes > 0 && (flags & MSG_ZEROCOPY);
+  if (*zcUsed) zc->issued++;
+  return ncclSuccess;
+}
+
+static ncclResult_t socketPollAdd(int epollFd, int fd, uint32_t id, uint32_t events) {
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.u32 = id;
+  SYSCHECK(epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev), "epoll_ctl");
+  return ncclSuccess;
+}
+
+static void socketThreadWait(struct ncclSocketThreadResources* resource, int timeout) {
+  struct epoll_event events[MAX_SOCKETS+1];
+  int nEvents = epoll_wait(resource->epollFd, events, MAX_SOCKETS+1, timeout);
+  for (int e=0; e<nEvents; e++) {
+    uint32_t id = events[e].data.u32;
+    if (id == NCCL_SOCKET_EVENT_WAKEUP) {
+      uint64_t count;
+      // Reset the wakeup counter; it is non-blocking so a spurious event is harmless.
+      (void) read(resource->eventFd, &count, sizeof(count));
+    } else {
+      // Errors and hang-ups are reported by the next send/recv, treat them as ready.
+      // With zerocopy, EPOLLERR also signals completions on the error queue.
+      struct ncclSocketThreadSock* sock = resource->socks+id;
+      uint32_t ready = events[e].events;
+      if (ready & (EPOLLERR|EPOLLHUP)) ready |= EPOLLIN|EPOLLOUT;
+      if ((ready & EPOLLERR) && sock->zc.enabled) sock->errQueue = 1;
+      sock->ready |= ready & (EPOLLIN|EPOLLOUT);
+    }
+  }
+}
+
+static inline void socketTaskPush(struct ncclSocketTaskList* list, struct ncclSocketTask* r) {
+  r->next = NULL;
+  if (list->tail) list->tail->next = r;
+  else list->head = r;
+  list->tail = r;
+}
+
+static inline struct ncclSocketTask* socketTaskPop(struct ncclSocketTaskList* list) {
+  struct ncclSocketTask* r = list->head;
+  list->head = r->next;
+  if (list->head == NULL) list->tail = NULL;
+  return r;
+}
+
+static inline void socketTaskDone(struct ncclSocketTask* r) {
+  __atomic_store_n(&r->offset, r->size, __ATOMIC_RELEASE);
+}
+
+// Move bytes for the oldest tasks of a socket, for as long as it stays ready
+static ncclResult_t socketThreadProgress(struct ncclSocketThreadSock* sock, int* progress) {
+  if (sock->zcWait.head) {
+    if (sock->errQueue) {
+      sock->errQueue = 0;
+      NCCLCHECK(socketZeroCopyReap(sock->fd, &sock->zc));
+    }
+    while (sock->zcWait.head && socketZeroCopyDone(&sock->zc, sock->zcWait.head->zcSeq)) {
+      socketTaskDone(socketTaskPop(&sock->zcWait));
+      *progress = 1;
+    }
+  }
+  while (sock->pending.head) {
+    struct ncclSocketTask* r = sock->pending.head;
+    int op = r->op, zc = r->zc;
+    uint32_t event = socketOpEvent(op);
+    if ((sock->ready & event) == 0) break;
+    int moved = 0, complete, offset = 0;
+    if (zc) {
+      int sent, zcUsed, full;
+      do {
+        struct iovec iov = { (char*)r->data+r->sent, (size_t)(r->size-r->sent) };
+        NCCLCHECK(socketSendmsg(r->fd, r->addr, &iov, 1, 1, &sock->zc, &sent, &zcUsed, &full));
+        if (zcUsed) r->zcSeq = sock->zc.issued;
+        r->sent += sent;
+        moved += sent;
+      } while (!full && r->sent < r->size);
+      complete = r->sent == r->size;
+    } else {
+      offset = r->offset;
+      NCCLCHECK(socketProgress(op, r->fd, r->addr, r->data, r->size, &offset));
+      moved = offset - r->offset;
+      complete = offset == r->size;
+    }
+    if (op == NCCL_SOCKET_SEND) __atomic_store_n(&sock->bytes, sock->bytes+moved, __ATOMIC_RELAXED);
+    if (moved) *progress = 1;
+    if (!complete) {
+      if (!zc) __atomic_store_n(&r->offset, offset, __ATOMIC_RELEASE);
+      sock->ready &= ~event; // EAGAIN, wait for the next edge
+      break;
+    }
+    socketTaskPop(&sock->pending);
+    // All data is queued; complete once the kernel is done with the buffer.
+    if (zc) socketTaskPush(&sock->zcWait, r);
+    // Publishing completion must be the last access to the task, which the main
+    // thread can reuse right away.
+    else socketTaskDone(r);
+  }
+  return ncclSuccess;
+}
+
 void* persistentSocketThread(void *args_) {
   struct ncclSocketThreadResources* resource = (struct ncclSocketThreadResources*)args_;
-  struct ncclSocketComm* comm = resource->comm;
   volatile enum threadState* state = &resource->state;
   struct ncclSocketTaskQueue* myQueue = &resource->threadTaskQueue;
-  int nSocksPerThread = comm->nSocks / comm->nThreads;
   while (1) {
-    int idle = 1;
-    int mark = myQueue->next; // mark newest task seen
-    for (int i=0; i<myQueue->len; i+=nSocksPerThread) {
-      int repeat;
-      do {
-        repeat = 0;
-        for (int j=0; j<nSocksPerThread; j++) {
-          struct ncclSocketTask* r = myQueue->tasks+i+j;
-          if (r != NULL && r->used == 1 && r->offset < r->size) {
-            r->result = socketProgress(r->op, r->fd, r->addr, r->data, r->size, &r->offset);
-            if (r->result != ncclSuccess) {
-              WARN("NET/Socket : socket progress error");
-              return NULL;
-            }
-            idle = 0;
-            if (r->offset < r->size) repeat = 1;
-          }
-        }
-      } while (repeat);
+    if (*state == stop) return NULL;
+    // Take new tasks off the ring, in order, onto the list of their socket
+    uint64_t tail = __atomic_load_n(&myQueue->tail, __ATOMIC_ACQUIRE);
+    for (; myQueue->head < tail; myQueue->head++) {
+      struct ncclSocketTask* r = myQueue->ring[myQueue->head % myQueue->len];
+      socketTaskPush(&resource->socks[r->sock].pending, r);
     }
-    if (idle) {
-      pthread_mutex_lock(&resource->threadLock);
-      while (mark == myQueue->next && *state != stop) { // no new tasks, wait
-        pthread_cond_wait(&resource->threadCond, &resource->threadLock);
+    // Completing a task can unblock the next one on the same socket, so keep
+    // going as long as something moves.
+    int progress = 0;
+    for (int s=0; s<resource->nSocks; s++) {
+      struct ncclSocketThreadSock* sock = resource->socks+s;
+      ncclResult_t ret = socketThreadProgress(sock, &progress);
+      if (ret != ncclSuccess) {
+        WARN("NET/Socket : socket progress error");
+        // Fail the oldest task, the main thread will report it
+        struct ncclSocketTask* r = sock->zcWait.head ? sock->zcWait.head : sock->pending.head;
+        if (r) __atomic_store_n(&r->result, ret, __ATOMIC_RELEASE);
+        return NULL;
       }
-      pthread_mutex_unlock(&resource->threadLock);
     }
-    if (*state == stop) return NULL;
+    if (progress) {
+      socketThreadWait(resource, 0);
+      continue;
+    }
+    // Nothing can move: block until a socket or the main thread wakes us up.
+    // The producer checks parked after publishing a task, so check the ring
+    // again after setting it.
+    __atomic_store_n(&myQueue->parked, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&myQueue->tail, __ATOMIC_SEQ_CST) == myQueue->head) socketThreadWait(resource, -1);
+    __atomic_store_n(&myQueue->parked, 0, __ATOMIC_RELAXED);
   }
 }
 
-ncclResult_t ncclSocketGetNsockNthread(int dev, int* ns, int* nt) {
+// Outcome of the bandwidth probe, per interface
+struct ncclSocketCalibration {
+  int valid;
+  int probing;  // A listener asked its peer to probe this interface
+  int nThreads;
+  int nSocksPerThread;
+};
+static struct ncclSocketCalibration ncclSocketCalibrations[MAX_IFS];
+
+static void ncclSocketCalibrationSet(int dev, int nThreads, int nSocksPerThread) {
+  pthread_mutex_lock(&ncclSocketLock);
+  struct ncclSocketCalibration* cal = ncclSocketCalibrations+dev;
+  cal->nThreads = nThreads;
+  cal->nSocksPerThread = nSocksPerThread;
+  cal->valid = 1;
+  cal->probing = 0;
+  pthread_mutex_unlock(&ncclSocketLock);
+}
+
+// Let the next listen on the interface ask for a probe again
+static void ncclSocketCalibrationAbort(int dev) {
+  pthread_mutex_lock(&ncclSocketLock);
+  ncclSocketCalibrations[dev].probing = 0;
+  pthread_mutex_unlock(&ncclSocketLock);
+}
+
+// With calibrate set, ask for a bandwidth probe when NCCL_SOCKET_CALIBRATE
+// allows it and the interface was not probed yet.
+static ncclResult_t ncclSocketGetNsockNthreadOpt(int dev, int calibrate, int* ns, int* nt) {
   int nSocksPerThread = ncclParamSocketNsocksPerThread();
   int nThreads = ncclParamSocketNthreads();
   if (nThreads > MAX_THREADS) {
     WARN("NET/Socket : NCCL_SOCKET_NTHREADS is greater than the maximum allowed, setting to %d", MAX_THREADS);
     nThreads = MAX_THREADS;
   }
+  if (nThreads == -2 && nSocksPerThread == -2 && calibrate && ncclParamSocketCalibrate()) {
+    // Reuse the outcome of an earlier probe on this interface, or ask the
+    // connecting side for one. Concurrent probes would compete for the link and
+    // measure the wrong optimum, so only one is in flight per interface and the
+    // other connections use the static default meanwhile.
+    pthread_mutex_lock(&ncclSocketLock);
+    struct ncclSocketCalibration* cal = ncclSocketCalibrations+dev;
+    int probe = cal->valid == 0 && cal->probing == 0;
+    if (probe) cal->probing = 1;
+    if (cal->valid) {
+      nThreads = cal->nThreads;
+      nSocksPerThread = cal->nSocksPerThread;
+    }
+    pthread_mutex_unlock(&ncclSocketLock);
+    if (probe) {
+      *ns = *nt = NCCL_SOCKET_CALIBRATE;
+      return ncclSuccess;
+    }
+  }
   if (nThreads == -2 || nSocksPerThread == -2) {
     // Auto-detection
     int autoNt=0, autoNs=1; // By default, we only use the main thread and do not spawn extra threads
@@ -269,15 +638,210 @@ end:
   return ncclSuccess;
 }
 
+ncclResult_t ncclSocketGetNsockNthread(int dev, int* ns, int* nt) {
+  return ncclSocketGetNsockNthreadOpt(dev, 1, ns, nt);
+}
+
+
+struct ncclSocketProbeStream {
+  int op;
+  int fd;
+  union socketAddress* addr;
+  int64_t bytes;
+  ncclResult_t result;
+  pthread_t thread;
+};
+
+static void* socketProbeStream(void* args) {
+  struct ncclSocketProbeStream* stream = (struct ncclSocketProbeStream*)args;
+  char* buff = (char*)malloc(PROBE_BUFFSIZE);
+  stream->result = buff ? ncclSuccess : ncclSystemError;
+  for (int64_t done=0; done<stream->bytes && stream->result == ncclSuccess; ) {
+    int offset = 0, size = std::min((int64_t)PROBE_BUFFSIZE, stream->bytes-done);
+    stream->result = socketWait(stream->op, stream->fd, stream->addr, buff, size, &offset);
+    done += size;
+  }
+  free(buff);
+  return NULL;
+}
+
+// Send or receive bytes on each of the first n probe sockets at once, one
+// thread per socket as the helper threads would.
+static ncclResult_t socketProbeRun(int op, int* fds, int n, union socketAddress* addr, int64_t bytes) {
+  struct ncclSocketProbeStream streams[MAX_THREADS];
+  ncclResult_t ret = ncclSuccess;
+  for (int i=0; i<n && ret == ncclSuccess; i++) {
+    streams[i].op = op;
+    streams[i].fd = fds[i];
+    streams[i].addr = addr;
+    streams[i].bytes = bytes;
+    if (pthread_create(&streams[i].thread, NULL, socketProbeStream, streams+i) != 0) {
+      WARN("NET/Socket : failed to create probe thread");
+      n = i;
+      ret = ncclSystemError;
+    }
+  }
+  for (int i=0; i<n; i++) {
+    pthread_join(streams[i].thread, NULL);
+    if (streams[i].result != ncclSuccess) ret = streams[i].result;
+  }
+  return ret;
+}
+
+// Publish a socket the probe thread is about to block on. Returns 0 if the
+// listen comm is being closed, in which case the socket is not stored.
+static int ncclSocketProbeTrack(struct ncclSocketListenComm* comm, int* slot, int fd) {
+  pthread_mutex_lock(&ncclSocketLock);
+  int closing = comm->probeClosing;
+  if (!closing) *slot = fd;
+  pthread_mutex_unlock(&ncclSocketLock);
+  return !closing;
+}
+
+static void ncclSocketProbeUntrack(int* slot) {
+  pthread_mutex_lock(&ncclSocketLock);
+  if (*slot != -1) close(*slot);
+  *slot = -1;
+  pthread_mutex_unlock(&ncclSocketLock);
+}
+
+// Listener side of the probe: sink what the connecting side sends, phase by
+// phase, then record the configuration it settled on.
+static ncclResult_t ncclSocketProbeServe(struct ncclSocketListenComm* comm, int ctrlFd, union socketAddress* addr) {
+  ncclResult_t ret = ncclSuccess;
+  int* fds = comm->probeFds;
+  int nProbe;
+  int64_t phase[2];
+  int result[2], ack = 0;
+  NCCLCHECK(socketRecv(ctrlFd, addr, &nProbe, sizeof(int)));
+  if (nProbe < 1 || nProbe > MAX_THREADS) {
+    WARN("NET/Socket : invalid number of probe sockets %d", nProbe);
+    return ncclInternalError;
+  }
+  for (int i=0; i<nProbe; i++) {
+    int fd, idx;
+    fd = accept(comm->probeFd, NULL, NULL);
+    if (fd == -1) {
+      WARN("Call to accept failed : %s", strerror(errno));
+      ret = ncclSystemError;
+      goto out;
+    }
+    ret = socketRecv(fd, addr, &idx, sizeof(int));
+    if (ret == ncclSuccess && (idx < 0 || idx >= nProbe || fds[idx] != -1)) {
+      WARN("NET/Socket : invalid probe socket index %d", idx);
+      ret = ncclInternalError;
+    }
+    if (ret == ncclSuccess && !ncclSocketProbeTrack(comm, fds+idx, fd)) ret = ncclInternalError;
+    if (ret != ncclSuccess) {
+      close(fd);
+      goto out;
+    }
+  }
+  while (1) {
+    NCCLCHECKGOTO(socketRecv(ctrlFd, addr, phase, sizeof(phase)), ret, out);
+    if (phase[0] == 0) break;
+    if (phase[0] < 0 || phase[0] > nProbe) {
+      WARN("NET/Socket : invalid probe phase over %ld sockets", phase[0]);
+      ret = ncclInternalError;
+      goto out;
+    }
+    NCCLCHECKGOTO(socketProbeRun(NCCL_SOCKET_RECV, fds, phase[0], addr, phase[1]), ret, out);
+    NCCLCHECKGOTO(socketSend(ctrlFd, addr, &ack, sizeof(int)), ret, out);
+  }
+  NCCLCHECKGOTO(socketRecv(ctrlFd, addr, result, sizeof(result)), ret, out);
+  ncclSocketCalibrationSet(comm->dev, result[0], result[1]);
+out:
+  for (int i=0; i<nProbe; i++) ncclSocketProbeUntrack(fds+i);
+  return ret;
+}
+
+static void* ncclSocketProbeServer(void* args) {
+  struct ncclSocketListenComm* comm = (struct ncclSocketListenComm*)args;
+  union socketAddress addr;
+  socklen_t socklen = sizeof(addr);
+  int ctrlFd = accept(comm->probeFd, &addr.sa, &socklen);
+  if (ctrlFd == -1) { // Closed before anyone connected
+    ncclSocketCalibrationAbort(comm->dev);
+    return NULL;
+  }
+  if (!ncclSocketProbeTrack(comm, &comm->probeCtrlFd, ctrlFd)) {
+    close(ctrlFd);
+    ncclSocketCalibrationAbort(comm->dev);
+    return NULL;
+  }
+  if (ncclSocketProbeServe(comm, ctrlFd, &addr) != ncclSuccess) {
+    // The peer keeps its default configuration when its side of the probe fails
+    INFO(NCCL_INIT|NCCL_NET, "NET/Socket : bandwidth probe of %s failed", ncclSocketDevs[comm->dev].devName);
+    ncclSocketCalibrationAbort(comm->dev);
+  }
+  ncclSocketProbeUntrack(&comm->probeCtrlFd);
+  return NULL;
+}
+
+// Connecting side of the probe: stream over 1, 2, 4, ... sockets, each driven
+// by its own thread, for about NCCL_SOCKET_CALIBRATE_MS at the link speed, and
+// keep the smallest number of sockets within 10% of the best bandwidth.
+static ncclResult_t ncclSocketCalibrate(int dev, struct ncclSocketHandle* handle, int* ns, int* nt) {
+  union socketAddress addr = handle->connectAddr;
+  if (addr.sa.sa_family == AF_INET) addr.sin.sin_port = htons(handle->probePort);
+  else addr.sin6.sin6_port = htons(handle->probePort);
+  ncclResult_t ret = ncclSuccess;
+  int ctrlFd, fds[MAX_THREADS];
+  int nProbe = MAX_THREADS, nConnected = 0;
+  float bw[MAX_THREADS+1];
+  int speed, best = 1, nSocks = 1;
+  int64_t phase[2] = { 0, 0 };
+  int result[2], ack;
+  char line[1024];
+  line[0] = '\0';
+  NCCLCHECK(connectAddress(&ctrlFd, &addr));
+  NCCLCHECKGOTO(socketSend(ctrlFd, &addr, &nProbe, sizeof(int)), ret, out);
+  for (; nConnected<nProbe; nConnected++) {
+    NCCLCHECKGOTO(connectAddress(fds+nConnected, &addr), ret, out);
+    NCCLCHECKGOTO(socketSend(fds[nConnected], &addr, &nConnected, sizeof(int)), ret, out);
+  }
+  NCCLCHECKGOTO(ncclSocketGetSpeed(ncclSocketDevs[dev].devName, &speed), ret, out);
+  for (int n=1; n<=nProbe; n*=2) {
+    phase[0] = n;
+    phase[1] = DIVUP((int64_t)speed*125*ncclParamSocketCalibrateMs(), n); // Mb/s * ms -> bytes
+    double start = socketTime();
+    NCCLCHECKGOTO(socketSend(ctrlFd, &addr, phase, sizeof(phase)), ret, out);
+    NCCLCHECKGOTO(socketProbeRun(NCCL_SOCKET_SEND, fds, n, &addr, phase[1]), ret, out);
+    NCCLCHECKGOTO(socketRecv(ctrlFd, &addr, &ack, sizeof(int)), ret, out);
+    bw[n] = n*phase[1] / (socketTime()-start) / 1e3; // GB/s
+    if (bw[n] > bw[best]) best = n;
+    snprintf(line+strlen(line), sizeof(line)-strlen(line), " %d:%.2f", n, bw[n]);
+  }
+  while (bw[nSocks] < 0.9*bw[best]) nSocks *= 2;
+  // One socket is served by the main thread, without helper threads
+  result[0] = *nt = nSocks > 1 ? nSocks : 0;
+  result[1] = 1;
+  *ns = *nt;
+  phase[0] = phase[1] = 0;
+  NCCLCHECKGOTO(socketSend(ctrlFd, &addr, phase, sizeof(phase)), ret, out);
+  NCCLCHECKGOTO(socketSend(ctrlFd, &addr, result, sizeof(result)), ret, out);
+  ncclSocketCalibrationSet(dev, result[0], result[1]);
+  INFO(NCCL_INIT|NCCL_NET, "NET/Socket : probed %s, sockets:GB/s%s, using %d threads and 1 socket per thread",
+      ncclSocketDevs[dev].devName, line, *nt);
+out:
+  for (int i=0; i<nConnected; i++) close(fds[i]);
+  close(ctrlFd);
+  return ret;
+}
+
 ncclResult_t ncclSocketNewListenComm(struct ncclSocketListenComm** comm) {
   NCCLCHECK(ncclCalloc(comm, 1));
   (*comm)->fd = -1;
+  (*comm)->probeFd = -1;
+  (*comm)->probeCtrlFd = -1;
+  for (int i=0; i<MAX_THREADS; i++) (*comm)->probeFds[i] = -1;
   return ncclSuccess;
 }
 
 ncclResult_t ncclSocketNewComm(struct ncclSocketComm** comm) {
   NCCLCHECK(ncclCalloc(comm, 1));
   (*comm)->ctrlFd = -1;
+  (*comm)->ctrlEpollFd = -1;
   for (int i=0; i < MAX_SOCKETS; i++) {
     (*comm)->fds[i] = -1;
   }
@@ -285,6 +849,34 @@ ncclResult_t ncclSocketNewComm(struct ncclSocketComm** comm) {
   return ncclSuccess;
 }
 
+// The main thread progresses the control socket (and the data when there are no
+// helper threads) from ncclSocketTest; track its readiness the same way.
+static ncclResult_t ncclSocketCtrlPollInit(struct ncclSocketComm* comm) {
+  SYSCHECKVAL(epoll_create1(EPOLL_CLOEXEC), "epoll_create1", comm->ctrlEpollFd);
+  NCCLCHECK(socketPollAdd(comm->ctrlEpollFd, comm->ctrlFd, 0, EPOLLIN|EPOLLOUT|EPOLLET));
+  comm->ctrlReady = EPOLLIN|EPOLLOUT;
+  return ncclSuccess;
+}
+
+static int ncclSocketCtrlReady(struct ncclSocketComm* comm, int op) {
+  uint32_t event = socketOpEvent(op);
+  if ((comm->ctrlReady & event) == 0) {
+    struct epoll_event ev;
+    if (epoll_wait(comm->ctrlEpollFd, &ev, 1, 0) == 1) {
+      comm->ctrlReady |= ev.events & (EPOLLIN|EPOLLOUT);
+      if (ev.events & (EPOLLERR|EPOLLHUP)) comm->ctrlReady |= EPOLLIN|EPOLLOUT;
+    }
+  }
+  return (comm->ctrlReady & event) != 0;
+}
+
+static ncclResult_t ncclSocketCtrlProgress(struct ncclSocketComm* comm, int op, void* ptr, int size, int* offset) {
+  if (!ncclSocketCtrlReady(comm, op)) return ncclSuccess;
+  NCCLCHECK(socketProgress(op, comm->ctrlFd, &comm->addr, ptr, size, offset));
+  if (*offset < size) comm->ctrlReady &= ~socketOpEvent(op);
+  return ncclSuccess;
+}
+
 ncclResult_t ncclSocketListen(int dev, void* opaqueHandle, void** listenComm) {
   if (dev < 0) { // data transfer socket is based on specified dev
     return ncclInternalError;
@@ -296,6 +888,24 @@ ncclResult_t ncclSocketListen(int dev, void* opaqueHandle, void** listenComm) {
   NCCLCHECK(GetSocketAddr(dev, &handle->connectAddr));
   NCCLCHECK(createListenSocket(&comm->fd, &handle->connectAddr));
   NCCLCHECK(ncclSocketGetNsockNthread(dev, &comm->nSocks, &comm->nThreads));
+  comm->dev = dev;
+  if (comm->nSocks == NCCL_SOCKET_CALIBRATE) {
+    // Serve the probe from a thread: the peer connects before we get to accept
+    union socketAddress probeAddr;
+    ncclResult_t ret = GetSocketAddr(dev, &probeAddr);
+    if (ret == ncclSuccess) ret = createListenSocket(&comm->probeFd, &probeAddr);
+    if (ret == ncclSuccess && pthread_create(&comm->probeThread, NULL, ncclSocketProbeServer, comm) != 0) {
+      WARN("NET/Socket : failed to create the bandwidth probe thread");
+      close(comm->probeFd);
+      comm->probeFd = -1;
+      ret = ncclSystemError;
+    }
+    if (ret != ncclSuccess) {
+      ncclSocketCalibrationAbort(dev);
+      return ret;
+    }
+    handle->probePort = socketToPort(&probeAddr);
+  }
   handle->nSocks = comm->nSocks;
   handle->nThreads = comm->nThreads;
   *listenComm = comm;
@@ -311,13 +921,23 @@ ncclResult_t ncclSocketConnect(int dev, void* opaqueHandle, void** sendComm) {
   struct ncclSocketHandle* handle = (struct ncclSocketHandle*) opaqueHandle;
   comm->nSocks = handle->nSocks;
   comm->nThreads = handle->nThreads;
+  int calibrate = handle->nSocks == NCCL_SOCKET_CALIBRATE;
+  if (calibrate && ncclSocketCalibrate(dev, handle, &comm->nSocks, &comm->nThreads) != ncclSuccess) {
+    // Not worth failing the connection for; the listener follows what we pick
+    INFO(NCCL_INIT|NCCL_NET, "NET/Socket : bandwidth probe of %s failed, using the default configuration", ncclSocketDevs[dev].devName);
+    NCCLCHECK(ncclSocketGetNsockNthreadOpt(dev, 0, &comm->nSocks, &comm->nThreads));
+  }
   for (int i=0; i<comm->nSocks+1; i++) {
     int tmpFd, offset=0;
+    // After a probe, tell the listener what we settled on
+    int hello[3] = { i, comm->nSocks, comm->nThreads };
     NCCLCHECK(connectAddress(&tmpFd, &handle->connectAddr));
-    NCCLCHECK(socketWait(NCCL_SOCKET_SEND, tmpFd, &handle->connectAddr, &i, sizeof(int), &offset));
+    NCCLCHECK(socketWait(NCCL_SOCKET_SEND, tmpFd, &handle->connectAddr, hello, calibrate ? sizeof(hello) : sizeof(int), &offset));
     if (i == comm->nSocks) comm->ctrlFd = tmpFd;
     else comm->fds[i] = tmpFd;
   }
+  NCCLCHECK(ncclSocketCtrlPollInit(comm));
+  socketZeroCopyInit(comm->ctrlFd, &comm->ctrlZc);
   *sendComm = comm;
   comm->addr = handle->connectAddr;
   return ncclSuccess;
@@ -329,18 +949,150 @@ ncclResult_t ncclSocketAccept(void* listenComm, void** recvComm) {
   NCCLCHECK(ncclSocketNewComm(&rComm));
   rComm->nSocks = lComm->nSocks;
   rComm->nThreads = lComm->nThreads;
-  for (int i=0; i<rComm->nSocks+1; i++) {
-    int tmpFd, sendSockIdx, offset=0;
+  int calibrate = lComm->nSocks == NCCL_SOCKET_CALIBRATE;
+  int nConns = calibrate ? 1 : rComm->nSocks+1;
+  for (int i=0; i<nConns; i++) {
+    int tmpFd, hello[3], offset=0;
     socklen_t socklen = sizeof(union socketAddress);
     SYSCHECKVAL(accept(lComm->fd, &rComm->addr.sa, &socklen), "accept", tmpFd);
-    NCCLCHECK(socketWait(NCCL_SOCKET_RECV, tmpFd, &rComm->addr, &sendSockIdx, sizeof(int), &offset));
+    NCCLCHECK(socketWait(NCCL_SOCKET_RECV, tmpFd, &rComm->addr, hello, calibrate ? sizeof(hello) : sizeof(int), &offset));
+    int sendSockIdx = hello[0];
+    if (calibrate) {
+      if (hello[1] < 0 || hello[1] > MAX_SOCKETS || hello[2] < 0 || hello[2] > MAX_THREADS || (hello[1] > 0 && hello[2] == 0)) {
+        WARN("NET/Socket : invalid probed configuration of %d sockets and %d threads", hello[1], hello[2]);
+        return ncclInternalError;
+      }
+      rComm->nSocks = hello[1];
+      rComm->nThreads = hello[2];
+      nConns = rComm->nSocks+1;
+    }
     if (sendSockIdx == rComm->nSocks) rComm->ctrlFd = tmpFd;
     else rComm->fds[sendSockIdx] = tmpFd;
   }
+  NCCLCHECK(ncclSocketCtrlPollInit(rComm));
   *recvComm = rComm;
   return ncclSuccess;
 }
 
+// Refresh the delivery rate and RTT estimates of the data sockets. Bytes count
+// as delivered once the helper thread handed them to the kernel and they left
+// the socket send queue.
+static void ncclSocketSampleLoads(struct ncclSocketComm* comm, double now) {
+  double elapsed = now - comm->lastSample;
+  for (int i=0; i<comm->nSocks; i++) {
+    struct ncclSocketLoad* load = comm->loads+i;
+    struct ncclSocketThreadSock* sock = comm->threadResources[i%comm->nThreads].socks + i/comm->nThreads;
+    uint64_t bytes = __atomic_load_n(&sock->bytes, __ATOMIC_RELAXED);
+    int outq;
+    if (ioctl(comm->fds[i], SIOCOUTQ, &outq) != 0) continue;
+    uint64_t delivered = bytes - std::min(bytes, (uint64_t)outq);
+    // Only a socket that stayed busy over the whole interval tells its rate
+    int busy = delivered < load->queued;
+    if (load->busy && busy && delivered > load->delivered) {
+      float rate = (delivered - load->delivered) / elapsed;
+      load->bw = load->bw == 0 ? rate : 0.75f*load->bw + 0.25f*rate;
+    }
+    load->delivered = delivered;
+    load->busy = busy;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(comm->fds[i], IPPROTO_TCP, TCP_INFO, &info, &len) == 0 && info.tcpi_rtt > 0) {
+      load->rtt = load->rtt == 0 ? info.tcpi_rtt : 0.75f*load->rtt + 0.25f*info.tcpi_rtt;
+    }
+  }
+  comm->lastSample = now;
+}
+
+// Decide how a send request is striped over the data sockets. Chunks are
+// sized so that they are all expected to be delivered at the same time, given
+// the backlog and delivery rate of each socket, which keeps a slow or
+// congested socket from holding back the whole message. Chunks are not made
+// smaller than MIN_CHUNKSIZE nor than the bandwidth-delay product of a socket,
+// below which splitting further does not help.
+static void ncclSocketStripe(struct ncclSocketComm* comm, struct ncclSocketHeader* hdr) {
+  int nSocks = comm->nSocks;
+  hdr->nChunks = 0;
+  if (hdr->size == 0) return;
+  if (ncclParamSocketAdaptiveStriping() == 0) {
+    // Equal chunks, round-robin over the sockets
+    int taskSize = std::max(MIN_CHUNKSIZE, DIVUP(hdr->size, nSocks));
+    for (int offset=0; offset<hdr->size; offset+=taskSize) {
+      struct ncclSocketChunk* c = hdr->chunks+hdr->nChunks++;
+      c->sock = comm->nextFd;
+      c->size = std::min(taskSize, hdr->size-offset);
+      comm->nextFd = (comm->nextFd + 1) % nSocks;
+    }
+    return;
+  }
+  double now = socketTime();
+  if (now - comm->lastSample > STRIPE_SAMPLE_USEC) ncclSocketSampleLoads(comm, now);
+  double elapsed = now - comm->lastSample;
+
+  // Sockets we know nothing about yet are assumed to be average
+  float bwSum = 0, rttSum = 0;
+  int nBw = 0, nRtt = 0;
+  for (int i=0; i<nSocks; i++) {
+    if (comm->loads[i].bw > 0) { bwSum += comm->loads[i].bw; nBw++; }
+    if (comm->loads[i].rtt > 0) { rttSum += comm->loads[i].rtt; nRtt++; }
+  }
+  float bwAvg = nBw ? bwSum/nBw : 1;
+  int minChunk = MIN_CHUNKSIZE;
+  if (nBw && nRtt) minChunk = std::min(std::max((int)(bwAvg*rttSum/nRtt), MIN_CHUNKSIZE), MAX_STRIPE_CHUNKSIZE);
+
+  // Expected time for each socket to drain its backlog, sorted. Ties rotate
+  // so that idle sockets are used in turn.
+  float bw[MAX_SOCKETS], finish[MAX_SOCKETS];
+  int order[MAX_SOCKETS];
+  for (int n=0; n<nSocks; n++) {
+    int i = (comm->nextFd + n) % nSocks;
+    struct ncclSocketLoad* load = comm->loads+i;
+    bw[i] = load->bw > 0 ? load->bw : bwAvg;
+    float backlog = (float)(load->queued - load->delivered) - bw[i]*elapsed;
+    finish[i] = std::max(backlog, 0.0f) / bw[i];
+    int j = n;
+    while (j > 0 && finish[order[j-1]] > finish[i]) { order[j] = order[j-1]; j--; }
+    order[j] = i;
+  }
+  comm->nextFd = (comm->nextFd + 1) % nSocks;
+
+  // Fill the sockets that drain first until they all finish at the same time.
+  // Drop sockets which would get less than minChunk.
+  int maxChunks = std::min(nSocks, std::max(1, hdr->size / minChunk));
+  int k;
+  double T;
+  while (1) {
+    double sumBw = 0, sumBacklog = 0;
+    T = 0;
+    for (k=0; k<maxChunks; k++) {
+      int i = order[k];
+      if (k > 0 && T <= finish[i]) break;
+      sumBw += bw[i];
+      sumBacklog += finish[i]*bw[i];
+      T = (hdr->size + sumBacklog) / sumBw;
+    }
+    if (k == 1 || (T-finish[order[k-1]])*bw[order[k-1]] >= minChunk) break;
+    maxChunks = k-1;
+  }
+  int remaining = hdr->size;
+  for (int n=0; n<k; n++) {
+    int i = order[n];
+    struct ncclSocketChunk* c = hdr->chunks+hdr->nChunks++;
+    c->sock = i;
+    c->size = n == k-1 ? remaining : std::min(remaining, std::max(minChunk, (int)((T-finish[i])*bw[i])));
+    // Do not leave a tail smaller than minChunk for the next socket
+    if (remaining - c->size < minChunk) c->size = remaining;
+    comm->loads[i].queued += c->size;
+    remaining -= c->size;
+    if (remaining == 0) break;
+  }
+}
+
+// Without helper threads only the size goes on the wire
+static inline int ncclSocketHeaderSize(struct ncclSocketComm* comm, int nChunks) {
+  if (comm->nSocks == 0) return sizeof(int);
+  return offsetof(struct ncclSocketHeader, chunks) + nChunks*sizeof(struct ncclSocketChunk);
+}
+
 ncclResult_t ncclSocketGetRequest(struct ncclSocketComm* comm, int op, void* data, int size, struct ncclSocketRequest** req) {
   for (int i=0; i<MAX_REQUESTS; i++) {
     struct ncclSocketRequest* r = comm->requests+i;
@@ -353,6 +1105,17 @@ ncclResult_t ncclSocketGetRequest(struct ncclSocketComm* comm, int op, void* dat
       r->used = 1;
       r->comm = comm;
       r->nSubs = 0;
+      r->offset = 0;
+      r->zc = 0;
+      r->hdr.size = size;
+      r->hdr.nChunks = 0;
+      if (op == NCCL_SOCKET_SEND) {
+        if (comm->nSocks > 0) ncclSocketStripe(comm, &r->hdr);
+        r->hdrSize = ncclSocketHeaderSize(comm, r->hdr.nChunks);
+        r->hdrOffset = 0;
+        comm->sendQueue[(comm->sendHead+comm->nSendQueued)%MAX_REQUESTS] = r;
+        comm->nSendQueued++;
+      }
       *req = r;
       return ncclSuccess;
     }
@@ -361,46 +1124,150 @@ ncclResult_t ncclSocketGetRequest(struct ncclSocketComm* comm, int op, void* dat
   return ncclInternalError;
 }
 
-ncclResult_t ncclSocketGetTask(struct ncclSocketComm* comm, int op, void* data, int size, struct ncclSocketTask** req) {
-  int tid = comm->nextFd % comm->nThreads;
+static ncclResult_t ncclSocketThreadInit(struct ncclSocketComm* comm, int tid, int op) {
+  struct ncclSocketThreadResources* resource = comm->threadResources+tid;
+  struct ncclSocketTaskQueue* queue = &resource->threadTaskQueue;
+  // each request can be divided up to nSocks tasks, and
+  // these tasks are distributed to nThreads threads,
+  // we need to make sure each thread queue has enough slots for MAX_REQUESTS
+  queue->len = MAX_REQUESTS * DIVUP(comm->nSocks, comm->nThreads);
+  NCCLCHECK(ncclCalloc(&queue->tasks, queue->len));
+  NCCLCHECK(ncclCalloc(&queue->ring, queue->len));
+  queue->next = 0;
+  queue->head = queue->tail = 0;
+  queue->parked = 0;
+  resource->comm = comm;
+  SYSCHECKVAL(epoll_create1(EPOLL_CLOEXEC), "epoll_create1", resource->epollFd);
+  SYSCHECKVAL(eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC), "eventfd", resource->eventFd);
+  NCCLCHECK(socketPollAdd(resource->epollFd, resource->eventFd, NCCL_SOCKET_EVENT_WAKEUP, EPOLLIN));
+  // Socket i is always served by thread i % nThreads. Sockets start out as
+  // ready in both directions until a send/recv proves otherwise.
+  resource->nSocks = 0;
+  for (int i=tid; i<comm->nSocks; i+=comm->nThreads) {
+    struct ncclSocketThreadSock* sock = resource->socks+resource->nSocks;
+    sock->fd = comm->fds[i];
+    sock->ready = EPOLLIN|EPOLLOUT;
+    if (op == NCCL_SOCKET_SEND) socketZeroCopyInit(sock->fd, &sock->zc);
+    NCCLCHECK(socketPollAdd(resource->epollFd, sock->fd, resource->nSocks, EPOLLIN|EPOLLOUT|EPOLLET));
+    resource->nSocks++;
+  }
+  pthread_create(comm->helperThread+tid, NULL, persistentSocketThread, resource);
+  return ncclSuccess;
+}
+
+static void ncclSocketThreadWakeup(struct ncclSocketThreadResources* res) {
+  uint64_t one = 1;
+  (void) write(res->eventFd, &one, sizeof(one));
+}
+
+ncclResult_t ncclSocketGetTask(struct ncclSocketComm* comm, int i, int op, void* data, int size, struct ncclSocketTask** req) {
+  int tid = i % comm->nThreads;
   struct ncclSocketThreadResources* res = comm->threadResources+tid;
   struct ncclSocketTaskQueue* queue = &res->threadTaskQueue;
   // create helper threads and prepare per-thread task queue
-  if (queue->tasks == NULL) {
-    // each request can be divided up to nSocks tasks, and
-    // these tasks are distributed to nThreads threads,
-    // we need to make sure each thread queue has enough slots for MAX_REQUESTS
-    queue->len = MAX_REQUESTS * DIVUP(comm->nSocks, comm->nThreads);
-    NCCLCHECK(ncclCalloc(&queue->tasks, queue->len));
-    queue->next = 0;
-    res->comm = comm;
-    pthread_mutex_init(&res->threadLock, NULL);
-    pthread_cond_init(&res->threadCond, NULL);
-    pthread_create(comm->helperThread+tid, NULL, persistentSocketThread, res);
-  }
-  struct ncclSocketTask* r = queue->tasks+queue->next;
-  if (r->used == 0) {
+  if (queue->tasks == NULL) NCCLCHECK(ncclSocketThreadInit(comm, tid, op));
+  // Requests complete out of order and may not use every socket, so look past
+  // slots that are still in use.
+  for (int n=0; n<queue->len; n++) {
+    struct ncclSocketTask* r = queue->tasks+queue->next;
+    queue->next = (queue->next+1)%queue->len;
+    if (r->used != 0) continue;
     r->op = op;
     r->data = data;
     r->size = size;
-    r->fd = comm->fds[comm->nextFd];
+    r->fd = comm->fds[i];
     r->addr = &comm->addr;
     r->offset = 0;
-    r->result = ncclSuccess;
-    comm->nextFd = (comm->nextFd + 1) % comm->nSocks;
     r->used = 1;
+    r->sock = i / comm->nThreads;
+    r->sent = 0;
+    r->zc = op == NCCL_SOCKET_SEND && res->socks[r->sock].zc.enabled && size >= ncclParamSocketZeroCopyThreshold();
+    r->result = ncclSuccess;
     *req = r;
-    pthread_mutex_lock(&res->threadLock);
-    queue->next = (queue->next+1)%queue->len;
-    res->state = start;
-    pthread_cond_signal(&res->threadCond);
-    pthread_mutex_unlock(&res->threadLock);
+    // Publish the task, then wake the helper thread up if it is blocked or about to
+    queue->ring[queue->tail % queue->len] = r;
+    __atomic_store_n(&queue->tail, queue->tail+1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->parked, __ATOMIC_SEQ_CST)) ncclSocketThreadWakeup(res);
     return ncclSuccess;
   }
   WARN("NET/Socket : unable to allocate subtasks");
   return ncclInternalError;
 }
 
+// Size is known: hand the data to the helper threads, if any, following the
+// striping plan of the header.
+static ncclResult_t ncclSocketStartData(struct ncclSocketRequest* r) {
+  r->offset = 0;
+  r->used = 2; // done exchanging size
+  int chunkOffset = 0;
+  for (int i=0; i<r->hdr.nChunks; i++) {
+    struct ncclSocketChunk* c = r->hdr.chunks+i;
+    NCCLCHECK(ncclSocketGetTask(r->comm, c->sock, r->op, (char*)(r->data)+chunkOffset, c->size, r->tasks+i));
+    chunkOffset += c->size;
+  }
+  r->nSubs = r->hdr.nChunks;
+  return ncclSuccess;
+}
+
+// Push the headers of all posted send requests, along with their data
+// when there are no helper threads, to the control socket. Consecutive
+// requests are gathered into a single sendmsg() and large payloads use
+// MSG_ZEROCOPY.
+static ncclResult_t ncclSocketSendProgress(struct ncclSocketComm* comm) {
+  struct ncclSocketZeroCopy* zc = &comm->ctrlZc;
+  if (zc->completed != zc->issued) NCCLCHECK(socketZeroCopyReap(comm->ctrlFd, zc));
+  while (comm->nSendQueued > 0 && ncclSocketCtrlReady(comm, NCCL_SOCKET_SEND)) {
+    struct iovec iov[MAX_SEND_IOVS];
+    int niov = 0, bytes = 0, dataBytes = 0, hdrOnly = 0;
+    for (int i=0; i<comm->nSendQueued && niov+2 <= MAX_SEND_IOVS; i++) {
+      struct ncclSocketRequest* r = comm->sendQueue[(comm->sendHead+i)%MAX_REQUESTS];
+      if (r->hdrOffset < r->hdrSize) {
+        iov[niov].iov_base = (char*)&r->hdr+r->hdrOffset;
+        iov[niov].iov_len = r->hdrSize-r->hdrOffset;
+        bytes += iov[niov++].iov_len;
+        if (r->size == 0) hdrOnly = 1;
+      }
+      if (comm->nSocks == 0 && r->offset < r->size) {
+        iov[niov].iov_base = (char*)r->data+r->offset;
+        iov[niov].iov_len = r->size-r->offset;
+        bytes += iov[niov].iov_len;
+        dataBytes += iov[niov++].iov_len;
+      }
+    }
+    // A zero-size request completes as soon as its header is sent and can then
+    // be reused, so its header must be copied rather than sent with MSG_ZEROCOPY.
+    int zeroCopy = dataBytes >= ncclParamSocketZeroCopyThreshold() && hdrOnly == 0;
+    int sent, zcUsed, full;
+    NCCLCHECK(socketSendmsg(comm->ctrlFd, &comm->addr, iov, niov, zeroCopy, zc, &sent, &zcUsed, &full));
+    // The socket is full, wait for the next edge. A short write only retries.
+    if (full) comm->ctrlReady &= ~EPOLLOUT;
+    // Account the bytes to the requests, in order
+    while (sent > 0) {
+      struct ncclSocketRequest* r = comm->sendQueue[comm->sendHead];
+      if (r->hdrOffset < r->hdrSize) {
+        int n = std::min(sent, r->hdrSize-r->hdrOffset);
+        r->hdrOffset += n;
+        sent -= n;
+        if (r->hdrOffset == r->hdrSize) NCCLCHECK(ncclSocketStartData(r));
+      }
+      if (comm->nSocks == 0 && r->offset < r->size && sent > 0) {
+        int n = std::min(sent, r->size-r->offset);
+        r->offset += n;
+        sent -= n;
+      }
+      // The header and data stay in use until the kernel is done with the call
+      if (zcUsed) {
+        r->zc = 1;
+        r->zcSeq = zc->issued;
+      }
+      if (r->hdrOffset < r->hdrSize || (comm->nSocks == 0 && r->offset < r->size)) break;
+      comm->sendHead = (comm->sendHead+1)%MAX_REQUESTS;
+      comm->nSendQueued--;
+    }
+  }
+  return ncclSuccess;
+}
+
 ncclResult_t ncclSocketTest(void* request, int* done, int* size) {
   *done = 0;
   struct ncclSocketRequest *r = (struct ncclSocketRequest*)request;
@@ -408,45 +1275,53 @@ ncclResult_t ncclSocketTest(void* request, int* done, int* size) {
     WARN("NET/Socket : test called with NULL request");
     return ncclInternalError;
   }
-  if (r->used == 1) { /* try to send/recv size */
-    int data = r->size;
+  if (r->op == NCCL_SOCKET_SEND) {
+    NCCLCHECK(ncclSocketSendProgress(r->comm));
+  } else if (r->used == 1) { /* try to recv the header */
+    struct ncclSocketHeader* hdr = &r->hdr;
+    int fixedSize = ncclSocketHeaderSize(r->comm, 0);
     int offset = 0;
-    NCCLCHECK(socketProgress(r->op, r->ctrlFd, r->addr, &data, sizeof(int), &offset));
+    NCCLCHECK(ncclSocketCtrlProgress(r->comm, r->op, hdr, fixedSize, &offset));
 
     if (offset == 0) return ncclSuccess; /* Not ready -- retry later */
 
-    // Not sure we could ever receive less than 4 bytes, but just in case ...
-    if (offset < sizeof(int)) NCCLCHECK(socketWait(r->op, r->ctrlFd, r->addr, &data, sizeof(int), &offset));
+    // The header is sent at once, the rest of it cannot be far behind
+    if (offset < fixedSize) NCCLCHECK(socketWait(r->op, r->ctrlFd, r->addr, hdr, fixedSize, &offset));
+    if (hdr->nChunks < 0 || hdr->nChunks > r->comm->nSocks) {
+      WARN("NET/Socket : invalid striping of %d chunks over %d sockets", hdr->nChunks, r->comm->nSocks);
+      return ncclInternalError;
+    }
+    NCCLCHECK(socketWait(r->op, r->ctrlFd, r->addr, hdr, ncclSocketHeaderSize(r->comm, hdr->nChunks), &offset));
 
     // Check size is less or equal to the size provided by the user
-    if (r->op == NCCL_SOCKET_RECV && data > r->size) {
+    if (hdr->size > r->size) {
       char line[SOCKET_NAME_MAXLEN+1];
-      WARN("NET/Socket : peer %s message truncated : receiving %d bytes instead of %d", socketToString(r->addr, line), data, r->size);
+      WARN("NET/Socket : peer %s message truncated : receiving %d bytes instead of %d", socketToString(r->addr, line), hdr->size, r->size);
       return ncclInternalError;
     }
-    r->size = data;
-    r->offset = 0;
-    r->used = 2; // done exchanging size
-    // divide into subtasks
-    int chunkOffset = 0, i = 0;
-    if (r->comm->nSocks > 0) {
-      // each request can be divided up to nSocks tasks
-      int taskSize = std::max(MIN_CHUNKSIZE, DIVUP(r->size, r->comm->nSocks));
-      while (chunkOffset < r->size) {
-        int chunkSize = std::min(taskSize, r->size-chunkOffset);
-        NCCLCHECK(ncclSocketGetTask(r->comm, r->op, (char*)(r->data)+chunkOffset, chunkSize, r->tasks+i++));
-        chunkOffset += chunkSize;
+    int chunkBytes = 0;
+    for (int i=0; i<hdr->nChunks; i++) {
+      if (hdr->chunks[i].sock < 0 || hdr->chunks[i].sock >= r->comm->nSocks || hdr->chunks[i].size < 0) {
+        WARN("NET/Socket : invalid chunk %d (socket %d, %d bytes)", i, hdr->chunks[i].sock, hdr->chunks[i].size);
+        return ncclInternalError;
       }
+      chunkBytes += hdr->chunks[i].size;
     }
-    r->nSubs = i;
+    if (r->comm->nSocks > 0 && chunkBytes != hdr->size) {
+      WARN("NET/Socket : chunks cover %d bytes of a %d bytes message", chunkBytes, hdr->size);
+      return ncclInternalError;
+    }
+    r->size = hdr->size;
+    NCCLCHECK(ncclSocketStartData(r));
   }
   if (r->used == 2) { // already exchanged size
     if (r->nSubs > 0) {
       int nCompleted = 0;
       for (int i=0; i<r->nSubs; i++) {
         struct ncclSocketTask* sub = r->tasks[i];
-        if (sub->result != ncclSuccess) return sub->result;
-        if (sub->offset == sub->size) nCompleted++;
+        ncclResult_t result = __atomic_load_n(&sub->result, __ATOMIC_ACQUIRE);
+        if (result != ncclSuccess) return result;
+        if (__atomic_load_n(&sub->offset, __ATOMIC_ACQUIRE) == sub->size) nCompleted++;
       }
       if (nCompleted == r->nSubs) {
         if (size) *size = r->size;
@@ -458,10 +1333,10 @@ ncclResult_t ncclSocketTest(void* request, int* done, int* size) {
         }
       }
     } else { // progress request using main thread
-      if (r->offset < r->size) {
-        NCCLCHECK(socketProgress(r->op, r->ctrlFd, r->addr, r->data, r->size, &r->offset));
+      if (r->op == NCCL_SOCKET_RECV && r->offset < r->size) {
+        NCCLCHECK(ncclSocketCtrlProgress(r->comm, r->op, r->data, r->size, &r->offset));
       }
-      if (r->offset == r->size) {
+      if (r->offset == r->size && (r->zc == 0 || socketZeroCopyDone(&r->comm->ctrlZc, r->zcSeq))) {
         if (size) *size = r->size;
         *done = 1;
         r->used = 0;
@@ -497,6 +1372,18 @@ ncclResult_t ncclSocketCloseListen(void* opaqueComm) {
   struct ncclSocketListenComm* comm = (struct ncclSocketListenComm*)opaqueComm;
   if (comm) {
     if (comm->fd != -1) close(comm->fd);
+    if (comm->probeFd != -1) {
+      // Wake up the probe thread whether it waits for a connection or for the
+      // peer. Data the peer already sent can still be read after the shutdown.
+      pthread_mutex_lock(&ncclSocketLock);
+      comm->probeClosing = 1;
+      if (comm->probeCtrlFd != -1) shutdown(comm->probeCtrlFd, SHUT_RDWR);
+      for (int i=0; i<MAX_THREADS; i++) if (comm->probeFds[i] != -1) shutdown(comm->probeFds[i], SHUT_RDWR);
+      pthread_mutex_unlock(&ncclSocketLock);
+      shutdown(comm->probeFd, SHUT_RDWR);
+      pthread_join(comm->probeThread, NULL);
+      close(comm->probeFd);
+    }
     free(comm);
   }
   return ncclSuccess;
@@ -508,14 +1395,16 @@ ncclResult_t ncclSocketClose(void* opaqueComm) {
     for (int i=0; i<comm->nThreads; i++) {
       struct ncclSocketThreadResources* res = comm->threadResources+i;
       if (comm->helperThread[i]) {
-        pthread_mutex_lock(&res->threadLock);
         res->state = stop;
-        pthread_cond_signal(&res->threadCond);
-        pthread_mutex_unlock(&res->threadLock);
+        ncclSocketThreadWakeup(res);
         pthread_join(comm->helperThread[i], NULL);
+        close(res->epollFd);
+        close(res->eventFd);
       }
       free(res->threadTaskQueue.tasks);
+      free(res->threadTaskQueue.ring);
     }
+    if (comm->ctrlEpollFd != -1) close(comm->ctrlEpollFd);
     if (comm->ctrlFd != -1) close(comm->ctrlFd);
     for (int i=0; i<comm->nSocks; i++) {
       if (comm->fds[i] != -1) close(comm->fds[i]);
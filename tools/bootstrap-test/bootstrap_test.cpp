@@ -0,0 +1,201 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Multi-process test of the bootstrap network.
+//
+// Forks nranks processes which bootstrap over the loopback interface, then
+// run and check bootstrapAllGather with each algorithm for a range of sizes.
+// Nodes are emulated by giving ranks different NCCL_HOSTID values.
+// Point-to-point messages are then sent to all peers with several tags and
+// received in the opposite order, to go through the unexpected messages.
+// NCCL_BOOTSTRAP_MAX_CONNS=1 makes ranks close and reopen peer connections
+// all the time.
+// With -s, ranks only run bootstrapInit, to stress the root with many ranks;
+// NCCL_DEBUG=INFO shows the timings of the root.
+// Reported times are the maximum over all ranks.
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include "core.h"
+#include "bootstrap.h"
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+    return std::find(begin, end, option) != end;
+}
+
+static double wallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+static const char* algos[] = { "ring", "bruck", "hier" };
+#define NALGOS 3
+
+static char pattern(int rank, size_t i) {
+  return (char)(rank*31 + i*7 + 1);
+}
+
+// Largest value over all ranks, using the default algorithm
+static ncclResult_t maxOverRanks(void* state, int rank, int nranks, double value, double* max) {
+  double* all;
+  NCCLCHECK(ncclCalloc(&all, nranks));
+  all[rank] = value;
+  NCCLCHECK(bootstrapAllGather(state, all, sizeof(double)));
+  *max = 0;
+  for (int r=0; r<nranks; r++) *max = std::max(*max, all[r]);
+  free(all);
+  return ncclSuccess;
+}
+
+static ncclResult_t runRank(ncclUniqueId* id, int rank, int nranks, size_t minBytes, size_t maxBytes, int iters, bool initOnly, int* errors) {
+  void* state;
+  int rootPid;
+  NCCLCHECK(bootstrapNetInit());
+  double start = wallTime();
+  NCCLCHECK(bootstrapInit(id, rank, nranks, &state, &rootPid));
+  double initTime;
+  NCCLCHECK(maxOverRanks(state, rank, nranks, wallTime()-start, &initTime));
+  if (rank == 0) printf("bootstrapInit : %.2f ms\n", initTime*1e3);
+  if (initOnly) {
+    NCCLCHECK(bootstrapClose(state));
+    return ncclSuccess;
+  }
+  if (rank == 0) printf("%12s %12s %12s\n", "size(B)", "algo", "time(us)");
+
+  char* data;
+  NCCLCHECK(ncclCalloc(&data, maxBytes*nranks));
+  for (size_t size=minBytes; size<=maxBytes; size*=2) {
+    for (int a=0; a<NALGOS; a++) {
+      setenv("NCCL_BOOTSTRAP_ALLGATHER", algos[a], 1);
+      double total = 0;
+      for (int it=0; it<iters; it++) {
+        memset(data, 0, size*nranks);
+        for (size_t i=0; i<size; i++) data[rank*size+i] = pattern(rank, i);
+        start = wallTime();
+        NCCLCHECK(bootstrapAllGather(state, data, size));
+        total += wallTime()-start;
+        for (int r=0; r<nranks; r++) {
+          for (size_t i=0; i<size; i++) {
+            if (data[r*size+i] != pattern(r, i)) {
+              if (*errors == 0) printf("Rank %d: %s AllGather of %lu bytes, wrong data from rank %d at byte %lu\n", rank, algos[a], size, r, i);
+              (*errors)++;
+              break;
+            }
+          }
+        }
+      }
+      unsetenv("NCCL_BOOTSTRAP_ALLGATHER");
+      double maxTime;
+      NCCLCHECK(maxOverRanks(state, rank, nranks, total/iters, &maxTime));
+      if (rank == 0) printf("%12lu %12s %12.1f\n", size, algos[a], maxTime*1e6);
+    }
+  }
+  free(data);
+
+  // Send NTAGS messages to every peer, receive them in reverse tag order
+#define NTAGS 4
+  start = wallTime();
+  for (int it=0; it<iters; it++) {
+    for (int i=1; i<nranks; i++) {
+      int peer = (rank+i) % nranks;
+      for (int t=0; t<NTAGS; t++) {
+        int msg[2] = { rank, t };
+        NCCLCHECK(bootstrapSend(state, peer, t, msg, sizeof(msg)));
+      }
+    }
+    for (int i=1; i<nranks; i++) {
+      int peer = (rank-i+nranks) % nranks;
+      for (int t=NTAGS-1; t>=0; t--) {
+        int msg[2];
+        NCCLCHECK(bootstrapRecv(state, peer, t, msg, sizeof(msg)));
+        if (msg[0] != peer || msg[1] != t) {
+          if (*errors == 0) printf("Rank %d: got message %d/%d instead of %d/%d\n", rank, msg[0], msg[1], peer, t);
+          (*errors)++;
+        }
+      }
+    }
+  }
+  double p2pTime;
+  NCCLCHECK(maxOverRanks(state, rank, nranks, (wallTime()-start)/iters, &p2pTime));
+  if (rank == 0) printf("Send/Recv %d tags to all peers : %.1f us\n", NTAGS, p2pTime*1e6);
+  NCCLCHECK(bootstrapClose(state));
+  return ncclSuccess;
+}
+
+int main(int argc, char* argv[]) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("Usage: ./bootstrap_test [-n nranks] [-l ranks_per_node] [-b min_bytes] [-e max_bytes] [-i iters] [-s]\n");
+    printf("  Set NCCL_SOCKET_IFNAME=lo to use the loopback interface.\n");
+    exit(0);
+  }
+  int nranks = 16, ranksPerNode = 0, iters = 5;
+  size_t minBytes = 8, maxBytes = 4096;
+  char* opt;
+  if ((opt = getCmdOption(argv, argv + argc, "-n"))) nranks = atoi(opt);
+  if ((opt = getCmdOption(argv, argv + argc, "-l"))) ranksPerNode = atoi(opt);
+  if ((opt = getCmdOption(argv, argv + argc, "-b"))) minBytes = strtoull(opt, NULL, 0);
+  if ((opt = getCmdOption(argv, argv + argc, "-e"))) maxBytes = strtoull(opt, NULL, 0);
+  if ((opt = getCmdOption(argv, argv + argc, "-i"))) iters = atoi(opt);
+  bool initOnly = cmdOptionExists(argv, argv + argc, "-s");
+  if (ranksPerNode <= 0) ranksPerNode = nranks;
+  printf("%d ranks, %d ranks per node\n", nranks, ranksPerNode);
+  fflush(stdout);
+
+  // Fork the ranks before the root thread exists; they get the id through a pipe
+  int* pipes;
+  pid_t* pids;
+  NCCLCHECK(ncclCalloc(&pipes, 2*nranks));
+  NCCLCHECK(ncclCalloc(&pids, nranks));
+  for (int r=0; r<nranks; r++) {
+    SYSCHECK(pipe(pipes+2*r), "pipe");
+    pids[r] = fork();
+    if (pids[r] == 0) {
+      char hostId[64];
+      snprintf(hostId, sizeof(hostId), "bootstrap-test-node-%d", r/ranksPerNode);
+      setenv("NCCL_HOSTID", hostId, 1);
+      ncclUniqueId id;
+      if (read(pipes[2*r], &id, sizeof(id)) != sizeof(id)) exit(2);
+      int errors = 0;
+      if (runRank(&id, r, nranks, minBytes, maxBytes, iters, initOnly, &errors) != ncclSuccess) exit(2);
+      exit(errors ? 1 : 0);
+    }
+    close(pipes[2*r]);
+  }
+
+  ncclUniqueId id;
+  NCCLCHECK(bootstrapNetInit());
+  NCCLCHECK(bootstrapGetUniqueId(&id));
+  for (int r=0; r<nranks; r++) {
+    SYSCHECK(write(pipes[2*r+1], &id, sizeof(id)), "write");
+    close(pipes[2*r+1]);
+  }
+
+  int failed = 0;
+  for (int r=0; r<nranks; r++) {
+    int status;
+    waitpid(pids[r], &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+  }
+  free(pipes);
+  free(pids);
+  printf("%s\n", failed ? "FAILED" : "PASSED");
+  return failed ? 1 : 0;
+}
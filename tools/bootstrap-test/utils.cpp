@@ -0,0 +1,19 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+#include "nccl.h"
+#include "core.h"
+#include "CliqueManager.h"
+
+#ifdef ENABLE_TRACE
+std::chrono::high_resolution_clock::time_point ncclEpoch;
+#endif
+
+struct allocationTracker allocTracker[MAX_ALLOC_TRACK_NGPU] = {};
+
+// The bootstrap root prepares clique kernel resources, which this test does not use
+ncclResult_t CliqueManager::BootstrapRootInit(int pid, unsigned long hash) {
+  return ncclSuccess;
+}
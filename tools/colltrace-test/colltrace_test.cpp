@@ -0,0 +1,379 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Test of the collective trace reader and of its binary trace file (no GPU needed).
+//
+// A producer thread plays the kernels : it fills the collective trace ring with
+// synthetic ncclCollTrace records, in bursts, the way the kernels do. The reader of
+// RCCL drains the ring in another thread, either with the old fixed 1 ms poll
+// interval or with the adaptive one, and prints the records with INFO (text) or
+// writes them to a binary trace file. The records of the binary file must be the
+// ones produced, in order, except for the ones reported as lost.
+//
+// The text form of each record type is also checked, and -d decodes a binary trace
+// file to text. Use -k to keep the binary file of the last run, e.g. to check
+// tools/scripts/rccl_colltrace_json.py on it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include "colltrace.h"
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+    return std::find(begin, end, option) != end;
+}
+
+static double threadTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+#define TEST_RANK 1
+#define TEST_NRANKS 8
+#define TEST_BUSID 0x43000
+#define TEST_BLOCKS 16
+#define TEST_OPS_PER_KERNEL 8
+
+// Record s of the synthetic trace : kernels of TEST_OPS_PER_KERNEL collectives on
+// TEST_BLOCKS blocks, each block starting with KL, moving to the next collective with CE
+// and ending with KE. Every other kernel is a SendRecv.
+static void makeRecord(uint64_t s, struct ncclCollTrace* td) {
+  uint64_t kernel = s / (TEST_BLOCKS*(TEST_OPS_PER_KERNEL+1));
+  int step = (s / TEST_BLOCKS) % (TEST_OPS_PER_KERNEL+1);
+  int bid = s % TEST_BLOCKS;
+  memset(td, 0, sizeof(struct ncclCollTrace));
+  td->type = step == 0 ? ncclCollTraceKernelLaunchType :
+             step == TEST_OPS_PER_KERNEL ? ncclCollTraceKernelEndType : ncclCollTraceCollEndType;
+  td->bid = bid;
+  td->timeStamp = 25000000 + (kernel*(TEST_OPS_PER_KERNEL+2) + step)*250 + bid;
+  td->opCount = kernel*TEST_OPS_PER_KERNEL + std::min(step, TEST_OPS_PER_KERNEL-1);
+  if (kernel % 2) {
+    td->funcIndex = FUNC_INDEX_P2P;
+    td->p2p.nThreads = 256;
+    td->p2p.delta = 1 + bid % 4;
+  } else {
+    td->funcIndex = FUNC_INDEX(ncclFuncAllReduce, ncclDevSum, ncclFloat32, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE);
+    td->coll.nThreads = 256;
+    td->coll.bid = bid;
+    td->coll.nChannels = TEST_BLOCKS;
+  }
+  if (td->type == ncclCollTraceKernelLaunchType) td->data_0 = 0x1000 + bid;
+}
+
+struct ringArgs {
+  struct ncclCollTrace* ring;
+  uint32_t* tail;
+  volatile int ready;
+  volatile int exit;
+  uint64_t nRecords;
+  int burst;            // Records per burst
+  int gap;              // us between bursts
+  int pollMin, pollMax;
+  const char* path;     // Binary trace file, NULL for text
+  uint64_t lost;
+  int polls;
+  double readerTime;
+};
+
+// Same ring protocol as the kernels : reserve a slot, fill it, then set its type
+static void* producerThread(void* arg) {
+  struct ringArgs* args = (struct ringArgs*)arg;
+  // Kernels only start once the communicator, and its trace thread, is set up
+  while (!args->ready) usleep(100);
+  for (uint64_t s = 0; s < args->nRecords; ) {
+    for (int b = 0; b < args->burst && s < args->nRecords; b++, s++) {
+      struct ncclCollTrace td;
+      makeRecord(s, &td);
+      uint32_t pos = __atomic_fetch_add(args->tail, 1, __ATOMIC_SEQ_CST)%COLLTRACE_NUM_ITEMS;
+      struct ncclCollTrace* slot = args->ring+pos;
+      slot->bid = td.bid;
+      slot->funcIndex = td.funcIndex;
+      slot->data_0 = td.data_0;
+      slot->timeStamp = td.timeStamp;
+      slot->opCount = td.opCount;
+      slot->data_1 = td.data_1;
+      __atomic_store_n(&slot->type, td.type, __ATOMIC_SEQ_CST);
+    }
+    if (args->gap) usleep(args->gap);
+  }
+  return NULL;
+}
+
+// Same loop as ncclCommThreadMain
+static void* readerThread(void* arg) {
+  struct ringArgs* args = (struct ringArgs*)arg;
+  struct ncclCollTraceReader reader;
+  if (ncclCollTraceReaderInit(&reader, args->ring, args->tail, 0, TEST_RANK, TEST_NRANKS, TEST_BUSID, args->path) != ncclSuccess) exit(1);
+  args->ready = 1;
+  int interval = args->pollMin;
+  do {
+    int done = args->exit;
+    int count = ncclCollTraceReaderPoll(&reader);
+    args->polls++;
+    if (done) break;
+    interval = ncclCollTracePollInterval(interval, count, args->pollMin, args->pollMax);
+    usleep(interval);
+  } while(1);
+  args->lost = reader.lost;
+  ncclCollTraceReaderFinalize(&reader);
+  args->readerTime = threadTime();
+  return NULL;
+}
+
+static int mapTrace(const char* path, struct ncclCollTraceFileHeader** header, size_t* size) {
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return 1;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct ncclCollTraceFileHeader)) {
+    close(fd);
+    return 1;
+  }
+  void* base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return 1;
+  *header = (struct ncclCollTraceFileHeader*)base;
+  *size = st.st_size;
+  if (memcmp((*header)->magic, COLLTRACE_FILE_MAGIC, sizeof((*header)->magic)) != 0 ||
+      (*header)->version != COLLTRACE_FILE_VERSION || (*header)->recordSize != sizeof(struct ncclCollTrace) ||
+      (*header)->nameLength != COLLTRACE_NAME_LENGTH ||
+      (*header)->dataOffset+(*header)->nRecords*sizeof(struct ncclCollTrace) > *size) {
+    munmap(base, st.st_size);
+    return 1;
+  }
+  return 0;
+}
+
+static int decodeTrace(const char* path) {
+  struct ncclCollTraceFileHeader* header;
+  size_t size;
+  if (mapTrace(path, &header, &size)) {
+    printf("%s : not a valid collective trace file\n", path);
+    return 1;
+  }
+  printf("# %s pid %d rank %d/%d busId %lx : %lu records, %lu lost\n", header->hostname, header->pid,
+      header->rank, header->nRanks, header->busId, header->nRecords, header->lost);
+  const char* names = (const char*)(header+1);
+  const struct ncclCollTrace* records = (const struct ncclCollTrace*)((char*)header+header->dataOffset);
+  for (uint64_t i = 0; i < header->nRecords; i++) {
+    char line[1024];
+    struct ncclCollTrace td = records[i];
+    // Names of the file, which may come from another version
+    if (td.type != ncclCollTraceDataType && td.funcIndex >= (int)header->nNames) td.funcIndex = FUNC_INDEX_P2P+1;
+    ncclCollTraceFormat(&td, names, header->rank, header->busId, header->nRanks, line);
+    printf("%s\n", line);
+  }
+  munmap(header, size);
+  return 0;
+}
+
+// Binary file of a run : the records must be the produced ones in order, except the lost ones
+static int checkTrace(const char* path, uint64_t nRecords, uint64_t lost, uint64_t* written) {
+  struct ncclCollTraceFileHeader* header;
+  size_t size;
+  *written = 0;
+  if (mapTrace(path, &header, &size)) {
+    printf("%s : not a valid collective trace file\n", path);
+    return 1;
+  }
+  int errors = 0;
+  char* names;
+  NCCLCHECK(ncclCollTraceGetNames(&names));
+  if (header->rank != TEST_RANK || header->nRanks != TEST_NRANKS || header->busId != TEST_BUSID ||
+      header->nNames != COLLTRACE_NUM_NAMES || header->lost != lost || header->timerFreq != COLLTRACE_TIMER_FREQUENCY ||
+      memcmp(header+1, names, COLLTRACE_NAME_LENGTH*COLLTRACE_NUM_NAMES) != 0 ||
+      size != header->dataOffset+header->nRecords*sizeof(struct ncclCollTrace)) {
+    printf("Bad trace file header\n");
+    errors++;
+  }
+  const struct ncclCollTrace* records = (const struct ncclCollTrace*)((char*)header+header->dataOffset);
+  uint64_t s = 0;
+  for (uint64_t i = 0; i < header->nRecords && !errors; i++) {
+    struct ncclCollTrace td;
+    if (lost) {
+      // Records of a slot reused while it was read may come out of order, but must be intact
+      uint64_t t = records[i].timeStamp - 25000000;
+      uint64_t q = t / 250;
+      s = (q / (TEST_OPS_PER_KERNEL+2))*TEST_BLOCKS*(TEST_OPS_PER_KERNEL+1) + (q % (TEST_OPS_PER_KERNEL+2))*TEST_BLOCKS + t % 250;
+      makeRecord(s, &td);
+      if (s < nRecords && memcmp(&td, records+i, sizeof(td)) == 0) continue;
+    } else {
+      do makeRecord(s++, &td); while (s <= nRecords && memcmp(&td, records+i, sizeof(td)) != 0);
+      if (s <= nRecords) continue;
+    }
+    printf("Record %lu is not a produced record\n", i);
+    errors++;
+  }
+  *written = header->nRecords;
+  if (header->nRecords + lost > nRecords || (lost == 0 && header->nRecords != nRecords)) {
+    printf("%lu records written and %lu lost out of %lu\n", header->nRecords, lost, nRecords);
+    errors++;
+  }
+  free(names);
+  munmap(header, size);
+  return errors;
+}
+
+static uint64_t countLines(const char* path) {
+  uint64_t lines = 0;
+  FILE* file = fopen(path, "r");
+  if (file == NULL) return 0;
+  char line[2048];
+  while (fgets(line, sizeof(line), file)) {
+    if (strstr(line, "## [")) lines++;
+  }
+  fclose(file);
+  return lines;
+}
+
+static int checkFormat() {
+  char* names;
+  NCCLCHECK(ncclCollTraceGetNames(&names));
+  struct ncclCollTrace td;
+  memset(&td, 0, sizeof(td));
+  td.bid = 3;
+  td.timeStamp = 25000000;
+  td.opCount = 0x2a;
+  td.funcIndex = FUNC_INDEX(ncclFuncAllReduce, ncclDevSum, ncclFloat32, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE);
+  td.data_0 = 0x1234;
+  td.coll.nThreads = 256;
+  td.coll.bid = 3;
+  td.coll.nChannels = 4;
+  struct {
+    uint8_t type;
+    int16_t funcIndex;
+    const char* expected;
+  } tests[] = {
+    { ncclCollTraceKernelLaunchType, -1, "## [    1.000000] [01:03] 00002a KL HWID     1234 AllReduceRingSimpleSum_f32 nt 256 bi 3 nc 4 busId 43000 nRanks 8" },
+    { ncclCollTraceCollEndType, -1, "## [    1.000000] [01:03] 00002a CE AllReduceRingSimpleSum_f32 nt 256 bi 3 nc 4 busId 43000 nRanks 8" },
+    { ncclCollTraceCollEndType, FUNC_INDEX_P2P, "## [    1.000000] [01:03] 10002a CE SendRecvRingSimpleSum_i8 nt 256 dt 1027 busId 43000 nRanks 8" },
+    { ncclCollTraceKernelEndType, -1, "## [    1.000000] [01:03] 00002a KE busId 43000 nRanks 8" },
+    { ncclCollTraceAbortType, -1, "## [    1.000000] [01:03] 00002a Abort" },
+    { ncclCollTraceDataType, 123, "## [    1.000000] [01:03] L:0123 DT 00001234 000000000000002a 0000000004030100" },
+    { ncclCollTraceKernelLaunchType, FUNC_INDEX_P2P+1, "## [    1.000000] [01:03] 00002a KL ERROR bad function index " },
+  };
+  int errors = 0;
+  for (int t = 0; t < (int)(sizeof(tests)/sizeof(tests[0])); t++) {
+    struct ncclCollTrace rec = td;
+    rec.type = tests[t].type;
+    if (tests[t].funcIndex != -1) rec.funcIndex = tests[t].funcIndex;
+    char line[1024];
+    ncclCollTraceFormat(&rec, names, TEST_RANK, TEST_BUSID, TEST_NRANKS, line);
+    if (strncmp(line, tests[t].expected, strlen(tests[t].expected)) != 0) {
+      printf("Format of record type %d :\n  %s\nexpected\n  %s\n", rec.type, line, tests[t].expected);
+      errors++;
+    }
+  }
+  // Idle, large batches, a batch in the target range, then a nearly full ring
+  int interval = 10;
+  int counts[] = { 0, 0, 0, 0, 0, 0, 0, 1, 1, COLLTRACE_NUM_ITEMS/8, COLLTRACE_NUM_ITEMS/16, COLLTRACE_NUM_ITEMS/32, COLLTRACE_NUM_ITEMS/2, 1 };
+  int expected[] = { 20, 40, 80, 160, 320, 640, 1000, 1000, 1000, 500, 250, 250, 10, 20 };
+  for (int i = 0; i < (int)(sizeof(counts)/sizeof(counts[0])); i++) {
+    interval = ncclCollTracePollInterval(interval, counts[i], 10, 1000);
+    if (interval != expected[i]) {
+      printf("Poll interval %d after %d records, expected %d\n", interval, counts[i], expected[i]);
+      errors++;
+    }
+  }
+  free(names);
+  return errors;
+}
+
+int main(int argc, char* argv[]) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("Usage: ./colltrace_test [-n records] [-b burst] [-g gap_us] [-m poll_min_us] [-M poll_max_us] [-f file] [-k]\n");
+    printf("       ./colltrace_test -d trace_file\n");
+    return 0;
+  }
+  char* opt;
+  if ((opt = getCmdOption(argv, argv + argc, "-d"))) return decodeTrace(opt);
+
+  uint64_t nRecords = 1000000;
+  int burst = 2*TEST_BLOCKS, gap = 20, pollMin = 10, pollMax = 1000;
+  std::string path = "/tmp/colltrace_test_" + std::to_string(getpid()) + ".bin";
+  std::string logPath = "/tmp/colltrace_test_" + std::to_string(getpid()) + ".log";
+  if ((opt = getCmdOption(argv, argv + argc, "-n"))) nRecords = std::max(atol(opt), 1L);
+  if ((opt = getCmdOption(argv, argv + argc, "-b"))) burst = std::max(atoi(opt), 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-g"))) gap = std::max(atoi(opt), 0);
+  if ((opt = getCmdOption(argv, argv + argc, "-m"))) pollMin = std::max(atoi(opt), 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-M"))) pollMax = std::max(atoi(opt), pollMin);
+  if ((opt = getCmdOption(argv, argv + argc, "-f"))) path = opt;
+  bool keep = cmdOptionExists(argv, argv + argc, "-k");
+
+  // Text records go to the log file
+  setenv("NCCL_DEBUG", "INFO", 1);
+  setenv("NCCL_DEBUG_SUBSYS", "COLL", 1);
+  setenv("NCCL_DEBUG_FILE", logPath.c_str(), 1);
+
+  int errors = checkFormat();
+  printf("Record format : %s\n", errors ? "FAILED" : "OK");
+
+  struct ncclCollTrace* ring;
+  NCCLCHECK(ncclCalloc(&ring, COLLTRACE_NUM_ITEMS));
+  printf("%lu records in bursts of %d every %d us\n", nRecords, burst, gap);
+  printf("%6s %8s %12s %10s %10s %10s %12s %8s\n", "sink", "poll", "written", "lost", "polls", "reader(ms)", "ns/record", "");
+  for (int binary = 0; binary < 2; binary++) {
+    for (int adaptive = 0; adaptive < 2; adaptive++) {
+      struct ringArgs args;
+      memset(&args, 0, sizeof(args));
+      memset(ring, 0, sizeof(struct ncclCollTrace)*COLLTRACE_NUM_ITEMS);
+      uint32_t tail = 0;
+      args.ring = ring;
+      args.tail = &tail;
+      args.nRecords = nRecords;
+      args.burst = burst;
+      args.gap = gap;
+      // Fixed poll interval of 1 ms, as before the adaptive one
+      args.pollMin = adaptive ? pollMin : 1000;
+      args.pollMax = adaptive ? pollMax : 1000;
+      args.path = binary ? path.c_str() : NULL;
+      pthread_t producer, reader;
+      pthread_create(&reader, NULL, readerThread, &args);
+      pthread_create(&producer, NULL, producerThread, &args);
+      pthread_join(producer, NULL);
+      args.exit = 1;
+      pthread_join(reader, NULL);
+
+      uint64_t written;
+      int err = 0;
+      if (binary) {
+        err = checkTrace(path.c_str(), nRecords, args.lost, &written);
+      } else {
+        // Lines of the previous runs are in the log too
+        static uint64_t lines = 0;
+        written = countLines(logPath.c_str()) - lines;
+        lines += written;
+        if (written + args.lost > nRecords || (args.lost == 0 && written != nRecords)) err = 1;
+      }
+      printf("%6s %8s %12lu %10lu %10d %10.1f %12.1f %8s\n", binary ? "binary" : "text", adaptive ? "adaptive" : "1ms",
+          written, args.lost, args.polls, 1e3*args.readerTime, 1e9*args.readerTime/std::max(written, (uint64_t)1), err ? "FAILED" : "OK");
+      errors += err;
+    }
+  }
+  free(ring);
+  if (keep) printf("Binary trace kept in %s\n", path.c_str());
+  else unlink(path.c_str());
+  unlink(logPath.c_str());
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
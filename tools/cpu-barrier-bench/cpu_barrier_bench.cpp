@@ -0,0 +1,156 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Multi-process benchmark of the CliqueManager CPU barrier (no GPU needed).
+//
+// Forked processes go through the barrier the way DeclarePointers/WaitForPointers
+// do, on counters in shared memory. Rank 0 sleeps for the given delay before each
+// barrier, so that the other ranks have to wait for it. For each spin budget, the
+// wake-up latency is the time between rank 0 arriving and the other ranks leaving
+// the barrier, and the CPU usage is the CPU time of the waiting ranks (getrusage)
+// divided by the elapsed time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "CpuBarrier.h"
+
+// Counter pairs are reused every NUM_SLOTS barriers, like opIndex in CliqueManager
+#define NUM_SLOTS 4
+#define MAX_RANKS 64
+
+struct sharedState {
+  int32_t counters[2*NUM_SLOTS];
+  volatile double arrival;     // Time rank 0 arrived at the current barrier, ordered by the barrier
+  double latency[MAX_RANKS];   // Sum of wake-up latencies
+  double maxLatency[MAX_RANKS];
+  double cpu[MAX_RANKS];       // CPU time (s)
+  double elapsed[MAX_RANKS];   // Elapsed time (s)
+};
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+    return std::find(begin, end, option) != end;
+}
+
+static double wallTime() {
+  struct timespec ts;
+  // CLOCK_MONOTONIC is the same for all processes
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static double cpuTime() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec*1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec*1e-6;
+}
+
+static void runRank(struct sharedState* state, int rank, int nRanks, int iters, int delay, int64_t spin) {
+  double latency = 0, maxLatency = 0;
+  double start = wallTime();
+  double cpuStart = cpuTime();
+  for (int i = 0; i < iters; i++) {
+    int32_t* entry = &state->counters[2*(i%NUM_SLOTS)];
+    int32_t* exit = entry+1;
+    if (rank == 0) {
+      if (delay) usleep(delay);
+      state->arrival = wallTime();
+    }
+    cpuBarrierArrive(entry, nRanks, exit);
+    cpuBarrierWait(entry, nRanks, spin);
+    if (rank != 0) {
+      double lat = wallTime() - state->arrival;
+      latency += lat;
+      maxLatency = std::max(maxLatency, lat);
+    }
+    cpuBarrierArrive(exit, nRanks, entry);
+  }
+  state->elapsed[rank] = wallTime() - start;
+  state->cpu[rank] = cpuTime() - cpuStart;
+  state->latency[rank] = latency;
+  state->maxLatency[rank] = maxLatency;
+}
+
+int main(int argc, char* argv[]) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("Usage: ./cpu_barrier_bench [-n nranks] [-i iters] [-d delay_us] [-s spin1,spin2,...]\n");
+    printf("  A spin budget of -1 never sleeps (busy-wait only).\n");
+    return 0;
+  }
+  int nRanks = 4, iters = 2000, delay = 100;
+  std::vector<int64_t> spins = { -1, 0, 1000, 20000, 200000 };
+  char* opt;
+  if ((opt = getCmdOption(argv, argv + argc, "-n"))) nRanks = std::min(std::max(atoi(opt), 2), MAX_RANKS);
+  if ((opt = getCmdOption(argv, argv + argc, "-i"))) iters = std::max(atoi(opt), 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-d"))) delay = std::max(atoi(opt), 0);
+  if ((opt = getCmdOption(argv, argv + argc, "-s"))) {
+    spins.clear();
+    for (char* tok = strtok(opt, ","); tok; tok = strtok(NULL, ",")) spins.push_back(strtoll(tok, NULL, 0));
+  }
+
+  struct sharedState* state = (struct sharedState*)mmap(NULL, sizeof(struct sharedState), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (state == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  printf("%d processes, %d iterations, rank 0 late by %d us, %ld online CPUs\n", nRanks, iters, delay, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%12s %12s %12s %12s %12s\n", "spin", "iter(us)", "wake(us)", "maxwake(us)", "cpu(%)");
+  int errors = 0;
+  for (int64_t spin : spins) {
+    memset(state, 0, sizeof(struct sharedState));
+    std::vector<pid_t> pids;
+    for (int r = 0; r < nRanks; r++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        runRank(state, r, nRanks, iters, delay, spin);
+        _exit(0);
+      }
+      if (pid < 0) {
+        perror("fork");
+        errors++;
+        break;
+      }
+      pids.push_back(pid);
+    }
+    for (pid_t pid : pids) {
+      int status;
+      if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) errors++;
+    }
+    if (errors) break;
+
+    // Statistics of the waiting ranks
+    double latency = 0, maxLatency = 0, cpu = 0, elapsed = 0;
+    for (int r = 1; r < nRanks; r++) {
+      latency += state->latency[r];
+      maxLatency = std::max(maxLatency, state->maxLatency[r]);
+      cpu += state->cpu[r];
+      elapsed += state->elapsed[r];
+    }
+    printf("%12ld %12.2f %12.2f %12.2f %12.1f\n", spin, 1e6*state->elapsed[0]/iters,
+        1e6*latency/((nRanks-1)*iters), 1e6*maxLatency, 100*cpu/elapsed);
+  }
+  munmap(state, sizeof(struct sharedState));
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
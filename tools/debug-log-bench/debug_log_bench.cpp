@@ -0,0 +1,150 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Multi-threaded throughput benchmark of ncclDebugLog (no GPU needed).
+//
+// For synchronous and asynchronous (NCCL_DEBUG_ASYNC=1) logging, a child
+// process starts the given number of threads, which all log INFO messages as
+// fast as they can into a NCCL_DEBUG_FILE. The time per call is measured in
+// the logging threads; the throughput is the number of messages written out
+// per second, until the process has exited.
+// The file must then contain every message, except the ones reported as
+// dropped by the asynchronous logger.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include "core.h"
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+    return std::find(begin, end, option) != end;
+}
+
+static double wallTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+struct threadArgs {
+  int thread;
+  int iters;
+  pthread_barrier_t* barrier;
+  double elapsed;
+};
+
+static void* logThread(void* arg) {
+  struct threadArgs* args = (struct threadArgs*)arg;
+  pthread_barrier_wait(args->barrier);
+  double start = wallTime();
+  for (int i = 0; i < args->iters; i++) {
+    INFO(NCCL_COLL, "AllReduce: opCount %x sendbuff %p recvbuff %p count %zi datatype %d op %d root %d comm %p [nranks=%d] stream %p",
+        i, (void*)0x7f0000001000, (void*)0x7f0000002000, (size_t)1048576, 7, 0, 0, (void*)args, args->thread, (void*)0);
+  }
+  args->elapsed = wallTime() - start;
+  return NULL;
+}
+
+// Count the benchmark messages and the dropped ones in the log file
+static void countLines(const char* path, long* lines, long* dropped) {
+  *lines = *dropped = 0;
+  FILE* file = fopen(path, "r");
+  if (file == NULL) return;
+  char line[2048];
+  while (fgets(line, sizeof(line), file)) {
+    if (strstr(line, "AllReduce: opCount")) (*lines)++;
+    const char* str = strstr(line, "Dropped ");
+    if (str) *dropped += atol(str + 8);
+  }
+  fclose(file);
+}
+
+static int runMode(int async, int nThreads, int iters, const char* path) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    // Fresh process, so that the logger is initialized for this mode
+    setenv("NCCL_DEBUG", "INFO", 1);
+    setenv("NCCL_DEBUG_SUBSYS", "INIT,COLL", 1);
+    setenv("NCCL_DEBUG_FILE", path, 1);
+    setenv("NCCL_DEBUG_ASYNC", async ? "1" : "0", 1);
+    // Initialize the logger before starting the threads, as ncclInit does
+    INFO(NCCL_INIT, "Logging from %d threads", nThreads);
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, nThreads);
+    struct threadArgs args[nThreads];
+    pthread_t threads[nThreads];
+    double start = wallTime();
+    for (int t = 0; t < nThreads; t++) {
+      args[t].thread = t;
+      args[t].iters = iters;
+      args[t].barrier = &barrier;
+      pthread_create(threads + t, NULL, logThread, args + t);
+    }
+    double callTime = 0;
+    for (int t = 0; t < nThreads; t++) {
+      pthread_join(threads[t], NULL);
+      callTime += args[t].elapsed;
+    }
+    // exit() writes out the remaining asynchronous messages
+    printf("%8s %8d %12.3f ", async ? "async" : "sync", nThreads, 1e9*callTime/((double)nThreads*iters));
+    fflush(stdout);
+    exit(0);
+  }
+  int status;
+  double start = wallTime();
+  if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("Child process failed\n");
+    return 1;
+  }
+  double elapsed = wallTime() - start;
+  long lines, dropped;
+  countLines(path, &lines, &dropped);
+  long expected = (long)nThreads*iters;
+  bool pass = (lines + dropped == expected);
+  printf("%12.3f %10ld %10ld %s\n", lines/elapsed/1e6, lines, dropped, pass ? "OK" : "FAILED");
+  return pass ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("Usage: ./debug_log_bench [-t max_threads] [-i iters_per_thread] [-r async_records] [-f file]\n");
+    return 0;
+  }
+  int maxThreads = 8, iters = 100000;
+  std::string path = "/tmp/debug_log_bench_" + std::to_string(getpid()) + ".log";
+  char* opt;
+  if ((opt = getCmdOption(argv, argv + argc, "-t"))) maxThreads = std::max(atoi(opt), 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-i"))) iters = std::max(atoi(opt), 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-r"))) setenv("NCCL_DEBUG_ASYNC_RECORDS", opt, 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-f"))) path = opt;
+
+  printf("%8s %8s %12s %12s %10s %10s\n", "mode", "threads", "call(ns)", "Mmsg/s", "written", "dropped");
+  int errors = 0;
+  for (int nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+    for (int async = 0; async < 2; async++) {
+      errors += runMode(async, nThreads, iters, path.c_str());
+    }
+  }
+  unlink(path.c_str());
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,13 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+#include "nccl.h"
+#include "core.h"
+
+#ifdef ENABLE_TRACE
+std::chrono::high_resolution_clock::time_point ncclEpoch;
+#endif
+
+struct allocationTracker allocTracker[MAX_ALLOC_TRACK_NGPU] = {};
@@ -0,0 +1,183 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// CPU benchmark of the clique IPC handle caches (no GPU needed).
+//
+// First checks NcclIpcHandleFlatCache against a simple LRU model on random
+// operations, including with a hash function where all keys collide. Then
+// measures the latency of lookups which hit and miss, and of insertions which
+// evict, for the receive cache (handle -> pointer) with the std::unordered_map
+// based NcclIpcHandleCache and with NcclIpcHandleFlatCache.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <list>
+#include <random>
+#include <string>
+#include <vector>
+#include "HandleCache.h"
+
+typedef NcclIpcHandleCache<hipIpcMemHandle_t, void*, decltype(&hipIpcMemHandleHash), decltype(hipIpcMemHandleEqual), std::allocator< std::pair<const hipIpcMemHandle_t, std::pair<void*, std::list<hipIpcMemHandle_t>::iterator>>>> ListRecvCache;
+typedef NcclIpcHandleFlatCache<hipIpcMemHandle_t, void*, hipIpcMemHandleHasher, hipIpcMemHandleEqualTo> FlatRecvCache;
+
+struct collidingHash {
+  size_t operator()(uint64_t key) const { return 42; }
+};
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+    return std::find(begin, end, option) != end;
+}
+
+static double wallTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+// Random operations on small key sets, compared with a list of (key, value) in LRU order
+template <class Cache>
+static int checkCache(const char* name, int capacity, int nKeys, int nOps, unsigned seed) {
+  std::mt19937 rng(seed);
+  Cache cache(capacity);
+  std::list<std::pair<uint64_t, uint64_t>> model;
+  int errors = 0;
+  for (int op = 0; op < nOps && errors < 10; op++) {
+    uint64_t key = (rng() % nKeys) << 12;
+    auto it = std::find_if(model.begin(), model.end(), [key](const std::pair<uint64_t, uint64_t>& e) { return e.first == key; });
+    int action = rng() % 8;
+    if (action < 4) {
+      // find
+      typename Cache::iterator c = cache.find(key);
+      bool found = (c != cache.end());
+      if (found != (it != model.end()) || (found && c->second.first != it->second)) {
+        printf("%s : find of key %lx differs (op %d)\n", name, key, op);
+        errors++;
+      }
+      if (it != model.end()) model.splice(model.end(), model, it);
+    } else if (action < 7) {
+      // insert
+      uint64_t value = rng();
+      std::pair<typename Cache::iterator, bool> res = cache.insert(key, value);
+      if (res.second != (it == model.end())) {
+        printf("%s : insert of key %lx differs (op %d)\n", name, key, op);
+        errors++;
+      }
+      if (it == model.end()) {
+        if ((int)model.size() == capacity) model.pop_front();
+        model.push_back(std::make_pair(key, value));
+      }
+    } else {
+      // erase
+      if (cache.erase(key) != (it != model.end() ? 1U : 0U)) {
+        printf("%s : erase of key %lx differs (op %d)\n", name, key, op);
+        errors++;
+      }
+      if (it != model.end()) model.erase(it);
+    }
+    if (cache.size() != model.size()) {
+      printf("%s : size %lu instead of %lu (op %d)\n", name, cache.size(), model.size(), op);
+      errors++;
+    }
+  }
+  // All remaining keys must be there with the right value
+  for (auto& e : model) {
+    typename Cache::iterator c = cache.find(e.first);
+    if (c == cache.end() || c->second.first != e.second) {
+      printf("%s : key %lx missing at the end\n", name, e.first);
+      errors++;
+    }
+  }
+  return errors;
+}
+
+static void randomHandles(std::mt19937_64& rng, int n, std::vector<hipIpcMemHandle_t>& handles) {
+  handles.resize(n);
+  for (auto& h : handles) {
+    for (size_t i = 0; i < sizeof(h.reserved); i += sizeof(uint64_t)) {
+      uint64_t word = rng();
+      memcpy(h.reserved + i, &word, sizeof(word));
+    }
+  }
+}
+
+// Average time per operation in ns for lookups of present keys, absent keys, and insertions which evict
+template <class Cache>
+static void benchCache(const char* name, Cache& cache, int capacity, int iters, std::vector<hipIpcMemHandle_t> const& keys,
+                       std::vector<hipIpcMemHandle_t> const& others, std::vector<int> const& order) {
+  for (int i = 0; i < capacity; i++) cache.insert(keys[i], (void*)(uintptr_t)(i+1));
+  size_t n = order.size();
+  uintptr_t sum = 0;
+
+  double start = wallTime();
+  for (int i = 0; i < iters; i++) {
+    typename Cache::iterator it = cache.find(keys[order[i % n]]);
+    if (it != cache.end()) sum += (uintptr_t)it->second.first;
+  }
+  double hit = (wallTime() - start) * 1e9 / iters;
+
+  start = wallTime();
+  int misses = 0;
+  for (int i = 0; i < iters; i++) misses += (cache.find(others[order[i % n]]) == cache.end());
+  double miss = (wallTime() - start) * 1e9 / iters;
+
+  start = wallTime();
+  for (int i = 0; i < capacity; i++) cache.insert(others[i], (void*)(uintptr_t)i);
+  double evict = (wallTime() - start) * 1e9 / capacity;
+
+  printf("%10s %10d %12.1f %12.1f %12.1f %s\n", name, capacity, hit, miss, evict,
+      (sum == 0 || misses != iters) ? "(wrong results)" : "");
+}
+
+int main(int argc, char* argv[]) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("Usage: ./handle_cache_bench [-n capacity] [-i iters]\n");
+    printf("  The default capacity is the one of a 16 ranks clique receive cache.\n");
+    return 0;
+  }
+  int capacity = 16 * 2 * 2048, iters = 2000000;
+  char* opt;
+  if ((opt = getCmdOption(argv, argv + argc, "-n"))) capacity = std::max(atoi(opt), 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-i"))) iters = std::max(atoi(opt), 1);
+
+  int errors = 0;
+  errors += checkCache<NcclIpcHandleFlatCache<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>>>("flat", 37, 100, 200000, 1);
+  errors += checkCache<NcclIpcHandleFlatCache<uint64_t, uint64_t, std::hash<uint64_t>, std::equal_to<uint64_t>>>("flat", 1, 4, 10000, 2);
+  errors += checkCache<NcclIpcHandleFlatCache<uint64_t, uint64_t, collidingHash, std::equal_to<uint64_t>>>("colliding", 37, 60, 200000, 3);
+  printf("Check against LRU model : %s\n", errors ? "FAILED" : "OK");
+
+  std::mt19937_64 rng(1234);
+  std::vector<hipIpcMemHandle_t> keys, others;
+  randomHandles(rng, capacity, keys);
+  randomHandles(rng, capacity, others);
+  printf("%10s %10s %12s %12s %12s\n", "cache", "capacity", "hit(ns)", "miss(ns)", "evict(ns)");
+  for (int small = 0; small < 2; small++) {
+    // Also a small cache, which fits in the CPU caches
+    int const cap = small ? std::min(capacity, 256) : capacity;
+    // Random lookup order
+    std::vector<int> order(cap);
+    for (int i = 0; i < cap; i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    // Constructed as CliqueManager does
+    ListRecvCache listCache(cap, 100, hipIpcMemHandleHash, hipIpcMemHandleEqual);
+    benchCache("list", listCache, cap, iters, keys, others, order);
+    FlatRecvCache flatCache(cap);
+    benchCache("flat", flatCache, cap, iters, keys, others, order);
+  }
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
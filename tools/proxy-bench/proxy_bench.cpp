@@ -0,0 +1,179 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// CPU-only benchmark of the handoff of operations to the proxy thread.
+//
+// Posts synthetic send operations on a fake communicator whose connectors
+// have a dummy progress function, which completes each operation the first
+// time it is called. Reports the latency from ncclProxyStart to the first
+// progress call, and the CPU time used by the proxy threads.
+//
+// -g inserts a pause between launches, to measure the wake up of a parked
+// proxy thread (compare with NCCL_PROXY_SPIN_USEC). -t sets the number of
+// proxy threads, which share the channels.
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "comm.h"
+#include "proxy.h"
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+    return std::find(begin, end, option) != end;
+}
+
+static double timeUsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+static double threadCpuUsec(pthread_t thread) {
+  clockid_t cid;
+  struct timespec ts;
+  if (pthread_getcpuclockid(thread, &cid) != 0 || clock_gettime(cid, &ts) != 0) return 0;
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
+
+static double proxyCpuUsec(struct ncclComm* comm) {
+  double cpu = 0;
+  for (int t=0; t<comm->proxyState.nThreads; t++) cpu += threadCpuUsec(comm->proxyState.threads[t].thread);
+  return cpu;
+}
+
+static double* postTimes;
+static double* latencies;
+static uint64_t completed;
+
+static ncclResult_t dummyProgress(struct ncclProxyArgs* args) {
+  if (args->state == ncclProxyOpReady) {
+    latencies[args->opCount] = timeUsec() - postTimes[args->opCount];
+    args->state = ncclProxyOpNone;
+    __atomic_fetch_add(&completed, 1, __ATOMIC_RELEASE);
+  }
+  args->idle = 0;
+  return ncclSuccess;
+}
+
+static struct ncclTransportComm dummyTransport = { NULL, NULL, NULL, dummyProgress };
+
+// Communicator of 2 ranks where rank 0 sends to rank 1 on each channel
+static ncclResult_t createComm(struct ncclComm** commOut, int nChannels) {
+  struct ncclComm* comm;
+  NCCLCHECK(ncclCalloc(&comm, 1));
+  NCCLCHECK(ncclCalloc((uint32_t**)&comm->abortFlag, 1));
+  comm->rank = 0;
+  comm->nRanks = 2;
+  comm->nChannels = nChannels;
+  for (int c=0; c<nChannels; c++) {
+    struct ncclChannel* channel = comm->channels+c;
+    channel->id = c;
+    NCCLCHECK(ncclCalloc(&channel->peers, comm->nRanks));
+    struct ncclConnector* send = channel->peers[1].send;
+    send->transportComm = &dummyTransport;
+    send->proxyAppendPtr = &send->proxyAppend;
+    send->comm = comm;
+  }
+  NCCLCHECK(ncclProxyCreate(comm));
+  *commOut = comm;
+  return ncclSuccess;
+}
+
+static ncclResult_t postOp(struct ncclComm* comm, int nChannels, uint64_t op) {
+  for (int c=0; c<nChannels; c++) {
+    struct ncclProxyArgs args;
+    memset(&args, 0, sizeof(args));
+    args.nsubs = 1;
+    args.sliceSteps = args.chunkSteps = 1;
+    args.protocol = NCCL_PROTO_SIMPLE;
+    struct ncclProxySubArgs* sub = args.subs;
+    sub->channel = comm->channels+c;
+    sub->delta = 1;
+    sub->sendbytes = 8;
+    sub->sendChunkSize = 8;
+    sub->recvbytes = -1;
+    // ncclProxySaveP2p uses the last work element of the channel as opCount
+    comm->channels[c].workFifoTail = op+1;
+    NCCLCHECK(ncclProxySaveP2p(comm, &args));
+  }
+  postTimes[op] = timeUsec();
+  NCCLCHECK(ncclProxyStart(comm));
+  return ncclSuccess;
+}
+
+int main(int argc, char* argv[]) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("Usage: ./proxy_bench [-n launches] [-c channels] [-w launches_in_flight] [-g gap_usec] [-t proxy_threads]\n");
+    exit(0);
+  }
+  int nOps = 100000, nChannels = 4, window = 1, gap = 0;
+  char* opt;
+  if ((opt = getCmdOption(argv, argv + argc, "-n"))) nOps = atoi(opt);
+  if ((opt = getCmdOption(argv, argv + argc, "-c"))) nChannels = std::min(atoi(opt), MAXCHANNELS);
+  if ((opt = getCmdOption(argv, argv + argc, "-w"))) window = std::max(atoi(opt), 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-g"))) gap = atoi(opt);
+  if ((opt = getCmdOption(argv, argv + argc, "-t"))) setenv("NCCL_PROXY_NTHREADS", opt, 1);
+
+  struct ncclComm* comm;
+  NCCLCHECK(ncclCalloc(&postTimes, nOps));
+  NCCLCHECK(ncclCalloc(&latencies, nOps));
+  NCCLCHECK(createComm(&comm, nChannels));
+
+  double start = timeUsec();
+  double cpuStart = proxyCpuUsec(comm);
+  for (int op=0; op<nOps; op++) {
+    // Keep at most window launches in flight
+    while ((uint64_t)op - __atomic_load_n(&completed, __ATOMIC_ACQUIRE)/nChannels >= (uint64_t)window) sched_yield();
+    if (gap) usleep(gap);
+    NCCLCHECK(postOp(comm, nChannels, op));
+  }
+  while (__atomic_load_n(&completed, __ATOMIC_ACQUIRE) < (uint64_t)nOps*nChannels) sched_yield();
+  double elapsed = timeUsec() - start;
+  double cpu = proxyCpuUsec(comm) - cpuStart;
+
+  std::vector<double> sorted(latencies, latencies+nOps);
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0;
+  for (int i=0; i<nOps; i++) sum += sorted[i];
+  printf("%d launches of %d ops, %d in flight, %d us apart\n", nOps, nChannels, window, gap);
+  printf("Post to progress latency (us) : avg %.2f p50 %.2f p99 %.2f max %.2f\n",
+      sum/nOps, sorted[nOps/2], sorted[(int)(nOps*0.99)], sorted[nOps-1]);
+  printf("Launch rate : %.0f launches/s\n", nOps/elapsed*1e6);
+  printf("Proxy threads CPU : %.1f%% of %.0f ms\n", 100*cpu/elapsed, elapsed*1e-3);
+  // Threads account the time they spend asleep when they wake up
+  NCCLCHECK(ncclProxyDestroy(comm));
+  for (int t=0; t<comm->proxyState.nThreads; t++) {
+    struct ncclProxyThread* thread = comm->proxyState.threads+t;
+    double total = thread->busyUsec + thread->pollUsec + thread->waitUsec;
+    if (total == 0) { // Never ran an operation
+      printf("  Thread %d : %lu ops\n", t, thread->nOps);
+      continue;
+    }
+    printf("  Thread %d : %lu ops, busy %.1f%% polling %.1f%% waiting %.1f%%\n", t, thread->nOps,
+        100*thread->busyUsec/total, 100*thread->pollUsec/total, 100*thread->waitUsec/total);
+  }
+
+  for (int c=0; c<nChannels; c++) free(comm->channels[c].peers);
+  free((void*)comm->abortFlag);
+  free(comm);
+  free(postTimes);
+  free(latencies);
+  return 0;
+}
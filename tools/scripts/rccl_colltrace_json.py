@@ -0,0 +1,112 @@
+#!/usr/bin/python3
+
+# Convert RCCL binary collective trace files to a Chrome trace / Perfetto JSON file.
+#
+# The files are written by RCCL built with ENABLE_COLLTRACE, one per rank, e.g.
+#   RCCL_KERNEL_COLL_TRACE_ENABLE=1 RCCL_KERNEL_COLL_TRACE_FILE=/tmp/colltrace.%h.%r.bin ...
+#   rccl_colltrace_json.py /tmp/colltrace.*.bin -o trace.json
+# and the result can be opened in chrome://tracing or https://ui.perfetto.dev.
+#
+# Each rank is a process and each block of the kernel a thread. A kernel launch (KL)
+# starts the first collective of a block, each collective end (CE) starts the next
+# one, and the kernel end (KE) or an abort ends the last one. Data records (DT) are
+# shown as instant events.
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b'RCCLCTRC'
+HEADER = struct.Struct('<8sIIIIQQQdqiii52s')
+RECORD = struct.Struct('<BBhIQQQ')
+KL, KE, CE, ABORT, DT = 1, 2, 3, 4, 5
+
+def cstr(b):
+    return b.split(b'\0', 1)[0].decode(errors='replace')
+
+def read_trace(path):
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        sys.exit('%s : file too short' % path)
+    (magic, version, record_size, name_length, n_names, data_offset, n_records, lost,
+     freq, bus_id, rank, n_ranks, pid, hostname) = HEADER.unpack_from(data)
+    if magic != MAGIC or version != 1 or record_size != RECORD.size:
+        sys.exit('%s : not a RCCL collective trace file' % path)
+    names = [cstr(data[HEADER.size + i * name_length:HEADER.size + (i + 1) * name_length]) for i in range(n_names)]
+    # Records past nRecords were not committed, e.g. if the process was killed
+    n_records = min(n_records, (len(data) - data_offset) // record_size)
+    records = [RECORD.unpack_from(data, data_offset + i * record_size) for i in range(n_records)]
+    info = { 'rank': rank, 'nRanks': n_ranks, 'busId': bus_id, 'pid': pid, 'hostname': cstr(hostname),
+             'freq': freq, 'lost': lost }
+    return info, names, records
+
+def collective(names, fidx, data_1):
+    name = names[fidx] if 0 <= fidx < len(names) else 'Unknown function %d' % fidx
+    if fidx == len(names) - 1:
+        return name, { 'nThreads': data_1 & 0xffff, 'delta': (data_1 >> 16) & 0xffff }
+    return name, { 'nThreads': data_1 & 0xffff, 'bid': (data_1 >> 16) & 0xff, 'nChannels': (data_1 >> 24) & 0xff }
+
+def convert(info, names, records, t0):
+    rank = info['rank']
+    us = 1e6 / info['freq']
+    events = [{ 'name': 'process_name', 'ph': 'M', 'pid': rank,
+                'args': { 'name': 'Rank %d %s busId %x' % (rank, info['hostname'], info['busId']) } }]
+    blocks = set()
+    kernel = {}   # Kernel start per block
+    coll = {}     # Current collective per block : start, name, args
+    def end_coll(bid, ts):
+        if bid in coll:
+            start, name, args = coll.pop(bid)
+            events.append({ 'name': name, 'ph': 'X', 'pid': rank, 'tid': bid, 'ts': start, 'dur': ts - start, 'args': args })
+    for kind, bid, fidx, data_0, ts, op_count, data_1 in records:
+        ts = (ts - t0) * us
+        blocks.add(bid)
+        if kind == DT:
+            events.append({ 'name': 'Data', 'ph': 'i', 's': 't', 'pid': rank, 'tid': bid, 'ts': ts,
+                            'args': { 'line': fidx, 'data_0': '%08x' % data_0, 'opCount': '%016x' % op_count,
+                                      'data_1': '%016x' % data_1 } })
+            continue
+        if kind in (KL, CE):
+            end_coll(bid, ts)
+            name, args = collective(names, fidx, data_1)
+            args['opCount'] = op_count
+            if kind == KL:
+                kernel[bid] = ts
+                args['hwId'] = '%08x' % data_0
+            coll[bid] = (ts, name, args)
+        elif kind in (KE, ABORT):
+            end_coll(bid, ts)
+            if bid in kernel:
+                start = kernel.pop(bid)
+                events.append({ 'name': 'Kernel', 'ph': 'X', 'pid': rank, 'tid': bid, 'ts': start, 'dur': ts - start })
+            if kind == ABORT:
+                events.append({ 'name': 'Abort', 'ph': 'i', 's': 't', 'pid': rank, 'tid': bid, 'ts': ts })
+    for bid in sorted(blocks):
+        events.append({ 'name': 'thread_name', 'ph': 'M', 'pid': rank, 'tid': bid, 'args': { 'name': 'Block %d' % bid } })
+    return events
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert RCCL binary collective trace files to Chrome trace JSON')
+    parser.add_argument('traces', nargs='+', help='RCCL_KERNEL_COLL_TRACE_FILE files, one per rank')
+    parser.add_argument('-o', '--output', default=None, help='JSON file (default: stdout)')
+    args = parser.parse_args()
+
+    traces = [read_trace(path) for path in args.traces]
+    # Timestamps are relative to the first record of all ranks
+    t0 = min([r[4] for _, _, records in traces for r in records] or [0])
+    events = []
+    for path, (info, names, records) in zip(args.traces, traces):
+        if info['lost']:
+            sys.stderr.write('%s : rank %d lost %d records\n' % (path, info['rank'], info['lost']))
+        events += convert(info, names, records, t0)
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    json.dump({ 'traceEvents': events, 'displayTimeUnit': 'ns' }, out)
+    out.write('\n')
+    if out is not sys.stdout:
+        out.close()
+
+if __name__ == '__main__':
+    main()
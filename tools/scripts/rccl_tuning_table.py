@@ -0,0 +1,142 @@
+#!/usr/bin/python3
+
+# Generate an NCCL_TUNING_FILE tuning table from rccl-tests logs.
+#
+# Each log is one rccl-tests run, e.g.
+#   NCCL_DEBUG=INFO NCCL_DEBUG_SUBSYS=ENV NCCL_ALGO=Ring NCCL_PROTO=Simple \
+#     mpirun ... all_reduce_perf -b 64 -e 128M -f 2 -g 8 > all_reduce_ring_simple.log
+# The collective, algorithm, protocol, number of nodes and ranks per node are taken
+# from the log (file name, NCCL_ALGO/NCCL_PROTO INFO lines and rank lines), and can be
+# forced with the command line options.
+#
+# For each log2 size bucket, the latency and bandwidth are fitted on the measured
+# times of that bucket and of the next one, so that the model matches the measures.
+# Buckets where the time barely grows take the bandwidth of the next bucket.
+
+import argparse
+import os
+import re
+import sys
+
+colls = { 'broadcast': 'Broadcast', 'reduce': 'Reduce', 'all_gather': 'AllGather',
+          'reduce_scatter': 'ReduceScatter', 'all_reduce': 'AllReduce' }
+algos = [ 'Tree', 'Ring', 'CollNet' ]
+protos = [ 'LL', 'LL128', 'Simple' ]
+NBUCKETS = 27
+
+def bucket(size):
+    return min(max((size >> 6).bit_length() - 1, 0), NBUCKETS - 1)
+
+def find_name(name, names):
+    for n in names:
+        if n.lower() == name.lower():
+            return n
+    return None
+
+def find_coll(text):
+    # Longest names first, so that all_reduce is not taken for reduce
+    for key in sorted(colls, key=len, reverse=True):
+        if key in text:
+            return colls[key]
+    return None
+
+def parse_log(path, args):
+    coll = find_name(args.coll, colls.values()) if args.coll else None
+    algo = find_name(args.algo, algos) if args.algo else None
+    proto = find_name(args.proto, protos) if args.proto else None
+    hosts = {}
+    times = {}
+    with open(path) as f:
+        for line in f:
+            m = re.search(r'NCCL_ALGO set by environment to (\w+)', line)
+            if m and algo is None:
+                algo = find_name(m.group(1), algos)
+            m = re.search(r'NCCL_PROTO set by environment to (\w+)', line)
+            if m and proto is None:
+                proto = find_name(m.group(1), protos)
+            m = re.search(r'Collective test starting: (\w+)', line)
+            if m and coll is None:
+                coll = find_coll(m.group(1))
+            m = re.match(r'#\s+Rank\s+(\d+).*\son\s+(\S+)\s+device', line)
+            if m:
+                hosts[int(m.group(1))] = m.group(2)
+                continue
+            fields = line.split()
+            if len(fields) < 10 or line.startswith('#') or not fields[0].isdigit():
+                continue
+            # size count type redop [root] time algbw busbw #wrong time algbw busbw #wrong
+            try:
+                size = int(fields[0])
+                t = min(float(fields[-8]), float(fields[-4]))
+            except ValueError:
+                continue
+            if size > 0 and t > 0:
+                times[size] = min(t, times.get(size, t))
+    if coll is None:
+        coll = find_coll(os.path.basename(path))
+    nodes = args.nnodes if args.nnodes else max(len(set(hosts.values())), 1)
+    ppn = args.ppn if args.ppn else max(len(hosts), 1) // nodes
+    if coll is None or algo is None or proto is None:
+        sys.exit('%s : could not find the collective, algorithm or protocol, use --coll/--algo/--proto' % path)
+    return (coll, algo, proto, nodes, ppn), times
+
+def fit(times):
+    # Keep the largest size of each bucket, the one closest to the next bucket
+    points = {}
+    for size in sorted(times):
+        points[bucket(size)] = (size, times[size])
+    buckets = sorted(points)
+    entries = []
+    bw = 0.0
+    # From large to small sizes, so that buckets where the time does not grow
+    # significantly, i.e. latency bound ones, use the bandwidth of the next bucket
+    for i in reversed(range(len(buckets))):
+        s0, t0 = points[buckets[i]]
+        j = i + 1 if i + 1 < len(buckets) else i - 1
+        if j >= 0:
+            s1, t1 = points[buckets[j]]
+            # Line through both points : t = lat + size / (1000 * bw)
+            if abs(t1 - t0) > 0.01 * min(t0, t1) and (t1 - t0) * (s1 - s0) > 0:
+                bw = (s1 - s0) / (1000.0 * (t1 - t0))
+        if bw <= 0:
+            bw = s0 / (1000.0 * t0)
+        lat = t0 - s0 / (1000.0 * bw)
+        if lat < 0:
+            lat = 0.0
+            bw = s0 / (1000.0 * t0)
+        entries.append((s0, lat, bw))
+    return list(reversed(entries))
+
+def main():
+    parser = argparse.ArgumentParser(description='Generate an NCCL_TUNING_FILE tuning table from rccl-tests logs')
+    parser.add_argument('logs', nargs='+', help='rccl-tests output files')
+    parser.add_argument('-o', '--output', default=None, help='tuning table file (default: stdout)')
+    parser.add_argument('--coll', default=None, help='collective, e.g. AllReduce')
+    parser.add_argument('--algo', default=None, help='algorithm: Tree, Ring or CollNet')
+    parser.add_argument('--proto', default=None, help='protocol: LL, LL128 or Simple')
+    parser.add_argument('--nnodes', type=int, default=0, help='number of nodes, or 0 to count hosts in the logs')
+    parser.add_argument('--ppn', type=int, default=0, help='ranks per node, or 0 to count ranks in the logs')
+    parser.add_argument('--any', action='store_true', help="write '*' for nNodes and ppn, matching any communicator")
+    args = parser.parse_args()
+
+    runs = {}
+    for path in args.logs:
+        key, times = parse_log(path, args)
+        merged = runs.setdefault(key, {})
+        for size, t in times.items():
+            merged[size] = min(t, merged.get(size, t))
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    out.write('# RCCL tuning table, generated by rccl_tuning_table.py from %s\n' % ' '.join(os.path.basename(l) for l in args.logs))
+    out.write('# %-13s %-7s %-6s %6s %4s %10s %10s %10s\n' % ('coll', 'algo', 'proto', 'nNodes', 'ppn', 'bytes', 'lat(us)', 'bw(GB/s)'))
+    for key in sorted(runs):
+        coll, algo, proto, nodes, ppn = key
+        if args.any:
+            nodes, ppn = '*', '*'
+        for size, lat, bw in fit(runs[key]):
+            out.write('%-15s %-7s %-6s %6s %4s %10d %10.3f %10.4f\n' % (coll, algo, proto, nodes, ppn, size, lat, bw))
+    if out is not sys.stdout:
+        out.close()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,145 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Test of ShmObject::Open with forked processes (no GPU needed).
+//
+// Each process opens the same ShmObject as one rank, writes its rank into the shared
+// memory, waits for the others and checks what they wrote. The shared memory and the
+// rendezvous objects must be gone from /dev/shm afterwards. Variants start the root
+// last, and make the root fail by creating the shared memory beforehand, in which
+// case all ranks must fail without hanging.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "ShmObject.h"
+#include "CpuBarrier.h"
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+    return std::find(begin, end, option) != end;
+}
+
+static double wallTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static bool shmExists(std::string const& name) {
+  struct stat fileStatus;
+  return stat(("/dev/shm/" + name).c_str(), &fileStatus) == 0;
+}
+
+// Returns the exit code of the process: 0 on success, 1 if Open failed, 2 on wrong data
+static int runRank(std::string const& name, int rank, int nRanks, int rootDelay) {
+  if (rank == 0 && rootDelay) usleep(rootDelay);
+  // One entry per rank, then a barrier counter
+  ShmObject<int32_t> object((nRanks+1)*sizeof(int32_t), name, rank, nRanks, 0);
+  if (object.Open() != ncclSuccess) return 1;
+  int32_t* data = object.Get();
+  data[rank] = rank+1;
+  cpuBarrierArrive(&data[nRanks], nRanks, NULL);
+  // Ranks which did not get the same memory never see the others
+  if (!cpuBarrierWait(&data[nRanks], nRanks, 1000, 10000000)) {
+    printf("Rank %d : timed out waiting for the other ranks\n", rank);
+    object.Close();
+    return 2;
+  }
+  int errors = 0;
+  for (int r = 0; r < nRanks; r++) {
+    if (data[r] != r+1) {
+      printf("Rank %d : entry %d is %d instead of %d\n", rank, r, data[r], r+1);
+      errors++;
+    }
+  }
+  object.Close();
+  return errors ? 2 : 0;
+}
+
+// Forks nRanks processes opening the same object, returns the number of ranks which failed
+static int runTest(std::string const& name, int nRanks, int rootDelay, int* badData, double* elapsed) {
+  double start = wallTime();
+  std::vector<pid_t> pids;
+  for (int r = 0; r < nRanks; r++) {
+    pid_t pid = fork();
+    if (pid == 0) _exit(runRank(name, r, nRanks, rootDelay));
+    if (pid < 0) {
+      perror("fork");
+      break;
+    }
+    pids.push_back(pid);
+  }
+  int failed = nRanks - pids.size();
+  *badData = 0;
+  for (pid_t pid : pids) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) == 1) failed++;
+    else if (WEXITSTATUS(status) == 2) (*badData)++;
+  }
+  *elapsed = wallTime() - start;
+  return failed;
+}
+
+int main(int argc, char* argv[]) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("Usage: ./shm_rendezvous_test [-n max_ranks] [-i iters]\n");
+    return 0;
+  }
+  int maxRanks = 32, iters = 5;
+  char* opt;
+  if ((opt = getCmdOption(argv, argv + argc, "-n"))) maxRanks = std::max(atoi(opt), 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-i"))) iters = std::max(atoi(opt), 1);
+
+  int errors = 0;
+  std::string prefix = "RcclRdvTest" + std::to_string(getpid()) + "_";
+  printf("%8s %10s %8s %12s %s\n", "ranks", "variant", "failed", "time(ms)", "result");
+  for (int nRanks = 1; nRanks <= maxRanks; nRanks *= 2) {
+    for (int variant = 0; variant < 3; variant++) {
+      const char* variantStr[] = { "normal", "lateroot", "rootfail" };
+      for (int i = 0; i < iters; i++) {
+        std::string name = prefix + std::to_string(nRanks) + "_" + std::to_string(variant) + "_" + std::to_string(i);
+        int fd = -1;
+        if (variant == 2) {
+          // Existing shared memory makes the exclusive creation of the root fail
+          fd = shm_open(name.c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+          if (fd != -1) close(fd);
+        }
+        int badData;
+        double elapsed;
+        int failed = runTest(name, nRanks, variant == 1 ? 20000 : 0, &badData, &elapsed);
+        if (variant == 2) shm_unlink(name.c_str());
+
+        bool pass = (variant == 2 ? failed == nRanks : failed == 0) && badData == 0;
+        if (shmExists(name) || shmExists(name + "Rdv")) {
+          printf("%s left in /dev/shm\n", name.c_str());
+          ShmRendezvousUnlink(name);
+          pass = false;
+        }
+        if (!pass) errors++;
+        if (i == iters-1 || !pass) {
+          printf("%8d %10s %8d %12.2f %s\n", nRanks, variantStr[variant], failed, 1e3*elapsed, pass ? "OK" : "FAILED");
+        }
+      }
+    }
+  }
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
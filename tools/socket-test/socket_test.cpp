@@ -0,0 +1,263 @@
+/*************************************************************************
+ * Copyright (c) 2021 Advanced Micro Devices, Inc. All rights reserved.
+ *
+ * See LICENSE.txt for license information
+ ************************************************************************/
+
+// Loopback benchmark for the NET/Socket transport (ncclNetSocket).
+//
+// Both ends of two connections (forward and backward) live in this process:
+// latency is measured with a ping-pong over the pair, bandwidth by streaming
+// a window of requests over the forward connection. CPU time is taken from
+// getrusage() and therefore includes the NET/Socket helper threads.
+//
+// With -d, only the time from isend to send completion is measured, which for
+// small messages mostly tells how fast tasks are handed to the helper threads.
+//
+// With -p, the first data socket of the forward connection is paced down to
+// the given rate with SO_MAX_PACING_RATE, to see how striping copes with an
+// uneven set of sockets without tc/netem.
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <string>
+// Built into the test so that the data sockets of a comm can be reached
+#include "../../src/transport/net_socket.cc"
+
+#define MAX_WINDOW NCCL_NET_MAX_REQUESTS
+
+#ifndef SO_MAX_PACING_RATE
+#define SO_MAX_PACING_RATE 47
+#endif
+
+char* getCmdOption(char ** begin, char ** end, const std::string & option) {
+    char ** itr = std::find(begin, end, option);
+    if (itr != end && ++itr != end)
+    {
+        return *itr;
+    }
+    return 0;
+}
+
+bool cmdOptionExists(char** begin, char** end, const std::string& option) {
+    return std::find(begin, end, option) != end;
+}
+
+static double wallTime() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+static double cpuTime() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec*1e-6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec*1e-6;
+}
+
+struct socketPair {
+  void* sendComm;
+  void* recvComm;
+};
+
+// Connect a pair; when pacingRate is set, throttle the first data socket of
+// the send side to that many bytes per second.
+static ncclResult_t connectPair(int dev, struct socketPair* pair, uint32_t pacingRate) {
+  char handle[NCCL_NET_HANDLE_MAXSIZE];
+  void* listenComm;
+  NCCLCHECK(ncclNetSocket.listen(dev, handle, &listenComm));
+  // Connections complete in the kernel backlog, so we can connect before accepting.
+  NCCLCHECK(ncclNetSocket.connect(dev, handle, &pair->sendComm));
+  if (pacingRate) {
+    struct ncclSocketComm* comm = (struct ncclSocketComm*)pair->sendComm;
+    if (comm->nSocks <= 0) {
+      printf("Pacing needs helper threads, ignoring -p\n");
+    } else {
+      SYSCHECK(setsockopt(comm->fds[0], SOL_SOCKET, SO_MAX_PACING_RATE, &pacingRate, sizeof(pacingRate)), "setsockopt");
+    }
+  }
+  NCCLCHECK(ncclNetSocket.accept(listenComm, &pair->recvComm));
+  NCCLCHECK(ncclNetSocket.closeListen(listenComm));
+  return ncclSuccess;
+}
+
+static ncclResult_t closePair(struct socketPair* pair) {
+  NCCLCHECK(ncclNetSocket.closeSend(pair->sendComm));
+  NCCLCHECK(ncclNetSocket.closeRecv(pair->recvComm));
+  return ncclSuccess;
+}
+
+// Send and receive one message over the pair, polling both ends until done.
+static ncclResult_t transfer(struct socketPair* pair, char* sendBuff, char* recvBuff, int size) {
+  void* sendReq, *recvReq;
+  NCCLCHECK(ncclNetSocket.isend(pair->sendComm, sendBuff, size, NULL, &sendReq));
+  NCCLCHECK(ncclNetSocket.irecv(pair->recvComm, recvBuff, size, NULL, &recvReq));
+  int sendDone = 0, recvDone = 0;
+  while (!sendDone || !recvDone) {
+    if (!sendDone) NCCLCHECK(ncclNetSocket.test(sendReq, &sendDone, NULL));
+    if (!recvDone) NCCLCHECK(ncclNetSocket.test(recvReq, &recvDone, NULL));
+  }
+  return ncclSuccess;
+}
+
+static ncclResult_t measureLatency(struct socketPair* fwd, struct socketPair* bwd, char* sendBuff, char* recvBuff, int size, int iters, double* usec) {
+  NCCLCHECK(transfer(fwd, sendBuff, recvBuff, size));
+  NCCLCHECK(transfer(bwd, sendBuff, recvBuff, size));
+  double start = wallTime();
+  for (int i=0; i<iters; i++) {
+    NCCLCHECK(transfer(fwd, sendBuff, recvBuff, size));
+    NCCLCHECK(transfer(bwd, sendBuff, recvBuff, size));
+  }
+  *usec = (wallTime()-start)*1e6/(2*iters);
+  return ncclSuccess;
+}
+
+// Average time from isend until test reports the send done. The receive is
+// posted first and progressed in the same loop: with zerocopy, the send only
+// completes once the receiver has read the data.
+static ncclResult_t measureDispatch(struct socketPair* pair, char* sendBuff, char* recvBuff, int size, int iters, double* usec) {
+  double total = 0;
+  for (int i=-1; i<iters; i++) {
+    void* sendReq, *recvReq;
+    int sendDone = 0, recvDone = 0;
+    NCCLCHECK(ncclNetSocket.irecv(pair->recvComm, recvBuff, size, NULL, &recvReq));
+    double start = wallTime();
+    NCCLCHECK(ncclNetSocket.isend(pair->sendComm, sendBuff, size, NULL, &sendReq));
+    while (!sendDone || !recvDone) {
+      if (!sendDone) {
+        NCCLCHECK(ncclNetSocket.test(sendReq, &sendDone, NULL));
+        if (sendDone && i >= 0) total += wallTime()-start;
+      }
+      if (!recvDone) NCCLCHECK(ncclNetSocket.test(recvReq, &recvDone, NULL));
+    }
+  }
+  *usec = total*1e6/iters;
+  return ncclSuccess;
+}
+
+// Stream iters messages with up to window requests in flight.
+static ncclResult_t measureBandwidth(struct socketPair* pair, char* sendBuff, char* recvBuff, int size, int iters, int window,
+    double* gbps, double* cpuPerGB) {
+  void* sendReqs[MAX_WINDOW];
+  void* recvReqs[MAX_WINDOW];
+  int posted = 0, sent = 0, received = 0;
+  double start = wallTime();
+  double cpuStart = cpuTime();
+  while (received < iters || sent < iters) {
+    while (posted < iters && posted-std::min(sent, received) < window) {
+      int slot = posted%window;
+      NCCLCHECK(ncclNetSocket.isend(pair->sendComm, sendBuff+(size_t)slot*size, size, NULL, sendReqs+slot));
+      NCCLCHECK(ncclNetSocket.irecv(pair->recvComm, recvBuff+(size_t)slot*size, size, NULL, recvReqs+slot));
+      posted++;
+    }
+    // Progress both ends independently: with zerocopy, send completion
+    // depends on the receiver draining the socket.
+    int done;
+    if (sent < posted) {
+      NCCLCHECK(ncclNetSocket.test(sendReqs[sent%window], &done, NULL));
+      if (done) sent++;
+    }
+    if (received < posted) {
+      int rsize;
+      NCCLCHECK(ncclNetSocket.test(recvReqs[received%window], &done, &rsize));
+      if (done) {
+        if (rsize != size) {
+          WARN("Received %d bytes instead of %d", rsize, size);
+          return ncclInternalError;
+        }
+        received++;
+      }
+    }
+  }
+  double seconds = wallTime()-start;
+  double bytes = (double)size*iters;
+  *gbps = bytes/seconds/1e9;
+  *cpuPerGB = (cpuTime()-cpuStart)/(bytes/1e9);
+  return ncclSuccess;
+}
+
+static int checkData(char* sendBuff, char* recvBuff, size_t bytes) {
+  for (size_t i=0; i<bytes; i++) {
+    if (sendBuff[i] != recvBuff[i]) {
+      printf("Data mismatch at byte %lu\n", i);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  if (cmdOptionExists(argv, argv + argc, "-h")) {
+    printf("Usage: ./socket_test [-b min_bytes] [-e max_bytes] [-i iters] [-w window] [-t nthreads] [-s nsocks_per_thread] [-z zerocopy] [-p pacing_MBps] [-a adaptive_striping] [-c calibrate] [-d]\n");
+    printf("  Set NCCL_SOCKET_IFNAME=lo to use the loopback interface.\n");
+    exit(0);
+  }
+  size_t minBytes = 8, maxBytes = 64<<20;
+  int iters = 100, window = MAX_WINDOW;
+  char* opt;
+  if ((opt = getCmdOption(argv, argv + argc, "-b"))) minBytes = strtoull(opt, NULL, 0);
+  if ((opt = getCmdOption(argv, argv + argc, "-e"))) maxBytes = strtoull(opt, NULL, 0);
+  if ((opt = getCmdOption(argv, argv + argc, "-i"))) iters = atoi(opt);
+  if ((opt = getCmdOption(argv, argv + argc, "-w"))) window = std::min(std::max(atoi(opt), 1), MAX_WINDOW);
+  // The transport reads its configuration from the environment
+  if ((opt = getCmdOption(argv, argv + argc, "-t"))) setenv("NCCL_SOCKET_NTHREADS", opt, 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-s"))) setenv("NCCL_NSOCKS_PERTHREAD", opt, 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-z"))) setenv("NCCL_SOCKET_ZEROCOPY", opt, 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-a"))) setenv("NCCL_SOCKET_ADAPTIVE_STRIPING", opt, 1);
+  if ((opt = getCmdOption(argv, argv + argc, "-c"))) setenv("NCCL_SOCKET_CALIBRATE", opt, 1);
+  uint32_t pacingRate = 0;
+  if ((opt = getCmdOption(argv, argv + argc, "-p"))) pacingRate = atoi(opt)*1000000U;
+
+  int ndev;
+  NCCLCHECK(ncclNetSocket.init(ncclDebugLog));
+  NCCLCHECK(ncclNetSocket.devices(&ndev));
+  if (ndev <= 0) {
+    printf("No socket device found\n");
+    return 1;
+  }
+  ncclNetProperties_t props;
+  NCCLCHECK(ncclNetSocket.getProperties(0, &props));
+  printf("Using device %s, %d iterations, window %d\n", props.name, iters, window);
+
+  struct socketPair fwd, bwd;
+  NCCLCHECK(connectPair(0, &fwd, pacingRate));
+  NCCLCHECK(connectPair(0, &bwd, 0));
+
+  char* sendBuff, *recvBuff;
+  NCCLCHECK(ncclCalloc(&sendBuff, maxBytes*window));
+  NCCLCHECK(ncclCalloc(&recvBuff, maxBytes*window));
+  for (size_t i=0; i<maxBytes*window; i++) sendBuff[i] = (char)(i*7+3);
+
+  int errors = 0;
+  if (cmdOptionExists(argv, argv + argc, "-d")) {
+    printf("%12s %12s\n", "size(B)", "dispatch(us)");
+    for (size_t size=minBytes; size<=maxBytes; size*=2) {
+      double usec;
+      NCCLCHECK(measureDispatch(&fwd, sendBuff, recvBuff, size, iters, &usec));
+      errors += checkData(sendBuff, recvBuff, size);
+      printf("%12lu %12.2f\n", size, usec);
+    }
+  } else {
+    printf("%12s %12s %12s %12s\n", "size(B)", "lat(us)", "bw(GB/s)", "cpu(s/GB)");
+    for (size_t size=minBytes; size<=maxBytes; size*=2) {
+      double usec, gbps, cpuPerGB;
+      NCCLCHECK(measureLatency(&fwd, &bwd, sendBuff, recvBuff, size, iters, &usec));
+      memset(recvBuff, 0, size*window);
+      NCCLCHECK(measureBandwidth(&fwd, sendBuff, recvBuff, size, iters, window, &gbps, &cpuPerGB));
+      errors += checkData(sendBuff, recvBuff, size*std::min(window, iters));
+      printf("%12lu %12.2f %12.3f %12.3f\n", size, usec, gbps, cpuPerGB);
+    }
+  }
+
+  NCCLCHECK(closePair(&fwd));
+  NCCLCHECK(closePair(&bwd));
+  free(sendBuff);
+  free(recvBuff);
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
@@ -40,12 +40,17 @@ THE SOFTWARE.
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
 #include <cstdio>
 #include <iostream>
 #include <cstring>
 #include "model.h"
 #include "utils.h"
 #include "topo.h"
+#include "rome_models.h"
+#include "xml.h"
 
 NodeModel *node_model;
 
@@ -144,51 +149,105 @@ NodeModelDesc model_descs[] = {
   {4, "topo_8p1h_1.xml",        "4 nodes 8P1H Alt."},
 };
 
-int main(int argc,char* argv[])
-{
-  struct ncclComm *comm;
-  const int num_models = sizeof(model_descs) / sizeof(*model_descs);
+static double timeUsec() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e6 + ts.tv_nsec*1e-3;
+}
 
-  if (!cmdOptionExists(argv, argv + argc, "-m")) {
-    printf("Usage: ./topo_expl -m model_id\n");
-    printf("List of model_id:\n");
-    for (int i = 0; i < num_models; i++)
-      printf("  %d: %s\n", i, model_descs[i].description);
-    exit(0);
-  }
+static uint64_t hashGraph(uint64_t hash, struct ncclTopoGraph* graph, int ngpus) {
+  int values[] = { graph->pattern, graph->crossNic, graph->nChannels, graph->typeIntra, graph->typeInter, graph->sameChannels };
+  float speeds[] = { graph->speedIntra, graph->speedInter };
+  const unsigned char* bytes[] = { (const unsigned char*)values, (const unsigned char*)speeds,
+    (const unsigned char*)graph->intra, (const unsigned char*)graph->inter };
+  size_t sizes[] = { sizeof(values), sizeof(speeds), graph->nChannels*ngpus*sizeof(int), graph->nChannels*2*sizeof(int) };
+  for (int i=0; i<4; i++)
+    for (size_t b=0; b<sizes[i]; b++) hash = ((hash << 5) + hash) ^ bytes[i][b];
+  return hash;
+}
 
-  int model_id = 0;
-  char *mi = getCmdOption(argv, argv + argc, "-m");
-  if (mi)
-    model_id = atol(mi);
+// Paths of the ranks of a model, filled by checkRankPaths when set
+struct pathStats {
+  int ranks;
+  int mismatches;
+  uint64_t paths;
+  uint64_t hops;
+  double fullUsec;
+};
+static struct pathStats* rankPathStats = NULL;
 
-  if (model_id >= num_models) {
-      printf("Invalid model_id %d\n", model_id);
-      exit(0);
+static uint64_t hashPaths(struct ncclTopoSystem* system, uint64_t* nPaths, uint64_t* nHops) {
+  uint64_t hash = 5381;
+  *nPaths = *nHops = 0;
+  for (int t=0; t<NCCL_TOPO_NODE_TYPES; t++) {
+    for (int n=0; n<system->nodes[t].count; n++) {
+      struct ncclTopoNode* node = system->nodes[t].nodes+n;
+      for (int p=0; p<NCCL_TOPO_NODE_TYPES; p++) {
+        hash = ((hash << 5) + hash) ^ (node->paths[p] != NULL);
+        if (node->paths[p] == NULL) continue;
+        for (int i=0; i<system->nodes[p].count; i++) {
+          struct ncclTopoLinkList* path = node->paths[p]+i;
+          uint64_t values[] = { (uint64_t)path->count, (uint64_t)path->type, (uint64_t)(path->width*1000) };
+          for (int v=0; v<3; v++) hash = ((hash << 5) + hash) ^ values[v];
+          // Links do not move, so the hops can be compared by address
+          for (int h=0; h<path->count; h++) hash = ((hash << 5) + hash) ^ (uint64_t)path->list[h];
+          *nHops += path->count;
+        }
+        *nPaths += system->nodes[p].count;
+      }
+    }
   }
+  return hash;
+}
 
+// Check that the paths kept up to date while trimming the system are the ones
+// a full recomputation gives
+static ncclResult_t checkRankPaths(struct ncclComm* comm, struct pathStats* stats) {
+  struct ncclTopoSystem* system = comm->topo;
+  uint64_t paths, hops;
+  uint64_t hash = hashPaths(system, &paths, &hops);
+  // Paths were computed before the search, which may have set netGdrLevel from a Rome model
+  int netGdrLevel = system->netGdrLevel;
+  system->netGdrLevel = -2;
+  system->pathsValid = 0;
+  double start = timeUsec();
+  NCCLCHECK(ncclTopoComputePaths(system, comm->peerInfo));
+  stats->fullUsec += timeUsec() - start;
+  system->netGdrLevel = netGdrLevel;
+  if (hashPaths(system, &paths, &hops) != hash) stats->mismatches++;
+  stats->paths += paths;
+  stats->hops += hops;
+  stats->ranks++;
+  return ncclSuccess;
+}
+
+// Build the communicators of a model. When verbose is not set, only compute
+// the graphs and return the time it took and a hash of the graphs.
+static ncclResult_t runModel(int model_id, bool verbose, double* initUsec, uint64_t* graphsHash) {
+  struct ncclComm *comm;
   NetworkModel network;
   NodeModel* node;
-
-  initCollNet();
+  std::vector<NodeModel*> nodes;
 
   NodeModelDesc *desc = &model_descs[model_id];
   for (int i=0; i<desc->num_nodes; i++) {
       node = new NodeModel(desc->filename);
       network.AddNode(node);
+      nodes.push_back(node);
   }
 
-  printf("Generating topology using %d: %s\n", model_id, desc->description);
-
   int nranks = network.GetNRanks();
   int nnodes = network.GetNNodes();
 
-  printf("nnodes = %d, nranks = %d\n", nnodes, nranks);
-  for (int i = 0; i < nranks; i++) {
-    node_model = network.GetNode(i);
-    assert(node_model!=0);
-    printf("Rank %d: node %d cudaDev %d GPU busId %lx\n", i, node_model->nodeId,
-      node_model->rankToCudaDev(i), node_model->getGpuBusId(i));
+  if (verbose) {
+    printf("Generating topology using %d: %s\n", model_id, desc->description);
+    printf("nnodes = %d, nranks = %d\n", nnodes, nranks);
+    for (int i = 0; i < nranks; i++) {
+      node_model = network.GetNode(i);
+      assert(node_model!=0);
+      printf("Rank %d: node %d cudaDev %d GPU busId %lx\n", i, node_model->nodeId,
+        node_model->rankToCudaDev(i), node_model->getGpuBusId(i));
+    }
   }
 
   NCCLCHECK(ncclCalloc(&comm, nranks));
@@ -221,16 +280,34 @@ int main(int argc,char* argv[])
   NCCLCHECK(ncclCalloc(&treeGraph, nranks));
   NCCLCHECK(ncclCalloc(&ringGraph, nranks));
   NCCLCHECK(ncclCalloc(&collNetGraph, nranks));
+  double start = timeUsec();
   for (int i = 0; i < nranks; i++) {
     node_model = network.GetNode(i);
     assert(node_model!=0);
     initTransportsRank_1(&comm[i], allGather1Data, allGather3Data, treeGraph[i], ringGraph[i], collNetGraph[i]);
   }
+  if (initUsec) *initUsec = timeUsec() - start;
 
-  for (int i = 0; i < nranks; i++) {
-    node_model = network.GetNode(i);
-    assert(node_model!=0);
-    initTransportsRank_3(&comm[i], allGather3Data, treeGraph[i], ringGraph[i], collNetGraph[i]);
+  if (rankPathStats) {
+    for (int i = 0; i < nranks; i++) NCCLCHECK(checkRankPaths(&comm[i], rankPathStats));
+  }
+
+  if (graphsHash) {
+    *graphsHash = 5381;
+    for (int i = 0; i < nranks; i++) {
+      int ngpus = comm[i].topo->nodes[GPU].count;
+      *graphsHash = hashGraph(*graphsHash, ringGraph+i, ngpus);
+      *graphsHash = hashGraph(*graphsHash, treeGraph+i, ngpus);
+      *graphsHash = hashGraph(*graphsHash, collNetGraph+i, ngpus);
+    }
+  }
+
+  if (verbose) {
+    for (int i = 0; i < nranks; i++) {
+      node_model = network.GetNode(i);
+      assert(node_model!=0);
+      initTransportsRank_3(&comm[i], allGather3Data, treeGraph[i], ringGraph[i], collNetGraph[i]);
+    }
   }
 
   for (int i = 0; i < nranks; i++) {
@@ -238,6 +315,13 @@ int main(int argc,char* argv[])
     free(comm[i].connectRecv);
     free(comm[i].p2pSends);
     free(comm[i].p2pRecvs);
+    free(comm[i].peerInfo);
+    free(comm[i].rankToIntraNodeRank);
+  }
+  // Release the models, as -t builds them all in the same process
+  for (auto n : nodes) {
+    for (auto system : n->systems) ncclTopoFree(system);
+    delete n;
   }
 
   free(treeGraph);
@@ -247,7 +331,883 @@ int main(int argc,char* argv[])
   free(allGather1Data);
 
   free(comm);
-  printf("Done generating topology using %d: %s\n", model_id, desc->description);
+  node_model = NULL;
+  if (verbose) printf("Done generating topology using %d: %s\n", model_id, desc->description);
+  return ncclSuccess;
+}
+
+static void removeCacheDir(const char* dir) {
+  DIR* d = opendir(dir);
+  if (d == NULL) return;
+  struct dirent* entry;
+  char path[PATH_MAX];
+  while ((entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] == '.') continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    unlink(path);
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+// Time the graph search of each model with an empty, then a filled graph cache
+// Run each model twice, calling setup (if any) before each run, and compare
+// the time, graph search steps and graphs of both runs
+static ncclResult_t compareRuns(int first, int last, const char* label0, const char* label1, void (*setup)(int run, const char* arg), const char* arg, bool mustMatch) {
+  printf("%8s %12s %12s %8s %12s %12s %6s  %s\n", "model_id", label0, label1, "speedup", "steps0", "steps1", "match", "description");
+  double total0 = 0, total1 = 0;
+  uint64_t totalSteps0 = 0, totalSteps1 = 0;
+  int mismatches = 0;
+  for (int m = first; m <= last; m++) {
+    double time0, time1;
+    uint64_t hash0, hash1, start, steps0, steps1;
+    if (setup) setup(0, arg);
+    NCCLCHECK(ncclTopoGetSearchSteps(&start));
+    NCCLCHECK(runModel(m, false, &time0, &hash0));
+    NCCLCHECK(ncclTopoGetSearchSteps(&steps0));
+    steps0 -= start;
+    if (setup) setup(1, arg);
+    NCCLCHECK(ncclTopoGetSearchSteps(&start));
+    NCCLCHECK(runModel(m, false, &time1, &hash1));
+    NCCLCHECK(ncclTopoGetSearchSteps(&steps1));
+    steps1 -= start;
+    total0 += time0;
+    total1 += time1;
+    totalSteps0 += steps0;
+    totalSteps1 += steps1;
+    if (hash0 != hash1) mismatches++;
+    printf("%8d %12.3f %12.3f %7.1fx %12lu %12lu %6s  %s\n", m, time0*1e-3, time1*1e-3, time0/time1,
+        steps0, steps1, hash0 == hash1 ? "yes" : "NO", model_descs[m].description);
+  }
+  printf("%8s %12.3f %12.3f %7.1fx %12lu %12lu\n", "total", total0*1e-3, total1*1e-3, total0/total1, totalSteps0, totalSteps1);
+  if (mismatches) printf("%d models with different graphs\n", mismatches);
+  return mismatches && mustMatch ? ncclInternalError : ncclSuccess;
+}
+
+static ncclResult_t timeGraphCache(int first, int last) {
+  char dir[] = "/tmp/topo_expl_cache_XXXXXX";
+  if (mkdtemp(dir) == NULL) {
+    printf("Could not create a graph cache directory\n");
+    return ncclSystemError;
+  }
+  setenv("NCCL_GRAPH_CACHE_DIR", dir, 1);
+  // The first run fills the cache, the second one uses it
+  ncclResult_t res = compareRuns(first, last, "cold(ms)", "warm(ms)", NULL, NULL, true);
+  unsetenv("NCCL_GRAPH_CACHE_DIR");
+  removeCacheDir(dir);
+  return res;
+}
+
+static void setupSearchThreads(int run, const char* nThreads) {
+  setenv("RCCL_TOPO_SEARCH_THREADS", run ? nThreads : "0", 1);
+}
+
+static ncclResult_t timeParallelSearch(int first, int last, const char* nThreads) {
+  // Have RCCL_TOPO_SEARCH_THREADS read again for each run
+  setenv("RCCL_TEST_ENV_VARS", "ENABLE", 1);
+  return compareRuns(first, last, "serial(ms)", "parallel(ms)", setupSearchThreads, nThreads, true);
+}
+
+static void setupSearchPrune(int run, const char* arg) {
+  setenv("RCCL_TOPO_SEARCH_PRUNE", run ? "1" : "0", 1);
+}
+
+// Pruning lets searches go further within their time budget, so graphs may differ
+static ncclResult_t timeSearchPrune(int first, int last) {
+  setenv("RCCL_TEST_ENV_VARS", "ENABLE", 1);
+  return compareRuns(first, last, "full(ms)", "pruned(ms)", setupSearchPrune, NULL, false);
+}
+
+static void setupModelMatching(int run, const char* arg) {
+  setenv("RCCL_MODEL_MATCHING_EXHAUSTIVE", run ? "0" : "1", 1);
+}
+
+// Check that the indexed Rome model matching finds the same model and
+// mappings as the exhaustive one, on shuffled built-in models then on the
+// models of topo_expl
+static ncclResult_t checkModelMatching(int first, int last) {
+  int checks, failures;
+  double exhaustiveMs, indexedMs;
+  NCCLCHECK(romeModelsCheckMatch(4, &checks, &failures, &exhaustiveMs, &indexedMs));
+  printf("Built-in Rome models: %d checks, %d failures, exhaustive %.3f ms, indexed %.3f ms\n",
+      checks, failures, exhaustiveMs, indexedMs);
+  setenv("RCCL_TEST_ENV_VARS", "ENABLE", 1);
+  ncclResult_t res = compareRuns(first, last, "exhaustive(ms)", "indexed(ms)", setupModelMatching, NULL, true);
+  return failures ? ncclInternalError : res;
+}
+
+// Check the paths of each model after trimming against a full recomputation,
+// and report their memory with compact hop lists and with fixed size ones
+static ncclResult_t checkPaths(int first, int last) {
+  printf("%8s %6s %10s %10s %12s %12s %10s %6s  %s\n", "model_id", "ranks", "paths", "hops", "fixed(KB)", "compact(KB)", "full(us)", "match", "description");
+  int mismatches = 0;
+  double totalUsec = 0;
+  for (int m = first; m <= last; m++) {
+    struct pathStats stats;
+    memset(&stats, 0, sizeof(stats));
+    rankPathStats = &stats;
+    ncclResult_t res = runModel(m, false, NULL, NULL);
+    rankPathStats = NULL;
+    if (res != ncclSuccess) return res;
+    size_t fixedBytes = stats.paths*(sizeof(struct ncclTopoLinkList) + NCCL_TOPO_MAX_NODES*NCCL_TOPO_NODE_TYPES*sizeof(struct ncclTopoLink*));
+    size_t compactBytes = stats.paths*sizeof(struct ncclTopoLinkList) + stats.hops*sizeof(struct ncclTopoLink*);
+    if (stats.mismatches) mismatches++;
+    totalUsec += stats.fullUsec;
+    printf("%8d %6d %10lu %10lu %12lu %12lu %10.1f %6s  %s\n", m, stats.ranks, stats.paths, stats.hops,
+        fixedBytes/1024, compactBytes/1024, stats.fullUsec/stats.ranks, stats.mismatches ? "NO" : "yes", model_descs[m].description);
+  }
+  printf("%8s %6s %10s %10s %12s %12s %10.1f\n", "total", "", "", "", "", "", totalUsec);
+  if (mismatches) printf("%d models with different paths\n", mismatches);
+  return mismatches ? ncclInternalError : ncclSuccess;
+}
+
+// Time parsing the XML file of each model, from the file then from memory
+static ncclResult_t timeXmlParse(int first, int last, int iterations) {
+  struct ncclXml* xml;
+  NCCLCHECK(ncclCalloc(&xml, 1));
+  char dir[PATH_MAX];
+  ssize_t count = readlink("/proc/self/exe", dir, PATH_MAX-1);
+  while (count > 0 && dir[count-1] != '/') count--;
+  dir[count] = '\0';
+  printf("%-24s %8s %6s %12s %12s %10s\n", "file", "bytes", "nodes", "file(us)", "memory(us)", "MB/s");
+  double totalFile = 0, totalMemory = 0;
+  for (int m = first; m <= last; m++) {
+    const char* name = model_descs[m].filename;
+    bool seen = false;
+    for (int p = first; p < m; p++) seen |= strcmp(model_descs[p].filename, name) == 0;
+    if (seen) continue;
+    char path[PATH_MAX];
+    FILE* file = NULL;
+    if (snprintf(path, sizeof(path), "%smodels/%s", dir, name) < (int)sizeof(path)) file = fopen(path, "r");
+    if (file == NULL) {
+      printf("Could not open %s\n", path);
+      free(xml);
+      return ncclSystemError;
+    }
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* buffer = (char*)malloc(size);
+    size_t bytes = fread(buffer, 1, size, file);
+    fclose(file);
+    uint64_t hashFile, hashMemory;
+    double start = timeUsec();
+    for (int i = 0; i < iterations; i++) NCCLCHECK(ncclTopoGetXmlFromFile(path, xml, 1));
+    double timeFile = (timeUsec()-start)/iterations;
+    NCCLCHECK(ncclTopoXmlHash(xml->nodes, &hashFile));
+    int nodes = xml->maxIndex;
+    start = timeUsec();
+    for (int i = 0; i < iterations; i++) NCCLCHECK(ncclTopoGetXmlFromBuffer(buffer, bytes, xml));
+    double timeMemory = (timeUsec()-start)/iterations;
+    NCCLCHECK(ncclTopoXmlHash(xml->nodes, &hashMemory));
+    free(buffer);
+    if (hashFile != hashMemory || nodes != xml->maxIndex) {
+      printf("%s : different XML trees from the file and from memory\n", name);
+      free(xml);
+      return ncclInternalError;
+    }
+    totalFile += timeFile;
+    totalMemory += timeMemory;
+    printf("%-24s %8lu %6d %12.2f %12.2f %10.1f\n", name, bytes, nodes, timeFile, timeMemory, bytes/timeFile);
+  }
+  printf("%-24s %8s %6s %12.2f %12.2f\n", "total", "", "", totalFile, totalMemory);
+  free(xml);
+  return ncclSuccess;
+}
+
+static int makeDirs(const char* root, const char* dir) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", root, dir);
+  for (char* p = path+strlen(root)+1; *p; p++) {
+    if (*p != '/') continue;
+    *p = '\0';
+    mkdir(path, 0755);
+    *p = '/';
+  }
+  return mkdir(path, 0755) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+static int writeSysFile(const char* root, const char* dir, const char* name, const char* value) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s/%s", root, dir, name);
+  FILE* file = fopen(path, "w");
+  if (file == NULL) return -1;
+  fprintf(file, "%s\n", value);
+  fclose(file);
+  return 0;
+}
+
+// Fake sysfs with a GPU and a NIC behind two levels of PCI switches
+#define FAKE_SWITCH "devices/pci0000:00/0000:00:01.0"
+#define FAKE_SWITCH2 FAKE_SWITCH "/0000:01:00.0/0000:02:00.0"
+static int makeFakeSys(const char* root) {
+  const char* devs[][3] = {
+    { FAKE_SWITCH "/0000:01:00.0", "0x060400", "0x1000" },
+    { FAKE_SWITCH2 "/0000:03:00.0", "0x038000", "0x66a1" },
+    { FAKE_SWITCH2 "/0000:04:00.0", "0x020700", "0x101b" } };
+  const char* buses[][2] = { { "0000:01", FAKE_SWITCH }, { "0000:03", FAKE_SWITCH2 }, { "0000:04", FAKE_SWITCH2 } };
+  char dir[PATH_MAX], target[PATH_MAX];
+  if (makeDirs(root, "class/pci_bus") || makeDirs(root, "bus/pci") || makeDirs(root, "devices/system/node/node0") ||
+      writeSysFile(root, "devices/system/node/node0", "cpumap", "ffffffff")) return -1;
+  for (auto dev : devs) {
+    if (makeDirs(root, dev[0]) || writeSysFile(root, dev[0], "class", dev[1]) ||
+        writeSysFile(root, dev[0], "vendor", "0x1002") || writeSysFile(root, dev[0], "device", dev[2]) ||
+        writeSysFile(root, dev[0], "max_link_speed", "16.0 GT/s PCIe") || writeSysFile(root, dev[0], "max_link_width", "16") ||
+        writeSysFile(root, dev[0], "numa_node", "0")) return -1;
+    snprintf(dir, sizeof(dir), "%s/%s/subsystem", root, dev[0]);
+    snprintf(target, sizeof(target), "%s/bus/pci", root);
+    if (symlink(target, dir) && errno != EEXIST) return -1;
+  }
+  for (auto bus : buses) {
+    snprintf(dir, sizeof(dir), "%s/pci_bus/%s", bus[1], bus[0]);
+    if (makeDirs(root, dir)) return -1;
+    snprintf(dir, sizeof(dir), "%s/class/pci_bus/%s", root, bus[0]);
+    snprintf(target, sizeof(target), "../../%s/pci_bus/%s", bus[1], bus[0]);
+    if (symlink(target, dir) && errno != EEXIST) return -1;
+  }
+  return 0;
+}
+
+static void removeTree(const char* path) {
+  struct stat st;
+  if (lstat(path, &st) != 0) return;
+  if (S_ISDIR(st.st_mode)) {
+    DIR* d = opendir(path);
+    struct dirent* entry;
+    char sub[PATH_MAX];
+    while (d && (entry = readdir(d)) != NULL) {
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+      snprintf(sub, sizeof(sub), "%s/%s", path, entry->d_name);
+      removeTree(sub);
+    }
+    if (d) closedir(d);
+    rmdir(path);
+  } else {
+    unlink(path);
+  }
+}
+
+// Detect the fake devices as ncclTopoGetSystem does for NICs, return the XML hash
+static ncclResult_t detectFakeSys(const char* root, uint64_t* hash, uint64_t* reads, uint64_t* hits, double* usec) {
+  struct ncclXml* xml;
+  NCCLCHECK(ncclCalloc(&xml, 1));
+  struct ncclXmlNode* top;
+  NCCLCHECK(xmlAddNode(xml, NULL, "system", &top));
+  NCCLCHECK(xmlSetAttrInt(top, "version", NCCL_TOPO_XML_VERSION));
+  uint64_t reads0, hits0;
+  NCCLCHECK(ncclTopoSysCacheStats(&reads0, &hits0));
+  double start = timeUsec();
+  const char* devs[][2] = { { FAKE_SWITCH2 "/0000:03:00.0", "fake0" }, { FAKE_SWITCH2 "/0000:04:00.0", "fake1" } };
+  for (auto dev : devs) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", root, dev[0]);
+    struct ncclXmlNode* node;
+    NCCLCHECK(ncclTopoFillNet(xml, path, dev[1], &node));
+  }
+  *usec = timeUsec() - start;
+  NCCLCHECK(ncclTopoSysCacheStats(reads, hits));
+  *reads -= reads0;
+  *hits -= hits0;
+  NCCLCHECK(ncclTopoXmlHash(xml->nodes, hash));
+  free(xml);
+  return ncclSuccess;
+}
+
+// Check the sysfs cache on a fake sysfs tree
+static ncclResult_t checkSysCache() {
+  char root[] = "/tmp/topo_expl_sys_XXXXXX";
+  if (mkdtemp(root) == NULL || makeFakeSys(root)) {
+    printf("Could not create a fake sysfs in %s\n", root);
+    return ncclSystemError;
+  }
+  setenv("RCCL_TOPO_SYS_ROOT", root, 1);
+  setenv("RCCL_TEST_ENV_VARS", "ENABLE", 1);
+  struct {
+    const char* step;
+    const char* cache;
+    const char* timeout;
+    bool changed;     // Whether the XML should differ from the first detection
+    bool cached;      // Whether no sysfs file should be read at all
+  } steps[] = {
+    { "cold", "1", "0", false, false },
+    { "warm", "1", "0", false, true },
+    { "sysfs changed, cached", "1", "0", false, true },
+    { "cache disabled", "0", "0", true, false },
+    { "timeout expired", "1", "1", true, false } };
+  uint64_t hash0 = 0;
+  int failures = 0;
+  printf("%-24s %8s %8s %10s %6s\n", "step", "reads", "cached", "time(us)", "ok");
+  for (int i = 0; i < (int)(sizeof(steps)/sizeof(steps[0])); i++) {
+    setenv("RCCL_TOPO_SYS_CACHE", steps[i].cache, 1);
+    setenv("RCCL_TOPO_SYS_CACHE_TIMEOUT", steps[i].timeout, 1);
+    if (i == 2) writeSysFile(root, FAKE_SWITCH2 "/0000:03:00.0", "max_link_width", "8");
+    if (i == 4) sleep(2);
+    uint64_t hash, reads, hits;
+    double usec;
+    NCCLCHECK(detectFakeSys(root, &hash, &reads, &hits, &usec));
+    if (i == 0) hash0 = hash;
+    bool ok = (hash != hash0) == steps[i].changed && (reads == 0) == steps[i].cached;
+    if (!ok) failures++;
+    printf("%-24s %8lu %8lu %10.1f %6s\n", steps[i].step, reads, hits, usec, ok ? "yes" : "NO");
+  }
+  unsetenv("RCCL_TOPO_SYS_ROOT");
+  unsetenv("RCCL_TOPO_SYS_CACHE");
+  unsetenv("RCCL_TOPO_SYS_CACHE_TIMEOUT");
+  removeTree(root);
+  if (failures) printf("%d steps failed\n", failures);
+  return failures ? ncclInternalError : ncclSuccess;
+}
+
+// Feed a synthetic tuning table to ncclTopoGetAlgoTime and check the times it gives
+static ncclResult_t checkTuningTable() {
+  char path[] = "/tmp/topo_expl_tuning_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    printf("Could not create a tuning table file\n");
+    return ncclSystemError;
+  }
+  const char* table =
+    "# coll algo proto nNodes ppn bytes lat(us) bw(GB/s)\n"
+    "AllReduce Ring Simple 2 8 1024 2.0 80.0   # exact match, wins over the wildcard below\n"
+    "AllReduce Ring Simple * * 1024 3.0 40.0\n"
+    "AllReduce Ring Simple 4 8 2048 1.0 99.0   # other communicator size\n"
+    "\n"
+    "AllReduce Ring Simple 2 * 4294967296 4.0 60.0\n"
+    "allreduce ring simple 2 * 8589934592 4.5 70.0 # same (last) bucket, later entry wins\n"
+    "AllReduce Tree LL128 * * 1024 1.0 100.0   # disabled by the model\n"
+    "Broadcast Ring LL * * 64 1.5 0.5\n";
+  if (write(fd, table, strlen(table)) != (ssize_t)strlen(table)) {
+    close(fd);
+    unlink(path);
+    printf("Could not write %s\n", path);
+    return ncclSystemError;
+  }
+  close(fd);
+
+  struct ncclComm* comm;
+  NCCLCHECK(ncclCalloc(&comm, 1));
+  comm->nNodes = 2;
+  comm->nRanks = 16;
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+    comm->bandwidths[c][a][p] = 10.0;
+    comm->latencies[c][a][p] = 5.0;
+  }
+  comm->bandwidths[ncclFuncAllReduce][NCCL_ALGO_TREE][NCCL_PROTO_LL128] = 0;
+  ncclResult_t res = ncclTopoLoadTuningTable(comm, path);
+  unlink(path);
+  if (res != ncclSuccess) return res;
+
+  struct {
+    ncclFunc_t coll;
+    int algo, proto;
+    size_t nBytes;
+    int numPipeOps;
+    float lat, bw;    // Expected, bw 0 for the model, lat -1 for disabled
+  } checks[] = {
+    { ncclFuncAllReduce, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE, 1024, 1, 2.0, 80.0 },
+    { ncclFuncAllReduce, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE, 2047, 2, 2.0, 80.0 },
+    { ncclFuncAllReduce, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE, 2048, 1, 0, 0 },
+    { ncclFuncAllReduce, NCCL_ALGO_RING, NCCL_PROTO_SIMPLE, 1UL<<34, 1, 4.5, 70.0 },
+    { ncclFuncAllReduce, NCCL_ALGO_RING, NCCL_PROTO_LL, 1024, 1, 0, 0 },
+    { ncclFuncAllReduce, NCCL_ALGO_TREE, NCCL_PROTO_LL128, 1024, 1, -1, 0 },
+    { ncclFuncBroadcast, NCCL_ALGO_RING, NCCL_PROTO_LL, 100, 3, 1.5, 0.5 },
+    { ncclFuncAllGather, NCCL_ALGO_RING, NCCL_PROTO_LL, 100, 1, 0, 0 } };
+  int failures = 0;
+  printf("%-14s %-8s %-7s %12s %8s %10s %10s %6s\n", "coll", "algo", "proto", "bytes", "pipeOps", "time(us)", "model(us)", "ok");
+  for (int i = 0; i < (int)(sizeof(checks)/sizeof(checks[0])); i++) {
+    struct ncclInfo info;
+    memset(&info, 0, sizeof(info));
+    info.comm = comm;
+    info.coll = checks[i].coll;
+    info.nBytes = checks[i].nBytes;
+    float time, modelTime;
+    NCCLCHECK(ncclTopoGetAlgoTime(&info, checks[i].algo, checks[i].proto, checks[i].numPipeOps, &time));
+    struct ncclTuningTable* tuningTable = comm->tuningTable;
+    comm->tuningTable = NULL;
+    NCCLCHECK(ncclTopoGetAlgoTime(&info, checks[i].algo, checks[i].proto, checks[i].numPipeOps, &modelTime));
+    comm->tuningTable = tuningTable;
+    float expected = checks[i].lat == -1 ? -1.0 : checks[i].bw == 0 ? modelTime :
+      checks[i].lat * checks[i].numPipeOps + checks[i].nBytes / (1000 * checks[i].bw);
+    bool ok = fabsf(time - expected) <= 1e-5 * fabsf(expected);
+    if (!ok) failures++;
+    printf("%-14s %-8s %-7s %12lu %8d %10.3f %10.3f %6s\n", ncclFuncStr[checks[i].coll], ncclAlgoStr[checks[i].algo],
+        ncclProtoStr[checks[i].proto], checks[i].nBytes, checks[i].numPipeOps, time, modelTime, ok ? "yes" : "NO");
+  }
+  free(comm->tuningTable);
+  free(comm);
+  if (failures) printf("%d checks failed\n", failures);
+  return failures ? ncclInternalError : ncclSuccess;
+}
+
+// Autotuner check : every rank runs in a thread with a fake clock, advanced by the
+// "measured" time of the algorithm/protocol chosen for each call
+#define AUTOTUNE_RANKS 4
+#define AUTOTUNE_CANDIDATES 3
+#define AUTOTUNE_SAMPLES 4
+
+struct autoTuneShared {
+  pthread_barrier_t barrier;
+  float* data;
+  struct ncclComm* comm;
+  const char* exportPath;
+};
+
+struct autoTuneRank {
+  struct autoTuneShared* shared;
+  int rank;
+  double clock;
+  int order[AUTOTUNE_CANDIDATES];    // Expected candidates, from the model
+  int winner;                        // Expected decision, not the fastest on the last rank alone
+  int failures;
+};
+
+struct autoTuneFakeSample {
+  double start, stop;
+};
+
+static ncclResult_t fakeStart(void* ctx, hipStream_t stream, void** sample) {
+  struct autoTuneFakeSample* s;
+  NCCLCHECK(ncclCalloc(&s, 1));
+  s->start = ((struct autoTuneRank*)ctx)->clock;
+  *sample = s;
+  return ncclSuccess;
+}
+
+static ncclResult_t fakeStop(void* ctx, hipStream_t stream, void* sample) {
+  ((struct autoTuneFakeSample*)sample)->stop = ((struct autoTuneRank*)ctx)->clock;
+  return ncclSuccess;
+}
+
+static ncclResult_t fakeRelease(void* ctx, void* sample) {
+  free(sample);
+  return ncclSuccess;
+}
+
+static ncclResult_t fakeElapsed(void* ctx, void* sample, float* us) {
+  struct autoTuneFakeSample* s = (struct autoTuneFakeSample*)sample;
+  *us = s->stop - s->start;
+  return fakeRelease(ctx, sample);
+}
+
+static ncclResult_t fakeAllGather(void* ctx, float* data, int n) {
+  struct autoTuneRank* r = (struct autoTuneRank*)ctx;
+  memcpy(r->shared->data+r->rank*n, data+r->rank*n, n*sizeof(float));
+  pthread_barrier_wait(&r->shared->barrier);
+  memcpy(data, r->shared->data, AUTOTUNE_RANKS*n*sizeof(float));
+  pthread_barrier_wait(&r->shared->barrier);
+  return ncclSuccess;
+}
+
+// Index of an algorithm/protocol combination
+static int autoTuneCandidate(int algo, int proto) {
+  return algo*NCCL_NUM_PROTOCOLS+proto;
+}
+
+static void autoTuneStatic(struct ncclInfo* info) {
+  float minTime = 3600000000.0;
+  for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) {
+    if (a == NCCL_ALGO_COLLNET) continue;
+    for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      float time;
+      ncclTopoGetAlgoTime(info, a, p, 1, &time);
+      if (time >= 0 && time < minTime) {
+        info->algorithm = a;
+        info->protocol = p;
+        minTime = time;
+      }
+    }
+  }
+}
+
+// One blocking (explore) or grouped call, returns the combination used
+static ncclResult_t autoTuneCall(struct autoTuneRank* r, struct ncclAutoTuner* tuner, ncclDataType_t datatype, size_t nBytes,
+    int explore, const float* times, int* used, int* tuned, int* timed) {
+  struct ncclInfo info;
+  memset(&info, 0, sizeof(info));
+  info.comm = r->shared->comm;
+  info.coll = ncclFuncAllReduce;
+  info.datatype = datatype;
+  info.nBytes = nBytes;
+  autoTuneStatic(&info);
+  int staticChoice = autoTuneCandidate(info.algorithm, info.protocol);
+  tuner->explore = explore;
+  NCCLCHECK(ncclAutoTuneGetAlgo(tuner, &info, 0, tuned));
+  *used = autoTuneCandidate(info.algorithm, info.protocol);
+  if (*tuned == 0 && *used != staticChoice) {
+    printf("Rank %d : static choice changed but not reported\n", r->rank);
+    r->failures++;
+  }
+  *timed = tuner->sampleEntry != NULL;
+  NCCLCHECK(ncclAutoTuneStart(tuner, NULL));
+  r->clock += times[*used];
+  NCCLCHECK(ncclAutoTuneStop(tuner, NULL));
+  return ncclSuccess;
+}
+
+static void* autoTuneRankThread(void* arg) {
+  struct autoTuneRank* r = (struct autoTuneRank*)arg;
+  struct ncclComm comm = *r->shared->comm;
+  comm.rank = r->rank;
+  struct ncclAutoTuneOps ops = { fakeStart, fakeStop, fakeElapsed, fakeRelease, fakeAllGather, r };
+  struct ncclAutoTuner* tuner;
+  if (ncclAutoTuneCreate(&comm, &ops, AUTOTUNE_CANDIDATES, AUTOTUNE_SAMPLES, &tuner) != ncclSuccess) {
+    r->failures++;
+    return NULL;
+  }
+  // True times : order[2] is the fastest on average, order[1] on the last rank alone
+  float times[NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS];
+  for (int i=0; i<NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS; i++) times[i] = 100.0*(1+0.01*r->rank);
+  times[r->order[2]] = 60.0*(1+0.01*r->rank);
+  if (r->rank == AUTOTUNE_RANKS-1) times[r->order[1]] = 20.0;
+  float halfTimes[NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS];
+  for (int i=0; i<NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS; i++) halfTimes[i] = i == r->order[0] ? 50.0 : 70.0;
+  const size_t nBytes = 1<<20;
+  int used, tuned, timed;
+
+  // Grouped calls before any blocking one do not create entries
+  if (autoTuneCall(r, tuner, ncclFloat, nBytes, 0, times, &used, &tuned, &timed) != ncclSuccess) goto fail;
+  if (used != r->order[0] || timed) { printf("Rank %d : grouped call changed the static choice\n", r->rank); r->failures++; }
+
+  for (int i=0; i<AUTOTUNE_CANDIDATES*AUTOTUNE_SAMPLES; i++) {
+    float warmup[NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS];
+    for (int j=0; j<NCCL_NUM_ALGORITHMS*NCCL_NUM_PROTOCOLS; j++) warmup[j] = i < AUTOTUNE_CANDIDATES ? 3*times[j] : times[j];
+    if (autoTuneCall(r, tuner, ncclFloat, nBytes, 1, warmup, &used, &tuned, &timed) != ncclSuccess) goto fail;
+    if (used != r->order[i%AUTOTUNE_CANDIDATES] || !timed) {
+      printf("Rank %d : exploration call %d used %d, timed %d, expected %d\n", r->rank, i, used, timed, r->order[i%AUTOTUNE_CANDIDATES]);
+      r->failures++;
+    }
+    // Grouped calls in the middle do not change the state
+    if (autoTuneCall(r, tuner, ncclFloat, nBytes+64, 0, times, &used, &tuned, &timed) != ncclSuccess) goto fail;
+    if (used != r->order[0] || timed) { printf("Rank %d : grouped call %d changed the static choice\n", r->rank, i); r->failures++; }
+    // Other datatype, where the static choice is the fastest
+    if (autoTuneCall(r, tuner, ncclHalf, nBytes, 1, halfTimes, &used, &tuned, &timed) != ncclSuccess) goto fail;
+  }
+  // Decision, then cached decision for all calls
+  for (int i=0; i<3; i++) {
+    int explore = i != 1;
+    if (autoTuneCall(r, tuner, ncclFloat, nBytes, explore, times, &used, &tuned, &timed) != ncclSuccess) goto fail;
+    if (used != r->winner || !tuned || timed) {
+      printf("Rank %d : call %d after exploration used %d (tuned %d timed %d), expected %d\n", r->rank, i, used, tuned, timed, r->winner);
+      r->failures++;
+    }
+    if (autoTuneCall(r, tuner, ncclHalf, nBytes, explore, halfTimes, &used, &tuned, &timed) != ncclSuccess) goto fail;
+    if (used != r->order[0] || tuned || timed) {
+      printf("Rank %d : half call %d after exploration used %d (tuned %d timed %d), expected the static choice\n", r->rank, i, used, tuned, timed);
+      r->failures++;
+    }
+  }
+  if (r->rank == 0 && ncclAutoTuneExport(tuner, &comm, r->shared->exportPath) != ncclSuccess) goto fail;
+  ncclAutoTuneDestroy(tuner);
+  return NULL;
+fail:
+  r->failures++;
+  ncclAutoTuneDestroy(tuner);
+  return NULL;
+}
+
+static ncclResult_t checkAutoTune() {
+  struct ncclComm* comm;
+  NCCLCHECK(ncclCalloc(&comm, 1));
+  comm->nNodes = 2;
+  comm->nRanks = AUTOTUNE_RANKS;
+  for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+    comm->bandwidths[c][a][p] = 4.0*(a+1)*(p+1);
+    comm->latencies[c][a][p] = 2.0*(a+1)+p;
+  }
+  comm->bandwidths[ncclFuncAllReduce][NCCL_ALGO_TREE][NCCL_PROTO_LL] = 0;
+
+  // Expected candidates : static choice, then the best model times
+  const size_t nBytes = 1<<20;
+  struct ncclInfo info;
+  memset(&info, 0, sizeof(info));
+  info.comm = comm;
+  info.coll = ncclFuncAllReduce;
+  info.nBytes = nBytes;
+  autoTuneStatic(&info);
+  int order[AUTOTUNE_CANDIDATES];
+  order[0] = autoTuneCandidate(info.algorithm, info.protocol);
+  float orderTimes[AUTOTUNE_CANDIDATES];
+  int n = 1;
+  for (int a=0; a<NCCL_ALGO_COLLNET; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+    float time;
+    NCCLCHECK(ncclTopoGetAlgoTime(&info, a, p, 1, &time));
+    if (time < 0 || autoTuneCandidate(a, p) == order[0]) continue;
+    int k = n;
+    while (k > 1 && orderTimes[k-1] > time) k--;
+    if (k == AUTOTUNE_CANDIDATES) continue;
+    for (int i=std::min(n, AUTOTUNE_CANDIDATES-1); i>k; i--) { order[i] = order[i-1]; orderTimes[i] = orderTimes[i-1]; }
+    order[k] = autoTuneCandidate(a, p);
+    orderTimes[k] = time;
+    n = std::min(n+1, AUTOTUNE_CANDIDATES);
+  }
+  printf("Candidates :");
+  for (int i=0; i<AUTOTUNE_CANDIDATES; i++) printf(" %s/%s", ncclAlgoStr[order[i]/NCCL_NUM_PROTOCOLS], ncclProtoStr[order[i]%NCCL_NUM_PROTOCOLS]);
+  printf("\n");
+
+  char path[] = "/tmp/topo_expl_autotune_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    printf("Could not create an autotuning file\n");
+    return ncclSystemError;
+  }
+  close(fd);
+
+  struct autoTuneShared shared;
+  NCCLCHECK(ncclCalloc(&shared.data, AUTOTUNE_RANKS*NCCL_AUTOTUNE_MAX_CANDIDATES));
+  pthread_barrier_init(&shared.barrier, NULL, AUTOTUNE_RANKS);
+  shared.comm = comm;
+  shared.exportPath = path;
+  struct autoTuneRank ranks[AUTOTUNE_RANKS];
+  pthread_t threads[AUTOTUNE_RANKS];
+  for (int r=0; r<AUTOTUNE_RANKS; r++) {
+    memset(ranks+r, 0, sizeof(ranks[r]));
+    ranks[r].shared = &shared;
+    ranks[r].rank = r;
+    memcpy(ranks[r].order, order, sizeof(order));
+    ranks[r].winner = order[2];
+    pthread_create(threads+r, NULL, autoTuneRankThread, ranks+r);
+  }
+  int failures = 0;
+  for (int r=0; r<AUTOTUNE_RANKS; r++) {
+    pthread_join(threads[r], NULL);
+    failures += ranks[r].failures;
+  }
+  pthread_barrier_destroy(&shared.barrier);
+  free(shared.data);
+
+  // The exported measures give the average of the best samples back
+  ncclResult_t res = ncclTopoLoadTuningTable(comm, path);
+  unlink(path);
+  if (res != ncclSuccess) return res;
+  float expected = 0;
+  for (int r=0; r<AUTOTUNE_RANKS; r++) expected += 60.0*(1+0.01*r) / AUTOTUNE_RANKS;
+  float time = -1;
+  if (comm->tuningTable) NCCLCHECK(ncclTopoGetAlgoTime(&info, order[2]/NCCL_NUM_PROTOCOLS, order[2]%NCCL_NUM_PROTOCOLS, 1, &time));
+  bool ok = fabsf(time - expected) <= 1e-4 * expected;
+  printf("Exported %s/%s time %.3f us, expected %.3f us : %s\n", ncclAlgoStr[order[2]/NCCL_NUM_PROTOCOLS], ncclProtoStr[order[2]%NCCL_NUM_PROTOCOLS],
+      time, expected, ok ? "ok" : "NO");
+  if (!ok) failures++;
+  free(comm->tuningTable);
+  free(comm);
+  if (failures) printf("%d checks failed\n", failures);
+  else printf("All ranks explored %d candidates and agreed on the fastest\n", AUTOTUNE_CANDIDATES);
+  return failures ? ncclInternalError : ncclSuccess;
+}
+
+// Decision of getAlgoInfo without the table, for single operations without CollNet
+static ncclResult_t algoReference(struct ncclInfo* info, int* algorithm, int* protocol, int* nc, int* nt) {
+  struct ncclComm* comm = info->comm;
+  NCCLCHECK(ncclTopoGetBestAlgo(info, 0, 1, algorithm, protocol, NULL));
+  if (*algorithm == -1) return ncclSuccess;
+  *nc = comm->nChannels;
+  *nt = comm->maxThreads[*algorithm][*protocol];
+  int threadThreshold = comm->threadThresholds[*algorithm][*protocol];
+  while (info->nBytes < (size_t)(*nc)*(*nt)*threadThreshold) {
+    if (*nc >= 2) (*nc)--;
+    else break;
+  }
+  return ncclSuccess;
+}
+
+static struct ncclAlgoSegment* algoLookup(struct ncclInfo* info, int* nc, int* nt) {
+  struct ncclComm* comm = info->comm;
+  struct ncclAlgoSegment* segment = ncclTopoLookupAlgo(comm->algoTable, info->coll, info->nBytes);
+  if (segment == NULL) return NULL;
+  *nc = comm->nChannels;
+  *nt = segment->nThreads;
+  if ((ssize_t)info->nBytes < *nc*segment->channelBytes) *nc = std::max<ssize_t>(1, info->nBytes/segment->channelBytes);
+  return segment;
+}
+
+static float randFloat(unsigned int* seed, float min, float max) {
+  return min + (max-min) * (rand_r(seed) / (float)RAND_MAX);
+}
+
+static ncclResult_t checkAlgoTable() {
+  const int nComms = 40;
+  const int randomSizes = 64;
+  unsigned int seed = 1234;
+  int failures = 0;
+  long checks = 0, segments = 0, buckets = 0, ties = 0;
+  double tableUsec = 0, modelUsec = 0;
+  long timedCalls = 0;
+  struct ncclComm* comm;
+  NCCLCHECK(ncclCalloc(&comm, 1));
+  for (int i = 0; i < nComms; i++) {
+    memset(comm, 0, sizeof(*comm));
+    comm->nNodes = 1 + rand_r(&seed) % 8;
+    comm->nRanks = comm->nNodes * (1 + rand_r(&seed) % 16);
+    comm->nChannels = 1 + rand_r(&seed) % 64;
+    for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      comm->latencies[c][a][p] = randFloat(&seed, 1, 100);
+      // Some combinations disabled, like NCCL_ALGO/NCCL_PROTO do
+      comm->bandwidths[c][a][p] = rand_r(&seed) % 5 == 0 ? 0 : randFloat(&seed, 0.5, 200);
+    }
+    for (int a=0; a<NCCL_NUM_ALGORITHMS; a++) for (int p=0; p<NCCL_NUM_PROTOCOLS; p++) {
+      comm->maxThreads[a][p] = 64 << (rand_r(&seed) % 4);
+      comm->threadThresholds[a][p] = (p == NCCL_PROTO_SIMPLE ? NCCL_SIMPLE_THREAD_THRESHOLD : NCCL_LL_THREAD_THRESHOLD) * (a == NCCL_ALGO_RING && p == NCCL_PROTO_LL ? comm->nRanks : 1);
+    }
+    // Every other communicator has some measured buckets
+    if (i % 2) {
+      NCCLCHECK(ncclCalloc(&comm->tuningTable, 1));
+      for (int n = 0; n < 200; n++) {
+        int c = rand_r(&seed) % NCCL_NUM_FUNCTIONS, a = rand_r(&seed) % NCCL_NUM_ALGORITHMS, p = rand_r(&seed) % NCCL_NUM_PROTOCOLS;
+        int b = rand_r(&seed) % NCCL_TUNING_BUCKETS;
+        comm->tuningTable->lat[c][a][p][b] = randFloat(&seed, 0, 50);
+        comm->tuningTable->bw[c][a][p][b] = randFloat(&seed, 0.5, 300);
+      }
+    }
+    NCCLCHECK(ncclTopoComputeAlgoTable(comm));
+    if (comm->algoTable == NULL) {
+      printf("No decision table computed\n");
+      return ncclInternalError;
+    }
+
+    struct ncclInfo info;
+    memset(&info, 0, sizeof(info));
+    info.comm = comm;
+    for (int c=0; c<NCCL_NUM_FUNCTIONS; c++) {
+      if (c == ncclFuncSendRecv || c == ncclFuncAllToAllPivot) continue;
+      info.coll = (ncclFunc_t)c;
+      for (int b=0; b<NCCL_TUNING_BUCKETS; b++) {
+        int n = comm->algoTable->nSegments[c][b];
+        if (n) buckets++;
+        segments += n;
+        // Bucket and segment limits, then random sizes of the bucket
+        size_t first = b == 0 ? 0 : 64UL<<b, last = (64UL<<(b+1))-1;
+        std::vector<size_t> sizes = { first, first+1, last-1, last };
+        for (int s=0; s<n; s++) {
+          size_t maxBytes = comm->algoTable->segments[c][b][s].maxBytes;
+          sizes.push_back(maxBytes);
+          if (maxBytes > first) sizes.push_back(maxBytes-1);
+          if (maxBytes < last) sizes.push_back(maxBytes+1);
+        }
+        for (int r=0; r<randomSizes; r++) sizes.push_back(first + ((size_t)rand_r(&seed) << 20 | rand_r(&seed)) % (last-first+1));
+        for (size_t nBytes : sizes) {
+          info.nBytes = nBytes;
+          int a0, p0, nc0 = 0, nt0 = 0, nc1, nt1;
+          NCCLCHECK(algoReference(&info, &a0, &p0, &nc0, &nt0));
+          struct ncclAlgoSegment* segment = algoLookup(&info, &nc1, &nt1);
+          checks++;
+          // Buckets without any algorithm are left to the model, which fails in getAlgoInfo
+          bool ok = segment ? (segment->algorithm == a0 && segment->protocol == p0 && nc1 == nc0 && nt1 == nt0) : (n == 0);
+          if (!ok && segment) {
+            // Model times equal to float precision can compare either way around a crossover
+            float time0, time1;
+            NCCLCHECK(ncclTopoGetAlgoTime(&info, a0, p0, 1, &time0));
+            NCCLCHECK(ncclTopoGetAlgoTime(&info, segment->algorithm, segment->protocol, 1, &time1));
+            if (fabsf(time1-time0) <= 2.5e-7*time0) {
+              ties++;
+              continue;
+            }
+          }
+          if (!ok) {
+            failures++;
+            if (failures <= 10) printf("Comm %d %s %lu bytes : model %d/%d nc %d nt %d, table %d/%d nc %d nt %d\n", i, ncclFuncStr[c], nBytes,
+                a0, p0, nc0, nt0, segment ? segment->algorithm : -1, segment ? segment->protocol : -1, nc1, nt1);
+          }
+        }
+      }
+    }
+
+    // Cost of a decision for small operations
+    info.coll = ncclFuncAllReduce;
+    const int iterations = 20000;
+    int sum = 0;
+    double t0 = timeUsec();
+    for (int it = 0; it < iterations; it++) {
+      info.nBytes = 64 << (it % 12);
+      int a, p, nc = 0, nt = 0;
+      NCCLCHECK(algoReference(&info, &a, &p, &nc, &nt));
+      sum += a + p + nc + nt;
+    }
+    double t1 = timeUsec();
+    for (int it = 0; it < iterations; it++) {
+      info.nBytes = 64 << (it % 12);
+      int nc = 0, nt = 0;
+      struct ncclAlgoSegment* segment = algoLookup(&info, &nc, &nt);
+      if (segment) sum -= segment->algorithm + segment->protocol + nc + nt;
+    }
+    double t2 = timeUsec();
+    if (sum != 0 && comm->algoTable->nSegments[ncclFuncAllReduce][0]) printf("Comm %d : timed decisions differ\n", i);
+    modelUsec += t1-t0;
+    tableUsec += t2-t1;
+    timedCalls += iterations;
+
+    free(comm->algoTable);
+    free(comm->tuningTable);
+  }
+  free(comm);
+  printf("%d communicators, %ld buckets, %ld segments, %ld sizes checked, %ld ties, %d mismatches\n", nComms, buckets, segments, checks, ties, failures);
+  printf("Decision for 64 B - 128 KB : model %.1f ns, table %.1f ns\n", modelUsec*1000/timedCalls, tableUsec*1000/timedCalls);
+  return failures ? ncclInternalError : ncclSuccess;
+}
+
+int main(int argc,char* argv[])
+{
+  const int num_models = sizeof(model_descs) / sizeof(*model_descs);
+  bool timeCache = cmdOptionExists(argv, argv + argc, "-t");
+  char* searchThreads = getCmdOption(argv, argv + argc, "-p");
+  bool timePrune = cmdOptionExists(argv, argv + argc, "-s");
+  bool checkMatching = cmdOptionExists(argv, argv + argc, "-r");
+  char* xmlIterations = getCmdOption(argv, argv + argc, "-x");
+  bool sysCache = cmdOptionExists(argv, argv + argc, "-y");
+  bool tuningTable = cmdOptionExists(argv, argv + argc, "-u");
+  bool pathCheck = cmdOptionExists(argv, argv + argc, "-c");
+  bool autoTune = cmdOptionExists(argv, argv + argc, "-a");
+  bool algoTable = cmdOptionExists(argv, argv + argc, "-l");
+  bool compare = timeCache || searchThreads || timePrune || checkMatching || xmlIterations || pathCheck;
+
+  if (!cmdOptionExists(argv, argv + argc, "-m") && !compare && !sysCache && !tuningTable && !autoTune && !algoTable) {
+    printf("Usage: ./topo_expl -m model_id\n");
+    printf("       ./topo_expl -t [-m model_id] : time graph search with a cold and a warm graph cache\n");
+    printf("       ./topo_expl -p nthreads [-m model_id] : time graph search with 1 and nthreads threads\n");
+    printf("       ./topo_expl -s [-m model_id] : time graph search without and with pruning\n");
+    printf("       ./topo_expl -r [-m model_id] : check indexed against exhaustive Rome model matching\n");
+    printf("       ./topo_expl -x iterations [-m model_id] : time parsing XML topology files\n");
+    printf("       ./topo_expl -y : check the sysfs cache on a fake sysfs tree\n");
+    printf("       ./topo_expl -c [-m model_id] : check paths kept up to date while trimming against recomputed ones\n");
+    printf("       ./topo_expl -u : check algorithm times with a synthetic tuning table\n");
+    printf("       ./topo_expl -a : check the online autotuner with fake timers\n");
+    printf("       ./topo_expl -l : check and time precomputed algorithm decisions on random models\n");
+    printf("List of model_id:\n");
+    for (int i = 0; i < num_models; i++)
+      printf("  %d: %s\n", i, model_descs[i].description);
+    exit(0);
+  }
+
+  int model_id = 0;
+  char *mi = getCmdOption(argv, argv + argc, "-m");
+  if (mi)
+    model_id = atol(mi);
+
+  if (model_id >= num_models) {
+      printf("Invalid model_id %d\n", model_id);
+      exit(0);
+  }
+
+  // Keep the timings readable, unless NCCL_DEBUG asks otherwise
+  if (compare || sysCache || tuningTable || autoTune || algoTable) setenv("NCCL_DEBUG", "WARN", 0);
+
+  initCollNet();
+
+  if (sysCache) return checkSysCache() == ncclSuccess ? 0 : 1;
+  if (tuningTable) return checkTuningTable() == ncclSuccess ? 0 : 1;
+  if (autoTune) return checkAutoTune() == ncclSuccess ? 0 : 1;
+  if (algoTable) return checkAlgoTable() == ncclSuccess ? 0 : 1;
+
+  if (compare) {
+    int first = mi ? model_id : 0;
+    int last = mi ? model_id : num_models-1;
+    ncclResult_t res = timeCache ? timeGraphCache(first, last) :
+      searchThreads ? timeParallelSearch(first, last, searchThreads) :
+      checkMatching ? checkModelMatching(first, last) :
+      xmlIterations ? timeXmlParse(first, last, atoi(xmlIterations)) :
+      pathCheck ? checkPaths(first, last) : timeSearchPrune(first, last);
+    return res == ncclSuccess ? 0 : 1;
+  }
+
+  NCCLCHECK(runModel(model_id, true, NULL, NULL));
 
   return 0;
 }